@@ -0,0 +1,114 @@
+
+// crc64(rdb checksum) and crc16(key slot) kernels throughput
+// usage: qcrcbench [buffer MB, default 2048]
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "crc64.h"
+#include "crc16.h"
+
+typedef uint64_t (*Crc64Func)(uint64_t, const unsigned char*, uint64_t);
+typedef uint16_t (*Crc16Func)(uint16_t, const char*, size_t);
+
+template <typename F>
+static double Run(const F& f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int ac, char* av[])
+{
+    const size_t mb = ac > 1 ? std::strtoul(av[1], nullptr, 10) : 2048;
+    const size_t size = mb * 1024 * 1024;
+
+    std::vector<unsigned char> buf(size);
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    for (auto& c : buf)
+    {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        c = static_cast<unsigned char>(seed);
+    }
+
+    crc64_init();
+    printf("buffer %zu MB, crc64 dispatch: %s\n\n", mb, crc64_impl());
+    printf("%-10s %-10s %10s %10s %18s\n", "crc", "kernel", "seconds", "GB/s", "result");
+
+    const struct { const char* name; Crc64Func f; } crc64s[] = {
+        {"bytewise", crc64_bytewise},
+        {"slice8",   crc64_slice8},
+        {"slice16",  crc64_slice16},
+        {"pclmul",   crc64_clmul_supported() ? crc64_clmul : nullptr},
+    };
+
+    uint64_t expect64 = 0;
+    for (const auto& k : crc64s)
+    {
+        if (!k.f)
+        {
+            printf("%-10s %-10s %10s\n", "crc64", k.name, "n/a");
+            continue;
+        }
+
+        uint64_t crc = 0;
+        double sec = Run([&]() { crc = k.f(0, buf.data(), buf.size()); });
+        printf("%-10s %-10s %10.3f %10.2f %18llx\n",
+               "crc64", k.name, sec, mb / 1024.0 / sec, (unsigned long long)crc);
+
+        if (k.f == crc64_bytewise)
+            expect64 = crc;
+        else if (crc != expect64)
+        {
+            fprintf(stderr, "crc64 %s mismatch\n", k.name);
+            return -1;
+        }
+    }
+
+    const struct { const char* name; Crc16Func f; } crc16s[] = {
+        {"bytewise", crc16_bytewise},
+        {"slice8",   crc16},
+    };
+
+    uint16_t expect16 = 0;
+    for (const auto& k : crc16s)
+    {
+        uint16_t crc = 0;
+        double sec = Run([&]() { crc = k.f(0, (const char*)buf.data(), buf.size()); });
+        printf("%-10s %-10s %10.3f %10.2f %18x\n",
+               "crc16", k.name, sec, mb / 1024.0 / sec, crc);
+
+        if (k.f == crc16_bytewise)
+            expect16 = crc;
+        else if (crc != expect16)
+        {
+            fprintf(stderr, "crc16 %s mismatch\n", k.name);
+            return -1;
+        }
+    }
+
+    // key slot routing, short keys
+    const size_t kKeys = 10 * 1000 * 1000;
+    std::vector<std::string> keys;
+    keys.reserve(1000);
+    for (int i = 0; i < 1000; ++ i)
+        keys.push_back("user:" + std::to_string(i * 7919) + ":profile");
+
+    unsigned int sum = 0;
+    double sec = Run([&]() {
+        for (size_t i = 0; i < kKeys; ++ i)
+        {
+            const auto& key = keys[i % keys.size()];
+            sum += keyHashSlot(key.data(), key.size());
+        }
+    });
+    printf("\nkeyHashSlot: %.1f M keys/s (%u)\n", kKeys / sec / 1e6, sum);
+
+    return 0;
+}
+
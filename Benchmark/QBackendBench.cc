@@ -0,0 +1,170 @@
+
+// leveldb backend read and write latency, one leveldb per db vs shared
+// usage: qbackendbench [keys] [value size] [qedis.conf for backend options]
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "QLeveldb.h"
+#include "QConfig.h"
+
+using namespace qedis;
+
+static const int kDbs = 16;
+static const size_t kBatch = 128; // ops per write batch, like the writer
+
+struct Latency
+{
+    std::vector<double> us;
+
+    double Avg() const
+    {
+        double sum = 0;
+        for (auto v : us)
+            sum += v;
+
+        return us.empty() ? 0 : sum / us.size();
+    }
+
+    double Percentile(double p)
+    {
+        if (us.empty())
+            return 0;
+
+        std::sort(us.begin(), us.end());
+        return us[static_cast<size_t>(p * (us.size() - 1))];
+    }
+};
+
+static std::vector<std::unique_ptr<QLeveldb> > OpenBackends(const std::string& path, bool shared)
+{
+    std::vector<std::unique_ptr<QLeveldb> > dbs;
+    for (int i = 0; i < kDbs; ++ i)
+    {
+        std::unique_ptr<QLeveldb> db(new QLeveldb);
+        bool ok = shared ? db->Open(path.c_str(), i) : db->Open((path + std::to_string(i)).c_str());
+        if (!ok)
+        {
+            fprintf(stderr, "open leveldb %s failed\n", path.c_str());
+            exit(-1);
+        }
+
+        dbs.push_back(std::move(db));
+    }
+
+    return dbs;
+}
+
+static std::string Key(size_t i)
+{
+    char key[32];
+    snprintf(key, sizeof key, "key:%zu", i);
+    return key;
+}
+
+static void Run(bool shared, size_t keys, size_t valueSize)
+{
+    const std::string path = shared ? "qbackendbench.shared" : "qbackendbench.db";
+    system(("rm -rf " + path + "*").c_str());
+
+    Latency write, hit, miss;
+    {
+        auto dbs = OpenBackends(path, shared);
+
+        // keys are spread over dbs, every db writes its own batches
+        std::vector<std::vector<QBackendOp> > batches(kDbs);
+        auto flush = [&](int dbno) {
+            std::vector<const QBackendOp*> ops;
+            for (const auto& o : batches[dbno])
+                ops.push_back(&o);
+
+            auto start = std::chrono::steady_clock::now();
+            dbs[dbno]->Write(ops);
+            auto end = std::chrono::steady_clock::now();
+            write.us.push_back(std::chrono::duration<double, std::micro>(end - start).count() / ops.size());
+
+            batches[dbno].clear();
+        };
+
+        QObject value = QObject::CreateString(QString(valueSize, 'v'));
+        for (size_t i = 0; i < keys; ++ i)
+        {
+            const int dbno = static_cast<int>(i % kDbs);
+            batches[dbno].push_back(QBackendOp());
+
+            QBackendOp& op = batches[dbno].back();
+            op.dbno = dbno;
+            op.key = Key(i);
+            dbs[dbno]->Encode(value, 0, op);
+
+            if (batches[dbno].size() == kBatch)
+                flush(dbno);
+        }
+
+        for (int dbno = 0; dbno < kDbs; ++ dbno)
+        {
+            if (!batches[dbno].empty())
+                flush(dbno);
+        }
+    }
+
+    // reopen, reads go to the tables instead of memtables
+    auto dbs = OpenBackends(path, shared);
+
+    std::mt19937 rand(0);
+    const size_t reads = std::min<size_t>(keys, 100000);
+    for (size_t n = 0; n < reads; ++ n)
+    {
+        const size_t i = rand() % keys;
+        const bool exist = (n % 2 == 0);
+        const std::string key = exist ? Key(i) : Key(i + keys);
+
+        auto start = std::chrono::steady_clock::now();
+        QObject obj = dbs[i % kDbs]->Get(key);
+        auto end = std::chrono::steady_clock::now();
+
+        if (exist && obj.type != QType_string)
+        {
+            fprintf(stderr, "key %s lost\n", key.c_str());
+            exit(-1);
+        }
+
+        (exist ? hit : miss).us.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+    }
+
+    printf("%8s %10zu %12.2f %12.2f %12.2f %12.2f %12.2f\n",
+           shared ? "shared" : "per-db", keys,
+           write.Avg(),
+           hit.Avg(), hit.Percentile(0.99),
+           miss.Avg(), miss.Percentile(0.99));
+
+    dbs.clear();
+    system(("rm -rf " + path + "*").c_str());
+}
+
+int main(int ac, char* av[])
+{
+    const size_t keys = ac > 1 ? std::strtoul(av[1], nullptr, 10) : 1000000;
+    const size_t valueSize = ac > 2 ? std::strtoul(av[2], nullptr, 10) : 100;
+    if (ac > 3 && !LoadQedisConfig(av[3], g_config))
+    {
+        fprintf(stderr, "load config %s failed\n", av[3]);
+        return -1;
+    }
+
+    printf("cache %lu, bloom bits %d, write buffer %lu, compression %d\n",
+           g_config.backendcachesize, g_config.backendbloombits,
+           g_config.backendwritebuffer, g_config.backendcompression);
+    printf("%8s %10s %12s %12s %12s %12s %12s\n",
+           "layout", "keys", "write(us/op)", "hit(us)", "hit p99", "miss(us)", "miss p99");
+
+    Run(false, keys, valueSize);
+    Run(true, keys, valueSize);
+    return 0;
+}
+
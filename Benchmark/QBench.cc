@@ -0,0 +1,580 @@
+
+// micro benchmarks of core data structures and codecs: ns, allocations and
+// bytes allocated per op. Allocations are operator new calls of this process.
+// usage: qbench [-t min seconds per bench] [-o save result] [-b baseline] [name filter ...]
+// The result file is plain text, check it in and compare later runs with -b.
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "QStore.h"
+#include "QDB.h"
+#include "QConfig.h"
+#include "QCommon.h"
+#include "QCodec.h"
+#include "QHelper.h"
+#include "QGlobRegex.h"
+#include "QProtoParser.h"
+#include "QSortedSet.h"
+#include "QList.h"
+#include "UnboundedBuffer.h"
+#include "AsyncBuffer.h"
+#include "Timer.h"
+
+using namespace qedis;
+
+static std::atomic<uint64_t> g_allocs(0);
+static std::atomic<uint64_t> g_allocBytes(0);
+
+static void* CountedAlloc(std::size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    g_allocBytes.fetch_add(size, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new(std::size_t size)
+{
+    void* p = CountedAlloc(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t& ) noexcept
+{
+    return CountedAlloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& ) noexcept
+{
+    return CountedAlloc(size);
+}
+
+// not inlined: gcc sees free() on a pointer from operator new at every
+// inlined call site and warns -Wmismatched-new-delete
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t& ) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t& ) noexcept
+{
+    operator delete(p);
+}
+
+// sized forms are called from c++14 on
+void operator delete(void* p, std::size_t ) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete[](void* p, std::size_t ) noexcept
+{
+    operator delete(p);
+}
+
+// keeps results alive
+static volatile uint64_t g_sink;
+
+struct Bench
+{
+    std::string name;
+    std::function<void (size_t n)> run; // does n ops
+};
+
+struct Result
+{
+    size_t ops = 0;
+    double ns = 0;
+    double allocs = 0;
+    double bytes = 0;
+};
+
+// like go test -bench: grow n until one run takes min seconds
+static Result Measure(const Bench& bench, double minSeconds)
+{
+    size_t n = 1;
+    while (true)
+    {
+        const uint64_t allocs = g_allocs.load();
+        const uint64_t bytes = g_allocBytes.load();
+        auto start = std::chrono::steady_clock::now();
+        bench.run(n);
+        auto end = std::chrono::steady_clock::now();
+
+        const double seconds = std::chrono::duration<double>(end - start).count();
+        if (seconds >= minSeconds || n >= (1UL << 30))
+        {
+            Result r;
+            r.ops = n;
+            r.ns = seconds * 1e9 / n;
+            r.allocs = static_cast<double>(g_allocs.load() - allocs) / n;
+            r.bytes = static_cast<double>(g_allocBytes.load() - bytes) / n;
+            return r;
+        }
+
+        size_t next = seconds > 0 ? static_cast<size_t>(n * minSeconds * 1.2 / seconds) : n * 100;
+        next = std::max(next, n * 2);
+        n = std::min(next, n * 100);
+    }
+}
+
+static const size_t kKeys = 100000;
+static std::vector<QString> g_keys;
+static const QString g_value(64, 'v');
+
+static const QString& Key(size_t i)
+{
+    if (g_keys.empty())
+    {
+        char key[32];
+        for (size_t k = 0; k < kKeys; ++ k)
+        {
+            snprintf(key, sizeof key, "key:%08zu", k);
+            g_keys.push_back(key);
+        }
+    }
+
+    return g_keys[i % kKeys];
+}
+
+// db 0 holds kKeys strings for the store benches, or a mixed dataset for qdb
+enum StoreState
+{
+    Store_empty,
+    Store_strings,
+    Store_mixed,
+};
+
+static StoreState g_storeState = Store_empty;
+
+static void FillStrings()
+{
+    if (g_storeState == Store_strings)
+        return;
+
+    QSTORE.ResetDb();
+    for (size_t i = 0; i < kKeys; ++ i)
+        QSTORE.SetValue(Key(i), QObject::CreateString(g_value));
+    g_storeState = Store_strings;
+}
+
+// 10000 keys: strings, lists, hashes, sets and sorted sets
+static void FillMixed()
+{
+    if (g_storeState == Store_mixed)
+        return;
+
+    QSTORE.ResetDb();
+    for (size_t i = 0; i < 10000; ++ i)
+    {
+        switch (i % 5)
+        {
+        case 0:
+            {
+                QObject obj = QObject::CreateList();
+                for (int j = 0; j < 10; ++ j)
+                    obj.CastList()->push_back("elem" + std::to_string(j));
+                QSTORE.SetValue(Key(i), std::move(obj));
+            }
+            break;
+
+        case 1:
+            {
+                QObject obj = QObject::CreateHash();
+                for (int j = 0; j < 10; ++ j)
+                    obj.CastHash()->insert(QHash::value_type("field" + std::to_string(j), g_value));
+                QSTORE.SetValue(Key(i), std::move(obj));
+            }
+            break;
+
+        case 2:
+            {
+                QObject obj = QObject::CreateSSet();
+                for (int j = 0; j < 10; ++ j)
+                    obj.CastSortedSet()->AddMember("member" + std::to_string(j), j);
+                QSTORE.SetValue(Key(i), std::move(obj));
+            }
+            break;
+
+        default:
+            QSTORE.SetValue(Key(i), QObject::CreateString(g_value));
+            break;
+        }
+    }
+
+    g_storeState = Store_mixed;
+}
+
+static const char* const kQdbFile = "qbench.rdb";
+
+// compressible text, like json values
+static QString MakeText(size_t len)
+{
+    QString text;
+    while (text.size() < len)
+        text += "{\"id\":" + std::to_string(text.size()) + ",\"name\":\"qedis\",\"tags\":[\"a\",\"b\"]}";
+    text.resize(len);
+    return text;
+}
+
+static std::vector<Bench> MakeBenches()
+{
+    std::vector<Bench> benches;
+
+    benches.push_back({"store/set", [](size_t n) {
+        FillStrings();
+        for (size_t i = 0; i < n; ++ i)
+            QSTORE.SetValue(Key(i), QObject::CreateString(g_value));
+    }});
+
+    benches.push_back({"store/get", [](size_t n) {
+        FillStrings();
+        QObject* obj;
+        for (size_t i = 0; i < n; ++ i)
+            g_sink += QSTORE.GetValueByType(Key(i), obj, QType_string) == QError_ok;
+    }});
+
+    benches.push_back({"sortedset/add", [](size_t n) {
+        QSortedSet ss;
+        for (size_t i = 0; i < n; ++ i)
+        {
+            if (i % kKeys == 0)
+                ss = QSortedSet();
+            ss.AddMember(Key(i), static_cast<double>(i % 1000));
+        }
+    }});
+
+    static QSortedSet s_ss;
+    static const size_t kMembers = 10000;
+    auto fillSortedSet = []() {
+        if (s_ss.Size() == 0)
+        {
+            for (size_t i = 0; i < kMembers; ++ i)
+                s_ss.AddMember(Key(i), static_cast<double>(i * 7 % kMembers));
+        }
+    };
+
+    benches.push_back({"sortedset/rank", [fillSortedSet](size_t n) {
+        fillSortedSet();
+        for (size_t i = 0; i < n; ++ i)
+            g_sink += s_ss.Rank(Key(i * 31 % kMembers));
+    }});
+
+    benches.push_back({"sortedset/range10", [fillSortedSet](size_t n) {
+        fillSortedSet();
+        for (size_t i = 0; i < n; ++ i)
+        {
+            const long start = static_cast<long>(i * 31 % (kMembers - 10));
+            g_sink += s_ss.RangeByRank(start, start + 9).size();
+        }
+    }});
+
+    benches.push_back({"list/push", [](size_t n) {
+        QList list;
+        for (size_t i = 0; i < n; ++ i)
+        {
+            if (i % kKeys == 0)
+                list.clear();
+            list.push_back(g_value);
+        }
+    }});
+
+    // like lindex, walks from the nearer end
+    benches.push_back({"list/index1000", [](size_t n) {
+        QList list(1000, g_value);
+        const long size = static_cast<long>(list.size());
+        for (size_t i = 0; i < n; ++ i)
+        {
+            const long idx = static_cast<long>(i * 31 % size);
+            const QString* result;
+            if (2 * idx < size)
+                result = &*std::next(list.begin(), idx);
+            else
+                result = &*std::next(list.rbegin(), size - 1 - idx);
+            g_sink += result->size();
+        }
+    }});
+
+    benches.push_back({"proto/parse_set", [](size_t n) {
+        UnboundedBuffer req;
+        PreFormatMultiBulk(3, &req);
+        FormatBulk("set", 3, &req);
+        FormatBulk(Key(0), &req);
+        FormatBulk(g_value, &req);
+
+        QProtoParser parser;
+        const char* const end = req.ReadAddr() + req.ReadableSize();
+        for (size_t i = 0; i < n; ++ i)
+        {
+            const char* ptr = req.ReadAddr();
+            g_sink += parser.ParseRequest(ptr, end) == QParseResult::ok;
+            parser.Reset();
+        }
+    }});
+
+    benches.push_back({"format/bulk64", [](size_t n) {
+        UnboundedBuffer reply;
+        for (size_t i = 0; i < n; ++ i)
+        {
+            if (i % 1024 == 0)
+                reply.Clear();
+            FormatBulk(g_value, &reply);
+        }
+    }});
+
+    benches.push_back({"format/int", [](size_t n) {
+        UnboundedBuffer reply;
+        for (size_t i = 0; i < n; ++ i)
+        {
+            if (i % 1024 == 0)
+                reply.Clear();
+            FormatInt(static_cast<long>(i * 7919), &reply);
+        }
+    }});
+
+    benches.push_back({"glob/star", [](size_t n) {
+        const QString pattern("key:*5*");
+        for (size_t i = 0; i < n; ++ i)
+            g_sink += glob_match(pattern, Key(i));
+    }});
+
+    benches.push_back({"glob/bracket", [](size_t n) {
+        const QString pattern("key:000[0-4]?[!9]*");
+        for (size_t i = 0; i < n; ++ i)
+            g_sink += glob_match(pattern, Key(i));
+    }});
+
+    benches.push_back({"buffer/unbounded64", [](size_t n) {
+        UnboundedBuffer buf;
+        for (size_t i = 0; i < n; ++ i)
+        {
+            if (i % 1024 == 0)
+                buf.Clear();
+            buf.PushData(g_value.data(), g_value.size());
+        }
+    }});
+
+    // writer and sender on one thread, drained every 256 writes
+    benches.push_back({"buffer/async64", [](size_t n) {
+        AsyncBuffer buf;
+        BufferSequence seq;
+        for (size_t i = 0; i < n; ++ i)
+        {
+            buf.Write(g_value.data(), g_value.size());
+            if (i % 256 == 255)
+            {
+                while (buf.ProcessBuffer(seq), seq.count > 0)
+                    buf.Skip(seq.TotalBytes());
+            }
+        }
+    }});
+
+    // schedule one shot timers over 64ms, then fire them by a fake clock
+    benches.push_back({"timer/schedule_fire", [](size_t n) {
+        static Time s_clock;
+        auto& mgr = TimerManager::Instance();
+        size_t fired = 0;
+        for (size_t i = 0; i < n; )
+        {
+            const size_t batch = std::min<size_t>(n - i, 1024);
+            for (size_t j = 0; j < batch; ++ j)
+            {
+                Timer* timer = mgr.CreateTimer();
+                timer->Init(1, 1);
+                timer->SetCallback([&fired]() { ++ fired; });
+
+                Time at(s_clock);
+                at.AddDelay(1 + j % 64);
+                mgr.ScheduleAt(timer, at);
+            }
+
+            s_clock.AddDelay(66);
+            mgr.UpdateTimers(s_clock);
+            i += batch;
+        }
+
+        g_sink += fired;
+    }});
+
+    static const QString s_text(MakeText(1024));
+    for (QCodec codec : {QCodec_lzf, QCodec_lz4})
+    {
+        const std::string name(CodecName(codec));
+        benches.push_back({"codec/" + name + "_compress1k", [codec](size_t n) {
+            QString out;
+            for (size_t i = 0; i < n; ++ i)
+                g_sink += Compress(codec, s_text.data(), s_text.size(), out);
+        }});
+
+        benches.push_back({"codec/" + name + "_decompress1k", [codec](size_t n) {
+            QString packed;
+            Compress(codec, s_text.data(), s_text.size(), packed);
+            std::vector<char> out(s_text.size());
+            for (size_t i = 0; i < n; ++ i)
+                g_sink += Decompress(codec, packed.data(), packed.size(), &out[0], out.size());
+        }});
+    }
+
+    benches.push_back({"hash/dictgen16", [](size_t n) {
+        for (size_t i = 0; i < n; ++ i)
+        {
+            const QString& key = Key(i);
+            g_sink += dictGenHashFunction(key.data(), static_cast<int>(key.size()));
+        }
+    }});
+
+    // one op saves or loads 10000 mixed keys
+    benches.push_back({"qdb/save10k", [](size_t n) {
+        FillMixed();
+        for (size_t i = 0; i < n; ++ i)
+        {
+            QDBSaver qdb;
+            qdb.Save(kQdbFile);
+        }
+    }});
+
+    benches.push_back({"qdb/load10k", [](size_t n) {
+        FillMixed();
+        {
+            QDBSaver qdb;
+            qdb.Save(kQdbFile);
+        }
+
+        for (size_t i = 0; i < n; ++ i)
+        {
+            QSTORE.ResetDb();
+            QDBLoader loader;
+            if (loader.Load(kQdbFile) != 0)
+            {
+                fprintf(stderr, "load %s failed\n", kQdbFile);
+                exit(-1);
+            }
+        }
+    }});
+
+    return benches;
+}
+
+// lines of "name ns/op allocs/op bytes/op"
+static std::map<std::string, Result> LoadBaseline(const char* file)
+{
+    std::map<std::string, Result> baseline;
+
+    std::ifstream ifs(file);
+    if (!ifs)
+    {
+        fprintf(stderr, "can not open baseline %s\n", file);
+        exit(-1);
+    }
+
+    std::string line;
+    while (std::getline(ifs, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        char name[128];
+        Result r;
+        if (sscanf(line.c_str(), "%127s %lf %lf %lf", name, &r.ns, &r.allocs, &r.bytes) == 4)
+            baseline[name] = r;
+    }
+
+    return baseline;
+}
+
+int main(int ac, char* av[])
+{
+    double minSeconds = 0.5;
+    const char* output = nullptr;
+    const char* baselineFile = nullptr;
+
+    int opt;
+    while ((opt = getopt(ac, av, "t:o:b:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't': minSeconds = atof(optarg); break;
+        case 'o': output = optarg; break;
+        case 'b': baselineFile = optarg; break;
+        default:
+            fprintf(stderr, "usage: qbench [-t min seconds per bench] [-o save result] [-b baseline] [name filter ...]\n");
+            return -1;
+        }
+    }
+
+    std::map<std::string, Result> baseline;
+    if (baselineFile)
+        baseline = LoadBaseline(baselineFile);
+
+    FILE* out = nullptr;
+    if (output && !(out = fopen(output, "w")))
+    {
+        fprintf(stderr, "can not open %s\n", output);
+        return -1;
+    }
+
+    if (out)
+        fprintf(out, "# name ns/op allocs/op bytes/op\n");
+
+    QSTORE.Init(g_config.databases);
+
+    printf("%-28s %12s %12s %10s %10s", "benchmark", "ops", "ns/op", "allocs/op", "B/op");
+    if (baselineFile)
+        printf(" %10s %10s", "ns delta", "allocs");
+    printf("\n");
+
+    for (const auto& bench : MakeBenches())
+    {
+        bool selected = optind >= ac;
+        for (int i = optind; i < ac && !selected; ++ i)
+            selected = bench.name.find(av[i]) != std::string::npos;
+
+        if (!selected)
+            continue;
+
+        const Result r = Measure(bench, minSeconds);
+        printf("%-28s %12zu %12.1f %10.2f %10.1f", bench.name.c_str(), r.ops, r.ns, r.allocs, r.bytes);
+
+        auto it = baseline.find(bench.name);
+        if (it != baseline.end() && it->second.ns > 0)
+            printf(" %+9.1f%% %+10.2f", (r.ns - it->second.ns) * 100 / it->second.ns, r.allocs - it->second.allocs);
+        printf("\n");
+
+        if (out)
+            fprintf(out, "%s %.1f %.2f %.1f\n", bench.name.c_str(), r.ns, r.allocs, r.bytes);
+    }
+
+    if (out)
+        fclose(out);
+
+    ::unlink(kQdbFile);
+    return 0;
+}
+
@@ -0,0 +1,122 @@
+
+// rdb load throughput at several dataset sizes and thread counts
+// usage: qdbloadbench [keys ...]
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "QStore.h"
+#include "QDB.h"
+#include "QConfig.h"
+
+using namespace qedis;
+
+static const char* const kRdbFile = "qdbloadbench.rdb";
+
+// 70% strings, 10% lists, 10% hashes, 5% sets, 5% sorted sets
+static void FillStore(size_t keys)
+{
+    QSTORE.ResetDb();
+
+    char key[32];
+    for (size_t i = 0; i < keys; ++ i)
+    {
+        snprintf(key, sizeof key, "key:%zu", i);
+
+        const size_t kind = i % 20;
+        if (kind < 14)
+        {
+            // long values are lzf compressed
+            QString value(kind < 7 ? 8 : 64, 'a' + i % 26);
+            QSTORE.SetValue(key, QObject::CreateString(value));
+        }
+        else if (kind < 16)
+        {
+            QObject obj = QObject::CreateList();
+            for (int j = 0; j < 10; ++ j)
+                obj.CastList()->push_back("elem" + std::to_string(j));
+            QSTORE.SetValue(key, std::move(obj));
+        }
+        else if (kind < 18)
+        {
+            QObject obj = QObject::CreateHash();
+            for (int j = 0; j < 10; ++ j)
+                obj.CastHash()->insert(QHash::value_type("field" + std::to_string(j), "value"));
+            QSTORE.SetValue(key, std::move(obj));
+        }
+        else if (kind < 19)
+        {
+            QObject obj = QObject::CreateSet();
+            for (int j = 0; j < 10; ++ j)
+                obj.CastSet()->insert("member" + std::to_string(j));
+            QSTORE.SetValue(key, std::move(obj));
+        }
+        else
+        {
+            QObject obj = QObject::CreateSSet();
+            for (int j = 0; j < 10; ++ j)
+                obj.CastSortedSet()->AddMember("member" + std::to_string(j), j);
+            QSTORE.SetValue(key, std::move(obj));
+        }
+    }
+}
+
+int main(int ac, char* av[])
+{
+    std::vector<size_t> sizes;
+    for (int i = 1; i < ac; ++ i)
+        sizes.push_back(std::strtoul(av[i], nullptr, 10));
+
+    if (sizes.empty())
+        sizes = {100000, 1000000, 4000000};
+
+    QSTORE.Init(g_config.databases);
+
+    printf("%10s %10s %8s %10s %12s %10s\n", "keys", "file(MB)", "threads", "ms", "keys/s", "MB/s");
+    for (auto keys : sizes)
+    {
+        FillStore(keys);
+        {
+            QDBSaver  qdb;
+            qdb.Save(kRdbFile);
+        }
+
+        struct stat st;
+        ::stat(kRdbFile, &st);
+        const double mb = st.st_size / (1024.0 * 1024.0);
+
+        for (int threads : {1, 2, 4, 8})
+        {
+            QSTORE.ResetDb();
+            g_config.rdbloadthreads = threads;
+
+            auto start = std::chrono::steady_clock::now();
+            QDBLoader  loader;
+            int ret = loader.Load(kRdbFile);
+            auto end = std::chrono::steady_clock::now();
+
+            size_t loaded = 0;
+            for (int dbno = 0; QSTORE.SelectDB(dbno) != -1; ++ dbno)
+                loaded += QSTORE.DBSize();
+            QSTORE.SelectDB(0);
+
+            if (ret != 0 || loaded != keys)
+            {
+                fprintf(stderr, "load failed, ret %d, loaded %zu, expect %zu\n", ret, loaded, keys);
+                return -1;
+            }
+
+            const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+            printf("%10zu %10.1f %8d %10.1f %12.0f %10.1f\n",
+                   keys, mb, threads, ms, keys * 1000 / ms, mb * 1000 / ms);
+        }
+    }
+
+    ::unlink(kRdbFile);
+    return 0;
+}
+
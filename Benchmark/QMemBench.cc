@@ -0,0 +1,261 @@
+
+// memory per key of synthetic datasets in QStore, by keyspace entry, value
+// container and expire index. Bytes are malloc in-use bytes (glibc), so
+// allocator overhead is included; RSS is shown as a cross check.
+// usage: qmembench [-n keys] [-k key size] [-e max elements] [dataset ...]
+// dataset: int | string:SIZE | list|hash|set|zset:ELEMENTSxSIZE
+
+#include <malloc.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "QStore.h"
+#include "QConfig.h"
+#include "QHelper.h"
+#include "Timer.h"
+
+using namespace qedis;
+
+// big blocks like hash table buckets may be mmapped, they are not in uordblks
+static size_t MallocUsed()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    const auto mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+#else
+    const auto mi = mallinfo();
+    return static_cast<unsigned>(mi.uordblks) + static_cast<unsigned>(mi.hblkhd);
+#endif
+}
+
+struct Dataset
+{
+    std::string name;
+    QType  type = QType_string;
+    bool   isInt = false;
+    size_t elements = 1;
+    size_t size = 0;    // bytes of string value, element or field value
+};
+
+static bool ParseDataset(const char* spec, Dataset& ds)
+{
+    ds.name = spec;
+    if (strcmp(spec, "int") == 0)
+    {
+        ds.isInt = true;
+        return true;
+    }
+
+    const char* colon = strchr(spec, ':');
+    if (!colon)
+        return false;
+
+    const std::string type(spec, colon - spec);
+    if (type == "string")
+    {
+        ds.size = strtoul(colon + 1, nullptr, 10);
+        return ds.size > 0;
+    }
+
+    if (type == "list")
+        ds.type = QType_list;
+    else if (type == "hash")
+        ds.type = QType_hash;
+    else if (type == "set")
+        ds.type = QType_set;
+    else if (type == "zset")
+        ds.type = QType_sortedSet;
+    else
+        return false;
+
+    char* end = nullptr;
+    ds.elements = strtoul(colon + 1, &end, 10);
+    if (*end != 'x')
+        return false;
+
+    ds.size = strtoul(end + 1, nullptr, 10);
+    return ds.elements > 0 && ds.size > 0;
+}
+
+static size_t g_keySize = 16;
+
+// zero padded to key size, at least wide enough for the number
+static QString MakeKey(size_t i)
+{
+    char key[64];
+    int width = static_cast<int>(g_keySize) - 4;
+    snprintf(key, sizeof key, "key:%0*zu", width > 0 ? width : 1, i);
+    return key;
+}
+
+// unique by j, not numeric so strings are not int encoded
+static QString MakeElement(size_t j, size_t size)
+{
+    QString elem("e" + std::to_string(j));
+    if (elem.size() < size)
+        elem.resize(size, 'x');
+    return elem;
+}
+
+static QObject MakeValue(const Dataset& ds, size_t i)
+{
+    if (ds.isInt)
+        return QObject::CreateString(std::to_string(i * 7919));
+
+    switch (ds.type)
+    {
+    case QType_list:
+        {
+            QObject obj = QObject::CreateList();
+            for (size_t j = 0; j < ds.elements; ++ j)
+                obj.CastList()->push_back(MakeElement(j, ds.size));
+            return obj;
+        }
+
+    case QType_hash:
+        {
+            QObject obj = QObject::CreateHash();
+            for (size_t j = 0; j < ds.elements; ++ j)
+                obj.CastHash()->insert(QHash::value_type("f" + std::to_string(j), MakeElement(j, ds.size)));
+            return obj;
+        }
+
+    case QType_set:
+        {
+            QObject obj = QObject::CreateSet();
+            for (size_t j = 0; j < ds.elements; ++ j)
+                obj.CastSet()->insert(MakeElement(j, ds.size));
+            return obj;
+        }
+
+    case QType_sortedSet:
+        {
+            QObject obj = QObject::CreateSSet();
+            for (size_t j = 0; j < ds.elements; ++ j)
+                obj.CastSortedSet()->AddMember(MakeElement(j, ds.size), static_cast<double>(j));
+            return obj;
+        }
+
+    default:
+        return QObject::CreateString(MakeElement(i, ds.size));
+    }
+}
+
+struct Usage
+{
+    size_t keys = 0;
+    long   entry = 0;   // bytes, may be negative if the allocator is noisy
+    long   value = 0;
+    long   expire = 0;
+    long   rss = 0;
+};
+
+// entry: keys with int encoded values, which own no memory;
+// value: the same keys set to the real values; expire: a ttl on every key
+static Usage Measure(const Dataset& ds, size_t keys)
+{
+    QSTORE.ResetDb();
+    malloc_trim(0);
+
+    Usage u;
+    u.keys = keys;
+
+    const long rss0 = static_cast<long>(getMemoryInfo(VmRSS));
+    const long m0 = static_cast<long>(MallocUsed());
+    for (size_t i = 0; i < keys; ++ i)
+        QSTORE.SetValue(MakeKey(i), QObject::CreateString(0L));
+
+    const long m1 = static_cast<long>(MallocUsed());
+    for (size_t i = 0; i < keys; ++ i)
+        QSTORE.SetValue(MakeKey(i), MakeValue(ds, i));
+
+    const long m2 = static_cast<long>(MallocUsed());
+    const uint64_t when = ::Now() + 3600 * 1000;
+    for (size_t i = 0; i < keys; ++ i)
+        QSTORE.SetExpire(MakeKey(i), when);
+
+    const long m3 = static_cast<long>(MallocUsed());
+    u.rss = static_cast<long>(getMemoryInfo(VmRSS)) - rss0;
+
+    u.entry = m1 - m0;
+    u.value = m2 - m1;
+    u.expire = m3 - m2;
+    return u;
+}
+
+int main(int ac, char* av[])
+{
+    size_t keys = 100000;
+    size_t maxElements = 4 * 1000 * 1000;
+
+    int opt;
+    while ((opt = getopt(ac, av, "n:k:e:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': keys = strtoul(optarg, nullptr, 10); break;
+        case 'k': g_keySize = strtoul(optarg, nullptr, 10); break;
+        case 'e': maxElements = strtoul(optarg, nullptr, 10); break;
+        default:
+            fprintf(stderr, "usage: qmembench [-n keys] [-k key size] [-e max elements] [dataset ...]\n");
+            return -1;
+        }
+    }
+
+    std::vector<const char*> specs(av + optind, av + ac);
+    if (specs.empty())
+    {
+        specs = {"int", "string:16", "string:64", "string:512",
+                 "list:16x16", "hash:8x16", "hash:256x16",
+                 "set:16x16", "set:256x16", "zset:16x16", "zset:256x16"};
+    }
+
+    std::vector<Dataset> datasets;
+    for (auto spec : specs)
+    {
+        Dataset ds;
+        if (!ParseDataset(spec, ds))
+        {
+            fprintf(stderr, "bad dataset %s\n", spec);
+            return -1;
+        }
+        datasets.push_back(ds);
+    }
+
+    QSTORE.Init(g_config.databases);
+
+    // lazily created state of the store is not counted for the first dataset
+    QSTORE.SetValue(MakeKey(0), QObject::CreateString(0L));
+    QSTORE.SetExpire(MakeKey(0), ::Now() + 1000);
+
+    printf("key size %zu, bytes are malloc in use bytes\n\n", g_keySize);
+    printf("%-14s %8s %6s %10s %10s %10s %10s %10s %10s\n",
+           "dataset", "keys", "elems", "entry/key", "value/key", "value/elem", "expire/key", "total/key", "rss/key");
+
+    for (const auto& ds : datasets)
+    {
+        // big collections use fewer keys
+        size_t n = keys;
+        if (n * ds.elements > maxElements)
+            n = std::max<size_t>(maxElements / ds.elements, 1);
+
+        const Usage u = Measure(ds, n);
+        const double perKey = 1.0 / u.keys;
+        printf("%-14s %8zu %6zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+               ds.name.c_str(), u.keys, ds.elements,
+               u.entry * perKey,
+               u.value * perKey,
+               u.value * perKey / ds.elements,
+               u.expire * perKey,
+               (u.entry + u.value + u.expire) * perKey,
+               u.rss * perKey);
+    }
+
+    QSTORE.ResetDb();
+    return 0;
+}
+
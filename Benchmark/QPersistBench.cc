@@ -0,0 +1,550 @@
+
+// persistence and replication timings of real qedis processes on loopback:
+// aof append throughput by appendfsync policy, SAVE, BGSAVE and BGREWRITEAOF
+// durations with fork latency, rdb and aof load time, full sync to a slave.
+// The report is json on stdout, progress goes to stderr.
+// usage: qpersistbench [-s qedis_server] [-p port] [-n keys] [-d value size]
+//                      [-a aof ops] [-w work dir] [-k keep work dir]
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <climits>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Socket.h"
+
+static double NowMs()
+{
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string Command(const std::vector<std::string>& args)
+{
+    std::string out("*" + std::to_string(args.size()) + "\r\n");
+    for (const auto& arg : args)
+        out += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+    return out;
+}
+
+// length of the first complete reply, -1 if not complete yet
+static long ReplyLength(const char* p, const char* end, bool& error)
+{
+    if (p >= end)
+        return -1;
+
+    const char* lf = static_cast<const char*>(memchr(p, '\n', end - p));
+    if (!lf)
+        return -1;
+
+    const long head = lf + 1 - p;
+    switch (*p)
+    {
+    case '-':
+        error = true;
+        return head;
+
+    case '$':
+        {
+            const long n = strtol(p + 1, nullptr, 10);
+            if (n < 0)
+                return head;
+
+            return end - p >= head + n + 2 ? head + n + 2 : -1;
+        }
+
+    case '*':
+        {
+            const long n = strtol(p + 1, nullptr, 10);
+            long total = head;
+            for (long i = 0; i < n; ++ i)
+            {
+                const long sub = ReplyLength(p + total, end, error);
+                if (sub < 0)
+                    return -1;
+
+                total += sub;
+            }
+
+            return total;
+        }
+
+    default:
+        return head;
+    }
+}
+
+// blocking RESP client
+class Client
+{
+public:
+    ~Client()
+    {
+        Socket::CloseSocket(fd_);
+    }
+
+    bool Connect(int port)
+    {
+        Socket::CloseSocket(fd_);
+        in_.clear();
+
+        fd_ = Socket::CreateTCPSocket();
+        const SocketAddr addr("127.0.0.1", static_cast<uint16_t>(port));
+        if (::connect(fd_, (const sockaddr*)&addr.GetAddr(), sizeof(sockaddr_in)) != 0)
+        {
+            Socket::CloseSocket(fd_);
+            return false;
+        }
+
+        Socket::SetNodelay(fd_);
+        return true;
+    }
+
+    // sends the pipeline, returns the count of error replies, -1 if io failed
+    long Pipeline(const std::string& cmds, size_t count)
+    {
+        if (!_Send(cmds))
+            return -1;
+
+        long errors = 0;
+        for (size_t i = 0; i < count; ++ i)
+        {
+            std::string reply;
+            if (!_Read(reply))
+                return -1;
+            if (!reply.empty() && reply[0] == '-')
+                ++ errors;
+        }
+
+        return errors;
+    }
+
+    // raw reply, empty if io failed
+    std::string Call(const std::vector<std::string>& args)
+    {
+        std::string reply;
+        if (!_Send(Command(args)) || !_Read(reply))
+            reply.clear();
+        return reply;
+    }
+
+    // field of INFO, empty if not found
+    std::string Info(const char* field)
+    {
+        const std::string info = Call({"info"});
+        const std::string key = std::string("\r\n") + field + ":";
+        auto pos = info.find(key);
+        if (pos == std::string::npos)
+            return std::string();
+
+        pos += key.size();
+        return info.substr(pos, info.find("\r\n", pos) - pos);
+    }
+
+    long InfoInt(const char* field)
+    {
+        return atol(Info(field).c_str());
+    }
+
+private:
+    bool _Send(const std::string& data)
+    {
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            const ssize_t n = ::write(fd_, data.data() + sent, data.size() - sent);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            sent += n;
+        }
+
+        return true;
+    }
+
+    bool _Read(std::string& reply)
+    {
+        while (true)
+        {
+            bool error = false;
+            const long len = ReplyLength(in_.data(), in_.data() + in_.size(), error);
+            if (len > 0)
+            {
+                reply.assign(in_, 0, len);
+                in_.erase(0, len);
+                return true;
+            }
+
+            char buf[64 * 1024];
+            const ssize_t n = ::read(fd_, buf, sizeof buf);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+
+            in_.append(buf, n);
+        }
+    }
+
+    int fd_ = INVALID_SOCKET;
+    std::string in_;
+};
+
+struct Options
+{
+    std::string server;
+    std::string workDir = "qpersistbench.data";
+    int    port = 16379;
+    size_t keys = 1000000;
+    size_t valueSize = 64;
+    size_t aofOps = 200000;
+    bool   keep = false;
+};
+
+static Options g_opts;
+
+// a qedis_server child process in its own directory
+class Server
+{
+public:
+    Server(const std::string& name, int port) :
+        dir_(g_opts.workDir + "/" + name),
+        port_(port)
+    {
+        ::mkdir(dir_.c_str(), 0755);
+    }
+
+    ~Server()
+    {
+        Stop();
+    }
+
+    const std::string& Dir() const { return dir_; }
+    int Port() const { return port_; }
+    Client& Cli() { return cli_; }
+
+    // ms until it answers PING, loading data on disk first; negative if failed
+    double Start(const std::vector<std::string>& conf)
+    {
+        const std::string confFile = dir_ + "/qedis.conf";
+        FILE* fp = fopen(confFile.c_str(), "w");
+        if (!fp)
+            return -1;
+
+        fprintf(fp, "daemonize no\nport %d\nlogfile stdout\nloglevel warning\nsave \"\"\n"
+                    "dir ./\ndbfilename dump.rdb\nappendfilename appendonly.aof\n", port_);
+        for (const auto& line : conf)
+            fprintf(fp, "%s\n", line.c_str());
+        fclose(fp);
+
+        const double start = NowMs();
+        pid_ = fork();
+        if (pid_ == 0)
+        {
+            if (chdir(dir_.c_str()) != 0 || !freopen("server.log", "a", stdout))
+                _exit(-1);
+            dup2(STDOUT_FILENO, STDERR_FILENO);
+            execl(g_opts.server.c_str(), g_opts.server.c_str(), "qedis.conf", (char*)nullptr);
+            _exit(-1);
+        }
+
+        if (pid_ < 0)
+            return -1;
+
+        while (NowMs() - start < 600 * 1000)
+        {
+            int status;
+            if (waitpid(pid_, &status, WNOHANG) == pid_)
+            {
+                pid_ = -1;
+                return -1;
+            }
+
+            if (cli_.Connect(port_) && cli_.Call({"ping"}) == "+PONG\r\n")
+                return NowMs() - start;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        return -1;
+    }
+
+    void Stop()
+    {
+        if (pid_ <= 0)
+            return;
+
+        cli_.Call({"shutdown"});
+
+        const double start = NowMs();
+        int status;
+        while (waitpid(pid_, &status, WNOHANG) != pid_)
+        {
+            if (NowMs() - start > 30 * 1000)
+            {
+                kill(pid_, SIGKILL);
+                waitpid(pid_, &status, 0);
+                break;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        pid_ = -1;
+    }
+
+    size_t FileSize(const char* name) const
+    {
+        struct stat st;
+        return ::stat((dir_ + "/" + name).c_str(), &st) == 0 ? st.st_size : 0;
+    }
+
+    void RemoveFile(const char* name) const
+    {
+        ::unlink((dir_ + "/" + name).c_str());
+    }
+
+private:
+    std::string dir_;
+    int    port_;
+    pid_t  pid_ = -1;
+    Client cli_;
+};
+
+static const size_t kBatch = 1000;
+
+// ops/sec of pipelined sets of ops keys, exits if any failed
+static double Populate(Client& cli, size_t ops)
+{
+    const std::string value(g_opts.valueSize, 'v');
+    const std::vector<std::string> fields = {"f1", value, "f2", value, "f3", value, "f4", value};
+
+    const double start = NowMs();
+    for (size_t i = 0; i < ops; )
+    {
+        std::string cmds;
+        size_t count = 0;
+        for (; count < kBatch && i < ops; ++ count, ++ i)
+        {
+            const std::string key("key:" + std::to_string(i));
+
+            // 10% hashes and 10% lists, others strings
+            switch (i % 10)
+            {
+            case 0:
+                {
+                    std::vector<std::string> args = {"hmset", key};
+                    args.insert(args.end(), fields.begin(), fields.end());
+                    cmds += Command(args);
+                }
+                break;
+
+            case 1:
+                cmds += Command({"rpush", key, value, value, value, value});
+                break;
+
+            default:
+                cmds += Command({"set", key, value});
+                break;
+            }
+        }
+
+        if (cli.Pipeline(cmds, count) != 0)
+        {
+            fprintf(stderr, "populate failed\n");
+            exit(-1);
+        }
+    }
+
+    return ops * 1000 / (NowMs() - start);
+}
+
+// until the INFO field is 0
+static void WaitDone(Client& cli, const char* field)
+{
+    std::string value;
+    while ((value = cli.Info(field)) != "0")
+    {
+        if (value.empty())
+        {
+            fprintf(stderr, "no %s in INFO\n", field);
+            exit(-1);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static void Fail(const char* what)
+{
+    fprintf(stderr, "%s failed\n", what);
+    exit(-1);
+}
+
+static std::string SelfDir()
+{
+    char path[1024];
+    const ssize_t n = readlink("/proc/self/exe", path, sizeof path - 1);
+    if (n <= 0)
+        return ".";
+
+    path[n] = '\0';
+    char* slash = strrchr(path, '/');
+    if (slash)
+        *slash = '\0';
+    return path;
+}
+
+int main(int ac, char* av[])
+{
+    int opt;
+    while ((opt = getopt(ac, av, "s:p:n:d:a:w:k")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': g_opts.server = optarg; break;
+        case 'p': g_opts.port = atoi(optarg); break;
+        case 'n': g_opts.keys = strtoul(optarg, nullptr, 10); break;
+        case 'd': g_opts.valueSize = strtoul(optarg, nullptr, 10); break;
+        case 'a': g_opts.aofOps = strtoul(optarg, nullptr, 10); break;
+        case 'w': g_opts.workDir = optarg; break;
+        case 'k': g_opts.keep = true; break;
+        default:
+            fprintf(stderr, "usage: qpersistbench [-s qedis_server] [-p port] [-n keys] [-d value size] "
+                            "[-a aof ops] [-w work dir] [-k keep work dir]\n");
+            return -1;
+        }
+    }
+
+    if (g_opts.server.empty())
+        g_opts.server = SelfDir() + "/qedis_server";
+
+    // servers run in their own dirs
+    char path[PATH_MAX];
+    if (!realpath(g_opts.server.c_str(), path))
+        Fail(("find " + g_opts.server).c_str());
+    g_opts.server = path;
+
+    signal(SIGPIPE, SIG_IGN);
+    if (system(("rm -rf " + g_opts.workDir).c_str()) != 0 || ::mkdir(g_opts.workDir.c_str(), 0755) != 0)
+        Fail("create work dir");
+
+    std::ostringstream json;
+    json << "{\n  \"keys\": " << g_opts.keys << ", \"value_size\": " << g_opts.valueSize
+         << ", \"aof_ops\": " << g_opts.aofOps << ",\n";
+
+    // aof append throughput, a fresh server for each policy
+    double emptyStartMs = 0;
+    json << "  \"aof_append_ops_per_sec\": {";
+    const char* const policies[] = {"no", "everysec", "always"};
+    for (size_t i = 0; i < sizeof policies / sizeof policies[0]; ++ i)
+    {
+        Server server(std::string("aof-") + policies[i], g_opts.port);
+        const double startMs = server.Start({"appendonly yes", std::string("appendfsync ") + policies[i]});
+        if (startMs < 0)
+            Fail("start server");
+        if (i == 0)
+            emptyStartMs = startMs;
+
+        const double ops = Populate(server.Cli(), g_opts.aofOps);
+        fprintf(stderr, "aof appendfsync %-8s %.0f ops/sec\n", policies[i], ops);
+        json << (i ? ", " : "") << "\"" << policies[i] << "\": " << ops;
+    }
+    json << "},\n";
+
+    Server master("master", g_opts.port);
+    if (master.Start({"appendonly yes", "appendfsync everysec"}) < 0)
+        Fail("start master");
+
+    Client& cli = master.Cli();
+    const double populateOps = Populate(cli, g_opts.keys);
+    fprintf(stderr, "populate %zu keys %.0f ops/sec\n", g_opts.keys, populateOps);
+
+    double start = NowMs();
+    if (cli.Call({"save"}) != "+OK\r\n")
+        Fail("save");
+    const double saveMs = NowMs() - start;
+    const size_t rdbSize = master.FileSize("dump.rdb");
+    fprintf(stderr, "save %.1f ms, rdb %zu bytes\n", saveMs, rdbSize);
+
+    start = NowMs();
+    if (cli.Call({"bgsave"})[0] == '-')
+        Fail("bgsave");
+    WaitDone(cli, "rdb_bgsave_in_progress");
+    const double bgsaveMs = NowMs() - start;
+    const long bgsaveForkUs = cli.InfoInt("latest_fork_usec");
+    fprintf(stderr, "bgsave %.1f ms, fork %ld us\n", bgsaveMs, bgsaveForkUs);
+
+    start = NowMs();
+    if (cli.Call({"bgrewriteaof"})[0] == '-')
+        Fail("bgrewriteaof");
+    WaitDone(cli, "aof_rewrite_in_progress");
+    const double rewriteMs = NowMs() - start;
+    const long rewriteForkUs = cli.InfoInt("latest_fork_usec");
+    master.Stop();
+    const size_t aofSize = master.FileSize("appendonly.aof");
+    fprintf(stderr, "bgrewriteaof %.1f ms, fork %ld us, aof %zu bytes\n", rewriteMs, rewriteForkUs, aofSize);
+
+    // aof is loaded first if it exists
+    const double aofLoadMs = master.Start({"appendonly yes", "appendfsync everysec"});
+    const long aofKeys = atol(cli.Call({"dbsize"}).c_str() + 1);
+    master.Stop();
+    fprintf(stderr, "aof load %.1f ms, %ld keys\n", aofLoadMs, aofKeys);
+
+    master.RemoveFile("appendonly.aof");
+    const double rdbLoadMs = master.Start({"appendonly no"});
+    const long rdbKeys = atol(cli.Call({"dbsize"}).c_str() + 1);
+    fprintf(stderr, "rdb load %.1f ms, %ld keys\n", rdbLoadMs, rdbKeys);
+    if (aofLoadMs < 0 || rdbLoadMs < 0 || aofKeys != static_cast<long>(g_opts.keys) || rdbKeys != aofKeys)
+        Fail("load");
+
+    Server slave("slave", g_opts.port + 1);
+    if (slave.Start({"appendonly no"}) < 0)
+        Fail("start slave");
+
+    start = NowMs();
+    if (slave.Cli().Call({"slaveof", "127.0.0.1", std::to_string(g_opts.port)}) != "+OK\r\n")
+        Fail("slaveof");
+
+    while (slave.Cli().Info("master_link_status") != "up" || slave.Cli().InfoInt("master_sync_in_progress") != 0)
+    {
+        if (slave.Cli().Call({"ping"}).empty() || NowMs() - start > 600 * 1000)
+            Fail("full sync");
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    const double syncMs = NowMs() - start;
+    const long slaveKeys = atol(slave.Cli().Call({"dbsize"}).c_str() + 1);
+    fprintf(stderr, "full sync %.1f ms, %ld keys\n", syncMs, slaveKeys);
+    if (slaveKeys != rdbKeys)
+        Fail("full sync");
+
+    slave.Stop();
+    master.Stop();
+
+    json << "  \"populate_ops_per_sec\": " << populateOps << ",\n"
+         << "  \"rdb_bytes\": " << rdbSize << ", \"save_ms\": " << saveMs
+         << ", \"bgsave_ms\": " << bgsaveMs << ", \"bgsave_fork_us\": " << bgsaveForkUs << ",\n"
+         << "  \"aof_bytes\": " << aofSize << ", \"aof_rewrite_ms\": " << rewriteMs
+         << ", \"aof_rewrite_fork_us\": " << rewriteForkUs << ",\n"
+         << "  \"empty_start_ms\": " << emptyStartMs << ", \"aof_load_ms\": " << aofLoadMs << ", \"rdb_load_ms\": " << rdbLoadMs << ",\n"
+         << "  \"full_sync_ms\": " << syncMs << "\n}\n";
+
+    printf("%s", json.str().c_str());
+
+    if (!g_opts.keep && system(("rm -rf " + g_opts.workDir).c_str()) != 0)
+        fprintf(stderr, "remove %s failed\n", g_opts.workDir.c_str());
+
+    return 0;
+}
+
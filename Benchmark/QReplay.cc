@@ -0,0 +1,689 @@
+
+// qreplay: replay a request trace captured by DEBUG TRACE START
+//
+// Requests of a traced client always go to the same connection in the
+// original order; clients are spread over the connections as they first
+// appear. With speed s > 0 a request is sent at its trace time divided by
+// s (1 is the original timing) and latency is measured from that time, so
+// a stalled server is not hidden. Speed 0 replays as fast as possible with
+// -P requests in flight per connection.
+//
+// usage: qreplay [options] <trace file>
+
+#include <getopt.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "EPoller.h"
+#include "Socket.h"
+#include "QCommandStats.h"
+#include "QTraceCapture.h"
+
+using namespace qedis;
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    int         port = 6379;
+    int         threads = 1;
+    int         conns = 50;
+    int         pipeline = 1;
+    double      speed = 1;
+    std::string jsonFile;
+};
+
+static Options g_opts;
+
+// command names in trace, lower case
+static std::vector<std::string> g_cmds;
+static const int kSelect = -1;
+
+static void AppendBulk(std::string& out, const char* data, size_t len)
+{
+    char head[32];
+    int n = snprintf(head, sizeof head, "$%zu\r\n", len);
+    out.append(head, n);
+    out.append(data, len);
+    out.append("\r\n", 2);
+}
+
+// length of the first complete reply, -1 if not complete yet
+static long ReplyLength(const char* p, const char* end, bool& error)
+{
+    if (p >= end)
+        return -1;
+
+    const char* lf = static_cast<const char*>(memchr(p, '\n', end - p));
+    if (!lf)
+        return -1;
+
+    const long head = lf + 1 - p;
+    switch (*p)
+    {
+    case '+':
+    case ':':
+        return head;
+
+    case '$':
+        {
+            const long n = strtol(p + 1, nullptr, 10);
+            if (n < 0)
+                return head;
+
+            return end - p >= head + n + 2 ? head + n + 2 : -1;
+        }
+
+    case '*':
+        {
+            const long n = strtol(p + 1, nullptr, 10);
+            long total = head;
+            for (long i = 0; i < n; ++ i)
+            {
+                const long sub = ReplyLength(p + total, end, error);
+                if (sub < 0)
+                    return -1;
+
+                total += sub;
+            }
+
+            return total;
+        }
+
+    default:
+        error = true;
+        return head;
+    }
+}
+
+struct Item
+{
+    uint64_t    time;   // usec since capture start
+    int         cmd;
+    int         db;
+    std::string request;
+};
+
+struct Request
+{
+    uint64_t start; // intended send time, or when it was queued at speed 0
+    int      cmd;
+};
+
+struct Conn
+{
+    int         fd = INVALID_SOCKET;
+    std::string out;
+    size_t      outPos = 0;
+    bool        wantWrite = false;
+    std::string in;
+    size_t      inPos = 0;
+
+    int         db = 0;
+    std::deque<Item>    items;
+    std::deque<Request> inflight;
+};
+
+struct Stats
+{
+    std::vector<QHistogram> latency;
+    std::vector<uint64_t>   errors;
+    std::vector<uint64_t>   ns;
+
+    Stats() : latency(g_cmds.size()), errors(g_cmds.size()), ns(g_cmds.size())
+    {
+    }
+
+    void Merge(const Stats& other)
+    {
+        for (size_t i = 0; i < g_cmds.size(); ++ i)
+        {
+            latency[i].Merge(other.latency[i]);
+            errors[i] += other.errors[i];
+            ns[i] += other.ns[i];
+        }
+    }
+};
+
+static const uint64_t kUnlimited = ~0ULL;
+
+class Worker
+{
+public:
+    explicit Worker(int conns) : conns_(conns), end_(0)
+    {
+    }
+
+    Conn& GetConn(size_t i) { return conns_[i]; }
+
+    bool Connect(const SocketAddr& addr)
+    {
+        for (auto& conn : conns_)
+        {
+            conn.fd = Socket::CreateTCPSocket();
+            if (::connect(conn.fd, (const sockaddr*)&addr.GetAddr(), sizeof(sockaddr_in)) != 0)
+            {
+                fprintf(stderr, "connect %s:%d failed: %s\n", g_opts.host.c_str(), g_opts.port, strerror(errno));
+                return false;
+            }
+
+            Socket::SetNonBlock(conn.fd);
+            Socket::SetNodelay(conn.fd);
+            poller_.AddSocket(conn.fd, EventTypeRead, &conn);
+        }
+
+        return true;
+    }
+
+    void Start(uint64_t start)
+    {
+        start_ = start;
+        stats_ = Stats(); // commands are known once the trace is loaded
+        thread_ = std::thread([this]() { _Run(); });
+    }
+
+    void Join()
+    {
+        thread_.join();
+    }
+
+    const Stats& GetStats() const { return stats_; }
+    uint64_t End() const { return end_; }
+
+private:
+    uint64_t _Due(const Item& item) const
+    {
+        return start_ + static_cast<uint64_t>(item.time * 1000 / g_opts.speed);
+    }
+
+    void _Run();
+    void _Fill(Conn& conn, uint64_t now);
+    void _Flush(Conn& conn);
+    void _Read(Conn& conn);
+
+    std::vector<Conn> conns_;
+    Epoller poller_;
+    std::thread thread_;
+    Stats stats_;
+    uint64_t start_;
+    uint64_t end_; // when the last reply came
+};
+
+void Worker::_Run()
+{
+    std::vector<FiredEvent> events(conns_.size());
+    while (true)
+    {
+        const uint64_t now = QCommandStats::Clock();
+
+        bool done = true;
+        uint64_t wakeup = kUnlimited;
+        for (auto& conn : conns_)
+        {
+            _Fill(conn, now);
+            _Flush(conn);
+
+            if (!conn.inflight.empty() || !conn.items.empty())
+                done = false;
+
+            if (g_opts.speed > 0 && !conn.items.empty())
+                wakeup = std::min(wakeup, _Due(conn.items.front()));
+        }
+
+        if (done)
+            break;
+
+        // sleep until the next request is due, busy polls below 1ms
+        int timeoutMs = 100;
+        if (wakeup != kUnlimited)
+            timeoutMs = wakeup > now ? static_cast<int>(std::min<uint64_t>((wakeup - now) / 1000000, 100)) : 0;
+
+        const int n = poller_.Poll(events, conns_.size(), timeoutMs);
+        for (int i = 0; i < n; ++ i)
+        {
+            Conn& conn = *static_cast<Conn*>(events[i].userdata);
+            if (events[i].events & EventTypeRead)
+                _Read(conn);
+            if (events[i].events & EventTypeWrite)
+                _Flush(conn);
+            if (events[i].events & EventTypeError)
+            {
+                fprintf(stderr, "connection error\n");
+                exit(-1);
+            }
+        }
+    }
+}
+
+void Worker::_Fill(Conn& conn, uint64_t now)
+{
+    while (!conn.items.empty())
+    {
+        const Item& item = conn.items.front();
+
+        Request req;
+        req.start = now;
+        if (g_opts.speed > 0)
+        {
+            // late requests keep their intended time
+            const uint64_t due = _Due(item);
+            if (due > now)
+                break;
+
+            req.start = due;
+        }
+        else if (conn.inflight.size() >= static_cast<size_t>(g_opts.pipeline))
+        {
+            break;
+        }
+
+        if (item.db != conn.db)
+        {
+            const std::string db = std::to_string(item.db);
+            conn.out.append("*2\r\n$6\r\nselect\r\n");
+            AppendBulk(conn.out, db.data(), db.size());
+            conn.inflight.push_back(Request{req.start, kSelect});
+            conn.db = item.db;
+        }
+
+        req.cmd = item.cmd;
+        conn.out.append(item.request);
+        conn.inflight.push_back(req);
+        conn.items.pop_front();
+    }
+}
+
+void Worker::_Flush(Conn& conn)
+{
+    while (conn.outPos < conn.out.size())
+    {
+        const ssize_t n = ::write(conn.fd, conn.out.data() + conn.outPos, conn.out.size() - conn.outPos);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                fprintf(stderr, "write failed: %s\n", strerror(errno));
+                exit(-1);
+            }
+
+            if (!conn.wantWrite)
+            {
+                conn.wantWrite = true;
+                poller_.ModSocket(conn.fd, EventTypeRead | EventTypeWrite, &conn);
+            }
+
+            return;
+        }
+
+        conn.outPos += n;
+    }
+
+    conn.out.clear();
+    conn.outPos = 0;
+
+    if (conn.wantWrite)
+    {
+        conn.wantWrite = false;
+        poller_.ModSocket(conn.fd, EventTypeRead, &conn);
+    }
+}
+
+void Worker::_Read(Conn& conn)
+{
+    char buf[64 * 1024];
+    while (true)
+    {
+        const ssize_t n = ::read(conn.fd, buf, sizeof buf);
+        if (n == 0)
+        {
+            fprintf(stderr, "server closed connection\n");
+            exit(-1);
+        }
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            fprintf(stderr, "read failed: %s\n", strerror(errno));
+            exit(-1);
+        }
+
+        conn.in.append(buf, n);
+        if (static_cast<size_t>(n) < sizeof buf)
+            break;
+    }
+
+    const uint64_t now = QCommandStats::Clock();
+    const char* const end = conn.in.data() + conn.in.size();
+    while (!conn.inflight.empty())
+    {
+        bool error = false;
+        const long len = ReplyLength(conn.in.data() + conn.inPos, end, error);
+        if (len < 0)
+            break;
+
+        conn.inPos += len;
+
+        const Request& req = conn.inflight.front();
+        if (req.cmd != kSelect)
+        {
+            const uint64_t ns = now > req.start ? now - req.start : 0;
+            stats_.latency[req.cmd].Record(ns);
+            stats_.ns[req.cmd] += ns;
+            if (error)
+                ++ stats_.errors[req.cmd];
+        }
+        else if (error)
+        {
+            fprintf(stderr, "select failed, does the target have enough databases?\n");
+            exit(-1);
+        }
+
+        conn.inflight.pop_front();
+        end_ = now;
+    }
+
+    if (conn.inPos == conn.in.size())
+    {
+        conn.in.clear();
+        conn.inPos = 0;
+    }
+    else if (conn.inPos > sizeof buf)
+    {
+        conn.in.erase(0, conn.inPos);
+        conn.inPos = 0;
+    }
+}
+
+// the trace into items of connections, returns trace duration in usec
+static bool LoadTrace(const char* file, std::vector<std::unique_ptr<Worker> >& workers,
+                      uint64_t& records, uint64_t& clients, uint64_t& usec)
+{
+    QTraceReader reader;
+    if (!reader.Open(file))
+    {
+        fprintf(stderr, "open trace %s failed\n", file);
+        return false;
+    }
+
+    std::unordered_map<std::string, int> cmds;
+    std::unordered_map<uint64_t, int> connOfClient;
+
+    records = 0;
+    usec = 0;
+
+    QTraceReader::Record rec;
+    while (reader.Next(rec))
+    {
+        std::string name(rec.params[0]);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+        auto cmd = cmds.find(name);
+        if (cmd == cmds.end())
+        {
+            cmd = cmds.insert(std::make_pair(name, static_cast<int>(g_cmds.size()))).first;
+            g_cmds.push_back(name);
+        }
+
+        // round robin by first appearance
+        auto conn = connOfClient.find(rec.client);
+        if (conn == connOfClient.end())
+        {
+            const int index = static_cast<int>(connOfClient.size() % g_opts.conns);
+            conn = connOfClient.insert(std::make_pair(rec.client, index)).first;
+        }
+
+        Item item;
+        item.time = rec.time;
+        item.cmd = cmd->second;
+        item.db = rec.db;
+
+        char head[16];
+        int n = snprintf(head, sizeof head, "*%zu\r\n", rec.params.size());
+        item.request.append(head, n);
+        for (const auto& arg : rec.params)
+            AppendBulk(item.request, arg.data(), arg.size());
+
+        // connections are dealt to workers in turn
+        const int index = conn->second;
+        Worker& worker = *workers[index % workers.size()];
+        worker.GetConn(index / workers.size()).items.push_back(std::move(item));
+
+        ++ records;
+        usec = rec.time;
+    }
+
+    clients = connOfClient.size();
+    return true;
+}
+
+struct Result
+{
+    std::string name;
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    double   opsPerSec = 0;
+    double   avgUs = 0;
+    double   p50 = 0, p90 = 0, p99 = 0, p999 = 0, max = 0;
+};
+
+static Result MakeResult(const std::string& name, const QHistogram& h, uint64_t errors, uint64_t ns, double seconds)
+{
+    Result r;
+    r.name = name;
+    r.requests = h.Count();
+    r.errors = errors;
+    r.opsPerSec = seconds > 0 ? r.requests / seconds : 0;
+    r.avgUs = r.requests ? ns / 1000.0 / r.requests : 0;
+    r.p50 = h.Percentile(50) / 1000.0;
+    r.p90 = h.Percentile(90) / 1000.0;
+    r.p99 = h.Percentile(99) / 1000.0;
+    r.p999 = h.Percentile(99.9) / 1000.0;
+    r.max = h.Percentile(100) / 1000.0;
+    return r;
+}
+
+static void PrintText(const Result& r, double seconds)
+{
+    printf("====== %s ======\n", r.name.c_str());
+    printf("  %lu requests, %lu errors in %.2f seconds, %.2f requests per second\n",
+           r.requests, r.errors, seconds, r.opsPerSec);
+    printf("  latency usec: avg %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n\n",
+           r.avgUs, r.p50, r.p90, r.p99, r.p999, r.max);
+}
+
+static void JsonFields(std::ostream& os, const Result& r)
+{
+    os << "\"requests\": " << r.requests
+       << ", \"errors\": " << r.errors
+       << ", \"ops_per_sec\": " << r.opsPerSec
+       << ", \"avg_us\": " << r.avgUs
+       << ", \"p50_us\": " << r.p50
+       << ", \"p90_us\": " << r.p90
+       << ", \"p99_us\": " << r.p99
+       << ", \"p999_us\": " << r.p999
+       << ", \"max_us\": " << r.max;
+}
+
+// results[0] is all commands, same layout as qedis-benchmark
+static std::string ToJson(const std::vector<Result>& results, double seconds, double traceSeconds)
+{
+    std::ostringstream oss;
+    oss << "{\n  \"threads\": " << g_opts.threads
+        << ", \"connections\": " << g_opts.conns
+        << ", \"pipeline\": " << g_opts.pipeline
+        << ", \"speed\": " << g_opts.speed
+        << ", \"trace_seconds\": " << traceSeconds
+        << ", \"seconds\": " << seconds << ",\n  ";
+    JsonFields(oss, results[0]);
+    oss << ",\n  \"commands\": [\n";
+    for (size_t i = 1; i < results.size(); ++ i)
+    {
+        oss << "    {\"name\": \"" << results[i].name << "\", ";
+        JsonFields(oss, results[i]);
+        oss << (i + 1 < results.size() ? "},\n" : "}\n");
+    }
+    oss << "  ]\n}\n";
+
+    return oss.str();
+}
+
+static void Usage()
+{
+    printf("Usage: qreplay [options] <trace file>\n"
+           "  -h <host>            server host, default 127.0.0.1\n"
+           "  -p <port>            server port, default 6379\n"
+           "  -t <threads>         client threads, default 1\n"
+           "  -c <connections>     total connections, default 50, traced clients\n"
+           "                       share them\n"
+           "  -s <speed>           1 is the original timing, 2 twice as fast, 0 as\n"
+           "                       fast as possible; default 1\n"
+           "  -P <pipeline>        requests in flight per connection at speed 0,\n"
+           "                       default 1\n"
+           "  --json <file>        write json result\n"
+           "  --help\n");
+}
+
+int main(int ac, char* av[])
+{
+    enum
+    {
+        Opt_json = 256,
+        Opt_help,
+    };
+
+    static const option longOptions[] =
+    {
+        { "json",       required_argument, nullptr, Opt_json },
+        { "help",       no_argument,       nullptr, Opt_help },
+        { nullptr,      0,                 nullptr, 0 },
+    };
+
+    int opt;
+    while ((opt = getopt_long(ac, av, "h:p:t:c:s:P:", longOptions, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 'h': g_opts.host = optarg; break;
+        case 'p': g_opts.port = atoi(optarg); break;
+        case 't': g_opts.threads = atoi(optarg); break;
+        case 'c': g_opts.conns = atoi(optarg); break;
+        case 's': g_opts.speed = atof(optarg); break;
+        case 'P': g_opts.pipeline = atoi(optarg); break;
+        case Opt_json: g_opts.jsonFile = optarg; break;
+
+        default:
+            Usage();
+            return -1;
+        }
+    }
+
+    if (optind + 1 != ac ||
+        g_opts.threads <= 0 || g_opts.conns <= 0 || g_opts.pipeline <= 0 || g_opts.speed < 0)
+    {
+        Usage();
+        return -1;
+    }
+
+    if (g_opts.threads > g_opts.conns)
+        g_opts.threads = g_opts.conns;
+
+    std::vector<std::unique_ptr<Worker> > workers;
+    for (int i = 0; i < g_opts.threads; ++ i)
+    {
+        const int conns = g_opts.conns / g_opts.threads + (i < g_opts.conns % g_opts.threads ? 1 : 0);
+        workers.push_back(std::unique_ptr<Worker>(new Worker(conns)));
+    }
+
+    uint64_t records, clients, traceUsec;
+    if (!LoadTrace(av[optind], workers, records, clients, traceUsec))
+        return -1;
+
+    if (records == 0)
+    {
+        fprintf(stderr, "trace %s is empty\n", av[optind]);
+        return -1;
+    }
+
+    const double traceSeconds = traceUsec / 1e6;
+    char mode[64];
+    if (g_opts.speed > 0)
+        snprintf(mode, sizeof mode, "speed %g", g_opts.speed);
+    else
+        snprintf(mode, sizeof mode, "as fast as possible, pipeline %d", g_opts.pipeline);
+
+    printf("qreplay %s:%d, %d threads, %d connections, %s\n",
+           g_opts.host.c_str(), g_opts.port, g_opts.threads, g_opts.conns, mode);
+    printf("trace %s: %lu requests of %lu clients in %.2f seconds\n\n",
+           av[optind], records, clients, traceSeconds);
+
+    const SocketAddr addr(g_opts.host.c_str(), static_cast<uint16_t>(g_opts.port));
+    for (auto& worker : workers)
+    {
+        if (!worker->Connect(addr))
+            return -1;
+    }
+
+    const uint64_t start = QCommandStats::Clock();
+    for (auto& worker : workers)
+        worker->Start(start);
+
+    Stats stats;
+    uint64_t end = start;
+    for (auto& worker : workers)
+    {
+        worker->Join();
+        stats.Merge(worker->GetStats());
+        end = std::max(end, worker->End());
+    }
+
+    const double seconds = (end - start) / 1e9;
+
+    QHistogram all;
+    uint64_t errors = 0, ns = 0;
+    for (size_t i = 0; i < g_cmds.size(); ++ i)
+    {
+        all.Merge(stats.latency[i]);
+        errors += stats.errors[i];
+        ns += stats.ns[i];
+    }
+
+    std::vector<Result> results;
+    results.push_back(MakeResult("all", all, errors, ns, seconds));
+    for (size_t i = 0; i < g_cmds.size(); ++ i)
+        results.push_back(MakeResult(g_cmds[i], stats.latency[i], stats.errors[i], stats.ns[i], seconds));
+
+    for (const auto& r : results)
+        PrintText(r, seconds);
+
+    if (!g_opts.jsonFile.empty())
+    {
+        std::ofstream ofs(g_opts.jsonFile.c_str(), std::ios::trunc);
+        ofs << ToJson(results, seconds, traceSeconds);
+        if (!ofs)
+        {
+            fprintf(stderr, "write %s failed\n", g_opts.jsonFile.c_str());
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
@@ -0,0 +1,992 @@
+
+// qedis-benchmark: load generator for qedis or any redis server
+//
+// Every thread drives its connections with its own epoll loop. Closed loop
+// keeps -P requests in flight per connection; open loop (-R) sends at a
+// fixed total rate and measures latency from when a request should have
+// been sent, so a stalled server is not hidden by a stalled client
+// (coordinated omission). Keys and value sizes are uniform or zipf, the
+// command mix is weighted. Results are text, csv or json; a json result
+// may be used as the baseline of a later run.
+//
+// usage: qedis-benchmark --help
+
+#include <getopt.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EPoller.h"
+#include "Socket.h"
+#include "QCommandStats.h"
+
+using namespace qedis;
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    int         port = 6379;
+    int         threads = 1;
+    int         conns = 50;
+    int         pipeline = 1;
+    uint64_t    requests = 100000;
+    double      duration = 0;       // seconds, instead of requests
+    double      rate = 0;           // total requests per second, open loop
+
+    uint64_t    keys = 100000;
+    bool        keyZipf = false;
+    double      theta = 0.99;
+
+    size_t      minValue = 64;
+    size_t      maxValue = 64;
+    bool        valueZipf = false;
+
+    std::string mix = "get=1,set=1";
+    uint64_t    seed = 0;
+
+    std::string csvFile;
+    std::string jsonFile;
+    std::string compareFile;
+    double      tolerance = 5;      // percent
+};
+
+static Options g_opts;
+
+// YCSB zipfian generator, Gray et al. "Quickly generating billion-record
+// synthetic databases". Rank 0 is the most popular.
+class Zipf
+{
+public:
+    Zipf(uint64_t n, double theta) : n_(n), theta_(theta)
+    {
+        double zeta2 = 1 + std::pow(0.5, theta);
+        zetan_ = 0;
+        for (uint64_t i = 1; i <= n; ++ i)
+            zetan_ += 1 / std::pow(static_cast<double>(i), theta);
+
+        alpha_ = 1 / (1 - theta);
+        eta_ = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan_);
+        half_ = 1 + std::pow(0.5, theta);
+    }
+
+    uint64_t Next(std::mt19937_64& rng) const
+    {
+        const double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        const double uz = u * zetan_;
+        if (uz < 1)
+            return 0;
+        if (uz < half_)
+            return 1;
+
+        const uint64_t rank = static_cast<uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+        return rank < n_ ? rank : n_ - 1;
+    }
+
+private:
+    uint64_t n_;
+    double   theta_;
+    double   zetan_;
+    double   alpha_;
+    double   eta_;
+    double   half_;
+};
+
+// popular keys are scattered over the key space, not the first ones
+static uint64_t Scramble(uint64_t rank, uint64_t n)
+{
+    uint64_t h = rank * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 29;
+    return h % n;
+}
+
+enum Cmd
+{
+    Cmd_ping,
+    Cmd_get,
+    Cmd_set,
+    Cmd_incr,
+    Cmd_lpush,
+    Cmd_rpop,
+    Cmd_sadd,
+    Cmd_hset,
+    Cmd_hget,
+    Cmd_zadd,
+    Cmd_max,
+};
+
+static const char* const kCmdNames[Cmd_max] =
+{
+    "ping", "get", "set", "incr", "lpush", "rpop", "sadd", "hset", "hget", "zadd",
+};
+
+// cumulative weights of the mix
+static std::vector<std::pair<uint64_t, Cmd> > g_mix;
+static uint64_t g_mixTotal = 0;
+
+static bool ParseMix(const std::string& mix)
+{
+    std::istringstream iss(mix);
+    std::string item;
+    while (std::getline(iss, item, ','))
+    {
+        auto eq = item.find('=');
+        std::string name = item.substr(0, eq);
+        long weight = eq == std::string::npos ? 1 : strtol(item.c_str() + eq + 1, nullptr, 10);
+
+        int cmd = 0;
+        while (cmd < Cmd_max && name != kCmdNames[cmd])
+            ++ cmd;
+
+        if (cmd == Cmd_max || weight <= 0)
+        {
+            fprintf(stderr, "bad command mix %s\n", item.c_str());
+            return false;
+        }
+
+        g_mixTotal += weight;
+        g_mix.push_back(std::make_pair(g_mixTotal, static_cast<Cmd>(cmd)));
+    }
+
+    return !g_mix.empty();
+}
+
+static std::unique_ptr<Zipf> g_keyZipf;
+static std::unique_ptr<Zipf> g_valueZipf;
+static std::string g_value;
+
+static void AppendBulk(std::string& out, const char* data, size_t len)
+{
+    char head[32];
+    int n = snprintf(head, sizeof head, "$%zu\r\n", len);
+    out.append(head, n);
+    out.append(data, len);
+    out.append("\r\n", 2);
+}
+
+static void AppendBulk(std::string& out, const char* str)
+{
+    AppendBulk(out, str, strlen(str));
+}
+
+class Generator
+{
+public:
+    explicit Generator(uint64_t seed) : rng_(seed)
+    {
+    }
+
+    Cmd NextCmd()
+    {
+        const uint64_t r = std::uniform_int_distribution<uint64_t>(0, g_mixTotal - 1)(rng_);
+        for (const auto& m : g_mix)
+        {
+            if (r < m.first)
+                return m.second;
+        }
+
+        return g_mix.back().second;
+    }
+
+    void AppendRequest(Cmd cmd, std::string& out)
+    {
+        static const int kArgs[Cmd_max] = { 1, 2, 3, 2, 3, 2, 3, 4, 3, 4 };
+
+        char head[16];
+        int n = snprintf(head, sizeof head, "*%d\r\n", kArgs[cmd]);
+        out.append(head, n);
+        AppendBulk(out, kCmdNames[cmd]);
+
+        if (cmd == Cmd_ping)
+            return;
+
+        static const char* const kPrefix[Cmd_max] =
+        {
+            "", "key:", "key:", "counter:", "list:", "list:", "set:", "hash:", "hash:", "zset:",
+        };
+
+        char key[64];
+        snprintf(key, sizeof key, "%s%lu", kPrefix[cmd], _NextKey());
+        AppendBulk(out, key);
+
+        char member[32];
+        switch (cmd)
+        {
+        case Cmd_set:
+        case Cmd_lpush:
+            AppendBulk(out, g_value.data(), _NextValueSize());
+            break;
+
+        case Cmd_sadd:
+            snprintf(member, sizeof member, "m:%lu", _NextKey());
+            AppendBulk(out, member);
+            break;
+
+        case Cmd_hset:
+            AppendBulk(out, "field");
+            AppendBulk(out, g_value.data(), _NextValueSize());
+            break;
+
+        case Cmd_hget:
+            AppendBulk(out, "field");
+            break;
+
+        case Cmd_zadd:
+            snprintf(member, sizeof member, "%lu", rng_() % 1000000);
+            AppendBulk(out, member);
+            snprintf(member, sizeof member, "m:%lu", _NextKey());
+            AppendBulk(out, member);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+private:
+    uint64_t _NextKey()
+    {
+        if (g_keyZipf)
+            return Scramble(g_keyZipf->Next(rng_), g_opts.keys);
+
+        return std::uniform_int_distribution<uint64_t>(0, g_opts.keys - 1)(rng_);
+    }
+
+    size_t _NextValueSize()
+    {
+        const size_t range = g_opts.maxValue - g_opts.minValue;
+        if (range == 0)
+            return g_opts.minValue;
+
+        // small values are popular
+        if (g_valueZipf)
+            return g_opts.minValue + g_valueZipf->Next(rng_);
+
+        return g_opts.minValue + std::uniform_int_distribution<size_t>(0, range)(rng_);
+    }
+
+    std::mt19937_64 rng_;
+};
+
+// length of the first complete reply, -1 if not complete yet
+static long ReplyLength(const char* p, const char* end, bool& error)
+{
+    if (p >= end)
+        return -1;
+
+    const char* lf = static_cast<const char*>(memchr(p, '\n', end - p));
+    if (!lf)
+        return -1;
+
+    const long head = lf + 1 - p;
+    switch (*p)
+    {
+    case '+':
+    case ':':
+        return head;
+
+    case '$':
+        {
+            const long n = strtol(p + 1, nullptr, 10);
+            if (n < 0)
+                return head;
+
+            return end - p >= head + n + 2 ? head + n + 2 : -1;
+        }
+
+    case '*':
+        {
+            const long n = strtol(p + 1, nullptr, 10);
+            long total = head;
+            for (long i = 0; i < n; ++ i)
+            {
+                const long sub = ReplyLength(p + total, end, error);
+                if (sub < 0)
+                    return -1;
+
+                total += sub;
+            }
+
+            return total;
+        }
+
+    default:
+        error = true;
+        return head;
+    }
+}
+
+struct Stats
+{
+    QHistogram latency[Cmd_max];
+    uint64_t   errors[Cmd_max] = {};
+    uint64_t   ns[Cmd_max] = {};
+
+    void Merge(const Stats& other)
+    {
+        for (int i = 0; i < Cmd_max; ++ i)
+        {
+            latency[i].Merge(other.latency[i]);
+            errors[i] += other.errors[i];
+            ns[i] += other.ns[i];
+        }
+    }
+};
+
+struct Request
+{
+    uint64_t start; // intended send time in open loop
+    Cmd      cmd;
+};
+
+struct Conn
+{
+    int         fd = INVALID_SOCKET;
+    std::string out;
+    size_t      outPos = 0;
+    bool        wantWrite = false;
+    std::string in;
+    size_t      inPos = 0;
+
+    std::deque<Request> inflight;
+    uint64_t    remaining = 0;
+    uint64_t    next = 0;       // open loop, intended time of the next request
+};
+
+static const uint64_t kUnlimited = ~0ULL;
+
+class Worker
+{
+public:
+    Worker(int id, int conns, int firstConn) :
+        id_(id),
+        conns_(conns),
+        firstConn_(firstConn),
+        gen_(g_opts.seed * 1000 + id),
+        end_(0)
+    {
+    }
+
+    bool Connect(const SocketAddr& addr)
+    {
+        for (auto& conn : conns_)
+        {
+            conn.fd = Socket::CreateTCPSocket();
+            if (::connect(conn.fd, (const sockaddr*)&addr.GetAddr(), sizeof(sockaddr_in)) != 0)
+            {
+                fprintf(stderr, "connect %s:%d failed: %s\n", g_opts.host.c_str(), g_opts.port, strerror(errno));
+                return false;
+            }
+
+            Socket::SetNonBlock(conn.fd);
+            Socket::SetNodelay(conn.fd);
+            poller_.AddSocket(conn.fd, EventTypeRead, &conn);
+        }
+
+        return true;
+    }
+
+    void Start(uint64_t start)
+    {
+        start_ = start;
+
+        const int total = g_opts.conns;
+        const double interval = g_opts.rate > 0 ? 1e9 * total / g_opts.rate : 0;
+        for (size_t i = 0; i < conns_.size(); ++ i)
+        {
+            const int index = firstConn_ + static_cast<int>(i);
+            Conn& conn = conns_[i];
+
+            if (g_opts.duration > 0)
+                conn.remaining = kUnlimited;
+            else
+                conn.remaining = g_opts.requests / total + (static_cast<uint64_t>(index) < g_opts.requests % total ? 1 : 0);
+
+            // spread connections over the interval
+            conn.next = start + static_cast<uint64_t>(interval * index / total);
+        }
+
+        thread_ = std::thread([this, interval]() { _Run(static_cast<uint64_t>(interval)); });
+    }
+
+    void Join()
+    {
+        thread_.join();
+    }
+
+    const Stats& GetStats() const { return stats_; }
+    uint64_t End() const { return end_; }
+
+private:
+    void _Run(uint64_t interval);
+    void _Fill(Conn& conn, uint64_t now, bool stopping, uint64_t interval);
+    void _Flush(Conn& conn);
+    void _Read(Conn& conn);
+
+    int id_;
+    std::vector<Conn> conns_;
+    int firstConn_;
+    Generator gen_;
+    Epoller poller_;
+    std::thread thread_;
+    Stats stats_;
+    uint64_t start_;
+    uint64_t end_; // when the last reply came
+};
+
+void Worker::_Run(uint64_t interval)
+{
+    const uint64_t stopAt = g_opts.duration > 0 ? start_ + static_cast<uint64_t>(g_opts.duration * 1e9) : kUnlimited;
+    const uint64_t kDrainNs = 5 * 1000000000ULL;
+
+    std::vector<FiredEvent> events(conns_.size());
+    while (true)
+    {
+        uint64_t now = QCommandStats::Clock();
+        const bool stopping = now >= stopAt;
+
+        bool done = true;
+        uint64_t wakeup = kUnlimited;
+        for (auto& conn : conns_)
+        {
+            _Fill(conn, now, stopping, interval);
+            _Flush(conn);
+
+            if (!conn.inflight.empty() || (!stopping && conn.remaining > 0))
+                done = false;
+
+            if (interval && !stopping && conn.remaining > 0 && conn.inflight.size() < static_cast<size_t>(g_opts.pipeline))
+                wakeup = std::min(wakeup, conn.next);
+        }
+
+        if (done || (stopping && now > stopAt + kDrainNs))
+            break;
+
+        // open loop sleeps until the next request is due, busy polls below 1ms
+        int timeoutMs = 100;
+        if (wakeup != kUnlimited)
+            timeoutMs = wakeup > now ? static_cast<int>(std::min<uint64_t>((wakeup - now) / 1000000, 100)) : 0;
+
+        const int n = poller_.Poll(events, conns_.size(), timeoutMs);
+        for (int i = 0; i < n; ++ i)
+        {
+            Conn& conn = *static_cast<Conn*>(events[i].userdata);
+            if (events[i].events & EventTypeRead)
+                _Read(conn);
+            if (events[i].events & EventTypeWrite)
+                _Flush(conn);
+            if (events[i].events & EventTypeError)
+            {
+                fprintf(stderr, "connection error\n");
+                exit(-1);
+            }
+        }
+    }
+}
+
+void Worker::_Fill(Conn& conn, uint64_t now, bool stopping, uint64_t interval)
+{
+    while (!stopping &&
+           conn.remaining > 0 &&
+           conn.inflight.size() < static_cast<size_t>(g_opts.pipeline))
+    {
+        Request req;
+        req.start = now;
+        if (interval)
+        {
+            // late requests keep their intended time
+            if (conn.next > now)
+                break;
+
+            req.start = conn.next;
+            conn.next += interval;
+        }
+
+        req.cmd = gen_.NextCmd();
+        gen_.AppendRequest(req.cmd, conn.out);
+        conn.inflight.push_back(req);
+
+        if (conn.remaining != kUnlimited)
+            -- conn.remaining;
+    }
+}
+
+void Worker::_Flush(Conn& conn)
+{
+    while (conn.outPos < conn.out.size())
+    {
+        const ssize_t n = ::write(conn.fd, conn.out.data() + conn.outPos, conn.out.size() - conn.outPos);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                fprintf(stderr, "write failed: %s\n", strerror(errno));
+                exit(-1);
+            }
+
+            if (!conn.wantWrite)
+            {
+                conn.wantWrite = true;
+                poller_.ModSocket(conn.fd, EventTypeRead | EventTypeWrite, &conn);
+            }
+
+            return;
+        }
+
+        conn.outPos += n;
+    }
+
+    conn.out.clear();
+    conn.outPos = 0;
+
+    if (conn.wantWrite)
+    {
+        conn.wantWrite = false;
+        poller_.ModSocket(conn.fd, EventTypeRead, &conn);
+    }
+}
+
+void Worker::_Read(Conn& conn)
+{
+    char buf[64 * 1024];
+    while (true)
+    {
+        const ssize_t n = ::read(conn.fd, buf, sizeof buf);
+        if (n == 0)
+        {
+            fprintf(stderr, "server closed connection\n");
+            exit(-1);
+        }
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            fprintf(stderr, "read failed: %s\n", strerror(errno));
+            exit(-1);
+        }
+
+        conn.in.append(buf, n);
+        if (static_cast<size_t>(n) < sizeof buf)
+            break;
+    }
+
+    const uint64_t now = QCommandStats::Clock();
+    const char* const end = conn.in.data() + conn.in.size();
+    while (!conn.inflight.empty())
+    {
+        bool error = false;
+        const long len = ReplyLength(conn.in.data() + conn.inPos, end, error);
+        if (len < 0)
+            break;
+
+        conn.inPos += len;
+
+        const Request& req = conn.inflight.front();
+        const uint64_t ns = now > req.start ? now - req.start : 0;
+        stats_.latency[req.cmd].Record(ns);
+        stats_.ns[req.cmd] += ns;
+        if (error)
+            ++ stats_.errors[req.cmd];
+
+        conn.inflight.pop_front();
+        end_ = now;
+    }
+
+    if (conn.inPos == conn.in.size())
+    {
+        conn.in.clear();
+        conn.inPos = 0;
+    }
+    else if (conn.inPos > sizeof buf)
+    {
+        conn.in.erase(0, conn.inPos);
+        conn.inPos = 0;
+    }
+}
+
+struct Result
+{
+    std::string name;
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    double   opsPerSec = 0;
+    double   avgUs = 0;
+    double   p50 = 0, p90 = 0, p99 = 0, p999 = 0, p9999 = 0, max = 0;
+};
+
+static Result MakeResult(const std::string& name, const QHistogram& h, uint64_t errors, uint64_t ns, double seconds)
+{
+    Result r;
+    r.name = name;
+    r.requests = h.Count();
+    r.errors = errors;
+    r.opsPerSec = seconds > 0 ? r.requests / seconds : 0;
+    r.avgUs = r.requests ? ns / 1000.0 / r.requests : 0;
+    r.p50 = h.Percentile(50) / 1000.0;
+    r.p90 = h.Percentile(90) / 1000.0;
+    r.p99 = h.Percentile(99) / 1000.0;
+    r.p999 = h.Percentile(99.9) / 1000.0;
+    r.p9999 = h.Percentile(99.99) / 1000.0;
+    r.max = h.Percentile(100) / 1000.0;
+    return r;
+}
+
+static void PrintText(const Result& r, double seconds)
+{
+    printf("====== %s ======\n", r.name.c_str());
+    printf("  %lu requests, %lu errors in %.2f seconds, %.2f requests per second\n",
+           r.requests, r.errors, seconds, r.opsPerSec);
+    printf("  latency usec: avg %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, p99.99 %.1f, max %.1f\n\n",
+           r.avgUs, r.p50, r.p90, r.p99, r.p999, r.p9999, r.max);
+}
+
+static std::string ToCsv(const std::vector<Result>& results)
+{
+    std::ostringstream oss;
+    oss << "command,requests,errors,ops_per_sec,avg_us,p50_us,p90_us,p99_us,p999_us,p9999_us,max_us\n";
+    for (const auto& r : results)
+    {
+        oss << r.name << ',' << r.requests << ',' << r.errors << ',' << r.opsPerSec << ','
+            << r.avgUs << ',' << r.p50 << ',' << r.p90 << ',' << r.p99 << ','
+            << r.p999 << ',' << r.p9999 << ',' << r.max << '\n';
+    }
+
+    return oss.str();
+}
+
+static void JsonFields(std::ostream& os, const Result& r)
+{
+    os << "\"requests\": " << r.requests
+       << ", \"errors\": " << r.errors
+       << ", \"ops_per_sec\": " << r.opsPerSec
+       << ", \"avg_us\": " << r.avgUs
+       << ", \"p50_us\": " << r.p50
+       << ", \"p90_us\": " << r.p90
+       << ", \"p99_us\": " << r.p99
+       << ", \"p999_us\": " << r.p999
+       << ", \"p9999_us\": " << r.p9999
+       << ", \"max_us\": " << r.max;
+}
+
+// results[0] is all commands
+static std::string ToJson(const std::vector<Result>& results, double seconds)
+{
+    std::ostringstream oss;
+    oss << "{\n  \"threads\": " << g_opts.threads
+        << ", \"connections\": " << g_opts.conns
+        << ", \"pipeline\": " << g_opts.pipeline
+        << ", \"rate\": " << g_opts.rate
+        << ", \"keys\": " << g_opts.keys
+        << ", \"mix\": \"" << g_opts.mix << "\""
+        << ", \"seconds\": " << seconds << ",\n  ";
+    JsonFields(oss, results[0]);
+    oss << ",\n  \"commands\": [\n";
+    for (size_t i = 1; i < results.size(); ++ i)
+    {
+        oss << "    {\"name\": \"" << results[i].name << "\", ";
+        JsonFields(oss, results[i]);
+        oss << (i + 1 < results.size() ? "},\n" : "}\n");
+    }
+    oss << "  ]\n}\n";
+
+    return oss.str();
+}
+
+static bool WriteFile(const std::string& file, const std::string& data)
+{
+    std::ofstream ofs(file.c_str(), std::ios::trunc);
+    ofs << data;
+    if (!ofs)
+        fprintf(stderr, "write %s failed\n", file.c_str());
+
+    return static_cast<bool>(ofs);
+}
+
+// top level field of a json written by ToJson, they come before "commands"
+static bool JsonNumber(const std::string& json, const char* field, double& value)
+{
+    const std::string key = std::string("\"") + field + "\":";
+    auto pos = json.find(key);
+    if (pos == std::string::npos)
+        return false;
+
+    value = strtod(json.c_str() + pos + key.size(), nullptr);
+    return true;
+}
+
+// 0 if no regression beyond tolerance
+static int Compare(const Result& cur)
+{
+    std::ifstream ifs(g_opts.compareFile.c_str());
+    std::string json((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    if (json.empty())
+    {
+        fprintf(stderr, "read baseline %s failed\n", g_opts.compareFile.c_str());
+        return -1;
+    }
+
+    struct Item
+    {
+        const char* field;
+        double      value;
+        bool        higherIsBetter;
+    };
+
+    const Item items[] =
+    {
+        { "ops_per_sec", cur.opsPerSec, true },
+        { "p50_us", cur.p50, false },
+        { "p99_us", cur.p99, false },
+        { "p999_us", cur.p999, false },
+    };
+
+    printf("====== compare with %s, tolerance %.1f%% ======\n", g_opts.compareFile.c_str(), g_opts.tolerance);
+
+    int regressions = 0;
+    for (const auto& item : items)
+    {
+        double base = 0;
+        if (!JsonNumber(json, item.field, base) || base <= 0)
+            continue;
+
+        const double change = (item.value - base) / base * 100;
+        const bool worse = item.higherIsBetter ? -change > g_opts.tolerance : change > g_opts.tolerance;
+        if (worse)
+            ++ regressions;
+
+        printf("  %-12s baseline %12.2f  current %12.2f  %+7.2f%%  %s\n",
+               item.field, base, item.value, change, worse ? "REGRESSION" : "ok");
+    }
+
+    return regressions > 0 ? 1 : 0;
+}
+
+static void Usage()
+{
+    printf("Usage: qedis-benchmark [options]\n"
+           "  -h <host>            server host, default 127.0.0.1\n"
+           "  -p <port>            server port, default 6379\n"
+           "  -t <threads>         client threads, default 1\n"
+           "  -c <connections>     total connections, default 50\n"
+           "  -P <pipeline>        requests in flight per connection, default 1\n"
+           "  -n <requests>        total requests, default 100000\n"
+           "  -D <seconds>         run for seconds instead of -n\n"
+           "  -R <rate>            open loop: total requests per second, latency is\n"
+           "                       from the intended send time; -P still limits\n"
+           "                       requests in flight\n"
+           "  -r <keys>            key space size, default 100000\n"
+           "  --key-dist <d>       uniform or zipf, default uniform\n"
+           "  --zipf-theta <t>     zipf skew in (0, 1), default 0.99\n"
+           "  -d <size[-max]>      value size in bytes, or a range, default 64\n"
+           "  --value-dist <d>     uniform or zipf over the range, default uniform\n"
+           "  -m <mix>             weighted commands, default get=1,set=1; commands are\n"
+           "                       ping get set incr lpush rpop sadd hset hget zadd\n"
+           "  --seed <n>           random seed, same seed same requests\n"
+           "  --csv <file>         write csv result\n"
+           "  --json <file>        write json result\n"
+           "  --compare <file>     compare with a json result, exit 1 if ops/sec or\n"
+           "                       p50/p99/p99.9 latency is worse than tolerance\n"
+           "  --tolerance <pct>    default 5\n"
+           "  --help\n");
+}
+
+static bool ParseDist(const char* arg, bool& zipf)
+{
+    if (strcmp(arg, "zipf") == 0)
+        zipf = true;
+    else if (strcmp(arg, "uniform") == 0)
+        zipf = false;
+    else
+        return false;
+
+    return true;
+}
+
+static bool ParseOptions(int ac, char* av[])
+{
+    enum
+    {
+        Opt_keyDist = 256,
+        Opt_theta,
+        Opt_valueDist,
+        Opt_seed,
+        Opt_csv,
+        Opt_json,
+        Opt_compare,
+        Opt_tolerance,
+        Opt_help,
+    };
+
+    static const option longOptions[] =
+    {
+        { "key-dist",   required_argument, nullptr, Opt_keyDist },
+        { "zipf-theta", required_argument, nullptr, Opt_theta },
+        { "value-dist", required_argument, nullptr, Opt_valueDist },
+        { "seed",       required_argument, nullptr, Opt_seed },
+        { "csv",        required_argument, nullptr, Opt_csv },
+        { "json",       required_argument, nullptr, Opt_json },
+        { "compare",    required_argument, nullptr, Opt_compare },
+        { "tolerance",  required_argument, nullptr, Opt_tolerance },
+        { "help",       no_argument,       nullptr, Opt_help },
+        { nullptr,      0,                 nullptr, 0 },
+    };
+
+    int opt;
+    while ((opt = getopt_long(ac, av, "h:p:t:c:P:n:D:R:r:d:m:", longOptions, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 'h': g_opts.host = optarg; break;
+        case 'p': g_opts.port = atoi(optarg); break;
+        case 't': g_opts.threads = atoi(optarg); break;
+        case 'c': g_opts.conns = atoi(optarg); break;
+        case 'P': g_opts.pipeline = atoi(optarg); break;
+        case 'n': g_opts.requests = strtoull(optarg, nullptr, 10); break;
+        case 'D': g_opts.duration = atof(optarg); break;
+        case 'R': g_opts.rate = atof(optarg); break;
+        case 'r': g_opts.keys = strtoull(optarg, nullptr, 10); break;
+        case 'm': g_opts.mix = optarg; break;
+
+        case 'd':
+            {
+                char* end = nullptr;
+                g_opts.minValue = g_opts.maxValue = strtoul(optarg, &end, 10);
+                if (*end == '-')
+                    g_opts.maxValue = strtoul(end + 1, nullptr, 10);
+            }
+            break;
+
+        case Opt_keyDist:
+            if (!ParseDist(optarg, g_opts.keyZipf))
+                return false;
+            break;
+
+        case Opt_valueDist:
+            if (!ParseDist(optarg, g_opts.valueZipf))
+                return false;
+            break;
+
+        case Opt_theta: g_opts.theta = atof(optarg); break;
+        case Opt_seed: g_opts.seed = strtoull(optarg, nullptr, 10); break;
+        case Opt_csv: g_opts.csvFile = optarg; break;
+        case Opt_json: g_opts.jsonFile = optarg; break;
+        case Opt_compare: g_opts.compareFile = optarg; break;
+        case Opt_tolerance: g_opts.tolerance = atof(optarg); break;
+
+        default:
+            return false;
+        }
+    }
+
+    if (g_opts.threads <= 0 || g_opts.conns <= 0 || g_opts.pipeline <= 0 ||
+        g_opts.keys == 0 || g_opts.maxValue < g_opts.minValue ||
+        g_opts.theta <= 0 || g_opts.theta >= 1 ||
+        (g_opts.duration <= 0 && g_opts.requests == 0))
+        return false;
+
+    if (g_opts.threads > g_opts.conns)
+        g_opts.threads = g_opts.conns;
+
+    return ParseMix(g_opts.mix);
+}
+
+int main(int ac, char* av[])
+{
+    if (!ParseOptions(ac, av))
+    {
+        Usage();
+        return -1;
+    }
+
+    if (g_opts.keyZipf)
+        g_keyZipf.reset(new Zipf(g_opts.keys, g_opts.theta));
+    if (g_opts.valueZipf && g_opts.maxValue > g_opts.minValue)
+        g_valueZipf.reset(new Zipf(g_opts.maxValue - g_opts.minValue + 1, g_opts.theta));
+    g_value.assign(g_opts.maxValue, 'x');
+
+    printf("qedis-benchmark %s:%d, %d threads, %d connections, pipeline %d, %s\n",
+           g_opts.host.c_str(), g_opts.port, g_opts.threads, g_opts.conns, g_opts.pipeline,
+           g_opts.rate > 0 ? ("open loop " + std::to_string(static_cast<long>(g_opts.rate)) + " requests/s").c_str() : "closed loop");
+    printf("keys %lu %s, value %zu-%zu bytes %s, mix %s\n\n",
+           g_opts.keys, g_opts.keyZipf ? "zipf" : "uniform",
+           g_opts.minValue, g_opts.maxValue, g_opts.valueZipf ? "zipf" : "uniform",
+           g_opts.mix.c_str());
+
+    const SocketAddr addr(g_opts.host.c_str(), static_cast<uint16_t>(g_opts.port));
+
+    std::vector<std::unique_ptr<Worker> > workers;
+    int first = 0;
+    for (int i = 0; i < g_opts.threads; ++ i)
+    {
+        const int conns = g_opts.conns / g_opts.threads + (i < g_opts.conns % g_opts.threads ? 1 : 0);
+        std::unique_ptr<Worker> worker(new Worker(i, conns, first));
+        if (!worker->Connect(addr))
+            return -1;
+
+        first += conns;
+        workers.push_back(std::move(worker));
+    }
+
+    const uint64_t start = QCommandStats::Clock();
+    for (auto& worker : workers)
+        worker->Start(start);
+
+    Stats stats;
+    uint64_t end = start;
+    for (auto& worker : workers)
+    {
+        worker->Join();
+        stats.Merge(worker->GetStats());
+        end = std::max(end, worker->End());
+    }
+
+    const double seconds = (end - start) / 1e9;
+
+    QHistogram all;
+    uint64_t errors = 0, ns = 0;
+    for (int i = 0; i < Cmd_max; ++ i)
+    {
+        all.Merge(stats.latency[i]);
+        errors += stats.errors[i];
+        ns += stats.ns[i];
+    }
+
+    std::vector<Result> results;
+    results.push_back(MakeResult("all", all, errors, ns, seconds));
+    for (int i = 0; i < Cmd_max; ++ i)
+    {
+        if (stats.latency[i].Count() > 0)
+            results.push_back(MakeResult(kCmdNames[i], stats.latency[i], stats.errors[i], stats.ns[i], seconds));
+    }
+
+    for (const auto& r : results)
+        PrintText(r, seconds);
+
+    if (!g_opts.csvFile.empty() && !WriteFile(g_opts.csvFile, ToCsv(results)))
+        return -1;
+    if (!g_opts.jsonFile.empty() && !WriteFile(g_opts.jsonFile, ToJson(results, seconds)))
+        return -1;
+
+    if (!g_opts.compareFile.empty())
+        return Compare(results[0]);
+
+    return 0;
+}
+
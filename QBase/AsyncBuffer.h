@@ -20,6 +20,9 @@ public:
     void        ProcessBuffer(BufferSequence& data);
     void        Skip(std::size_t  size);
 
+    // bytes written but not processed yet, except the back buffer being processed
+    std::size_t PendingBytes() const { return buffer_.ReadableSize() + backBytes_; }
+
 private:
     // for async write
     Buffer          buffer_;
@@ -6,11 +6,20 @@
 #include "StreamSocket.h"
 #include "Server.h"
 #include "NetThreadPool.h"
+#include "Timer.h"
 #include "Log/Logger.h"
 
 using std::size_t;
 
-StreamSocket::StreamSocket()
+// one recv thread and one send thread add
+static std::atomic<uint64_t> s_recvBytes(0);
+static std::atomic<uint64_t> s_sentBytes(0);
+
+StreamSocket::StreamSocket() :
+    recvTime_(0),
+    queuedBytes_(0),
+    sentBytes_(0),
+    hasSentWatchers_(false)
 {
 }
 
@@ -62,7 +71,11 @@ int StreamSocket::Recv()
         return 0;
 
     if (ret > 0)
+    {
         recvBuf_.AdjustWritePtr(ret);
+        recvTime_ = ::NowUs();
+        s_recvBytes.fetch_add(ret, std::memory_order_relaxed);
+    }
 
     return (0 == ret) ? EOFSOCKET : ret;
 }
@@ -96,7 +109,10 @@ int StreamSocket::_Send(const BufferSequence& bf)
 bool StreamSocket::SendPacket(const void* data, size_t bytes)
 {
     if (data && bytes > 0)
+    {
         sendBuf_.Write(data, bytes);
+        queuedBytes_ += bytes;
+    }
 
     return true;
 }
@@ -150,6 +166,7 @@ bool StreamSocket::Send()
     if (nSent > 0)
     {
         sendBuf_.Skip(nSent);
+        _NotifySent(nSent);
     }
         
     if (epollOut_)
@@ -177,7 +194,10 @@ bool StreamSocket::OnWritable()
     {
         nSent = _Send(bf);
         if (nSent > 0)
+        {
             sendBuf_.Skip(nSent);
+            _NotifySent(nSent);
+        }
     }
     else
     {
@@ -197,6 +217,42 @@ bool StreamSocket::OnWritable()
     return  nSent >= 0;
 }
 
+void StreamSocket::OnSent(uint64_t bytes, const std::function<void (uint64_t )>& cb)
+{
+    std::lock_guard<std::mutex> guard(sentMutex_);
+    sentWatchers_.push_back(std::make_pair(bytes, cb));
+    hasSentWatchers_ = true;
+}
+
+uint64_t StreamSocket::TotalRecvBytes()
+{
+    return s_recvBytes.load(std::memory_order_relaxed);
+}
+
+uint64_t StreamSocket::TotalSentBytes()
+{
+    return s_sentBytes.load(std::memory_order_relaxed);
+}
+
+void StreamSocket::_NotifySent(std::size_t bytes)
+{
+    s_sentBytes.fetch_add(bytes, std::memory_order_relaxed);
+    sentBytes_ += bytes;
+    if (!hasSentWatchers_)
+        return;
+
+    const uint64_t now = ::NowUs();
+
+    std::lock_guard<std::mutex> guard(sentMutex_);
+    while (!sentWatchers_.empty() && sentWatchers_.front().first <= sentBytes_)
+    {
+        sentWatchers_.front().second(now);
+        sentWatchers_.pop_front();
+    }
+
+    hasSentWatchers_ = !sentWatchers_.empty();
+}
+
 bool StreamSocket::OnError()
 {
     if (Socket::OnError())
@@ -6,6 +6,10 @@
 #include "Socket.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
 
 using PacketLength = int32_t;
 
@@ -45,6 +49,18 @@ public:
     
     const SocketAddr& GetPeerAddr() const { return peerAddr_; }
 
+    // request tracing, times are NowUs()
+    // when recv thread last read data
+    uint64_t RecvTime() const { return recvTime_; }
+    // bytes ever passed to SendPacket
+    uint64_t QueuedBytes() const { return queuedBytes_; }
+    // send thread calls cb(time) once the first bytes are written
+    void  OnSent(uint64_t bytes, const std::function<void (uint64_t )>& cb);
+
+    // bytes read and written by all stream sockets
+    static uint64_t TotalRecvBytes();
+    static uint64_t TotalSentBytes();
+
 protected:
     SocketAddr  peerAddr_;
 
@@ -52,6 +68,7 @@ private:
     std::function<void ()> onDisconnect_;
 
     int    _Send(const BufferSequence& bf);
+    void   _NotifySent(std::size_t bytes);
     virtual PacketLength _HandlePacket(const char* msg, std::size_t len) = 0;
 
     // For human readability
@@ -64,6 +81,14 @@ private:
 
     Buffer recvBuf_;
     AsyncBuffer sendBuf_;
+
+    std::atomic<uint64_t> recvTime_;
+    uint64_t queuedBytes_;  // main thread
+    uint64_t sentBytes_;    // send thread
+
+    std::atomic<bool> hasSentWatchers_;
+    std::mutex sentMutex_;
+    std::deque<std::pair<uint64_t, std::function<void (uint64_t )> > > sentWatchers_;
 };
 
 template <int N>
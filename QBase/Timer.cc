@@ -11,6 +11,13 @@ uint64_t Now()
     return  uint64_t(now.tv_sec * 1000UL + now.tv_usec / 1000UL);
 }
 
+uint64_t NowUs()
+{
+    struct timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    return  uint64_t(now.tv_sec * 1000000UL + now.tv_nsec / 1000UL);
+}
+
 static bool  IsLeapYear(int year)
 {
     return  (year % 400 == 0 ||
@@ -12,6 +12,7 @@
 #include <atomic>
 
 uint64_t Now();
+uint64_t NowUs(); // monotonic microseconds, for durations
 
 class Time
 {
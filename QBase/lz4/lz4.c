@@ -0,0 +1,224 @@
+#include <stdint.h>
+#include <string.h>
+#include "lz4.h"
+
+#define LZ4_HASHLOG   12
+#define LZ4_MINMATCH  4
+#define LZ4_MAXOFFSET 65535
+/* the last match must start 12 bytes before the end, the last 5 bytes are
+ * always literals, as required by the block format */
+#define LZ4_MFLIMIT   12
+#define LZ4_LASTLITERALS 5
+
+static inline uint32_t
+lz4_read32 (const uint8_t *p)
+{
+  uint32_t v;
+  memcpy (&v, p, sizeof v);
+  return v;
+}
+
+static inline uint32_t
+lz4_hash (uint32_t seq)
+{
+  return (seq * 2654435761U) >> (32 - LZ4_HASHLOG);
+}
+
+/* length extension bytes: 255, 255, ..., rest */
+static inline uint8_t *
+lz4_write_length (uint8_t *op, unsigned int len)
+{
+  while (len >= 255)
+    {
+      *op++ = 255;
+      len -= 255;
+    }
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+static uint8_t *
+lz4_write_sequence (uint8_t *op, uint8_t *oend,
+                    const uint8_t *literals, unsigned int litlen,
+                    unsigned int offset, unsigned int matchlen, int last)
+{
+  /* worst case size: token, literal length ext, literals, offset, match ext */
+  if ((uint64_t)(oend - op) < 1 + litlen / 255 + 1 + litlen + 2 + matchlen / 255 + 1)
+    return 0;
+
+  uint8_t *token = op++;
+  if (litlen >= 15)
+    {
+      *token = 15 << 4;
+      op = lz4_write_length (op, litlen - 15);
+    }
+  else
+    *token = (uint8_t)(litlen << 4);
+
+  memcpy (op, literals, litlen);
+  op += litlen;
+
+  if (last)
+    return op;
+
+  *op++ = (uint8_t)offset;
+  *op++ = (uint8_t)(offset >> 8);
+
+  matchlen -= LZ4_MINMATCH;
+  if (matchlen >= 15)
+    {
+      *token |= 15;
+      op = lz4_write_length (op, matchlen - 15);
+    }
+  else
+    *token |= (uint8_t)matchlen;
+
+  return op;
+}
+
+unsigned int
+lz4_compress (const void *const in_data, unsigned int in_len,
+              void *out_data, unsigned int out_len)
+{
+  const uint8_t *const in = (const uint8_t *)in_data;
+  const uint8_t *const iend = in + in_len;
+  const uint8_t *ip = in;
+  const uint8_t *anchor = in;
+  uint8_t *op = (uint8_t *)out_data;
+  uint8_t *const oend = op + out_len;
+  uint32_t htab[1 << LZ4_HASHLOG];
+
+  if (in_len > LZ4_MFLIMIT)
+    {
+      const uint8_t *const mflimit = iend - LZ4_MFLIMIT;
+      const uint8_t *const matchlimit = iend - LZ4_LASTLITERALS;
+
+      memset (htab, 0, sizeof htab);
+
+      while (ip < mflimit)
+        {
+          const uint32_t seq = lz4_read32 (ip);
+          const uint32_t h = lz4_hash (seq);
+          const uint8_t *ref = in + htab[h];
+          htab[h] = (uint32_t)(ip - in);
+
+          if (ref >= ip || ip - ref > LZ4_MAXOFFSET || lz4_read32 (ref) != seq)
+            {
+              /* skip faster over incompressible data */
+              ip += 1 + ((ip - anchor) >> 6);
+              continue;
+            }
+
+          while (ip > anchor && ref > in && ip[-1] == ref[-1])
+            {
+              --ip;
+              --ref;
+            }
+
+          const uint8_t *mp = ip + LZ4_MINMATCH;
+          const uint8_t *rp = ref + LZ4_MINMATCH;
+          while (mp < matchlimit && *mp == *rp)
+            {
+              ++mp;
+              ++rp;
+            }
+
+          op = lz4_write_sequence (op, oend, anchor, (unsigned int)(ip - anchor),
+                                   (unsigned int)(ip - ref), (unsigned int)(mp - ip), 0);
+          if (!op)
+            return 0;
+
+          ip = anchor = mp;
+          if (ip - 2 > in && ip < mflimit)
+            htab[lz4_hash (lz4_read32 (ip - 2))] = (uint32_t)(ip - 2 - in);
+        }
+    }
+
+  op = lz4_write_sequence (op, oend, anchor, (unsigned int)(iend - anchor), 0, 0, 1);
+  if (!op)
+    return 0;
+
+  return (unsigned int)(op - (uint8_t *)out_data);
+}
+
+unsigned int
+lz4_decompress (const void *const in_data, unsigned int in_len,
+                void *out_data, unsigned int out_len)
+{
+  const uint8_t *ip = (const uint8_t *)in_data;
+  const uint8_t *const iend = ip + in_len;
+  uint8_t *const out = (uint8_t *)out_data;
+  uint8_t *op = out;
+  uint8_t *const oend = out + out_len;
+
+  while (ip < iend)
+    {
+      const unsigned int token = *ip++;
+      size_t len = token >> 4;
+
+      if (len == 15)
+        {
+          unsigned int b;
+          do
+            {
+              if (ip >= iend)
+                return 0;
+              b = *ip++;
+              len += b;
+            }
+          while (b == 255);
+        }
+
+      if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+        return 0;
+
+      memcpy (op, ip, len);
+      op += len;
+      ip += len;
+
+      if (ip == iend)
+        break;
+
+      if (iend - ip < 2)
+        return 0;
+
+      const size_t offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > (size_t)(op - out))
+        return 0;
+
+      len = token & 15;
+      if (len == 15)
+        {
+          unsigned int b;
+          do
+            {
+              if (ip >= iend)
+                return 0;
+              b = *ip++;
+              len += b;
+            }
+          while (b == 255);
+        }
+      len += LZ4_MINMATCH;
+
+      if (len > (size_t)(oend - op))
+        return 0;
+
+      const uint8_t *ref = op - offset;
+      if (offset >= len)
+        {
+          memcpy (op, ref, len);
+          op += len;
+        }
+      else
+        {
+          /* overlapped, a run of the last offset bytes */
+          while (len--)
+            *op++ = *ref++;
+        }
+    }
+
+  return (unsigned int)(op - out);
+}
+
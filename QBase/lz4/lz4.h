@@ -0,0 +1,39 @@
+#ifndef BERT_LZ4_H
+#define BERT_LZ4_H
+
+/*
+ * A small compressor producing the LZ4 block format: sequences of
+ * | token | literal length ext | literals | offset 2bytes LE | match length ext |
+ * Greedy parsing with a 4-byte hash table and a 64KB window. It favors speed
+ * of decompression over ratio, decoding is mostly memcpy.
+ * The api mirrors lzf.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compress in_len bytes from in_data to out_data, up to out_len bytes.
+ * Return the compressed length, or 0 if out_len is not enough.
+ * Pass out_len < in_len to ensure some compression.
+ */
+unsigned int
+lz4_compress (const void *const in_data,  unsigned int in_len,
+              void             *out_data, unsigned int out_len);
+
+/*
+ * Decompress in_len bytes to out_data, up to out_len bytes.
+ * Return the decompressed length, or 0 if data is corrupted or out_len is
+ * not enough.
+ */
+unsigned int
+lz4_decompress (const void *const in_data,  unsigned int in_len,
+                void             *out_data, unsigned int out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
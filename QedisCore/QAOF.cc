@@ -5,7 +5,14 @@
 #include "QStore.h"
 #include "QConfig.h"
 #include "QProtoParser.h"
+#include "QLazyLoader.h"
+#include "QLatencyMonitor.h"
 #include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <thread>
 #include <sstream>
 
 namespace qedis
@@ -15,6 +22,10 @@ const char* const g_aofTmp = "qedis_appendonly.aof.tmp";
 
 pid_t             g_rewritePid = -1;
 
+static bool IsMultiPart()
+{
+    return g_config.appendonly && g_config.appendmultipart;
+}
 
 /*****************************************************
  * when after fork(), the parent stop aof thread, which means
@@ -25,6 +36,16 @@ void QAOFThreadController::RewriteDoneHandler(int exitRet, int whatSignal)
 {
     g_rewritePid = -1;
 
+    if (IsMultiPart())
+    {
+        // aof thread never stopped, new writes are already in the new incr segment
+        if (exitRet != 0 || whatSignal != 0)
+            ERR << "save aof failed with exit result " << exitRet << ", signal " << whatSignal;
+
+        QAOFThreadController::Instance()._OnMultiPartRewriteDone(exitRet == 0 && whatSignal == 0);
+        return;
+    }
+
     if (exitRet == 0 && whatSignal == 0)
     {
         INF << "save aof success";
@@ -63,8 +84,11 @@ void QAOFThreadController::Start()
     DBG << "start aof thread";
     
     assert(!aofThread_ || !aofThread_->IsAlive());
+
+    if (IsMultiPart())
+        _InitManifest();
     
-    aofThread_ = std::make_shared<AOFThread>();
+    aofThread_ = std::make_shared<AOFThread>(_CurrentFile());
     aofThread_->SetAlive();
     
     ThreadPool::Instance().ExecuteTask(std::bind(&AOFThread::Run, aofThread_));
@@ -95,6 +119,130 @@ void QAOFThreadController::_WriteSelectDB(int db, AsyncBuffer& dst)
     WriteBulkLong(db, dst);
 }
 
+QString QAOFThreadController::_CurrentFile() const
+{
+    if (manifestLoaded_ && !manifest_.Incrs().empty())
+        return manifest_.Incrs().back();
+
+    return g_config.appendfilename;
+}
+
+bool QAOFThreadController::_InitManifest()
+{
+    if (manifestLoaded_)
+        return true;
+
+    if (!manifest_.Load(QAOFManifest::Name()))
+    {
+        if (manifest_.IsDamaged())
+        {
+            ERR << "aof manifest " << QAOFManifest::Name() << " is damaged, not overwrite it";
+            return false;
+        }
+
+        // upgrade from single file aof: the old file becomes the base
+        if (::access(g_config.appendfilename.c_str(), F_OK) == 0)
+        {
+            QString base = manifest_.NewBase();
+            if (::rename(g_config.appendfilename.c_str(), base.c_str()) != 0)
+            {
+                ERR << "rename " << g_config.appendfilename << " to " << base << " failed, errno " << errno;
+                return false;
+            }
+
+            manifest_.SetBase(base);
+        }
+    }
+
+    if (manifest_.Incrs().empty())
+        manifest_.NewIncr();
+
+    if (!manifest_.Save(QAOFManifest::Name()))
+        return false;
+
+    manifestLoaded_ = true;
+    return true;
+}
+
+bool QAOFThreadController::RotateSegment()
+{
+    if (!_InitManifest())
+        return false;
+
+    Stop();
+
+    QString incr = manifest_.NewIncr();
+    if (!manifest_.Save(QAOFManifest::Name()))
+    {
+        ERR << "save aof manifest failed when rotate to " << incr;
+        Start();
+        return false;
+    }
+
+    // the rewrite child covers all segments except the new one
+    rewriteIncrs_ = manifest_.Incrs().size() - 1;
+    lastDb_ = -1; // new segment must begin with select
+
+    INF << "aof rotate to new segment " << incr;
+    Start();
+    return true;
+}
+
+void QAOFThreadController::_OnMultiPartRewriteDone(bool succ)
+{
+    if (!succ)
+    {
+        ::unlink(g_aofTmp);
+        return;
+    }
+
+    QString base = manifest_.NewBase();
+    if (::rename(g_aofTmp, base.c_str()) != 0)
+    {
+        ERR << "rename new aof base " << base << " failed, errno " << errno;
+        ::unlink(g_aofTmp);
+        return;
+    }
+
+    QString oldBase = manifest_.Base();
+    manifest_.SetBase(base);
+    auto oldIncrs = manifest_.EraseIncrs(rewriteIncrs_);
+    rewriteIncrs_ = 0;
+
+    if (!manifest_.Save(QAOFManifest::Name()))
+    {
+        ERR << "save aof manifest failed, keep old segments";
+        return;
+    }
+
+    INF << "save aof success, new base " << base;
+
+    // old files are garbage only after the manifest landed
+    if (!oldBase.empty())
+        ::unlink(oldBase.c_str());
+    for (const auto& f : oldIncrs)
+        ::unlink(f.c_str());
+}
+
+std::size_t QAOFThreadController::PendingBytes() const
+{
+    std::size_t bytes = aofBuffer_.PendingBytes();
+    if (aofThread_)
+        bytes += aofThread_->buf_.PendingBytes();
+
+    return bytes;
+}
+
+uint64_t QAOFThreadController::LagMs() const
+{
+    if (!aofThread_ || PendingBytes() == 0)
+        return 0;
+
+    const uint64_t caughtUp = aofThread_->caughtUp_;
+    const uint64_t now = ::Now();
+    return caughtUp && caughtUp < now ? now - caughtUp : 0;
+}
+
 void QAOFThreadController::SaveCommand(const std::vector<QString>& params, int db)
 {
     AsyncBuffer* dst;
@@ -121,7 +269,7 @@ bool QAOFThreadController::AOFThread::Flush()
         return false;
     
     if (!file_.IsOpen())
-        file_.Open(g_config.appendfilename.c_str());
+        file_.Open(fileName_.c_str());
     
     for (size_t i = 0; i < data.count; ++ i)
     {
@@ -148,7 +296,7 @@ void QAOFThreadController::AOFThread::Run()
     while (QAOFThreadController::Instance().ProcessTmpBuffer(data))
     {
         if (!file_.IsOpen())
-            file_.Open(g_config.appendfilename.c_str());
+            file_.Open(fileName_.c_str());
         
         for (size_t i = 0; i < data.count; ++ i)
         {
@@ -162,10 +310,21 @@ void QAOFThreadController::AOFThread::Run()
     {
         //sync incrementally, always, the redis sync policy is useless
         if (Flush())
+        {
+            const uint64_t start = ::NowUs();
             file_.Sync();
+            QLatencyMonitor::Instance().AddSampleIfNeeded("aof-fsync", ::NowUs() - start);
+        }
         else
+        {
+            caughtUp_ = ::Now();
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
     }
+
+    // drain what main thread wrote before stop
+    while (Flush())
+        ;
     
     file_.Close();
     pro_.set_value();
@@ -179,14 +338,126 @@ void QAOFThreadController::Join()
 
 static void SaveExpire(const QString& key, uint64_t absMs, OutputMemoryFile& file)
 {
-    WriteBulkLong(3, file);
-    WriteBulkString("expire", 6, file);
+    WriteMultiBulkLong(3, file);
+    WriteBulkString("pexpireat", 9, file);
     WriteBulkString(key, file);
     WriteBulkLong(absMs, file);
 }
 
-// child  save the db to tmp file
+static void SaveSelectDB(int dbno, OutputMemoryFile& file)
+{
+    WriteMultiBulkLong(2, file);
+    WriteBulkString("select", 6, file);
+    WriteBulkLong(dbno, file);
+}
+
+// keys of a range rewritten by one thread, at least
+static const size_t kKeysPerSegment = 64 * 1024;
+
 static void SaveObject(const QString& key, const QObject& obj, OutputMemoryFile& file);
+
+// threads rewrite ranges to segment files, then join them; false if failed
+static bool RewriteParallel(const std::vector<QStore::BucketRange>& ranges, OutputMemoryFile& file)
+{
+    std::vector<QString> files(ranges.size());
+    for (size_t i = 0; i < ranges.size(); ++ i)
+    {
+        char name[64];
+        snprintf(name, sizeof name, "tmp_aof_seg_%d_%zu", getpid(), i);
+        files[i] = name;
+        ::unlink(name);
+    }
+
+    std::vector<size_t> sizes(ranges.size(), 0);
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    const uint64_t now = ::Now();
+
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next ++) < ranges.size() && !failed)
+        {
+            const auto& range = ranges[i];
+
+            OutputMemoryFile seg;
+            if (!seg.Open(files[i].c_str(), false))
+            {
+                failed = true;
+                break;
+            }
+
+            const QDB& db = QSTORE.GetDb(range.dbno);
+            for (size_t bucket = range.begin; bucket < range.end; ++ bucket)
+            {
+                for (auto it = db.begin(bucket); it != db.end(bucket); ++ it)
+                {
+                    const uint64_t expireAt = QSTORE.ExpireAt(range.dbno, it->first);
+                    if (expireAt != 0 && expireAt <= now)
+                        continue;
+
+                    SaveObject(it->first, it->second, seg);
+                    if (expireAt != 0)
+                        SaveExpire(it->first, expireAt, seg);
+                }
+            }
+
+            sizes[i] = seg.Offset();
+        }
+    };
+
+    // not ThreadPool: in fork child, only the forking thread exists
+    const size_t threads = std::min<size_t>(g_config.savethreads, ranges.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; ++ i)
+        workers.emplace_back(worker);
+
+    for (auto& t : workers)
+        t.join();
+
+    // map all before writing any, so a failure leaves file for the serial
+    // rewrite; a range may have no key, its segment is empty
+    std::vector<std::unique_ptr<InputMemoryFile> > maps(ranges.size());
+    for (size_t i = 0; i < ranges.size() && !failed; ++ i)
+    {
+        if (sizes[i] == 0)
+            continue;
+
+        maps[i].reset(new InputMemoryFile);
+        size_t len = sizes[i];
+        if (!maps[i]->Open(files[i].c_str()) || !maps[i]->Read(len) || len != sizes[i])
+        {
+            ERR << "read aof segment " << files[i] << " failed, expect bytes " << sizes[i];
+            failed = true;
+        }
+    }
+
+    if (!failed)
+    {
+        int dbno = -1;
+        for (size_t i = 0; i < ranges.size(); ++ i)
+        {
+            if (ranges[i].dbno != dbno)
+            {
+                dbno = ranges[i].dbno;
+                SaveSelectDB(dbno, file);
+            }
+
+            if (maps[i])
+            {
+                size_t len = sizes[i];
+                file.Write(maps[i]->Read(len), len);
+                maps[i].reset();
+            }
+        }
+    }
+
+    for (const auto& name : files)
+        ::unlink(name.c_str());
+
+    return !failed;
+}
+
+// child  save the db to tmp file
 static void RewriteProcess()
 {
     OutputMemoryFile  file;
@@ -196,6 +467,16 @@ static void RewriteProcess()
         _exit(-1);
     }
 
+    // ranges walk buckets, keys left in lazily loaded rdb first
+    QLazyLoader::Instance().LoadAll(-1);
+
+    if (g_config.savethreads > 1)
+    {
+        auto ranges = QSTORE.SplitBuckets(g_config.savethreads * 4, kKeysPerSegment);
+        if (ranges.size() > 1 && RewriteParallel(ranges, file))
+            return;
+    }
+
     for (int dbno = 0; true; ++ dbno)
     {
         if (QSTORE.SelectDB(dbno) == -1)
@@ -204,10 +485,7 @@ static void RewriteProcess()
         if (QSTORE.DBSize() == 0)
             continue;
 
-        // select db
-        WriteMultiBulkLong(2, file);
-        WriteBulkString("select", 6, file);
-        WriteBulkLong(dbno, file);
+        SaveSelectDB(dbno, file);
 
         const auto now = ::Now();
         for (const auto& kv : QSTORE)
@@ -233,6 +511,7 @@ QError bgrewriteaof(const std::vector<QString>& , UnboundedBuffer* reply)
     }
     else
     {
+        const uint64_t forkStart = ::NowUs();
         g_rewritePid = fork();
         switch (g_rewritePid)
         {
@@ -247,11 +526,16 @@ QError bgrewriteaof(const std::vector<QString>& , UnboundedBuffer* reply)
                 return QError_ok;
                 
             default:
+                QLatencyMonitor::Instance().OnFork(::NowUs() - forkStart);
                 break;
         }
     }
     
-    QAOFThreadController::Instance().Stop();
+    if (IsMultiPart())
+        QAOFThreadController::Instance().RotateSegment();
+    else
+        QAOFThreadController::Instance().Stop();
+
     FormatOK(reply);
     return QError_ok;
 }
@@ -370,7 +654,44 @@ static void SaveObject(const QString& key, const QObject& obj, OutputMemoryFile&
 }
 
 
-QAOFLoader::QAOFLoader()
+QString QAOFManifest::Name()
+{
+    return g_config.appendfilename + ".manifest";
+}
+
+QString QAOFManifest::NewBase()
+{
+    return g_config.appendfilename + "." + std::to_string(NextSeq()) + ".base.aof";
+}
+
+QString QAOFManifest::NewIncr()
+{
+    Parts().push_back(g_config.appendfilename + "." + std::to_string(NextSeq()) + ".incr.aof");
+    return Parts().back();
+}
+
+std::vector<QString> QAOFManifest::EraseIncrs(size_t n)
+{
+    auto& incrs = Parts();
+    n = std::min(n, incrs.size());
+
+    std::vector<QString> erased(incrs.begin(), incrs.begin() + n);
+    incrs.erase(incrs.begin(), incrs.begin() + n);
+    return erased;
+}
+
+std::vector<QString> QAOFManifest::Files() const
+{
+    std::vector<QString> files;
+    if (!Base().empty())
+        files.push_back(Base());
+
+    files.insert(files.end(), Parts().begin(), Parts().end());
+    return files;
+}
+
+
+QAOFLoader::QAOFLoader() : truncated_(false)
 {
 }
 
@@ -385,6 +706,11 @@ bool QAOFLoader::Load(const char* name)
         file.Open(name);
         file.TruncateTailZero();
     }
+
+    // a segment without data, it can not be mapped
+    struct stat st;
+    if (::stat(name, &st) == 0 && st.st_size == 0)
+        return true;
     
     // load file to memory
     InputMemoryFile file;
@@ -393,9 +719,10 @@ bool QAOFLoader::Load(const char* name)
 
     size_t maxLen = std::numeric_limits<size_t>::max();
     const char* content = file.Read(maxLen);
-    
-    if (maxLen == 0)
-        return false;
+
+    // a segment without data is left as one zero byte
+    while (maxLen > 0 && content[maxLen - 1] == '\0')
+        -- maxLen;
 
     QProtoParser parser;
     // extract commands from file content
@@ -405,7 +732,8 @@ bool QAOFLoader::Load(const char* name)
         parser.Reset();
         if (QParseResult::ok != parser.ParseRequest(content, end))
         {
-            ERR << "Load aof failed";
+            ERR << "Load aof " << name << " failed after " << cmds_.size() << " commands";
+            truncated_ = true;
             return false;
         }
 
@@ -7,12 +7,32 @@
 #include "AsyncBuffer.h"
 #include "QString.h"
 #include "QStore.h"
+#include "QManifest.h"
 
 namespace qedis
 {
 
 extern pid_t g_rewritePid;
 
+// multi part aof: one base file(snapshot) plus numbered incremental segments,
+// the manifest records which files are alive and in which order to load them.
+class  QAOFManifest : public QManifest
+{
+public:
+    QAOFManifest() : QManifest("incr") {}
+
+    static QString  Name();
+
+    QString  NewBase();
+    QString  NewIncr();
+
+    const std::vector<QString>& Incrs() const { return Parts(); }
+    std::vector<QString>  EraseIncrs(size_t n);
+
+    // base first, then incrs in order
+    std::vector<QString>  Files() const;
+};
+
 class  QAOFThreadController
 {
 public:
@@ -28,17 +48,26 @@ public:
     void  SaveCommand(const std::vector<QString>& params, int db);
     bool  ProcessTmpBuffer(BufferSequence& bf);
     void  SkipTmpBuffer(size_t  n);
+
+    // multi part: switch new writes to a new incr segment
+    bool  RotateSegment();
+
+    // bytes of commands not written to aof file yet
+    std::size_t PendingBytes() const;
+    // ms since aof thread last caught up, 0 if nothing pending
+    uint64_t    LagMs() const;
     
     static void  RewriteDoneHandler(int exit, int signal);
     
 private:
-    QAOFThreadController() : lastDb_(-1) {}
+    QAOFThreadController() : lastDb_(-1), manifestLoaded_(false), rewriteIncrs_(0) {}
 
     class AOFThread
     {
         friend class QAOFThreadController;
     public:
-        AOFThread() : alive_(false) { }
+        explicit
+        AOFThread(const QString& file) : alive_(false), fileName_(file), caughtUp_(0) { }
         ~AOFThread();
         
         void  SetAlive()      {  alive_ = true; }
@@ -54,17 +83,27 @@ private:
         
         std::atomic<bool>   alive_;
 
+        QString             fileName_;
         OutputMemoryFile    file_;
         AsyncBuffer         buf_;
+        std::atomic<uint64_t> caughtUp_; // when buf_ was last drained
         
         std::promise<void>  pro_; // Effective modern C++ : Item 39
     };
     
     void _WriteSelectDB(int db, AsyncBuffer& dst);
+    bool _InitManifest();
+    QString _CurrentFile() const;
+    void _OnMultiPartRewriteDone(bool succ);
     
     std::shared_ptr<AOFThread>  aofThread_;
     AsyncBuffer                 aofBuffer_;
     int                         lastDb_;
+
+    // multi part aof
+    QAOFManifest                manifest_;
+    bool                        manifestLoaded_;
+    size_t                      rewriteIncrs_; // incrs covered by the running rewrite
 };
 
 
@@ -73,7 +112,10 @@ class  QAOFLoader
 public:
     QAOFLoader();
     
+    // false if the file is missing or has a broken tail, commands before
+    // the broken tail are kept; an empty file has no commands
     bool  Load(const char* name);
+    bool  IsTruncated() const { return truncated_; }
 
     const std::vector<std::vector<QString> >& GetCmds() const
     {
@@ -82,6 +124,7 @@ public:
 
 private:
     std::vector<std::vector<QString> > cmds_;
+    bool truncated_;
 };
 
 template <typename DEST>
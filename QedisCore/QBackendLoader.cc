@@ -0,0 +1,406 @@
+
+#include <cassert>
+#include <chrono>
+#include "QBackendLoader.h"
+#include "QBackendWriter.h"
+#include "QStore.h"
+#include "QClient.h"
+#include "Log/Logger.h"
+#include "Threads/ThreadPool.h"
+#include "UnboundedBuffer.h"
+
+namespace qedis
+{
+
+QBackendLoader& QBackendLoader::Instance()
+{
+    static QBackendLoader loader;
+    return loader;
+}
+
+QBackendLoader::QBackendLoader() :
+    running_(false),
+    loads_(0),
+    coalesced_(0),
+    hits_(0),
+    fieldReads_(0),
+    prefetchInflight_(0),
+    prefetchLoaded_(0),
+    lastLoadUs_(0)
+{
+}
+
+void QBackendLoader::Start(const std::vector<QDumpInterface*>& backends, int threads)
+{
+    assert (results_.empty());
+
+    backends_ = backends;
+    loading_.resize(backends.size());
+    fieldLoading_.resize(backends.size());
+    absent_.resize(backends.size());
+    running_ = true;
+
+    for (int i = 0; i < threads; ++ i)
+    {
+        auto result = ThreadPool::Instance().ExecuteTask(std::bind(&QBackendLoader::_Run, this));
+        if (!result.valid())
+        {
+            ERR << "start backend loader thread failed";
+            break;
+        }
+
+        results_.push_back(std::move(result));
+    }
+
+    if (results_.empty())
+        running_ = false;
+    else
+        INF << "start backend loader, threads " << results_.size();
+}
+
+void QBackendLoader::Stop()
+{
+    if (results_.empty())
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        running_ = false;
+        prefetchTodo_.clear(); // nobody waits them
+    }
+    cond_.notify_all();
+
+    for (auto& result : results_)
+        result.get();
+
+    results_.clear();
+}
+
+// field reads of the same command, key and field are merged
+static QString FieldReadId(const QString& cmd, const QString& key, const QString& field)
+{
+    return cmd + " " + std::to_string(key.size()) + " " + key + field;
+}
+
+bool QBackendLoader::Load(int dbno, const QString& key, QClient* client)
+{
+    if (results_.empty())
+        return false;
+
+    auto& loading = loading_[dbno];
+    auto it = loading.find(key);
+    if (it == loading.end())
+    {
+        uint64_t waitSeq = 0;
+        if (!QSTORE.IsColdKey(dbno, key, waitSeq))
+            return false;
+
+        it = loading.insert(std::make_pair(key, Waiters())).first;
+        ++ loads_;
+
+        Task task;
+        task.dbno = dbno;
+        task.key = key;
+        task.waitSeq = waitSeq;
+        _Submit(std::move(task));
+    }
+    else
+    {
+        ++ coalesced_;
+    }
+
+    _Wait(it->second, client);
+    return true;
+}
+
+bool QBackendLoader::Prefetch(int dbno, const QString& key)
+{
+    if (results_.empty())
+        return false;
+
+    auto& loading = loading_[dbno];
+    if (loading.count(key))
+        return false;
+
+    uint64_t waitSeq = 0;
+    if (!QSTORE.IsColdKey(dbno, key, waitSeq))
+        return false;
+
+    // clients missing the key meanwhile wait for it
+    loading.insert(std::make_pair(key, Waiters()));
+    ++ prefetchInflight_;
+
+    Task task;
+    task.dbno = dbno;
+    task.key = key;
+    task.waitSeq = waitSeq;
+    task.prefetch = true;
+    _Submit(std::move(task));
+    return true;
+}
+
+bool QBackendLoader::LoadField(int dbno, const QString& cmd, const QString& key, const QString& field, QClient* client)
+{
+    if (results_.empty())
+        return false;
+
+    // the whole object is coming
+    if (loading_[dbno].count(key))
+        return Load(dbno, key, client);
+
+    auto& loading = fieldLoading_[dbno];
+    const QString id = FieldReadId(cmd, key, field);
+    auto it = loading.find(id);
+    if (it == loading.end())
+    {
+        uint64_t waitSeq = 0;
+        if (!QSTORE.IsColdKey(dbno, key, waitSeq))
+            return false;
+
+        it = loading.insert(std::make_pair(id, Waiters())).first;
+        ++ loads_;
+
+        Task task;
+        task.dbno = dbno;
+        task.key = key;
+        task.waitSeq = waitSeq;
+        task.cmd = cmd;
+        task.field = field;
+        _Submit(std::move(task));
+    }
+    else
+    {
+        ++ coalesced_;
+    }
+
+    _Wait(it->second, client);
+    return true;
+}
+
+void QBackendLoader::_Submit(Task&& task)
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (task.prefetch)
+            prefetchTodo_.push_back(std::move(task));
+        else
+            todo_.push_back(std::move(task));
+    }
+    cond_.notify_one();
+}
+
+void QBackendLoader::_Wait(Waiters& waiters, QClient* client)
+{
+    client->WaitLoad();
+    waiters.push_back(std::static_pointer_cast<QClient>(client->shared_from_this()));
+}
+
+bool QBackendLoader::Poll()
+{
+    if (results_.empty())
+        return false;
+
+    for (auto& keys : absent_)
+        keys.clear();
+
+    std::vector<Task> done;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        done.swap(done_);
+    }
+
+    if (done.empty())
+        return false;
+
+    const int oldDb = QSTORE.GetDB();
+    for (auto& task : done)
+    {
+        QSTORE.OnBackendRead(task.fieldRead ? task.type != QType_invalid : task.obj.type != QType_invalid);
+
+        UnboundedBuffer reply;
+
+        // modified or deleted while loading, memory wins
+        uint64_t waitSeq = 0;
+        if (QSTORE.IsColdKey(task.dbno, task.key, waitSeq))
+        {
+            if (task.fieldRead)
+            {
+                ++ fieldReads_;
+                _FieldReply(task, reply);
+            }
+            else if (task.obj.type != QType_invalid)
+            {
+                ++ hits_;
+                if (task.prefetch)
+                    ++ prefetchLoaded_;
+                QSTORE.SelectDB(task.dbno);
+                QSTORE.InsertFromBackend(task.key, std::move(task.obj), task.byFields);
+            }
+            else
+            {
+                absent_[task.dbno].insert(task.key);
+            }
+        }
+
+        if (task.prefetch)
+            -- prefetchInflight_;
+
+        auto& loading = task.field.empty() ? loading_[task.dbno] : fieldLoading_[task.dbno];
+        auto it = loading.find(task.field.empty() ? task.key : FieldReadId(task.cmd, task.key, task.field));
+        assert (it != loading.end());
+
+        for (const auto& wc : it->second)
+        {
+            auto client = wc.lock();
+            if (!client)
+                continue;
+
+            if (!reply.IsEmpty())
+                client->SetLoadedReply(reply);
+
+            client->OnLoaded();
+        }
+
+        loading.erase(it);
+    }
+
+    QSTORE.SelectDB(oldDb);
+    return true;
+}
+
+void QBackendLoader::_FieldReply(const Task& task, UnboundedBuffer& reply)
+{
+    const QString& cmd = task.cmd;
+    if (cmd == "hget" || cmd == "hexists" || cmd == "hstrlen")
+    {
+        if (task.type != QType_hash)
+        {
+            ReplyError(QError_type, &reply);
+        }
+        else if (cmd == "hget")
+        {
+            if (task.exist)
+                FormatBulk(task.value, &reply);
+            else
+                FormatNull(&reply);
+        }
+        else if (cmd == "hexists")
+        {
+            FormatInt(task.exist ? 1 : 0, &reply);
+        }
+        else
+        {
+            FormatInt(task.exist ? static_cast<long>(task.value.size()) : 0, &reply);
+        }
+    }
+    else if (cmd == "sismember")
+    {
+        if (task.type != QType_set)
+            ReplyError(QError_type, &reply);
+        else
+            FormatInt(task.exist ? 1 : 0, &reply);
+    }
+    else if (cmd == "zscore")
+    {
+        if (task.type != QType_sortedSet)
+            ReplyError(QError_type, &reply);
+        else if (task.exist)
+            FormatInt(static_cast<long>(std::stod(task.value)), &reply);
+        else
+            FormatNull(&reply);
+    }
+    else
+    {
+        assert (!!!"unknown field read command");
+    }
+}
+
+bool QBackendLoader::IsAbsent(int dbno, const QString& key) const
+{
+    if (dbno >= static_cast<int>(absent_.size()))
+        return false;
+
+    return absent_[dbno].count(key) != 0;
+}
+
+void QBackendLoader::_Run()
+{
+    while (true)
+    {
+        Task task;
+        {
+            std::unique_lock<std::mutex> guard(mutex_);
+            cond_.wait(guard, [this]() { return !running_ || !todo_.empty() || !prefetchTodo_.empty(); });
+
+            auto& todo = todo_.empty() ? prefetchTodo_ : todo_;
+            if (todo.empty())
+                break;
+
+            task = std::move(todo.front());
+            todo.pop_front();
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        // the value in backend is stale until the write committed
+        if (task.waitSeq != 0)
+            QBackendWriter::Instance().WaitCommitted(task.waitSeq);
+
+        auto backend = backends_[task.dbno];
+        if (!task.field.empty())
+            task.fieldRead = backend->GetField(task.key, task.field, task.type, task.exist, task.value);
+
+        // not stored by fields, load all
+        if (!task.fieldRead)
+            task.obj = backend->Get(task.key, &task.byFields);
+
+        auto end = std::chrono::steady_clock::now();
+        lastLoadUs_ = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+        std::lock_guard<std::mutex> guard(mutex_);
+        done_.push_back(std::move(task));
+    }
+}
+
+void QBackendLoader::OnInfoCommand(UnboundedBuffer& res)
+{
+    if (backends_.empty())
+        return;
+
+    size_t loading = 0;
+    size_t waiters = 0;
+    for (const auto& keys : loading_)
+    {
+        loading += keys.size();
+        for (const auto& kv : keys)
+            waiters += kv.second.size();
+    }
+
+    char buf[512];
+    int n = snprintf(buf, sizeof buf - 1,
+                 "# BackendLoader\r\n"
+                 "backend_loader_threads:%lu\r\n"
+                 "backend_loading_keys:%lu\r\n"
+                 "backend_load_waiters:%lu\r\n"
+                 "backend_loads:%lu\r\n"
+                 "backend_load_hits:%lu\r\n"
+                 "backend_field_reads:%lu\r\n"
+                 "backend_load_coalesced:%lu\r\n"
+                 "backend_last_load_us:%lu\r\n"
+                 , results_.size()
+                 , loading
+                 , waiters
+                 , loads_
+                 , hits_
+                 , fieldReads_
+                 , coalesced_
+                 , static_cast<uint64_t>(lastLoadUs_));
+
+    if (!res.IsEmpty())
+        res.PushData("\r\n", 2);
+
+    res.PushData(buf, n);
+}
+
+}
+
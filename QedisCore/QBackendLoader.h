@@ -0,0 +1,112 @@
+#ifndef BERT_QBACKENDLOADER_H
+#define BERT_QBACKENDLOADER_H
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include "QStore.h"
+#include "QHelper.h"
+
+namespace qedis
+{
+
+class QClient;
+class UnboundedBuffer;
+
+// Non blocking cold reads.
+// When a command touches keys that may only live in backend, the client is
+// suspended and the keys are fetched by loader threads. Concurrent misses on
+// the same key share one read. Main thread polls the results, inserts them,
+// then the suspended clients execute their command.
+// Commands reading one field of a collection stored by fields are answered
+// by reading only that field, the object is not loaded.
+class QBackendLoader
+{
+public:
+    static QBackendLoader& Instance();
+
+    QBackendLoader(const QBackendLoader& ) = delete;
+    void operator= (const QBackendLoader& ) = delete;
+
+    // main thread
+    void Start(const std::vector<QDumpInterface*>& backends, int threads);
+    void Stop();
+    bool IsRunning() const { return !results_.empty(); }
+
+    // load key for client if it's cold, return true if client must wait
+    bool Load(int dbno, const QString& key, QClient* client);
+    // read one field for command like hget
+    bool LoadField(int dbno, const QString& cmd, const QString& key, const QString& field, QClient* client);
+    // load key if it's cold, no client waits; false if not cold or loading
+    bool Prefetch(int dbno, const QString& key);
+    size_t PrefetchInflight() const { return prefetchInflight_; }
+    uint64_t PrefetchLoaded() const { return prefetchLoaded_; }
+    // insert loaded objects and wake clients, return true if any
+    bool Poll();
+
+    // key was checked not in backend, valid until next Poll
+    bool IsAbsent(int dbno, const QString& key) const;
+
+    void OnInfoCommand(UnboundedBuffer& res);
+
+private:
+    QBackendLoader();
+
+    using Waiters = std::vector<std::weak_ptr<QClient> >;
+
+    struct Task
+    {
+        int       dbno = 0;
+        QString   key;
+        uint64_t  waitSeq = 0; // pending write of key, wait it committed
+        QObject   obj;
+        bool      byFields = false;
+        bool      prefetch = false;
+
+        // field read, result is the field if key is stored by fields
+        QString   cmd;
+        QString   field;
+        bool      fieldRead = false;
+        int       type = QType_invalid;
+        bool      exist = false;
+        QString   value;
+    };
+
+    void _Submit(Task&& task);
+    void _Wait(Waiters& waiters, QClient* client);
+    void _Run();
+    static void _FieldReply(const Task& task, UnboundedBuffer& reply);
+
+    std::vector<QDumpInterface*> backends_;
+    std::vector<std::future<void> > results_;
+
+    std::mutex               mutex_;
+    std::condition_variable  cond_;
+    std::deque<Task>         todo_;
+    std::deque<Task>         prefetchTodo_; // after todo_, clients first
+    std::vector<Task>        done_;
+    bool                     running_;
+
+    // main thread only
+    std::vector<std::unordered_map<QString, Waiters, Hash> > loading_;
+    std::vector<std::unordered_map<QString, Waiters, Hash> > fieldLoading_;
+    std::vector<std::unordered_set<QString, Hash> > absent_;
+
+    // stats
+    uint64_t                 loads_;
+    uint64_t                 coalesced_;
+    uint64_t                 hits_;
+    uint64_t                 fieldReads_;
+    size_t                   prefetchInflight_;
+    uint64_t                 prefetchLoaded_;
+    std::atomic<uint64_t>    lastLoadUs_;
+};
+
+}
+
+#endif
+
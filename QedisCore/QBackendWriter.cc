@@ -0,0 +1,327 @@
+
+#include <cassert>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include "QBackendWriter.h"
+#include "QStore.h"
+#include "Log/Logger.h"
+#include "Threads/ThreadPool.h"
+#include "UnboundedBuffer.h"
+#include "Timer.h"
+
+namespace qedis
+{
+
+// ops of one write batch, by bytes of key and value
+static const uint64_t kBatchBytes = 1 * 1024 * 1024;
+// main thread stops pushing if writer is too far behind
+static const uint64_t kMaxPendingBytes = 64 * 1024 * 1024;
+// a failed batch is retried, the wait doubles up to the max
+static const uint64_t kMinRetryMs = 10;
+static const uint64_t kMaxRetryMs = 1000;
+// when stopping, a batch still failing after these is dropped
+static const int      kStopRetries = 5;
+
+QBackendWriter& QBackendWriter::Instance()
+{
+    static QBackendWriter writer;
+    return writer;
+}
+
+QBackendWriter::QBackendWriter() :
+    writingSince_(0),
+    running_(false),
+    seq_(0),
+    committed_(0),
+    pendingBytes_(0),
+    writtenOps_(0),
+    batches_(0),
+    errors_(0),
+    lastBatchUs_(0)
+{
+}
+
+void QBackendWriter::Start(const std::vector<QDumpInterface*>& backends)
+{
+    assert (!running_);
+
+    backends_ = backends;
+    pending_.resize(backends.size());
+    running_ = true;
+
+    result_ = ThreadPool::Instance().ExecuteTask(std::bind(&QBackendWriter::_Run, this));
+    if (!result_.valid())
+    {
+        ERR << "start backend writer thread failed";
+        running_ = false;
+        return;
+    }
+
+    INF << "start backend writer";
+}
+
+void QBackendWriter::Stop()
+{
+    if (!result_.valid())
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        running_ = false;
+    }
+    cond_.notify_one();
+
+    result_.get();
+    _Reap();
+}
+
+bool QBackendWriter::IsFull() const
+{
+    return pendingBytes_ >= kMaxPendingBytes;
+}
+
+bool QBackendWriter::Push(QBackendOp&& op)
+{
+    if (!result_.valid())
+    {
+        // no writer thread, write synchronously
+        if (!backends_[op.dbno]->Write({&op}))
+        {
+            ++ errors_;
+            ERR << "backend write key " << op.key << " failed";
+            return false;
+        }
+
+        return true;
+    }
+
+    _Reap();
+
+    op.seq = ++ seq_;
+    op.time = ::Now();
+
+    pending_[op.dbno][op.key] = Pending{op.seq, op.del};
+    order_.push_back({op.seq, {op.dbno, op.key}});
+    pendingBytes_ += op.Bytes();
+
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        queue_.push_back(std::move(op));
+    }
+    cond_.notify_one();
+    return true;
+}
+
+uint64_t QBackendWriter::PendingSeq(int dbno, const QString& key, bool& del)
+{
+    _Reap();
+
+    if (dbno >= static_cast<int>(pending_.size()))
+        return 0;
+
+    auto it = pending_[dbno].find(key);
+    if (it == pending_[dbno].end())
+        return 0;
+
+    del = it->second.del;
+    return it->second.seq;
+}
+
+void QBackendWriter::WaitCommitted(uint64_t seq)
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    committedCond_.wait(guard, [this, seq]() { return committed_ >= seq; });
+}
+
+void QBackendWriter::_Reap()
+{
+    const uint64_t committed = committed_;
+    while (!order_.empty() && order_.front().first <= committed)
+    {
+        const auto& front = order_.front();
+        auto& keys = pending_[front.second.first];
+
+        // the key may be pushed again later
+        auto it = keys.find(front.second.second);
+        if (it != keys.end() && it->second.seq == front.first)
+            keys.erase(it);
+
+        order_.pop_front();
+    }
+}
+
+void QBackendWriter::_Run()
+{
+    std::vector<QBackendOp> batch;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(mutex_);
+            cond_.wait(guard, [this]() { return !queue_.empty() || !running_; });
+
+            // drain before exit
+            if (queue_.empty())
+                break;
+
+            uint64_t bytes = 0;
+            while (!queue_.empty() && bytes < kBatchBytes)
+            {
+                bytes += queue_.front().Bytes();
+                batch.push_back(std::move(queue_.front()));
+                queue_.pop_front();
+            }
+
+            writingSince_ = batch.front().time;
+        }
+
+        const uint64_t last = batch.back().seq;
+        uint64_t bytes = 0;
+        for (const auto& op : batch)
+            bytes += op.Bytes();
+
+        // later ops wait behind a failed batch, they may change the same keys
+        int failures = 0;
+        while (!_Write(batch))
+        {
+            ++ failures;
+
+            bool stopping;
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                stopping = !running_;
+            }
+
+            if (stopping && failures >= kStopRetries)
+            {
+                ERR << "backend writer stops, drop " << batch.size() << " ops not written";
+                break;
+            }
+
+            const uint64_t wait = std::min(kMinRetryMs << std::min(failures - 1, 10), kMaxRetryMs);
+            WRN << "backend write failed " << failures << " times, retry " << batch.size() << " ops after " << wait << "ms";
+            std::this_thread::sleep_for(std::chrono::milliseconds(wait));
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            writingSince_ = 0;
+            committed_ = last;
+            pendingBytes_ -= bytes;
+        }
+        committedCond_.notify_all();
+
+        batch.clear();
+    }
+}
+
+bool QBackendWriter::_Write(std::vector<QBackendOp>& batch)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // one write batch per db, ops of the same key keep their order
+    std::vector<std::vector<const QBackendOp*> > dbOps(backends_.size());
+    for (const auto& op : batch)
+        dbOps[op.dbno].push_back(&op);
+
+    std::vector<bool> failed(backends_.size(), false);
+    bool succ = true;
+    for (size_t dbno = 0; dbno < dbOps.size(); ++ dbno)
+    {
+        if (dbOps[dbno].empty())
+            continue;
+
+        if (backends_[dbno]->Write(dbOps[dbno]))
+        {
+            writtenOps_ += dbOps[dbno].size();
+        }
+        else
+        {
+            ++ errors_;
+            failed[dbno] = true;
+            succ = false;
+        }
+
+        ++ batches_;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    lastBatchUs_ = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+    // only ops of failed dbs are left to retry
+    if (!succ)
+    {
+        batch.erase(std::remove_if(batch.begin(), batch.end(),
+                                   [&failed](const QBackendOp& op) { return !failed[op.dbno]; }),
+                    batch.end());
+    }
+
+    return succ;
+}
+
+bool QBackendWriter::IsEnabled() const
+{
+    return !backends_.empty();
+}
+
+QBackendWriter::Stats QBackendWriter::GetStats()
+{
+    Stats stats;
+    uint64_t oldest = 0;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        stats.queued = queue_.size();
+        oldest = writingSince_;
+        if (!oldest && !queue_.empty())
+            oldest = queue_.front().time;
+    }
+
+    const uint64_t now = ::Now();
+    stats.lagMs = (oldest && oldest < now) ? now - oldest : 0;
+    stats.pendingOps = seq_ - committed_;
+    stats.pendingBytes = pendingBytes_;
+    stats.writtenOps = writtenOps_;
+    stats.batches = batches_;
+    stats.errors = errors_;
+    stats.lastBatchUs = lastBatchUs_;
+    return stats;
+}
+
+void QBackendWriter::OnInfoCommand(UnboundedBuffer& res)
+{
+    if (backends_.empty())
+        return;
+
+    const Stats stats = GetStats();
+
+    char buf[512];
+    int n = snprintf(buf, sizeof buf - 1,
+                 "# Backend\r\n"
+                 "backend_writer_running:%d\r\n"
+                 "backend_dirty_keys:%lu\r\n"
+                 "backend_queue_depth:%lu\r\n"
+                 "backend_pending_ops:%lu\r\n"
+                 "backend_pending_bytes:%lu\r\n"
+                 "backend_lag_ms:%lu\r\n"
+                 "backend_written_ops:%lu\r\n"
+                 "backend_batches:%lu\r\n"
+                 "backend_write_errors:%lu\r\n"
+                 "backend_last_batch_us:%lu\r\n"
+                 , result_.valid() ? 1 : 0
+                 , QSTORE.BackendDirtyKeys()
+                 , stats.queued
+                 , stats.pendingOps
+                 , stats.pendingBytes
+                 , stats.lagMs
+                 , stats.writtenOps
+                 , stats.batches
+                 , stats.errors
+                 , stats.lastBatchUs);
+
+    if (!res.IsEmpty())
+        res.PushData("\r\n", 2);
+
+    res.PushData(buf, n);
+}
+
+}
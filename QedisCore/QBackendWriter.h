@@ -0,0 +1,103 @@
+#ifndef BERT_QBACKENDWRITER_H
+#define BERT_QBACKENDWRITER_H
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <condition_variable>
+#include <unordered_map>
+#include "QDumpInterface.h"
+#include "QHelper.h"
+
+namespace qedis
+{
+
+class UnboundedBuffer;
+
+// Write behind for backends.
+// Main thread encodes dirty keys and pushes them here, a dedicated thread
+// commits them in write batches. Until committed, an op is "pending": main
+// thread must not read the key from backend, the value there is stale.
+// A failed batch is retried with backoff and blocks the ops behind it, so
+// an op is never committed unless written.
+class QBackendWriter
+{
+public:
+    static QBackendWriter& Instance();
+
+    QBackendWriter(const QBackendWriter& ) = delete;
+    void operator= (const QBackendWriter& ) = delete;
+
+    // main thread
+    void Start(const std::vector<QDumpInterface*>& backends);
+    // write all pushed ops, then stop the thread
+    void Stop();
+
+    bool IsFull() const;
+    // false only if no writer thread and the synchronous write failed
+    bool Push(QBackendOp&& op);
+
+    // the last pushed op of key not committed yet, 0 if none
+    uint64_t PendingSeq(int dbno, const QString& key, bool& del);
+    void WaitCommitted(uint64_t seq);
+
+    bool IsEnabled() const;
+
+    struct Stats
+    {
+        uint64_t queued = 0;       // ops waiting for the writer thread
+        uint64_t pendingOps = 0;   // ops not committed
+        uint64_t pendingBytes = 0;
+        uint64_t lagMs = 0;        // age of the oldest op not committed
+        uint64_t writtenOps = 0;
+        uint64_t batches = 0;
+        uint64_t errors = 0;
+        uint64_t lastBatchUs = 0;
+    };
+    Stats GetStats();
+
+    void OnInfoCommand(UnboundedBuffer& res);
+
+private:
+    QBackendWriter();
+
+    void _Run();
+    // false if a db failed, only its ops are left in batch
+    bool _Write(std::vector<QBackendOp>& batch);
+    void _Reap();
+
+    std::vector<QDumpInterface*> backends_;
+
+    std::mutex               mutex_;
+    std::condition_variable  cond_;      // writer waits for ops
+    std::condition_variable  committedCond_;
+    std::deque<QBackendOp>   queue_;
+    uint64_t                 writingSince_; // time of the oldest op being written
+    bool                     running_;
+    std::future<void>        result_;
+
+    uint64_t                 seq_;
+    std::atomic<uint64_t>    committed_;
+    std::atomic<uint64_t>    pendingBytes_;
+
+    // main thread only, pending ops in push order, and the last seq of key
+    struct Pending
+    {
+        uint64_t seq;
+        bool     del;
+    };
+    std::deque<std::pair<uint64_t, std::pair<int, QString> > > order_;
+    std::vector<std::unordered_map<QString, Pending, Hash> > pending_;
+
+    // stats
+    std::atomic<uint64_t>    writtenOps_;
+    std::atomic<uint64_t>    batches_;
+    std::atomic<uint64_t>    errors_;
+    std::atomic<uint64_t>    lastBatchUs_;
+};
+
+}
+
+#endif
+
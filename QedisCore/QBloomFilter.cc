@@ -0,0 +1,128 @@
+
+#include <cmath>
+#include "QBloomFilter.h"
+#include "QHelper.h"
+#include "crc64.h"
+
+namespace qedis
+{
+
+// error of the next filter is multiplied by it
+static const double kTightening = 0.5;
+
+QBloomFilter::QBloomFilter(size_t initCapacity, double errorRate) :
+    initCapacity_(initCapacity > 0 ? initCapacity : 1),
+    errorRate_(errorRate),
+    keys_(0)
+{
+}
+
+void QBloomFilter::_Hash(const QString& key, uint64_t& h1, uint64_t& h2)
+{
+    // double hashing, Kirsch and Mitzenmacher: probe i is h1 + i * h2
+    h1 = crc64(0, reinterpret_cast<const unsigned char*>(key.data()), key.size());
+    h2 = dictGenHashFunction(key.data(), static_cast<int>(key.size()));
+    h2 = (h2 * 0x9e3779b97f4a7c15ULL) | 1;
+}
+
+bool QBloomFilter::_Test(const Filter& f, uint64_t h1, uint64_t h2)
+{
+    for (int i = 0; i < f.hashes; ++ i)
+    {
+        const uint64_t bit = (h1 + i * h2) % f.nbits;
+        if (!(f.bits[bit / 64] & (1ULL << (bit % 64))))
+            return false;
+    }
+
+    return true;
+}
+
+bool QBloomFilter::MayContain(const QString& key) const
+{
+    uint64_t h1, h2;
+    _Hash(key, h1, h2);
+
+    // bigger filters hold more keys, check them first
+    for (auto it = filters_.rbegin(); it != filters_.rend(); ++ it)
+    {
+        if (_Test(*it, h1, h2))
+            return true;
+    }
+
+    return false;
+}
+
+bool QBloomFilter::Add(const QString& key)
+{
+    uint64_t h1, h2;
+    _Hash(key, h1, h2);
+
+    for (auto it = filters_.rbegin(); it != filters_.rend(); ++ it)
+    {
+        if (_Test(*it, h1, h2))
+            return false;
+    }
+
+    if (filters_.empty() || filters_.back().keys >= filters_.back().capacity)
+        _Grow();
+
+    Filter& f = filters_.back();
+    for (int i = 0; i < f.hashes; ++ i)
+    {
+        const uint64_t bit = (h1 + i * h2) % f.nbits;
+        uint64_t& word = f.bits[bit / 64];
+        const uint64_t mask = 1ULL << (bit % 64);
+        if (!(word & mask))
+        {
+            word |= mask;
+            ++ f.bitsSet;
+        }
+    }
+
+    ++ f.keys;
+    ++ keys_;
+    return true;
+}
+
+void QBloomFilter::_Grow()
+{
+    const size_t n = filters_.size();
+
+    // total error is errorRate_ * (1 - r) * (1 + r + r^2 + ...) <= errorRate_
+    const double error = errorRate_ * (1 - kTightening) * std::pow(kTightening, static_cast<double>(n));
+    const double ln2 = std::log(2.0);
+
+    Filter f;
+    f.capacity = initCapacity_ << n;
+    f.hashes = static_cast<int>(std::ceil(-std::log(error) / ln2));
+    f.nbits = static_cast<uint64_t>(std::ceil(f.capacity * -std::log(error) / (ln2 * ln2)));
+    f.nbits = (f.nbits + 63) / 64 * 64;
+    f.bits.resize(f.nbits / 64);
+
+    filters_.push_back(std::move(f));
+}
+
+size_t QBloomFilter::Bytes() const
+{
+    size_t bytes = 0;
+    for (const auto& f : filters_)
+        bytes += f.bits.size() * sizeof(uint64_t);
+
+    return bytes;
+}
+
+double QBloomFilter::FalsePositiveRate() const
+{
+    // a key passes one filter with probability fill^hashes
+    double pass = 1.0;
+    for (const auto& f : filters_)
+    {
+        const double fill = static_cast<double>(f.bitsSet) / f.nbits;
+        pass *= 1 - std::pow(fill, f.hashes);
+    }
+
+    return 1 - pass;
+}
+
+}
+
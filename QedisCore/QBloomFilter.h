@@ -0,0 +1,54 @@
+#ifndef BERT_QBLOOMFILTER_H
+#define BERT_QBLOOMFILTER_H
+
+#include <vector>
+#include <stdint.h>
+#include "QString.h"
+
+namespace qedis
+{
+
+// Scalable bloom filter, Almeida et al. 2007.
+// A chain of plain bloom filters, each one has double capacity and half
+// error of the previous, so the total error stays under errorRate no
+// matter how many keys are added. Keys can't be removed.
+class QBloomFilter
+{
+public:
+    explicit
+    QBloomFilter(size_t initCapacity = 64 * 1024, double errorRate = 0.01);
+
+    // false if key may be added before
+    bool   Add(const QString& key);
+    bool   MayContain(const QString& key) const;
+
+    size_t Keys() const { return keys_; }
+    size_t Bytes() const;
+    // expected false positive rate by the bits set now
+    double FalsePositiveRate() const;
+
+private:
+    struct Filter
+    {
+        std::vector<uint64_t> bits;
+        uint64_t nbits = 0;
+        int      hashes = 0;
+        size_t   capacity = 0;
+        size_t   keys = 0;
+        uint64_t bitsSet = 0;
+    };
+
+    void _Grow();
+    static bool _Test(const Filter& f, uint64_t h1, uint64_t h2);
+    static void _Hash(const QString& key, uint64_t& h1, uint64_t& h2);
+
+    std::vector<Filter> filters_;
+    size_t  initCapacity_;
+    double  errorRate_;
+    size_t  keys_;
+};
+
+}
+
+#endif
+
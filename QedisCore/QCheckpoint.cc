@@ -0,0 +1,321 @@
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <iostream>
+#include "QCheckpoint.h"
+#include "QDB.h"
+#include "QLazyLoader.h"
+#include "QConfig.h"
+#include "Log/Logger.h"
+#include "Threads/ThreadPool.h"
+#include "UnboundedBuffer.h"
+
+namespace qedis
+{
+
+QCheckpoint& QCheckpoint::Instance()
+{
+    static QCheckpoint checkpoint;
+    return checkpoint;
+}
+
+QCheckpoint::QCheckpoint() :
+    manifest_("delta"),
+    chained_(false),
+    baseGen_(0),
+    saving_(SaveNone),
+    compactDeltas_(0),
+    compactGen_(0),
+    compactStart_(0),
+    deltaSaves_(0),
+    lastDeltaKeys_(0),
+    lastDeltaBytes_(0),
+    compactions_(0),
+    lastCompactMs_(0)
+{
+}
+
+QString QCheckpoint::ManifestName()
+{
+    return g_config.rdbfullname + ".manifest";
+}
+
+bool QCheckpoint::Load()
+{
+    QString base = g_config.rdbfullname;
+    if (manifest_.Load(ManifestName()))
+    {
+        if (!manifest_.Base().empty())
+            base = manifest_.Base();
+    }
+    else if (manifest_.IsDamaged())
+    {
+        // log thread is not started yet
+        std::cerr << "rdb manifest " << ManifestName() << " is damaged, refuse to start\n";
+        return false;
+    }
+
+    const auto& deltas = manifest_.Parts();
+
+    // no rdb yet, start empty
+    struct stat st;
+    if (deltas.empty() && ::stat(base.c_str(), &st) != 0 && errno == ENOENT)
+        return true;
+
+    // a save after starting without them would drop the files for good, so
+    // leave all of them to the operator
+    const bool lazy = g_config.rdblazyload && QLazyLoader::Instance().Open(base);
+    if (!lazy)
+    {
+        QDBLoader loader;
+        if (loader.Load(base.c_str()) != 0)
+        {
+            std::cerr << "rdb base " << base << " is missing or broken, "
+                      << deltas.size() << " deltas can not be applied, refuse to start\n";
+            return false;
+        }
+    }
+
+    for (const auto& delta : deltas)
+    {
+        QDBLoader loader;
+        if (loader.LoadDelta(delta.c_str()) != 0)
+        {
+            std::cerr << "rdb delta " << delta << " is missing or broken, "
+                      << "later deltas can not be applied, refuse to start\n";
+            return false;
+        }
+    }
+
+    chained_ = true;
+
+    USR << "Load rdb " << base << " with " << deltas.size() << " deltas";
+    return true;
+}
+
+void QCheckpoint::Init()
+{
+    if (!g_config.rdbincremental || g_config.backend != BackEndNone)
+        return;
+
+    QSTORE.InitCheckpointTracking();
+
+    // rdb saved before incremental was on becomes the base
+    if (chained_ && !_SaveManifest())
+        chained_ = false;
+}
+
+bool QCheckpoint::BackgroundSave()
+{
+    if (!chained_ || !QSTORE.IsCheckpointTracking())
+        return QDBSaver::BackgroundSave(g_config.rdbfullname.c_str());
+
+    savingFile_ = _NewDeltaName();
+    return QDBSaver::BackgroundSave(savingFile_.c_str(), &savingKeys_);
+}
+
+void QCheckpoint::OnSaveStart(bool delta)
+{
+    saving_ = delta ? SaveDelta : SaveFull;
+    if (!delta)
+        savingFile_ = g_config.rdbfullname;
+
+    // the save covers all changes till now
+    savingKeys_ = QSTORE.TakeCheckpointDeltas();
+}
+
+void QCheckpoint::OnSaveDone(bool succ)
+{
+    const SaveType type = saving_;
+    saving_ = SaveNone;
+
+    if (!succ)
+    {
+        QSTORE.RestoreCheckpointDeltas(std::move(savingKeys_));
+        if (type == SaveDelta)
+            ::unlink(savingFile_.c_str());
+    }
+    else if (type == SaveDelta)
+    {
+        lastDeltaKeys_ = 0;
+        for (const auto& delta : savingKeys_)
+            lastDeltaKeys_ += delta.keys.size();
+
+        struct stat st;
+        lastDeltaBytes_ = ::stat(savingFile_.c_str(), &st) == 0 ? st.st_size : 0;
+        ++ deltaSaves_;
+
+        manifest_.Parts().push_back(savingFile_);
+        if (!_SaveManifest())
+        {
+            ERR << "Save rdb manifest failed, next save is full";
+            chained_ = false;
+        }
+        else
+        {
+            INF << "Save rdb delta " << savingFile_ << ", keys " << lastDeltaKeys_;
+        }
+    }
+    else if (type == SaveFull)
+    {
+        _ResetBase();
+    }
+
+    savingKeys_.clear();
+}
+
+void QCheckpoint::OnFullSaved()
+{
+    // tracked changes are in the new base
+    if (QSTORE.IsCheckpointTracking())
+        QSTORE.TakeCheckpointDeltas();
+
+    _ResetBase();
+}
+
+void QCheckpoint::_ResetBase()
+{
+    ++ baseGen_;
+    chained_ = QSTORE.IsCheckpointTracking();
+
+    std::vector<QString> deltas;
+    deltas.swap(manifest_.Parts());
+
+    if (chained_)
+    {
+        if (!_SaveManifest())
+        {
+            ERR << "Save rdb manifest failed, next save is full";
+            chained_ = false;
+            return;
+        }
+    }
+    else
+    {
+        ::unlink(ManifestName().c_str());
+    }
+
+    // old deltas are garbage only after the manifest landed
+    for (const auto& delta : deltas)
+        ::unlink(delta.c_str());
+}
+
+void QCheckpoint::Cron()
+{
+    if (compacting_.valid())
+    {
+        if (compacting_.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            _OnCompactDone(compacting_.get());
+
+        return;
+    }
+
+    if (!g_config.rdbincremental ||
+        !chained_ ||
+        manifest_.Parts().empty() ||
+        manifest_.Parts().size() < static_cast<size_t>(g_config.rdbmaxdeltas))
+        return;
+
+    compactDeltas_ = manifest_.Parts().size();
+    compactGen_ = baseGen_;
+    compactStart_ = ::Now();
+
+    const QString base = g_config.rdbfullname;
+    const QString output = base + ".compact";
+    const std::vector<QString> deltas = manifest_.Parts();
+    compacting_ = ThreadPool::Instance().ExecuteTask([base, deltas, output]() {
+        return QDBSaver::Compact(base, deltas, output);
+    });
+
+    INF << "Compact rdb " << base << " with " << deltas.size() << " deltas";
+}
+
+void QCheckpoint::_OnCompactDone(bool succ)
+{
+    lastCompactMs_ = ::Now() - compactStart_;
+
+    const QString output = g_config.rdbfullname + ".compact";
+    if (!succ || compactGen_ != baseGen_)
+    {
+        // a full save replaced the base meanwhile, output is stale
+        if (succ)
+            INF << "Drop compacted rdb, base changed";
+
+        ::unlink(output.c_str());
+        return;
+    }
+
+    if (::rename(output.c_str(), g_config.rdbfullname.c_str()) != 0)
+    {
+        ERR << "rename " << output << " failed, errno " << errno;
+        ::unlink(output.c_str());
+        return;
+    }
+
+    ++ compactions_;
+
+    // replay deltas is idempotent, it's ok if the manifest is not saved
+    auto& deltas = manifest_.Parts();
+    std::vector<QString> merged(deltas.begin(), deltas.begin() + compactDeltas_);
+    deltas.erase(deltas.begin(), deltas.begin() + compactDeltas_);
+    if (!_SaveManifest())
+    {
+        ERR << "Save rdb manifest failed after compaction, keep old deltas";
+        return;
+    }
+
+    for (const auto& delta : merged)
+        ::unlink(delta.c_str());
+
+    INF << "Compact rdb done, merged " << merged.size() << " deltas, cost " << lastCompactMs_ << "ms";
+}
+
+bool QCheckpoint::_SaveManifest()
+{
+    manifest_.SetBase(g_config.rdbfullname);
+    return manifest_.Save(ManifestName());
+}
+
+QString QCheckpoint::_NewDeltaName()
+{
+    return g_config.rdbfullname + "." + std::to_string(manifest_.NextSeq()) + ".delta";
+}
+
+void QCheckpoint::OnInfoCommand(UnboundedBuffer& res)
+{
+    if (!g_config.rdbincremental)
+        return;
+
+    char buf[512];
+    int n = snprintf(buf, sizeof buf - 1,
+                 "# Checkpoint\r\n"
+                 "rdb_incremental_chained:%d\r\n"
+                 "rdb_deltas:%lu\r\n"
+                 "rdb_delta_in_progress:%d\r\n"
+                 "rdb_changed_keys:%lu\r\n"
+                 "rdb_delta_saves:%lu\r\n"
+                 "rdb_last_delta_keys:%lu\r\n"
+                 "rdb_last_delta_bytes:%lu\r\n"
+                 "rdb_compaction_in_progress:%d\r\n"
+                 "rdb_compactions:%lu\r\n"
+                 "rdb_last_compaction_ms:%lu\r\n"
+                 , chained_ ? 1 : 0
+                 , manifest_.Parts().size()
+                 , saving_ == SaveDelta ? 1 : 0
+                 , QSTORE.CheckpointChangedKeys()
+                 , deltaSaves_
+                 , lastDeltaKeys_
+                 , lastDeltaBytes_
+                 , compacting_.valid() ? 1 : 0
+                 , compactions_
+                 , lastCompactMs_);
+
+    if (!res.IsEmpty())
+        res.PushData("\r\n", 2);
+
+    res.PushData(buf, n);
+}
+
+}
+
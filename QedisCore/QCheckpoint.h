@@ -0,0 +1,93 @@
+#ifndef BERT_QCHECKPOINT_H
+#define BERT_QCHECKPOINT_H
+
+#include <future>
+#include <vector>
+#include "QStore.h"
+#include "QManifest.h"
+
+namespace qedis
+{
+
+class UnboundedBuffer;
+
+// Incremental rdb.
+// A full rdb at dbfilename is the base. Every save point after it writes
+// only the keys changed or deleted since the previous save to a delta file,
+// the manifest lists the deltas in order, loading replays base and deltas.
+// When there are rdb-incremental-max-deltas deltas, a background thread
+// merges them with the base into a new one, the keyspace is not touched.
+class QCheckpoint
+{
+public:
+    static QCheckpoint& Instance();
+
+    QCheckpoint(const QCheckpoint& ) = delete;
+    void operator= (const QCheckpoint& ) = delete;
+
+    static QString ManifestName();
+
+    // at start, load base and deltas; false if any of them is broken, the
+    // server must not start, files are left untouched
+    bool Load();
+    // after data loaded, start tracking changes
+    void Init();
+
+    // save point: a delta if there is a base, else full rdb
+    bool BackgroundSave();
+    // called by QDBSaver for every background save
+    void OnSaveStart(bool delta);
+    void OnSaveDone(bool succ);
+    // SAVE or SHUTDOWN SAVE wrote full rdb in main thread
+    void OnFullSaved();
+
+    // start compaction or finish it
+    void Cron();
+
+    void OnInfoCommand(UnboundedBuffer& res);
+
+private:
+    QCheckpoint();
+
+    // a full rdb is the new base, drop old deltas
+    void _ResetBase();
+    bool _SaveManifest();
+    QString _NewDeltaName();
+    void _OnCompactDone(bool succ);
+
+    // base and deltas in order
+    QManifest manifest_;
+    // memory is base plus deltas plus tracked changes
+    bool     chained_;
+    // bumped when a full rdb replaced the base
+    uint64_t baseGen_;
+
+    // the running background save
+    enum SaveType
+    {
+        SaveNone,
+        SaveFull,
+        SaveDelta,
+    };
+    SaveType saving_;
+    QString  savingFile_;
+    std::vector<QCheckpointDelta> savingKeys_;
+
+    // compaction
+    std::future<bool> compacting_;
+    size_t   compactDeltas_;
+    uint64_t compactGen_;
+    uint64_t compactStart_;
+
+    // stats
+    uint64_t deltaSaves_;
+    uint64_t lastDeltaKeys_;
+    uint64_t lastDeltaBytes_;
+    uint64_t compactions_;
+    uint64_t lastCompactMs_;
+};
+
+}
+
+#endif
+
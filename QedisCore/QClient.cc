@@ -5,7 +5,12 @@
 #include "QCommand.h"
 #include "QConfig.h"
 #include "QSlowLog.h"
+#include "QCommandStats.h"
+#include "QLatencyMonitor.h"
+#include "QRequestTrace.h"
+#include "QTraceCapture.h"
 #include "QClient.h"
+#include "QBackendLoader.h"
 
 namespace qedis
 {
@@ -140,8 +145,16 @@ static int ProcessMaster(const char* start, const char* end)
 
 PacketLength QClient::_HandlePacket(const char* start, std::size_t bytes)
 {
+    if (IsLoading())
+        return 0;
+
     s_current = this;
 
+    // sampled request is traced from parse start
+    const bool traced = QRequestTrace::Instance().Sample();
+    const uint64_t recvTime = traced ? RecvTime() : 0;
+    const uint64_t parseTime = traced ? ::NowUs() : 0;
+
     const char* const end   = start + bytes;
     const char* ptr  = start;
     
@@ -153,7 +166,27 @@ PacketLength QClient::_HandlePacket(const char* start, std::size_t bytes)
             return static_cast<PacketLength>(recved);
     }
 
-    auto parseRet = parser_.ParseRequest(ptr, end);
+    auto parseRet = QParseResult::ok;
+    if (suspendedLen_ > 0)
+    {
+        // resume the command suspended for cold keys, it's still in parser
+        ptr += suspendedLen_;
+        suspendedLen_ = 0;
+
+        // answered by reading one field from backend
+        if (!loadedReply_.IsEmpty())
+        {
+            SendPacket(loadedReply_);
+            loadedReply_.Clear();
+            _Reset();
+            return static_cast<PacketLength>(ptr - start);
+        }
+    }
+    else
+    {
+        parseRet = parser_.ParseRequest(ptr, end);
+    }
+
     if (parseRet == QParseResult::error)
     {
         if (!parser_.IsInitialState())
@@ -217,10 +250,21 @@ PacketLength QClient::_HandlePacket(const char* start, std::size_t bytes)
     DBG << "client " << GetID() << ", cmd " << cmd;
     
     QSTORE.SelectDB(db_);
-    FeedMonitors(params);
     
     const QCommandInfo* info = QCommandTable::GetCommandInfo(cmd);
 
+    // suspend until cold keys are loaded, nothing is consumed until resumed
+    if (info && _LoadColdKeys(params, info))
+    {
+        suspendedLen_ = ptr - start;
+        return 0;
+    }
+
+    FeedMonitors(params);
+
+    if (!IsFlagOn(ClientFlag_master))
+        QTraceCapture::Instance().Capture(GetID(), db_, cmd, params);
+
     if (!info)
     {
         ReplyError(QError_unknowCmd, &reply_);
@@ -240,6 +284,7 @@ PacketLength QClient::_HandlePacket(const char* start, std::size_t bytes)
             if (!info->CheckParamsCount(static_cast<int>(params.size())))
             {
                 ERR << "queue failed: cmd " << cmd.c_str() << " has params " << params.size();
+                QCommandStats::Instance().Reject(info);
                 ReplyError(info ? QError_param : QError_unknowCmd, &reply_);
                 SendPacket(reply_);
                 FlagExecWrong();
@@ -259,22 +304,53 @@ PacketLength QClient::_HandlePacket(const char* start, std::size_t bytes)
     
     // check readonly slave and execute command
     QError err = QError_ok;
+    uint64_t begin = 0;
+    uint64_t used = 0;
     if (QREPL.GetMasterState() != QReplState_none &&
         !IsFlagOn(ClientFlag_master) &&
         (info->attr & QCommandAttr::QAttr_write))
     {
         ReplyError(err = QError_readonlySlave, &reply_);
+        QCommandStats::Instance().Reject(info);
+    }
+    else if (!info->CheckParamsCount(static_cast<int>(params.size())))
+    {
+        ReplyError(err = QError_param, IsFlagOn(ClientFlag_master) ? nullptr : &reply_);
+        QCommandStats::Instance().Reject(info);
     }
     else
     {
-        QSlowLog::Instance().Begin();
+        const std::size_t replied = reply_.ReadableSize();
+        begin = QCommandStats::Clock();
         err = QCommandTable::ExecuteCmd(params,
                                         info,
                                         IsFlagOn(ClientFlag_master) ? nullptr : &reply_);
-        QSlowLog::Instance().EndAndStat(params);
+        used = QCommandStats::Clock() - begin;
+
+        QSlowLog::Instance().EndAndStat(params, static_cast<long long>(used / 1000));
+        QLatencyMonitor::Instance().AddSampleIfNeeded("command", used / 1000);
+        QCommandStats::Instance().Record(info, used, _IsFailed(err, replied));
     }
     
     SendPacket(reply_);
+
+    if (traced && begin > 0 && !reply_.IsEmpty())
+    {
+        // both clocks are monotonic
+        QRequestTrace::Trace trace;
+        trace.client = GetID();
+        trace.cmd = cmd;
+        trace.recv = recvTime;
+        trace.parse = parseTime;
+        trace.exec = begin / 1000;
+        trace.execEnd = (begin + used) / 1000;
+        trace.queued = ::NowUs();
+
+        OnSent(QueuedBytes(), [trace](uint64_t sent) mutable {
+            trace.sent = sent;
+            QRequestTrace::Instance().OnDone(trace);
+        });
+    }
     
     if (err == QError_ok && (info->attr & QAttr_write))
     {
@@ -284,6 +360,67 @@ PacketLength QClient::_HandlePacket(const char* start, std::size_t bytes)
     return static_cast<PacketLength>(ptr - start);
 }
 
+// handlers may reply an error but return ok
+bool QClient::_IsFailed(QError err, std::size_t replied)
+{
+    if (err != QError_ok && err != QError_nop)
+        return true;
+
+    return reply_.ReadableSize() > replied && reply_.ReadAddr()[replied] == '-';
+}
+
+// the first key, or all params of multi key commands;
+// the other keys are loaded synchronously if cold
+static void CollectKeys(const std::vector<QString>& params,
+                        const QCommandInfo* info,
+                        std::vector<const QString*>& keys)
+{
+    if (!info || (info->attr & (QAttr_nokey | QAttr_overwrite)) || params.size() < 2)
+        return;
+
+    const size_t end = (info->attr & QAttr_multikey) ? params.size() : 2;
+    for (size_t i = 1; i < end; ++ i)
+        keys.push_back(&params[i]);
+}
+
+bool QClient::_LoadColdKeys(const std::vector<QString>& params, const QCommandInfo* info)
+{
+    if (!QBackendLoader::Instance().IsRunning())
+        return false;
+
+    std::vector<const QString*> keys;
+    if (IsFlagOn(ClientFlag_multi))
+    {
+        // commands are being queued, load their keys at exec
+        if (info->cmd != "exec")
+            return false;
+
+        for (const auto& queued : queueCmds_)
+        {
+            QString cmd(queued[0]);
+            std::transform(queued[0].begin(), queued[0].end(), cmd.begin(), ::tolower);
+            CollectKeys(queued, QCommandTable::GetCommandInfo(cmd), keys);
+        }
+    }
+    else if ((info->attr & QAttr_fieldread) && params.size() == 3)
+    {
+        return QBackendLoader::Instance().LoadField(db_, info->cmd, params[1], params[2], this);
+    }
+    else
+    {
+        CollectKeys(params, info, keys);
+    }
+
+    bool wait = false;
+    for (const auto key : keys)
+    {
+        if (QBackendLoader::Instance().Load(db_, *key, this))
+            wait = true;
+    }
+
+    return wait;
+}
+
 QClient*  QClient::Current()
 {
     return s_current;
@@ -333,7 +470,8 @@ void QClient::_Reset()
 {
     s_current = 0;
 
-    parser_.Reset();
+    if (suspendedLen_ == 0)
+        parser_.Reset();
     reply_.Clear();
 }
 
@@ -389,7 +527,10 @@ bool QClient::Exec()
     {
         DBG << "EXEC " << cmd[0] << ", for client " << GetID();
         const QCommandInfo* info = QCommandTable::GetCommandInfo(cmd[0]);
+        const std::size_t replied = reply_.ReadableSize();
+        const uint64_t begin = QCommandStats::Clock();
         QError err = QCommandTable::ExecuteCmd(cmd, info, &reply_);
+        QCommandStats::Instance().Record(info, QCommandStats::Clock() - begin, _IsFailed(err, replied));
         
         // may dirty clients;
         if (err == QError_ok && (info->attr & QAttr_write))
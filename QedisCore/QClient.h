@@ -28,6 +28,7 @@ enum ClientFlag
 
 class DB;
 struct QSlaveInfo;
+struct QCommandInfo;
 
 class QClient: public StreamSocket
 {
@@ -99,9 +100,19 @@ public:
     bool GetAuth() const { return auth_; }
     void RewriteCmd(std::vector<QString>& params) { parser_.SetParams(params); }
 
+    // cold keys from backend
+    void WaitLoad() { ++ pendingLoads_; }
+    void OnLoaded() { -- pendingLoads_; }
+    bool IsLoading() const { return pendingLoads_ > 0; }
+    // the suspended command is answered by loader
+    void SetLoadedReply(const UnboundedBuffer& reply) { loadedReply_ = reply; }
+
 private:
     PacketLength _ProcessInlineCmd(const char* , size_t, std::vector<QString>& );
     void _Reset();
+    bool _LoadColdKeys(const std::vector<QString>& params, const QCommandInfo* info);
+    // command replied an error since reply_ had replied bytes
+    bool _IsFailed(QError err, std::size_t replied);
 
     QProtoParser parser_;
     UnboundedBuffer reply_;
@@ -125,6 +136,11 @@ private:
     // name
     std::string name_;
     
+    // cold keys being loaded, the parsed command is executed when all done
+    int pendingLoads_ = 0;
+    size_t suspendedLen_ = 0;
+    UnboundedBuffer loadedReply_;
+
     // auth
     bool  auth_;
     time_t lastauth_ = 0;
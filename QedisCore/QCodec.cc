@@ -0,0 +1,92 @@
+#include <strings.h>
+#include "QCodec.h"
+
+extern "C"
+{
+#include "lzf/lzf.h"
+#include "lz4/lz4.h"
+}
+
+namespace qedis
+{
+
+// too short to gain anything
+static const size_t kMinCompressLen = 20;
+
+static const char* const kCodecNames[QCodec_max] = {"none", "lzf", "lz4"};
+
+bool ParseCodec(const QString& name, QCodec& codec)
+{
+    for (int i = 0; i < QCodec_max; ++ i)
+    {
+        if (strcasecmp(name.c_str(), kCodecNames[i]) == 0)
+        {
+            codec = static_cast<QCodec>(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char* CodecName(QCodec codec)
+{
+    if (codec < 0 || codec >= QCodec_max)
+        return "unknown";
+
+    return kCodecNames[codec];
+}
+
+bool Compress(QCodec codec, const char* data, size_t len, QString& out)
+{
+    if (len < kMinCompressLen || len > 0xFFFFFFFF)
+        return false;
+
+    // save at least 4 bytes, or it's not worth
+    const unsigned outLen = static_cast<unsigned>(len - 4);
+    out.resize(outLen);
+
+    unsigned compressLen = 0;
+    switch (codec)
+    {
+        case QCodec_lzf:
+            compressLen = lzf_compress(data, static_cast<unsigned>(len), &out[0], outLen);
+            break;
+
+        case QCodec_lz4:
+            compressLen = lz4_compress(data, static_cast<unsigned>(len), &out[0], outLen);
+            break;
+
+        default:
+            break;
+    }
+
+    if (compressLen == 0)
+        return false;
+
+    out.resize(compressLen);
+    return true;
+}
+
+bool Decompress(QCodec codec, const char* data, size_t len, char* out, size_t rawLen)
+{
+    unsigned n = 0;
+    switch (codec)
+    {
+        case QCodec_lzf:
+            n = lzf_decompress(data, static_cast<unsigned>(len), out, static_cast<unsigned>(rawLen));
+            break;
+
+        case QCodec_lz4:
+            n = lz4_decompress(data, static_cast<unsigned>(len), out, static_cast<unsigned>(rawLen));
+            break;
+
+        default:
+            break;
+    }
+
+    return n == rawLen;
+}
+
+}
+
@@ -0,0 +1,31 @@
+#ifndef BERT_QCODEC_H
+#define BERT_QCODEC_H
+
+#include "QString.h"
+
+namespace qedis
+{
+
+// compression codecs, the value is saved with compressed data as a tag,
+// never change it
+enum QCodec : int8_t
+{
+    QCodec_none = 0,
+    QCodec_lzf  = 1,
+    QCodec_lz4  = 2,
+    QCodec_max,
+};
+
+bool ParseCodec(const QString& name, QCodec& codec);
+const char* CodecName(QCodec codec);
+
+// out is the compressed data; return false if codec is none, data is too short
+// or nothing is saved, the caller should store data as is
+bool Compress(QCodec codec, const char* data, size_t len, QString& out);
+// out must have rawLen bytes
+bool Decompress(QCodec codec, const char* data, size_t len, char* out, size_t rawLen);
+
+}
+
+#endif
+
@@ -14,6 +14,10 @@ enum QCommandAttr
 {
     QAttr_read  = 0x1,
     QAttr_write = 0x1 << 1,
+    QAttr_nokey = 0x1 << 2,     // params[1] is not a key
+    QAttr_multikey = 0x1 << 3,  // all params are keys
+    QAttr_overwrite = 0x1 << 4, // old value of key is never read
+    QAttr_fieldread = 0x1 << 5, // only reads the field params[2]
 };
 
 
@@ -60,6 +64,9 @@ QCommandHandler  info;
 QCommandHandler  monitor;
 QCommandHandler  auth;
 QCommandHandler  slowlog;
+QCommandHandler  latency;
+QCommandHandler  hotkeys;
+QCommandHandler  bigkeys;
 QCommandHandler  config;
 
 // string commands
@@ -186,6 +193,7 @@ extern Delegate<void (UnboundedBuffer& )> g_infoCollector;
 extern void OnMemoryInfoCollect(UnboundedBuffer& );
 extern void OnServerInfoCollect(UnboundedBuffer& );
 extern void OnClientInfoCollect(UnboundedBuffer& );
+extern void OnPersistenceInfoCollect(UnboundedBuffer& );
 
 struct QCommandInfo
 {
@@ -0,0 +1,303 @@
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "QCommandStats.h"
+#include "QCommand.h"
+#include "UnboundedBuffer.h"
+
+namespace qedis
+{
+
+static const size_t kSubBuckets = 1 << QHistogram::kSubBits;
+static const size_t kBuckets = (QHistogram::kMaxExp - QHistogram::kSubBits + 1) << QHistogram::kSubBits;
+
+QHistogram::QHistogram() : count_(0)
+{
+}
+
+size_t QHistogram::_Index(uint64_t value)
+{
+    if (value >= (1ULL << kMaxExp))
+        value = (1ULL << kMaxExp) - 1;
+
+    if (value < kSubBuckets)
+        return static_cast<size_t>(value);
+
+    const int exp = 63 - __builtin_clzll(value);
+    return ((exp - kSubBits + 1) << kSubBits) +
+           ((value >> (exp - kSubBits)) & (kSubBuckets - 1));
+}
+
+uint64_t QHistogram::_Upper(size_t index)
+{
+    if (index < kSubBuckets)
+        return index;
+
+    const int exp = static_cast<int>(index >> kSubBits) + kSubBits - 1;
+    const uint64_t sub = index & (kSubBuckets - 1);
+    const uint64_t lower = (kSubBuckets + sub) << (exp - kSubBits);
+    return lower + (1ULL << (exp - kSubBits)) - 1;
+}
+
+void QHistogram::Record(uint64_t value)
+{
+    if (buckets_.empty())
+        buckets_.resize(kBuckets, 0);
+
+    ++ buckets_[_Index(value)];
+    ++ count_;
+}
+
+uint64_t QHistogram::Percentile(double p) const
+{
+    if (count_ == 0)
+        return 0;
+
+    uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100 * count_));
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t sum = 0;
+    for (size_t i = 0; i < buckets_.size(); ++ i)
+    {
+        sum += buckets_[i];
+        if (sum >= rank)
+            return _Upper(i);
+    }
+
+    return _Upper(buckets_.size() - 1);
+}
+
+uint64_t QHistogram::CountBelow(int exp) const
+{
+    if (exp >= kMaxExp)
+        return count_;
+
+    const size_t end = exp <= kSubBits ? (1ULL << exp) : ((exp - kSubBits + 1) << kSubBits);
+
+    uint64_t sum = 0;
+    for (size_t i = 0; i < end && i < buckets_.size(); ++ i)
+        sum += buckets_[i];
+
+    return sum;
+}
+
+void QHistogram::Merge(const QHistogram& other)
+{
+    if (other.count_ == 0)
+        return;
+
+    if (buckets_.empty())
+        buckets_.resize(kBuckets, 0);
+
+    for (size_t i = 0; i < other.buckets_.size(); ++ i)
+        buckets_[i] += other.buckets_[i];
+
+    count_ += other.count_;
+}
+
+void QHistogram::Reset()
+{
+    std::vector<uint64_t>().swap(buckets_);
+    count_ = 0;
+}
+
+
+QCommandStats& QCommandStats::Instance()
+{
+    static QCommandStats stats;
+    return stats;
+}
+
+QCommandStats::QCommandStats() :
+    totalCalls_(0),
+    lastInfo_(nullptr),
+    lastStat_(nullptr)
+{
+}
+
+QCommandStats::Stat& QCommandStats::_GetStat(const QCommandInfo* info)
+{
+    if (info == lastInfo_)
+        return *lastStat_;
+
+    Stat& stat = stats_[info];
+    if (stat.name.empty())
+        stat.name = info->cmd;
+
+    lastInfo_ = info;
+    lastStat_ = &stat;
+    return stat;
+}
+
+void QCommandStats::Record(const QCommandInfo* info, uint64_t ns, bool failed)
+{
+    Stat& stat = _GetStat(info);
+
+    ++ stat.calls;
+    ++ totalCalls_;
+    stat.ns += ns;
+    if (failed)
+        ++ stat.failed;
+
+    stat.latency.Record(ns);
+}
+
+void QCommandStats::Reject(const QCommandInfo* info)
+{
+    ++ _GetStat(info).rejected;
+}
+
+void QCommandStats::Remove(const QCommandInfo* info)
+{
+    stats_.erase(info);
+    lastInfo_ = nullptr;
+    lastStat_ = nullptr;
+}
+
+void QCommandStats::Reset()
+{
+    stats_.clear();
+    totalCalls_ = 0;
+    lastInfo_ = nullptr;
+    lastStat_ = nullptr;
+}
+
+std::vector<const QCommandStats::Stat*> QCommandStats::_SortedStats() const
+{
+    std::vector<const Stat*> stats;
+    stats.reserve(stats_.size());
+    for (const auto& kv : stats_)
+    {
+        if (kv.second.calls > 0 || kv.second.rejected > 0)
+            stats.push_back(&kv.second);
+    }
+
+    std::sort(stats.begin(), stats.end(), [](const Stat* a, const Stat* b) {
+        return a->name < b->name;
+    });
+
+    return stats;
+}
+
+std::vector<QCommandStats::Stat> QCommandStats::Snapshot() const
+{
+    std::vector<Stat> stats;
+    for (const Stat* stat : _SortedStats())
+        stats.push_back(*stat);
+
+    return stats;
+}
+
+void QCommandStats::OnCommandStatsInfo(UnboundedBuffer& res)
+{
+    if (!res.IsEmpty())
+        res.PushData("\r\n", 2);
+
+    res.PushData("# Commandstats\r\n", 16);
+
+    char buf[256];
+    for (const Stat* stat : _SortedStats())
+    {
+        const uint64_t usec = stat->ns / 1000;
+        int n = snprintf(buf, sizeof buf,
+                         "cmdstat_%s:calls=%lu,usec=%lu,usec_per_call=%.2f,rejected_calls=%lu,failed_calls=%lu\r\n",
+                         stat->name.c_str(),
+                         stat->calls,
+                         usec,
+                         stat->calls ? static_cast<double>(stat->ns) / 1000 / stat->calls : 0.0,
+                         stat->rejected,
+                         stat->failed);
+
+        res.PushData(buf, std::min<int>(n, sizeof buf - 1));
+    }
+}
+
+void QCommandStats::OnLatencyStatsInfo(UnboundedBuffer& res)
+{
+    if (!res.IsEmpty())
+        res.PushData("\r\n", 2);
+
+    res.PushData("# Latencystats\r\n", 16);
+
+    char buf[256];
+    for (const Stat* stat : _SortedStats())
+    {
+        const QHistogram& h = stat->latency;
+        if (h.Count() == 0)
+            continue;
+
+        int n = snprintf(buf, sizeof buf,
+                         "latency_percentiles_usec_%s:p50=%.3f,p99=%.3f,p99.9=%.3f\r\n",
+                         stat->name.c_str(),
+                         h.Percentile(50) / 1000.0,
+                         h.Percentile(99) / 1000.0,
+                         h.Percentile(99.9) / 1000.0);
+
+        res.PushData(buf, std::min<int>(n, sizeof buf - 1));
+    }
+}
+
+void QCommandStats::OnHistogramCommand(const std::vector<QString>& params, UnboundedBuffer* reply)
+{
+    std::vector<const Stat*> stats;
+    if (params.size() <= 2)
+    {
+        for (const Stat* stat : _SortedStats())
+        {
+            if (stat->calls > 0)
+                stats.push_back(stat);
+        }
+    }
+    else
+    {
+        for (size_t i = 2; i < params.size(); ++ i)
+        {
+            QString cmd(params[i]);
+            std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::tolower);
+
+            auto info = QCommandTable::GetCommandInfo(cmd);
+            auto it = info ? stats_.find(info) : stats_.end();
+            if (it != stats_.end() && it->second.calls > 0 &&
+                std::find(stats.begin(), stats.end(), &it->second) == stats.end())
+                stats.push_back(&it->second);
+        }
+    }
+
+    // cumulative counts at power of two usec(1024ns) bounds, like redis
+    static const int kUsecExp = 10;
+
+    PreFormatMultiBulk(stats.size() * 2, reply);
+    for (const Stat* stat : stats)
+    {
+        const QHistogram& h = stat->latency;
+
+        std::vector<std::pair<long, long> > bounds;
+        uint64_t last = 0;
+        for (int exp = kUsecExp; exp <= QHistogram::kMaxExp && last < h.Count(); ++ exp)
+        {
+            const uint64_t below = h.CountBelow(exp);
+            if (below == last)
+                continue;
+
+            bounds.push_back(std::make_pair(1L << (exp - kUsecExp), static_cast<long>(below)));
+            last = below;
+        }
+
+        FormatBulk(stat->name, reply);
+        PreFormatMultiBulk(4, reply);
+        FormatBulk("calls", 5, reply);
+        FormatInt(static_cast<long>(stat->calls), reply);
+        FormatBulk("histogram_usec", 14, reply);
+        PreFormatMultiBulk(bounds.size() * 2, reply);
+        for (const auto& b : bounds)
+        {
+            FormatInt(b.first, reply);
+            FormatInt(b.second, reply);
+        }
+    }
+}
+
+}
+
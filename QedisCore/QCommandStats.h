@@ -0,0 +1,109 @@
+#ifndef BERT_QCOMMANDSTATS_H
+#define BERT_QCOMMANDSTATS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <unordered_map>
+#include <vector>
+#include "QString.h"
+
+namespace qedis
+{
+
+class UnboundedBuffer;
+struct QCommandInfo;
+
+// Log-linear histogram of nanoseconds, like HDR histogram.
+// Values below 16 are exact, each power of two above is split to 16
+// sub buckets, so the error of a percentile is under 1/16.
+class QHistogram
+{
+public:
+    QHistogram();
+
+    void Record(uint64_t value);
+    uint64_t Count() const { return count_; }
+    // upper bound of the bucket holding the percentile, p in [0, 100]
+    uint64_t Percentile(double p) const;
+    // count of values below 2^exp
+    uint64_t CountBelow(int exp) const;
+    void Merge(const QHistogram& other);
+    void Reset();
+
+    static const int kSubBits = 4;
+    static const int kMaxExp = 40; // values are clamped to 2^40 - 1
+
+private:
+    static size_t _Index(uint64_t value);
+    static uint64_t _Upper(size_t index);
+
+    std::vector<uint64_t> buckets_; // allocated on first record
+    uint64_t count_;
+};
+
+// Per command stats: calls, time, rejected and failed calls, latency
+// histogram. Shown by INFO commandstats, INFO latencystats and
+// LATENCY HISTOGRAM, cleared by CONFIG RESETSTAT.
+class QCommandStats
+{
+public:
+    static QCommandStats& Instance();
+
+    QCommandStats(const QCommandStats& ) = delete;
+    void operator= (const QCommandStats& ) = delete;
+
+    // monotonic nanoseconds
+    static uint64_t Clock()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    // command is executed in ns, failed if it replied an error
+    void Record(const QCommandInfo* info, uint64_t ns, bool failed);
+    // command is refused before executed: arity, readonly slave
+    void Reject(const QCommandInfo* info);
+    // command is unregistered, its info may be freed
+    void Remove(const QCommandInfo* info);
+    void Reset();
+
+    void OnCommandStatsInfo(UnboundedBuffer& res);
+    void OnLatencyStatsInfo(UnboundedBuffer& res);
+    // LATENCY HISTOGRAM [cmd ...]
+    void OnHistogramCommand(const std::vector<QString>& params, UnboundedBuffer* reply);
+
+    struct Stat
+    {
+        QString  name;
+        uint64_t calls = 0;
+        uint64_t ns = 0;
+        uint64_t rejected = 0;
+        uint64_t failed = 0;
+        QHistogram latency;
+    };
+
+    // calls of all commands since reset
+    uint64_t TotalCalls() const { return totalCalls_; }
+    // copy of stats by command name, for other threads
+    std::vector<Stat> Snapshot() const;
+
+private:
+    QCommandStats();
+
+    Stat& _GetStat(const QCommandInfo* info);
+    // stats by command name, commands never called are skipped
+    std::vector<const Stat*> _SortedStats() const;
+
+    std::unordered_map<const QCommandInfo*, Stat> stats_;
+    uint64_t totalCalls_;
+
+    // pipelines repeat the same command
+    const QCommandInfo* lastInfo_;
+    Stat* lastStat_;
+};
+
+}
+
+#endif
+
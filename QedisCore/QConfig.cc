@@ -2,6 +2,7 @@
 #include <iostream>
 
 #include "QConfig.h"
+#include "QCodec.h"
 #include "ConfigParser.h"
 
 namespace qedis
@@ -19,6 +20,13 @@ static void EraseQuotes(QString& str)
     }
 }
 
+// QCodec_max if unknown, CheckArgs() fails then
+static QCodec CodecOf(const QString& name)
+{
+    QCodec codec;
+    return ParseCodec(name, codec) ? codec : QCodec_max;
+}
+
 extern std::vector<QString>  SplitString(const QString& str, char seperator);
 
 QConfig  g_config;
@@ -43,6 +51,14 @@ QConfig::QConfig()
     rdbcompression = true;
     rdbchecksum    = true;
     rdbfullname    = "./dump.rdb";
+    rdbforkless    = false;
+    rdbloadthreads = 4;
+    savethreads    = 4;
+    rdbincremental = false;
+    rdbmaxdeltas   = 16;
+    rdblazyload    = false;
+    rdbcodec       = QCodec_lzf;
+    dumpcodec      = QCodec_lzf;
     
     maxclients = 10000;
     
@@ -50,10 +66,17 @@ QConfig::QConfig()
     appendonly = false;
     appendfilename = "appendonly.aof";
     appendfsync = 0;
+    appendmultipart = false;
     
     // slow log
     slowlogtime = 0;
     slowlogmaxlen = 128;
+    latencythreshold = 0;
+    tracesamplerate = 0;
+    hotkeyssamplerate = 16;
+    bigkeysscaninterval = 600;
+    bigkeysscankeys = 1024;
+    metricsport = 0;
     
     hz = 10;
     
@@ -62,10 +85,23 @@ QConfig::QConfig()
     maxmemory = 2 * 1024 * 1024 * 1024UL;
     maxmemorySamples = 5;
     noeviction = true;
+    tieredstorage = false;
 
     backend = BackEndNone;
     backendPath = "dump";
     backendHz = 10;
+    backendcodec = QCodec_none;
+    backendloadthreads = 4;
+    backendfieldthreshold = 1024;
+    backendfilter = true;
+    backendshared = false;
+    backendcachesize = 0;
+    backendbloombits = 10;
+    backendwritebuffer = 4 * 1024 * 1024;
+    backendcompression = true;
+    backendwarmupfile = "warmup.keys";
+    backendwarmupmemory = 256 * 1024 * 1024;
+    backendwarmupinterval = 300;
 }
 
 bool  LoadQedisConfig(const char* cfgFile, QConfig& cfg)
@@ -135,6 +171,14 @@ bool  LoadQedisConfig(const char* cfgFile, QConfig& cfg)
     
     cfg.rdbcompression = (parser.GetData<QString>("rdbcompression") == "yes");
     cfg.rdbchecksum    = (parser.GetData<QString>("rdbchecksum") == "yes");
+    cfg.rdbforkless    = (parser.GetData<QString>("rdb-forkless", "no") == "yes");
+    cfg.rdbloadthreads = parser.GetData<int>("rdb-load-threads", 4);
+    cfg.savethreads    = parser.GetData<int>("save-threads", 4);
+    cfg.rdbincremental = (parser.GetData<QString>("rdb-incremental", "no") == "yes");
+    cfg.rdbmaxdeltas   = parser.GetData<int>("rdb-incremental-max-deltas", 16);
+    cfg.rdblazyload    = (parser.GetData<QString>("rdb-lazy-load", "no") == "yes");
+    cfg.rdbcodec       = CodecOf(parser.GetData<QString>("rdb-codec", "lzf"));
+    cfg.dumpcodec      = CodecOf(parser.GetData<QString>("dump-codec", "lzf"));
     
     cfg.rdbfullname    = parser.GetData<QString>("dir", "./") + \
                          parser.GetData<QString>("dbfilename", "dump.rdb");
@@ -148,6 +192,8 @@ bool  LoadQedisConfig(const char* cfgFile, QConfig& cfg)
     if (cfg.appendfilename[0] == '"') // redis.conf use quote for string, but qedis do not. For compatiable...
         cfg.appendfilename = cfg.appendfilename.substr(1, cfg.appendfilename.size() - 2);
 
+    cfg.appendmultipart = (parser.GetData<QString>("aof-multi-part", "no") == "yes");
+
     QString tmpfsync = parser.GetData<const char* >("appendfsync", "no");
     // qedis always use "always", fsync is done in another thread
     if (tmpfsync == "everysec")
@@ -162,6 +208,12 @@ bool  LoadQedisConfig(const char* cfgFile, QConfig& cfg)
     
     cfg.slowlogtime = parser.GetData<int>("slowlog-log-slower-than", 0);
     cfg.slowlogmaxlen = parser.GetData<int>("slowlog-max-len", cfg.slowlogmaxlen);
+    cfg.latencythreshold = parser.GetData<int>("latency-monitor-threshold", cfg.latencythreshold);
+    cfg.tracesamplerate = parser.GetData<int>("trace-sample-rate", cfg.tracesamplerate);
+    cfg.hotkeyssamplerate = parser.GetData<int>("hotkeys-sample-rate", cfg.hotkeyssamplerate);
+    cfg.bigkeysscaninterval = parser.GetData<int>("bigkeys-scan-interval", cfg.bigkeysscaninterval);
+    cfg.bigkeysscankeys = parser.GetData<int>("bigkeys-scan-keys", cfg.bigkeysscankeys);
+    cfg.metricsport = parser.GetData<int>("metrics-port", cfg.metricsport);
     
     cfg.hz = parser.GetData<int>("hz", 10);
 
@@ -182,12 +234,27 @@ bool  LoadQedisConfig(const char* cfgFile, QConfig& cfg)
     // lru cache
     cfg.maxmemory = parser.GetData<uint64_t>("maxmemory", 2 * 1024 * 1024 * 1024UL);
     cfg.maxmemorySamples = parser.GetData<int>("maxmemory-samples", 5);
-    cfg.noeviction = (parser.GetData<QString>("maxmemory-policy", "noeviction") == "noeviction");
+    const QString policy = parser.GetData<QString>("maxmemory-policy", "noeviction");
+    cfg.noeviction = (policy == "noeviction");
+    cfg.tieredstorage = (policy == "tiered");
 
     cfg.backend = parser.GetData<int>("backend", BackEndNone);
     cfg.backendPath = parser.GetData<QString>("backendpath", cfg.backendPath);
     EraseQuotes(cfg.backendPath);
     cfg.backendHz = parser.GetData<int>("backendhz", 10);
+    cfg.backendcodec = CodecOf(parser.GetData<QString>("backend-codec", "none"));
+    cfg.backendloadthreads = parser.GetData<int>("backend-load-threads", 4);
+    cfg.backendfieldthreshold = parser.GetData<int>("backend-field-threshold", 1024);
+    cfg.backendfilter = (parser.GetData<QString>("backend-filter", "yes") == "yes");
+    cfg.backendshared = (parser.GetData<QString>("backend-shared", "no") == "yes");
+    cfg.backendcachesize = parser.GetData<uint64_t>("backend-cache-size", 0);
+    cfg.backendbloombits = parser.GetData<int>("backend-bloom-bits", 10);
+    cfg.backendwritebuffer = parser.GetData<uint64_t>("backend-write-buffer-size", 4 * 1024 * 1024);
+    cfg.backendcompression = (parser.GetData<QString>("backend-compression", "snappy") == "snappy");
+    cfg.backendwarmupfile = parser.GetData<QString>("backend-warmup-file", cfg.backendwarmupfile);
+    EraseQuotes(cfg.backendwarmupfile);
+    cfg.backendwarmupmemory = parser.GetData<uint64_t>("backend-warmup-memory", 256 * 1024 * 1024);
+    cfg.backendwarmupinterval = parser.GetData<int>("backend-warmup-interval", 300);
 
     // cluster
     cfg.enableCluster = parser.GetData<QString>("cluster", "off") == "on";
@@ -216,6 +283,20 @@ bool  QConfig::CheckArgs() const
     RETURN_IF_FAIL(maxmemorySamples > 0 && maxmemorySamples < 10);
     RETURN_IF_FAIL(backend >= BackEndNone && backend < BackEndMax);
     RETURN_IF_FAIL(backendHz >= 1 && backendHz <= 50);
+    RETURN_IF_FAIL(!tieredstorage || backend != BackEndNone);
+    RETURN_IF_FAIL(backendloadthreads >= 1 && backendloadthreads <= 64);
+    RETURN_IF_FAIL(backendfieldthreshold >= 0);
+    RETURN_IF_FAIL(backendbloombits >= 0 && backendbloombits <= 64);
+    RETURN_IF_FAIL(backendwritebuffer >= 64 * 1024);
+    RETURN_IF_FAIL(backendwarmupmemory == 0 || !backendwarmupfile.empty());
+    RETURN_IF_FAIL(backendwarmupinterval >= 0);
+    RETURN_IF_FAIL(rdbloadthreads >= 1 && rdbloadthreads <= 64);
+    RETURN_IF_FAIL(savethreads >= 1 && savethreads <= 64);
+    RETURN_IF_FAIL(rdbmaxdeltas >= 1);
+
+    RETURN_IF_FAIL(rdbcodec < QCodec_max);
+    RETURN_IF_FAIL(dumpcodec < QCodec_max);
+    RETURN_IF_FAIL(backendcodec < QCodec_max);
 
     if (enableCluster)
     {
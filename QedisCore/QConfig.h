@@ -4,6 +4,7 @@
 #include <unordered_map>
 #include <vector>
 #include "QString.h"
+#include "QCodec.h"
 
 namespace qedis
 {
@@ -42,15 +43,30 @@ struct QConfig
     bool      rdbcompression;   // yes
     bool      rdbchecksum;      // yes
     QString   rdbfullname;      // ./dump.rdb
+    bool      rdbforkless;      // no
+    int       rdbloadthreads;   // 4
+    int       savethreads;      // 4, threads to save rdb or rewrite aof
+    bool      rdbincremental;   // no, save points write deltas
+    int       rdbmaxdeltas;     // 16, merge deltas to base then
+    bool      rdblazyload;      // no, rdb has key index, load keys on access
+    QCodec    rdbcodec;         // lzf
+    QCodec    dumpcodec;        // lzf, DUMP and MIGRATE payload
     
     int       maxclients;       // 10000
     
     bool      appendonly;       // no
     QString   appendfilename;   // appendonly.aof
     int       appendfsync;      // no, everysec, always
+    bool      appendmultipart;  // no
     
     int       slowlogtime;      // 1000 microseconds
     int       slowlogmaxlen;    // 128
+    int       latencythreshold; // 0 ms, latency monitor; 0: off
+    int       tracesamplerate;  // 0, trace one of N requests; 0: off
+    int       hotkeyssamplerate;   // 16, count one of N key accesses; 0: off
+    int       bigkeysscaninterval; // 600 seconds between big key scans; 0: off
+    int       bigkeysscankeys;     // 1024 keys scanned per 100ms
+    int       metricsport;         // 0, prometheus /metrics listener; 0: off
     
     int       hz;               // 10  [1,500]
     
@@ -68,10 +84,23 @@ struct QConfig
     uint64_t maxmemory; // default 2GB
     int maxmemorySamples; // default 5
     bool noeviction; // default true
+    bool tieredstorage; // false, evict to backend instead of delete
 
     int backend; // enum BackEndType
     QString backendPath; 
     int backendHz; // the frequency of dump to backend
+    QCodec backendcodec; // none
+    int backendloadthreads; // 4, threads reading cold keys
+    int backendfieldthreshold; // 1024, collections stored by fields
+    bool backendfilter; // true, bloom filter of keys in backend
+    bool backendshared; // false, one leveldb for all dbs, keys prefixed by db
+    uint64_t backendcachesize; // 0, block cache shared by dbs; 0: leveldb default
+    int backendbloombits; // 10, leveldb bloom filter bits per key; 0: none
+    uint64_t backendwritebuffer; // 4MB, leveldb memtable size
+    bool backendcompression; // true, snappy
+    QString backendwarmupfile; // warmup.keys, hot keys loaded at start
+    uint64_t backendwarmupmemory; // 256MB, memory of hot keys; 0: no warm up
+    int backendwarmupinterval; // 300 seconds, save hot keys; 0: only at exit
 
     // cluster
     bool enableCluster = false;
@@ -1,20 +1,31 @@
 #include <sstream>
+#include <iostream>
+#include <map>
+#include <deque>
+#include <limits>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
 #include <unistd.h>
 #include <math.h>
 #include <arpa/inet.h>
 
 #include "QDB.h"
+#include "QSnapshot.h"
+#include "QCheckpoint.h"
+#include "QLazyLoader.h"
+#include "QLatencyMonitor.h"
+#include "QConfig.h"
 #include "Log/Logger.h"
+#include "Threads/ThreadPool.h"
 
 extern "C"
 {
-#include "lzf/lzf.h"
 #include "redisZipList.h"
 #include "redisIntset.h"
 }
 
-extern "C"
-uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
+#include "crc64.h"
 
 namespace qedis
 {
@@ -49,32 +60,132 @@ static const int8_t kEOF        = 0xFF;
 static const int8_t  k6Bits    = 0;
 static const int8_t  k14bits   = 1;
 static const int8_t  k32bits   = 2;
-static const int8_t  kSpecial  = 3;  //  the string may be interger, or lzf
+static const int8_t  kSpecial  = 3;  //  the string may be interger, or compressed
 static const int8_t  kLow6Bits = 0x3F;
 
 static const int8_t  kEnc8Bits  = 0;
 static const int8_t  kEnc16Bits = 1;
 static const int8_t  kEnc32Bits = 2;
 static const int8_t  kEncLZF    = 3;
+static const int8_t  kEncLZ4    = 4;  // qedis only
+
+// chunk index aux field: magic, count, chunks, then total length at the very
+// end, just before EOF, so loader can find it from the tail of file.
+static const char* const kChunkIndexKey = "qedis-chunks";
+static const char        kChunkIndexMagic[4] = {'Q', 'C', 'H', 'K'};
+static const size_t      kChunkEncodedSize = 4 + 8 * 4;
+static const uint64_t    kChunkBytes = 1 * 1024 * 1024;
+
+// keys of a range saved by one thread, at least
+static const size_t      kKeysPerSegment = 64 * 1024;
+
+// key index: slot array of each db in a slots aux field, then the index aux
+// field: magic, table count, tables(dbno, keys, slots, offset of slots); its
+// offset is appended to chunk index. Older files keep the slot arrays in the
+// index field itself, the loader only follows the offsets.
+static const char* const kKeyIndexKey = "qedis-keyindex";
+static const char* const kKeyIndexSlotsKey = "qedis-keyindex-slots";
+static const char        kKeyIndexMagic[4] = {'Q', 'K', 'I', 'X'};
+static const size_t      kKeyTableEncodedSize = 4 + 8 * 3;
+static const uint64_t    kMaxAuxBytes = 0xFFFFFFFF;
+
+// delta of incremental rdb: aux fields for deleted key and flushed db, the
+// db is selected before them
+static const char* const kDeletedKeyAux = "qedis-del";
+static const char* const kFlushedDbAux = "qedis-flushdb";
+
+uint64_t QDBKeyTable::Hash(const QString& key)
+{
+    // stable across processes, the index is persisted
+    return crc64(0, reinterpret_cast<const unsigned char*>(key.data()), key.size());
+}
 
-QDBSaver::QDBSaver(const char* qdbFile)
+QDBSaver::QDBSaver(const char* qdbFile) :
+    codec_(g_config.rdbcodec),
+    dbno_(-1),
+    keyIndex_(g_config.rdblazyload),
+    delta_(nullptr)
 {
     if (qdbFile && !qdb_.Open(qdbFile, false))
         ERR << "QDBSaver can not open file " << qdbFile;
 }
 
-void  QDBSaver::Save(const char* qdbFile)
+bool  QDBSaver::Save(const char* qdbFile, QSnapshot* snapshot)
 {
     char tmpFile[64] = "";
     snprintf(tmpFile, sizeof tmpFile, "tmp_qdb_file_%d", getpid());
     
+    bool succ = _SaveFile(qdbFile, tmpFile, [&]() {
+        if (delta_)
+            _SaveDelta(snapshot);
+        else if (snapshot)
+            _SaveSnapshot(*snapshot);
+        else
+            _SaveStore();
+
+        // keys are missing if the snapshot gave up half way
+        return !snapshot || !snapshot->IsAborted();
+    });
+
+    if (!succ)
+        ERR << "save rdb to " << qdbFile << " failed";
+
+    return succ;
+}
+
+bool QDBSaver::_SaveFile(const char* qdbFile, const char* tmpFile, const std::function<bool ()>& body)
+{
     if (!qdb_.Open(tmpFile, false))
-        assert (false);
+        return false;
     
     char buf[16];
     snprintf(buf, sizeof buf, "REDIS%04d", kQDBVersion);
     qdb_.Write(buf, 9);
 
+    if (!body())
+    {
+        qdb_.Close();
+        ::unlink(tmpFile);
+        return false;
+    }
+
+    // delta is loaded in order, it may delete keys
+    if (!delta_)
+        _SaveChunkIndex(_SaveKeyIndex());
+    qdb_.Write(&kEOF, 1);
+    
+    // crc 8 bytes
+    InputMemoryFile  file;
+    file.Open(tmpFile);
+    
+    auto len  = qdb_.Offset();
+    auto data = file.Read(len);
+    
+    const uint64_t crc = crc64(0, (const unsigned char* )data, len);
+    qdb_.Write(&crc, sizeof crc);
+    qdb_.Close();
+    
+    if (::rename(tmpFile, qdbFile) != 0)
+    {
+        perror("rename error");
+        return false;
+    }
+
+    return true;
+}
+
+void QDBSaver::_SaveStore()
+{
+    // ranges walk buckets, keys left in lazily loaded rdb first
+    QLazyLoader::Instance().LoadAll(-1);
+
+    if (g_config.savethreads > 1)
+    {
+        auto ranges = QSTORE.SplitBuckets(g_config.savethreads * 4, kKeysPerSegment);
+        if (ranges.size() > 1 && _SaveStoreParallel(ranges))
+            return;
+    }
+
     for (int dbno = 0; true; ++ dbno)
     {
         if (QSTORE.SelectDB(dbno) == -1)
@@ -83,48 +194,372 @@ void  QDBSaver::Save(const char* qdbFile)
         if (QSTORE.DBSize() == 0)
             continue;  // But redis will save empty db
         
-        qdb_.Write(&kSelectDB, 1);
-        SaveLength(dbno);
+        _SaveSelectDB(dbno, QSTORE.DBSize(), QSTORE.ExpiresSize());
         
         uint64_t now = ::Now();
         for (const auto& kv : QSTORE)
         {
             int64_t ttl = QSTORE.TTL(kv.first, now);
             if (ttl > 0)
-            {
                 ttl += now;
+            else if (ttl == QStore::ExpireResult::expired)
+                continue;
+            else
+                ttl = 0;
 
-                qdb_.Write(&kExpireMs, 1);
-                qdb_.Write(&ttl, sizeof ttl);
+            _SaveKeyValue(kv.first, kv.second, ttl);
+        }
+    }
+}
+
+bool QDBSaver::_SaveStoreParallel(const std::vector<QStore::BucketRange>& ranges)
+{
+    // not ThreadPool: in fork child, only the forking thread exists
+    std::vector<QString> files(ranges.size());
+    for (size_t i = 0; i < ranges.size(); ++ i)
+    {
+        char name[64];
+        snprintf(name, sizeof name, "tmp_qdb_seg_%d_%zu", getpid(), i);
+        files[i] = name;
+        ::unlink(name);
+    }
+
+    std::vector<std::unique_ptr<QDBSaver> > segments(ranges.size());
+    std::vector<size_t> sizes(ranges.size(), 0);
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    const uint64_t now = ::Now();
+
+    // each thread encodes ranges to their own segment files
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next ++) < ranges.size() && !failed)
+        {
+            const auto& range = ranges[i];
+            segments[i].reset(new QDBSaver);
+
+            QDBSaver& seg = *segments[i];
+            if (!seg.qdb_.Open(files[i].c_str(), false))
+            {
+                failed = true;
+                break;
             }
-            else if (ttl == QStore::ExpireResult::expired)
+
+            seg.codec_ = codec_;
+            seg.dbno_ = range.dbno;
+
+            const QDB& db = QSTORE.GetDb(range.dbno);
+            for (size_t bucket = range.begin; bucket < range.end; ++ bucket)
             {
+                for (auto it = db.begin(bucket); it != db.end(bucket); ++ it)
+                {
+                    const uint64_t expireAt = QSTORE.ExpireAt(range.dbno, it->first);
+                    if (expireAt != 0 && expireAt <= now)
+                        continue;
+
+                    seg._SaveKeyValue(it->first, it->second, static_cast<int64_t>(expireAt));
+                }
+            }
+
+            sizes[i] = seg.qdb_.Offset();
+            seg.qdb_.Close();
+        }
+    };
+
+    const size_t threads = std::min<size_t>(g_config.savethreads, ranges.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; ++ i)
+        workers.emplace_back(worker);
+
+    for (auto& t : workers)
+        t.join();
+
+    // map all before writing any, so a failure leaves qdb_ for the serial save;
+    // a range may have no key, its segment is empty
+    std::vector<std::unique_ptr<InputMemoryFile> > maps(ranges.size());
+    for (size_t i = 0; i < ranges.size() && !failed; ++ i)
+    {
+        if (sizes[i] == 0)
+            continue;
+
+        maps[i].reset(new InputMemoryFile);
+        size_t len = sizes[i];
+        if (!maps[i]->Open(files[i].c_str()) || !maps[i]->Read(len) || len != sizes[i])
+        {
+            ERR << "read rdb segment " << files[i] << " failed, expect bytes " << sizes[i];
+            failed = true;
+        }
+    }
+
+    if (!failed)
+    {
+        // join segments, chunks and key index are shifted to file offsets
+        for (size_t i = 0; i < ranges.size(); ++ i)
+        {
+            const int dbno = ranges[i].dbno;
+            if (dbno != dbno_)
+            {
+                QSTORE.SelectDB(dbno);
+                _SaveSelectDB(dbno, QSTORE.DBSize(), QSTORE.ExpiresSize());
+            }
+
+            QDBSaver& seg = *segments[i];
+            const uint64_t shift = qdb_.Offset();
+
+            if (maps[i])
+            {
+                size_t len = sizes[i];
+                qdb_.Write(maps[i]->Read(len), len);
+                maps[i].reset();
+            }
+
+            for (auto chunk : seg.chunks_)
+            {
+                chunk.begin += shift;
+                chunk.end += shift;
+                chunks_.push_back(chunk);
+            }
+
+            for (auto& refs : seg.keyRefs_)
+            {
+                if (keyRefs_.empty() || keyRefs_.back().first != refs.first)
+                    keyRefs_.emplace_back(refs.first, std::vector<KeyRef>());
+
+                auto& dst = keyRefs_.back().second;
+                for (auto ref : refs.second)
+                {
+                    ref.offset += shift;
+                    dst.push_back(ref);
+                }
+            }
+
+            segments[i].reset();
+        }
+    }
+
+    for (const auto& file : files)
+        ::unlink(file.c_str());
+
+    return !failed;
+}
+
+void QDBSaver::_SaveSnapshot(QSnapshot& snapshot)
+{
+    for (int dbno = 0; dbno < snapshot.DbNum(); ++ dbno)
+    {
+        bool selected = false;
+        snapshot.ForEach(dbno, [&](const QString& key, const QObject& obj, int64_t expireAt) {
+            if (!selected)
+            {
+                selected = true;
+                _SaveSelectDB(dbno, snapshot.DbSize(dbno), snapshot.ExpiresSize(dbno));
+            }
+
+            _SaveKeyValue(key, obj, expireAt);
+        });
+    }
+}
+
+void QDBSaver::_SaveDelta(QSnapshot* snapshot)
+{
+    auto save = [this](const QString& key, const QObject& obj, int64_t expireAt) {
+        _SaveKeyValue(key, obj, expireAt);
+    };
+    auto erase = [this](const QString& key) {
+        _SaveAux(kDeletedKeyAux, key);
+    };
+
+    for (int dbno = 0; dbno < static_cast<int>(delta_->size()); ++ dbno)
+    {
+        const auto& delta = (*delta_)[dbno];
+        if (!delta.flushed && delta.keys.empty())
+            continue;
+
+        _SaveSelectDB(dbno, delta.keys.size(), 0);
+        if (delta.flushed)
+            _SaveAux(kFlushedDbAux, "");
+
+        if (snapshot)
+        {
+            snapshot->ForEachChanged(dbno, delta.keys, save, erase);
+            continue;
+        }
+
+        // fork child, the keyspace is frozen
+        QSTORE.SelectDB(dbno);
+
+        const uint64_t now = ::Now();
+        for (const auto& key : delta.keys)
+        {
+            QObject* obj = nullptr;
+            if (QSTORE.GetValue(key, obj, false) != QError_ok)
+            {
+                erase(key);
                 continue;
             }
 
-            SaveType(kv.second);
-            SaveKey(kv.first);
-            SaveObject(kv.second);
+            int64_t ttl = QSTORE.TTL(key, now);
+            save(key, *obj, ttl > 0 ? ttl + now : 0);
         }
     }
+}
 
-    qdb_.Write(&kEOF, 1);
-    
-    // crc 8 bytes
-    InputMemoryFile  file;
-    file.Open(tmpFile);
-    
-    auto len  = qdb_.Offset();
-    auto data = file.Read(len);
-    
-    const uint64_t crc = crc64(0, (const unsigned char* )data, len);
-    qdb_.Write(&crc, sizeof crc);
-    
-    if (::rename(tmpFile, qdbFile) != 0)
+void QDBSaver::_SaveAux(const QString& key, const QString& value)
+{
+    qdb_.Write(&kAux, 1);
+    SaveString(key);
+    SaveString(value);
+}
+
+void QDBSaver::_SaveSelectDB(int dbno, size_t dbsize, size_t expiresize)
+{
+    qdb_.Write(&kSelectDB, 1);
+    SaveLength(dbno);
+
+    qdb_.Write(&kResizeDb, 1);
+    SaveLength(dbsize);
+    SaveLength(expiresize);
+
+    dbno_ = dbno;
+}
+
+void QDBSaver::_SaveKeyValue(const QString& key, const QObject& obj, int64_t expireAt)
+{
+    const uint64_t offset = qdb_.Offset();
+    if (chunks_.empty() ||
+        chunks_.back().dbno != dbno_ ||
+        offset - chunks_.back().begin >= kChunkBytes)
     {
-        perror("rename error");
-        assert (false);
+        chunks_.push_back(QDBChunk{dbno_, offset, offset, 0, 0});
+    }
+
+    if (expireAt > 0)
+    {
+        qdb_.Write(&kExpireMs, 1);
+        qdb_.Write(&expireAt, sizeof expireAt);
+    }
+
+    SaveType(obj);
+    SaveKey(key);
+    SaveObject(obj);
+
+    if (keyIndex_ && !delta_)
+    {
+        if (keyRefs_.empty() || keyRefs_.back().first != dbno_)
+            keyRefs_.emplace_back(dbno_, std::vector<KeyRef>());
+
+        keyRefs_.back().second.push_back(KeyRef{QDBKeyTable::Hash(key), offset});
+    }
+
+    auto& chunk = chunks_.back();
+    chunk.end = qdb_.Offset();
+    ++ chunk.keys;
+    if (expireAt > 0)
+        ++ chunk.expires;
+}
+
+void QDBSaver::_SaveChunkIndex(uint64_t keyIndex)
+{
+    if (chunks_.empty())
+        return;
+
+    QString value(kChunkIndexMagic, sizeof kChunkIndexMagic);
+    const uint32_t count = static_cast<uint32_t>(chunks_.size());
+    value.append((const char*)&count, sizeof count);
+
+    for (const auto& chunk : chunks_)
+    {
+        const uint32_t dbno = static_cast<uint32_t>(chunk.dbno);
+        value.append((const char*)&dbno, sizeof dbno);
+        value.append((const char*)&chunk.begin, sizeof chunk.begin);
+        value.append((const char*)&chunk.end, sizeof chunk.end);
+        value.append((const char*)&chunk.keys, sizeof chunk.keys);
+        value.append((const char*)&chunk.expires, sizeof chunk.expires);
+    }
+
+    if (keyIndex != 0)
+        value.append((const char*)&keyIndex, sizeof keyIndex);
+
+    const uint64_t total = value.size() + sizeof(uint64_t);
+    value.append((const char*)&total, sizeof total);
+
+    // raw string, never compress it
+    qdb_.Write(&kAux, 1);
+    SaveString(kChunkIndexKey);
+    SaveLength(value.size());
+    qdb_.Write(value.data(), value.size());
+}
+
+uint64_t QDBSaver::_SaveKeyIndex()
+{
+    if (keyRefs_.empty())
+        return 0;
+
+    std::vector<uint64_t> slotCounts;
+    for (const auto& refs : keyRefs_)
+    {
+        // load factor no more than 0.5
+        uint64_t slots = 2;
+        while (slots < refs.second.size() * 2)
+            slots <<= 1;
+
+        // an aux length is 32 bits
+        if (slots * sizeof(uint64_t) > kMaxAuxBytes)
+        {
+            WRN << "Too many keys in db " << refs.first << " for rdb key index, skip it";
+            keyRefs_.clear();
+            return 0;
+        }
+
+        slotCounts.push_back(slots);
+    }
+
+    // slots of each db in its own aux
+    std::vector<uint64_t> slotsOffsets;
+    for (size_t i = 0; i < keyRefs_.size(); ++ i)
+    {
+        // raw string, never compress it
+        qdb_.Write(&kAux, 1);
+        SaveString(kKeyIndexSlotsKey);
+        SaveLength(slotCounts[i] * sizeof(uint64_t));
+        slotsOffsets.push_back(qdb_.Offset());
+
+        const uint64_t mask = slotCounts[i] - 1;
+        std::vector<uint64_t> slots(slotCounts[i], 0);
+        for (const auto& ref : keyRefs_[i].second)
+        {
+            uint64_t pos = ref.hash & mask;
+            while (slots[pos] != 0)
+                pos = (pos + 1) & mask;
+
+            // offset is never 0, after the header
+            slots[pos] = (QDBKeyTable::Tag(ref.hash) << 48) | ref.offset;
+        }
+
+        qdb_.Write(slots.data(), slots.size() * sizeof(uint64_t));
+    }
+
+    const uint32_t count = static_cast<uint32_t>(keyRefs_.size());
+    qdb_.Write(&kAux, 1);
+    SaveString(kKeyIndexKey);
+    SaveLength(sizeof kKeyIndexMagic + sizeof count + count * kKeyTableEncodedSize);
+
+    const uint64_t indexOffset = qdb_.Offset();
+    qdb_.Write(kKeyIndexMagic, sizeof kKeyIndexMagic);
+    qdb_.Write(&count, sizeof count);
+
+    for (size_t i = 0; i < keyRefs_.size(); ++ i)
+    {
+        const uint32_t dbno = static_cast<uint32_t>(keyRefs_[i].first);
+        const uint64_t keys = keyRefs_[i].second.size();
+        qdb_.Write(&dbno, sizeof dbno);
+        qdb_.Write(&keys, sizeof keys);
+        qdb_.Write(&slotCounts[i], sizeof slotCounts[i]);
+        qdb_.Write(&slotsOffsets[i], sizeof slotsOffsets[i]);
     }
+
+    keyRefs_.clear();
+    return indexOffset;
 }
 
 void QDBSaver::SaveType(const QObject& obj)
@@ -284,7 +719,7 @@ void QDBSaver::SaveString(const QString& str)
         }
     }
     
-    if (!SaveLZFString(str))
+    if (!SaveCompressedString(str))
     {
         SaveLength(str.size());
         qdb_.Write(str.data(), str.size());
@@ -350,32 +785,36 @@ void QDBSaver::SaveString(int64_t intVal)
 }
     
 
-bool QDBSaver::SaveLZFString(const QString& str)
+bool QDBSaver::SaveCompressedString(const QString& str)
 {
-    if (str.size() < 20)
-        return false;
-        
-    unsigned outlen = static_cast<unsigned>(str.size() - 4);
-    std::unique_ptr<char []> outBuf(new char[outlen + 1]);
-        
-    auto compressLen = lzf_compress((const void*)str.data(), static_cast<unsigned>(str.size()),
-                                        outBuf.get(), outlen);
-    
-    if (compressLen == 0)
+    int8_t encoding;
+    switch (codec_)
     {
-        ERR << "compress len = 0";
-        return false;
+        case QCodec_lzf:
+            encoding = kEncLZF;
+            break;
+
+        case QCodec_lz4:
+            encoding = kEncLZ4;
+            break;
+
+        default:
+            return false;
     }
+
+    QString compressed;
+    if (!Compress(codec_, str.data(), str.size(), compressed))
+        return false;
     
-    int8_t specialByte = static_cast<int8_t>(kSpecial << 6) | kEncLZF;
+    int8_t specialByte = static_cast<int8_t>(kSpecial << 6) | encoding;
     qdb_.Write(&specialByte, 1);
     
     // compress len + raw len + str data;
-    SaveLength(compressLen);
+    SaveLength(compressed.size());
     SaveLength(str.size());
-    qdb_.Write(outBuf.get(), compressLen);
+    qdb_.Write(compressed.data(), compressed.size());
     
-    DBG << "compress len " << compressLen << ", raw len " << str.size();
+    DBG << CodecName(codec_) << " compress len " << compressed.size() << ", raw len " << str.size();
     
     return true;
 }
@@ -383,7 +822,8 @@ bool QDBSaver::SaveLZFString(const QString& str)
 
 void QDBSaver::SaveDoneHandler(int exitRet, int whatSignal)
 {
-    if (exitRet == 0 && whatSignal == 0)
+    const bool succ = (exitRet == 0 && whatSignal == 0);
+    if (succ)
     {
         INF << "save rdb success";
         g_lastQDBSave = time(NULL);
@@ -395,6 +835,210 @@ void QDBSaver::SaveDoneHandler(int exitRet, int whatSignal)
     }
     
     g_qdbPid = -1;
+    QCheckpoint::Instance().OnSaveDone(succ);
+}
+
+bool QDBSaver::BackgroundSave(const char* qdbFile, const std::vector<QCheckpointDelta>* delta)
+{
+    assert (g_qdbPid == -1);
+
+    QCheckpoint::Instance().OnSaveStart(delta != nullptr);
+
+    if (g_config.rdbforkless)
+    {
+        if (!QSnapshot::Instance().Start(qdbFile, delta))
+        {
+            QCheckpoint::Instance().OnSaveDone(false);
+            return false;
+        }
+
+        g_qdbPid = kQDBSnapshotPid;
+        return true;
+    }
+
+    if (!_ForkSave(qdbFile, delta))
+    {
+        QCheckpoint::Instance().OnSaveDone(false);
+        return false;
+    }
+
+    return true;
+}
+
+bool QDBSaver::RetryByFork(const char* qdbFile, const std::vector<QCheckpointDelta>* delta)
+{
+    // take changes again, so the child saves a delta of one point in time
+    QCheckpoint::Instance().OnSaveDone(false);
+    QCheckpoint::Instance().OnSaveStart(delta != nullptr);
+
+    return _ForkSave(qdbFile, delta);
+}
+
+bool QDBSaver::_ForkSave(const char* qdbFile, const std::vector<QCheckpointDelta>* delta)
+{
+    const uint64_t forkStart = ::NowUs();
+    int ret = fork();
+    if (ret == 0)
+    {
+        bool succ;
+        {
+            QDBSaver  qdb;
+            qdb.SetDelta(delta);
+            succ = qdb.Save(qdbFile);
+            std::cerr << "child save rdb done, exiting child\n";
+        }  //  make qdb to be destructed before exit
+        _exit(succ ? 0 : 1);
+    }
+    else if (ret == -1)
+    {
+        return false;
+    }
+
+    QLatencyMonitor::Instance().OnFork(::NowUs() - forkStart);
+    g_qdbPid = ret;
+    return true;
+}
+
+bool QDBSaver::Compact(const QString& base, const std::vector<QString>& deltas, const QString& qdbFile)
+{
+    using Entry = QDBLoader::Entry;
+
+    // changes of all deltas, the later wins
+    struct DbChanges
+    {
+        bool flushed = false;
+        std::unordered_map<QString, Entry, Hash> keys;
+    };
+    std::vector<DbChanges> changes(g_config.databases);
+
+    for (const auto& file : deltas)
+    {
+        std::vector<Entry> entries;
+        QDBLoader loader;
+        if (loader._LoadRecords(file.c_str(), entries) != 0)
+        {
+            ERR << "Compact rdb: load delta " << file << " failed";
+            return false;
+        }
+
+        for (auto& entry : entries)
+        {
+            if (entry.dbno < 0 || entry.dbno >= static_cast<int>(changes.size()))
+            {
+                ERR << "Compact rdb: bad db " << entry.dbno << " in " << file;
+                return false;
+            }
+
+            auto& db = changes[entry.dbno];
+            if (entry.obj.type == QType_invalid && entry.key.empty())
+            {
+                db.flushed = true;
+                db.keys.clear();
+            }
+            else
+            {
+                QString key = entry.key;
+                db.keys[key] = std::move(entry);
+            }
+        }
+    }
+
+    InputMemoryFile file;
+    if (!file.Open(base.c_str()))
+    {
+        ERR << "Compact rdb: open base " << base << " failed";
+        return false;
+    }
+
+    size_t size = std::numeric_limits<size_t>::max();
+    const char* data = file.Read(size);
+
+    // base saved by qedis is decoded chunk by chunk, others at once
+    std::vector<QDBChunk> chunks;
+    std::vector<Entry> baseEntries;
+    const bool chunked = QDBLoader::_LoadChunkIndex(data, size, chunks);
+    if (!chunked)
+    {
+        QDBLoader loader;
+        if (loader._LoadRecords(base.c_str(), baseEntries) != 0)
+        {
+            ERR << "Compact rdb: load base " << base << " failed";
+            return false;
+        }
+    }
+
+    char tmpFile[64] = "";
+    snprintf(tmpFile, sizeof tmpFile, "tmp_qdb_compact_%d", getpid());
+
+    const uint64_t now = ::Now();
+    QDBSaver qdb;
+    try
+    {
+        return qdb._SaveFile(qdbFile.c_str(), tmpFile, [&]() {
+            for (int dbno = 0; dbno < static_cast<int>(changes.size()); ++ dbno)
+            {
+                auto& db = changes[dbno];
+
+                size_t hint = db.keys.size();
+                for (const auto& chunk : chunks)
+                {
+                    if (chunk.dbno == dbno)
+                        hint += chunk.keys;
+                }
+
+                bool selected = false;
+                auto save = [&](const Entry& entry) {
+                    if (entry.obj.type == QType_invalid ||
+                        (entry.expireAt > 0 && entry.expireAt <= static_cast<int64_t>(now)))
+                        return;
+
+                    if (!selected)
+                    {
+                        selected = true;
+                        qdb._SaveSelectDB(dbno, hint, 0);
+                    }
+
+                    qdb._SaveKeyValue(entry.key, entry.obj, entry.expireAt);
+                };
+
+                if (!db.flushed)
+                {
+                    for (const auto& chunk : chunks)
+                    {
+                        if (chunk.dbno != dbno)
+                            continue;
+
+                        std::vector<Entry> entries;
+                        QDBLoader loader(data + chunk.begin, chunk.end - chunk.begin);
+                        loader._LoadEntries(entries);
+
+                        for (const auto& entry : entries)
+                        {
+                            if (!db.keys.count(entry.key))
+                                save(entry);
+                        }
+                    }
+
+                    for (const auto& entry : baseEntries)
+                    {
+                        if (entry.dbno == dbno && !db.keys.count(entry.key))
+                            save(entry);
+                    }
+                }
+
+                for (const auto& kv : db.keys)
+                    save(kv.second);
+            }
+
+            return true;
+        });
+    }
+    catch (const std::runtime_error& e)
+    {
+        ERR << "Compact rdb with exception: " << e.what();
+        ::unlink(tmpFile);
+        return false;
+    }
 }
 
 
@@ -426,6 +1070,17 @@ int QDBLoader::Load(const char *filename)
     {
         return - __LINE__;
     }
+
+    if (g_config.rdbloadthreads > 1)
+    {
+        size_t size = std::numeric_limits<size_t>::max();
+        data = qdb_.Read(size);
+
+        std::vector<QDBChunk> chunks;
+        if (_LoadChunkIndex(data, size, chunks))
+            return _LoadParallel(data, chunks);
+    }
+
     qdb_.Skip(9);
     
     //  SELECTDB + dbno
@@ -676,6 +1331,7 @@ QObject QDBLoader::LoadSpecialStringObject(size_t  specialVal)
         }
             
         case kEncLZF:
+        case kEncLZ4:
         {
             isInt = false;
             break;
@@ -688,7 +1344,7 @@ QObject QDBLoader::LoadSpecialStringObject(size_t  specialVal)
     if (isInt)
         return QObject::CreateString(val);
     else
-        return QObject::CreateString(LoadLZFString());
+        return QObject::CreateString(LoadCompressedString(specialVal == kEncLZF ? QCodec_lzf : QCodec_lz4));
 }
 
 QString QDBLoader::LoadString(size_t strLen)
@@ -700,7 +1356,7 @@ QString QDBLoader::LoadString(size_t strLen)
 }
 
 
-QString QDBLoader::LoadLZFString()
+QString QDBLoader::LoadCompressedString(QCodec codec)
 {
     bool special;
     size_t compressLen = LoadLength(special);
@@ -721,8 +1377,7 @@ QString QDBLoader::LoadLZFString()
     
     QString val;
     val.resize(rawLen);
-    if (lzf_decompress(compressStr, static_cast<unsigned>(compressLen),
-                       &val[0], rawLen) == 0)
+    if (!Decompress(codec, compressStr, compressLen, &val[0], rawLen))
     {
         ERR << "decompress error";
         return QString();
@@ -1221,12 +1876,463 @@ void QDBLoader::_LoadResizeDB()
     if (special)
         throw std::runtime_error("Should not be special when LoadLength");
 
-    // Qedis just ignore this
-    (void)special;
-    (void)dbsize;
-    (void)expiresize;
+    QSTORE.ResizeDB(dbsize, expiresize);
+}
+
+bool QDBLoader::_LoadChunkIndex(const char* data, size_t size, std::vector<QDBChunk>& chunks,
+                                uint64_t* keyIndex)
+{
+    // ... + index + total(8 bytes) + EOF + crc(8 bytes)
+    const size_t kTail = 1 + 8;
+    const size_t kMinIndex = sizeof kChunkIndexMagic + 4 + 8;
+    if (size < 9 + kMinIndex + kTail || data[size - kTail] != kEOF)
+        return false;
+
+    uint64_t total;
+    memcpy(&total, data + size - kTail - sizeof total, sizeof total);
+    if (total < kMinIndex || total > size - 9 - kTail)
+        return false;
+
+    const char* index = data + size - kTail - total;
+    if (memcmp(index, kChunkIndexMagic, sizeof kChunkIndexMagic) != 0)
+        return false;
+
+    uint32_t count;
+    memcpy(&count, index + sizeof kChunkIndexMagic, sizeof count);
+
+    // key index offset is optional
+    const uint64_t chunksTotal = kMinIndex + static_cast<uint64_t>(count) * kChunkEncodedSize;
+    if (total != chunksTotal && total != chunksTotal + sizeof(uint64_t))
+        return false;
+
+    if (keyIndex)
+    {
+        *keyIndex = 0;
+        if (total != chunksTotal)
+            memcpy(keyIndex, index + chunksTotal - sizeof total, sizeof *keyIndex);
+    }
+
+    chunks.resize(count);
+
+    const char* ptr = index + sizeof kChunkIndexMagic + sizeof count;
+    for (auto& chunk : chunks)
+    {
+        uint32_t dbno;
+        memcpy(&dbno, ptr, sizeof dbno);
+        ptr += sizeof dbno;
+        chunk.dbno = static_cast<int>(dbno);
+
+        memcpy(&chunk.begin, ptr, sizeof chunk.begin);
+        ptr += sizeof chunk.begin;
+        memcpy(&chunk.end, ptr, sizeof chunk.end);
+        ptr += sizeof chunk.end;
+        memcpy(&chunk.keys, ptr, sizeof chunk.keys);
+        ptr += sizeof chunk.keys;
+        memcpy(&chunk.expires, ptr, sizeof chunk.expires);
+        ptr += sizeof chunk.expires;
+
+        if (chunk.begin < 9 || chunk.begin > chunk.end || chunk.end > size)
+        {
+            ERR << "Bad rdb chunk [" << chunk.begin << ", " << chunk.end << ")";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool QDBLoader::LoadKeyIndex(const char* data, size_t size, std::vector<QDBKeyTable>& tables)
+{
+    std::vector<QDBChunk> chunks;
+    uint64_t offset = 0;
+    if (!_LoadChunkIndex(data, size, chunks, &offset) || offset == 0)
+        return false;
+
+    const size_t kMinIndex = sizeof kKeyIndexMagic + sizeof(uint32_t);
+    if (offset < 9 || offset + kMinIndex > size ||
+        memcmp(data + offset, kKeyIndexMagic, sizeof kKeyIndexMagic) != 0)
+    {
+        ERR << "Bad rdb key index at " << offset;
+        return false;
+    }
+
+    uint32_t count;
+    memcpy(&count, data + offset + sizeof kKeyIndexMagic, sizeof count);
+    if (offset + kMinIndex + static_cast<uint64_t>(count) * kKeyTableEncodedSize > size)
+        return false;
+
+    tables.resize(count);
+
+    const char* ptr = data + offset + kMinIndex;
+    for (auto& table : tables)
+    {
+        uint32_t dbno;
+        memcpy(&dbno, ptr, sizeof dbno);
+        ptr += sizeof dbno;
+        table.dbno = static_cast<int>(dbno);
+
+        memcpy(&table.keys, ptr, sizeof table.keys);
+        ptr += sizeof table.keys;
+        memcpy(&table.slots, ptr, sizeof table.slots);
+        ptr += sizeof table.slots;
+
+        uint64_t slotsOffset;
+        memcpy(&slotsOffset, ptr, sizeof slotsOffset);
+        ptr += sizeof slotsOffset;
+
+        if (table.slots == 0 || (table.slots & (table.slots - 1)) != 0 ||
+            table.keys > table.slots ||
+            slotsOffset > size || table.slots > (size - slotsOffset) / sizeof(uint64_t))
+        {
+            ERR << "Bad rdb key table of db " << dbno;
+            return false;
+        }
+
+        table.data = data + slotsOffset;
+    }
+
+    return true;
+}
+
+bool QDBLoader::LoadRecordHeader(int8_t& type, QString& key, int64_t& expireAt)
+{
+    try {
+        expireAt = 0;
+        type = LoadByte();
+        if (type == kExpireMs)
+        {
+            expireAt = qdb_.Read<int64_t>();
+            type = LoadByte();
+        }
+        else if (type == kExpire)
+        {
+            expireAt = qdb_.Read<int64_t>() * 1000;
+            type = LoadByte();
+        }
+
+        key = LoadKey();
+    }
+    catch (const std::runtime_error& e) {
+        ERR << "LoadRecordHeader with exception: " << e.what();
+        return false;
+    }
+
+    return true;
 }
 
+int QDBLoader::_LoadParallel(const char* data, const std::vector<QDBChunk>& chunks)
+{
+    // pre-size tables
+    std::map<int, std::pair<size_t, size_t> > sizes;
+    for (const auto& chunk : chunks)
+    {
+        sizes[chunk.dbno].first += chunk.keys;
+        sizes[chunk.dbno].second += chunk.expires;
+    }
+
+    for (const auto& kv : sizes)
+    {
+        if (kv.first > kMaxDbNum || QSTORE.SelectDB(kv.first) == -1)
+        {
+            ERR << "DB NUMBER is differ from RDB file " << kv.first;
+            return __LINE__;
+        }
+
+        QSTORE.ResizeDB(kv.second.first, kv.second.second);
+    }
+
+    struct Batch
+    {
+        int dbno;
+        std::vector<Entry> entries;
+    };
+
+    const int threads = std::min<int>(g_config.rdbloadthreads, static_cast<int>(chunks.size()));
+    const size_t kMaxPending = static_cast<size_t>(threads) * 2;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Batch> batches;
+    std::atomic<size_t> next(0);
+    int running = threads;
+    QString error;
+
+    // workers decode chunks, main thread insert them to db
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next ++) < chunks.size())
+        {
+            const auto& chunk = chunks[i];
+
+            Batch batch;
+            batch.dbno = chunk.dbno;
+            batch.entries.reserve(chunk.keys);
+
+            QDBLoader loader(data + chunk.begin, chunk.end - chunk.begin);
+            try {
+                loader._LoadEntries(batch.entries);
+            }
+            catch (const std::runtime_error& e) {
+                std::unique_lock<std::mutex> guard(mutex);
+                error = e.what();
+                next = chunks.size();
+                break;
+            }
+
+            std::unique_lock<std::mutex> guard(mutex);
+            cond.wait(guard, [&]() { return batches.size() < kMaxPending || !error.empty(); });
+            batches.push_back(std::move(batch));
+            cond.notify_all();
+        }
+
+        std::unique_lock<std::mutex> guard(mutex);
+        -- running;
+        cond.notify_all();
+    };
+
+    std::vector<std::future<void> > futures;
+    for (int i = 0; i < threads; ++ i)
+    {
+        futures.push_back(ThreadPool::Instance().ExecuteTask(worker));
+        if (!futures.back().valid())
+        {
+            std::unique_lock<std::mutex> guard(mutex);
+            -- running;
+        }
+    }
+
+    const uint64_t now = ::Now();
+    size_t loaded = 0;
+    while (true)
+    {
+        Batch batch;
+        {
+            std::unique_lock<std::mutex> guard(mutex);
+            cond.wait(guard, [&]() { return !batches.empty() || running == 0; });
+            if (batches.empty())
+                break;
+
+            batch = std::move(batches.front());
+            batches.pop_front();
+            cond.notify_all();
+        }
+
+        QSTORE.SelectDB(batch.dbno);
+        for (auto& entry : batch.entries)
+        {
+            if (entry.expireAt > 0 && entry.expireAt <= static_cast<int64_t>(now))
+                continue;
+
+            QSTORE.SetValue(entry.key, std::move(entry.obj));
+            if (entry.expireAt > 0)
+                QSTORE.SetExpire(entry.key, entry.expireAt);
+
+            ++ loaded;
+        }
+    }
+
+    for (auto& f : futures)
+    {
+        if (f.valid())
+            f.wait();
+    }
+
+    if (!error.empty())
+    {
+        ERR << "Parallel load rdb with exception: " << error;
+        return - __LINE__;
+    }
+
+    INF << "Parallel load rdb " << loaded << " keys, " << chunks.size() << " chunks, " << threads << " threads";
+    return 0;
+}
+
+void QDBLoader::_LoadEntries(std::vector<Entry>& entries)
+{
+    int64_t absTimeout = 0;
+    while (true)
+    {
+        size_t avail = 1;
+        if (!qdb_.Read(avail))
+            break;
+
+        int8_t indicator = LoadByte();
+        switch (indicator)
+        {
+            case kExpireMs:
+                absTimeout = qdb_.Read<int64_t>();
+                break;
+
+            case kExpire:
+                absTimeout = qdb_.Read<int64_t>();
+                absTimeout *= 1000;
+                break;
+
+            case kTypeString:
+            case kTypeList:
+            case kTypeZipList:
+            case kTypeSet:
+            case kTypeIntSet:
+            case kTypeHash:
+            case kTypeHashZipList:
+            case kTypeZSet:
+            case kTypeZSetZipList:
+            case kTypeQuickList:
+            {
+                Entry entry;
+                entry.key = LoadKey();
+                entry.obj = LoadObject(indicator);
+                entry.expireAt = absTimeout;
+
+                if (entry.obj.type == QType_invalid || absTimeout < 0)
+                    throw std::runtime_error("Bad object in chunk, key " + entry.key);
+
+                entries.push_back(std::move(entry));
+                absTimeout = 0;
+                break;
+            }
+
+            default:
+                throw std::runtime_error("Unexpected type in chunk " + std::to_string(indicator));
+        }
+    }
+}
+
+int QDBLoader::_LoadRecords(const char* filename, std::vector<Entry>& entries)
+{
+    if (!qdb_.Open(filename))
+        return - __LINE__;
+
+    size_t len = 9;
+    const char* data = qdb_.Read(len);
+
+    long qdbversion;
+    if (len != 9 || !Strtol(data + 5, 4, &qdbversion) || qdbversion < 6)
+        return - __LINE__;
+
+    qdb_.Skip(9);
+
+    int dbno = 0;
+    int64_t absTimeout = 0;
+    try {
+        while (true)
+        {
+            bool special;
+            int8_t indicator = LoadByte();
+            switch (indicator)
+            {
+                case kEOF:
+                    return 0;
+
+                case kSelectDB:
+                    dbno = static_cast<int>(LoadLength(special));
+                    break;
+
+                case kResizeDb:
+                    LoadLength(special);
+                    LoadLength(special);
+                    break;
+
+                case kAux:
+                {
+                    QString auxkey = _LoadGenericString();
+                    QString auxvalue = _LoadGenericString();
+                    if (auxkey != kDeletedKeyAux && auxkey != kFlushedDbAux)
+                        break;
+
+                    Entry entry;
+                    if (auxkey == kDeletedKeyAux)
+                        entry.key = std::move(auxvalue);
+                    entry.dbno = dbno;
+                    entries.push_back(std::move(entry));
+                    break;
+                }
+
+                case kExpireMs:
+                    absTimeout = qdb_.Read<int64_t>();
+                    break;
+
+                case kExpire:
+                    absTimeout = qdb_.Read<int64_t>();
+                    absTimeout *= 1000;
+                    break;
+
+                case kTypeString:
+                case kTypeList:
+                case kTypeZipList:
+                case kTypeSet:
+                case kTypeIntSet:
+                case kTypeHash:
+                case kTypeHashZipList:
+                case kTypeZipMap:
+                case kTypeZSet:
+                case kTypeZSetZipList:
+                case kTypeQuickList:
+                {
+                    Entry entry;
+                    entry.key = LoadKey();
+                    entry.obj = LoadObject(indicator);
+                    entry.expireAt = absTimeout;
+                    entry.dbno = dbno;
+
+                    if (entry.obj.type == QType_invalid || absTimeout < 0)
+                        throw std::runtime_error("Bad object, key " + entry.key);
+
+                    entries.push_back(std::move(entry));
+                    absTimeout = 0;
+                    break;
+                }
+
+                default:
+                    throw std::runtime_error("Unknown type " + std::to_string(indicator));
+            }
+        }
+    }
+    catch (const std::runtime_error& e) {
+        ERR << "Load records of " << filename << " with exception: " << e.what();
+        return - __LINE__;
+    }
+}
+
+int QDBLoader::LoadDelta(const char* filename)
+{
+    std::vector<Entry> entries;
+    int ret = _LoadRecords(filename, entries);
+    if (ret != 0)
+        return ret;
+
+    const uint64_t now = ::Now();
+    for (auto& entry : entries)
+    {
+        if (entry.dbno > kMaxDbNum || QSTORE.SelectDB(entry.dbno) == -1)
+        {
+            ERR << "DB NUMBER is differ from delta file " << entry.dbno;
+            return __LINE__;
+        }
+
+        if (entry.obj.type == QType_invalid && entry.key.empty())
+        {
+            QSTORE.ClearCurrentDB();
+            continue;
+        }
+
+        // it also deletes the old version with ttl
+        QSTORE.ClearExpire(entry.key);
+        QSTORE.DeleteKey(entry.key);
+
+        if (entry.obj.type == QType_invalid)
+            continue;
+
+        if (entry.expireAt > 0 && entry.expireAt <= static_cast<int64_t>(now))
+            continue;
+
+        QSTORE.SetValue(entry.key, std::move(entry.obj));
+        if (entry.expireAt > 0)
+            QSTORE.SetExpire(entry.key, entry.expireAt);
+    }
+
+    return 0;
+}
 
 std::string DumpObject(const QObject& val)
 {
@@ -1234,6 +2340,7 @@ std::string DumpObject(const QObject& val)
     file += std::to_string(getpid());
     {
         QDBSaver saver(file.data());
+        saver.SetCodec(g_config.dumpcodec);
         saver.SaveType(val);
         saver.SaveObject(val);
     }
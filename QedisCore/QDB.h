@@ -1,29 +1,93 @@
 #ifndef BERT_QDB_H
 #define BERT_QDB_H
 
+#include <cstring>
 #include "Log/MemoryFile.h"
 #include "QStore.h"
+#include "QCodec.h"
 
 namespace qedis
 {
 
+class QSnapshot;
+
+// key values of one db in a range of rdb file, the index is saved in
+// aux field, so the loader can decode chunks in parallel
+struct QDBChunk
+{
+    int      dbno;
+    uint64_t begin;
+    uint64_t end;
+    uint64_t keys;
+    uint64_t expires;
+};
+
+// persisted hash index of the keys of one db, for lazy loading; slots are
+// in the mapped file, a slot is hash tag(16 bits) and offset of the record
+// (48 bits), 0 if empty; open addressing with linear probing
+struct QDBKeyTable
+{
+    int      dbno;
+    uint64_t keys;
+    uint64_t slots;  // power of 2
+    const char* data;
+
+    static uint64_t Hash(const QString& key);
+    static uint64_t Tag(uint64_t hash) { return hash >> 48; }
+    static uint64_t Offset(uint64_t slot) { return slot & ((1ULL << 48) - 1); }
+
+    uint64_t Slot(uint64_t i) const
+    {
+        uint64_t slot;
+        memcpy(&slot, data + i * sizeof slot, sizeof slot);
+        return slot;
+    }
+};
+
 class QDBSaver
 {
 public:
     explicit
     QDBSaver(const char* file = nullptr);
-    void    Save(const char* qdbFile);
+    // save the snapshot if not null, else the live keyspace(fork child or SAVE);
+    // false if the file is not written
+    bool    Save(const char* qdbFile, QSnapshot* snapshot = nullptr);
     void    SaveType(const QObject& obj);
     void    SaveKey(const QString& key);
     void    SaveObject(const QObject& obj);
     void    SaveString(const QString& str);
     void    SaveLength(uint64_t len);   // big endian
     void    SaveString(int64_t intVal);
-    bool    SaveLZFString(const QString& str);
+    bool    SaveCompressedString(const QString& str);
+    // codec for string values, default is rdb-codec
+    void    SetCodec(QCodec codec) { codec_ = codec; }
+    // save only these keys, deleted ones as markers: a delta of incremental rdb
+    void    SetDelta(const std::vector<QCheckpointDelta>* delta) { delta_ = delta; }
     
     static  void SaveDoneHandler(int exit, int signal);
+    // fork child or start snapshot thread, set g_qdbPid if success
+    static  bool BackgroundSave(const char* qdbFile, const std::vector<QCheckpointDelta>* delta = nullptr);
+    // snapshot thread gave up, save again by fork child; false if fork failed
+    static  bool RetryByFork(const char* qdbFile, const std::vector<QCheckpointDelta>* delta);
+    // merge deltas into base, write to qdbFile; no keyspace access
+    static  bool Compact(const QString& base, const std::vector<QString>& deltas, const QString& qdbFile);
 
 private:
+    // header, body, chunk index, EOF and crc, then rename tmpFile to qdbFile;
+    // tmpFile is removed if body returns false
+    bool    _SaveFile(const char* qdbFile, const char* tmpFile, const std::function<bool ()>& body);
+    static  bool _ForkSave(const char* qdbFile, const std::vector<QCheckpointDelta>* delta);
+    void    _SaveSelectDB(int dbno, size_t dbsize, size_t expiresize);
+    void    _SaveKeyValue(const QString& key, const QObject& obj, int64_t expireAt);
+    void    _SaveChunkIndex(uint64_t keyIndex);
+    // return the file offset of the index, 0 if none
+    uint64_t _SaveKeyIndex();
+    void    _SaveStore();
+    // threads save ranges to segment files, then join them; false if failed
+    bool    _SaveStoreParallel(const std::vector<QStore::BucketRange>& ranges);
+    void    _SaveSnapshot(QSnapshot& snapshot);
+    void    _SaveDelta(QSnapshot* snapshot);
+    void    _SaveAux(const QString& key, const QString& value);
     void    _SaveDoubleValue(double val);
     
     void    _SaveList(const PLIST& l);
@@ -32,26 +96,52 @@ private:
     void    _SaveSSet(const PSSET& ss);
    
     OutputMemoryFile  qdb_;
+    QCodec            codec_;
+
+    int                    dbno_;
+    std::vector<QDBChunk>  chunks_;
+
+    // hash and record offset of keys by db, if rdb-lazy-load
+    struct KeyRef
+    {
+        uint64_t hash;
+        uint64_t offset;
+    };
+    bool   keyIndex_;
+    std::vector<std::pair<int, std::vector<KeyRef> > > keyRefs_;
+
+    const std::vector<QCheckpointDelta>* delta_;
 };
 
 extern time_t g_lastQDBSave;
 extern pid_t  g_qdbPid;
 
+// g_qdbPid when saved by snapshot thread instead of child
+const pid_t kQDBSnapshotPid = 0;
+
 class QDBLoader
 {
+    friend class QDBSaver;
 public:
     explicit
     QDBLoader(const char* data = nullptr, size_t len = 0);
     int Load(const char* filename);
+    // apply a delta of incremental rdb to the keyspace
+    int LoadDelta(const char* filename);
 
     int8_t  LoadByte();
     size_t  LoadLength(bool& special);
     QObject LoadSpecialStringObject(size_t  specialVal);
     QString LoadString(size_t strLen);
-    QString LoadLZFString();
+    QString LoadCompressedString(QCodec codec);
 
     QString LoadKey();
     QObject LoadObject(int8_t type);
+    // expire and type and key of a key value record, then LoadObject(type)
+    bool    LoadRecordHeader(int8_t& type, QString& key, int64_t& expireAt);
+
+    // key index tables of a mapped rdb, false if it has no key index
+    static bool LoadKeyIndex(const char* data, size_t size, std::vector<QDBKeyTable>& tables);
 
 private:
     QString _LoadGenericString();
@@ -67,6 +157,24 @@ private:
 
     void    _LoadAux();
     void    _LoadResizeDB();
+
+    // obj is invalid for a deleted key of delta, key is empty too if the
+    // db was flushed
+    struct Entry
+    {
+        QString key;
+        QObject obj;
+        int64_t expireAt = 0;
+        int     dbno = 0;
+    };
+
+    // all records of a file in order, for delta or compaction
+    int     _LoadRecords(const char* filename, std::vector<Entry>& entries);
+
+    static bool _LoadChunkIndex(const char* data, size_t size, std::vector<QDBChunk>& chunks,
+                                uint64_t* keyIndex = nullptr);
+    int     _LoadParallel(const char* data, const std::vector<QDBChunk>& chunks);
+    void    _LoadEntries(std::vector<Entry>& entries);
     
     InputMemoryFile qdb_;
 };
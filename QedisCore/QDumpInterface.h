@@ -2,23 +2,86 @@
 #define BERT_QDUMPINTERFACE_H
 
 #include <stdint.h>
+#include <vector>
+#include <functional>
+#include <unordered_set>
 #include "QString.h"
+#include "QHelper.h"
 
 namespace qedis
 {
 
 struct QObject;
 
+// a field of big hash, set or sorted set, stored as a backend key
+struct QBackendField
+{
+    QString  name;
+    QString  value;
+    bool     del = false;
+};
+
+using QFieldSet = std::unordered_set<QString, Hash>;
+
+// whether the backend holds fields of the key from before a write
+enum QOldFields : int8_t
+{
+    QOldFields_unknown, // backend looks at the stored meta
+    QOldFields_none,
+    QOldFields_some,
+};
+
+// a write handed from main thread to the backend writer thread
+struct QBackendOp
+{
+    int      dbno = 0;
+    bool     del = false;
+    QString  key;
+    QString  value;    // by Encode(), empty if del
+    uint64_t seq = 0;  // increasing, assigned by writer
+    uint64_t time = 0; // ms, when handed over
+
+    // stored by fields, value is the meta; if delta, only these fields
+    // changed, else the old fields are all dropped
+    bool     byFields = false;
+    bool     delta = false;
+    std::vector<QBackendField> fields;
+    // old fields to drop, if not delta
+    QOldFields oldFields = QOldFields_unknown;
+
+    size_t   Bytes() const
+    {
+        size_t bytes = key.size() + value.size();
+        for (const auto& f : fields)
+            bytes += f.name.size() + f.value.size();
+
+        return bytes;
+    }
+};
+
 class QDumpInterface
 {
 public:
     virtual ~QDumpInterface() {}
 
-    virtual QObject Get(const QString& key) = 0;
+    // byFields: the object is stored by fields in backend
+    virtual QObject Get(const QString& key, bool* byFields = nullptr) = 0;
+    // read one field of object stored by fields, false if it's not
+    virtual bool GetField(const QString& key, const QString& field, int& type, bool& exist, QString& value) = 0;
     virtual bool Put(const QString& key, const QObject& obj, int64_t ttl = 0) = 0;
     virtual bool Put(const QString& key) = 0;
     virtual bool Delete(const QString& key) = 0;
 
+    // main thread serializes the object, op is passed to Write later
+    virtual void Encode(const QObject& obj, int64_t absttl, QBackendOp& op) = 0;
+    // only the fields changed, object must be stored by fields already
+    virtual void EncodeFields(const QObject& obj, int64_t absttl, const QFieldSet& fields, QBackendOp& op) = 0;
+    // writer thread, commit ops in one batch
+    virtual bool Write(const std::vector<const QBackendOp*>& ops) = 0;
+
+    // visit all the keys, slow; keys written meanwhile may be missed
+    virtual void ForEachKey(const std::function<void (const QString& key)>& visitor) = 0;
+
     //std::vector<QObject> MultiGet(const QString& key);
     //bool MultiPut(const QString& key, const QObject& obj, int64_t ttl = 0);
     //SaveAllRedisTolevelDb();
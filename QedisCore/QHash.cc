@@ -300,7 +300,10 @@ QError hstrlen(const std::vector<QString>& params, UnboundedBuffer* reply)
     QError err = QSTORE.GetValueByType(params[1], value, QType_hash);
     if (err != QError_ok) 
     {
-        Format0(reply);
+        if (err == QError_notExist)
+            Format0(reply);
+        else
+            ReplyError(err, reply);
         return err;
     }
     
@@ -76,6 +76,8 @@ static int _SetExpireByMs(const QString& key, uint64_t absTimeout)
     if (QSTORE.ExistsKey(key))
     {
         QSTORE.SetExpire(key, absTimeout);
+        // no field changed, only the ttl in backend
+        QSTORE.AddDirtyFields(key, {});
         ret = 1;
     }
 
@@ -118,7 +120,7 @@ QError expireat(const std::vector<QString>& params, UnboundedBuffer* reply)
 QError pexpireat(const std::vector<QString>& params, UnboundedBuffer* reply)
 {
     const QString& key = params[1];
-    const uint64_t timeout = atoi(params[2].c_str()); // by milliseconds;
+    const uint64_t timeout = atoll(params[2].c_str()); // by milliseconds, overflow int;
         
     int ret = _SetExpireByMs(key, timeout);
 
@@ -171,7 +173,12 @@ QError persist(const std::vector<QString>& params, UnboundedBuffer* reply)
 {
     const QString& key = params[1];
 
-    int ret = QSTORE.ClearExpire(key) ? 1 : 0;
+    int ret = 0;
+    if (QSTORE.ClearExpire(key))
+    {
+        QSTORE.AddDirtyFields(key, {});
+        ret = 1;
+    }
 
     FormatInt(ret, reply);
     return QError_ok;
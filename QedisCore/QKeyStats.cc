@@ -0,0 +1,413 @@
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include "QKeyStats.h"
+#include "QStore.h"
+#include "QConfig.h"
+#include "Log/Logger.h"
+#include "UnboundedBuffer.h"
+#include "Timer.h"
+
+namespace qedis
+{
+
+// top keys shown in INFO
+static const size_t kInfoKeys = 5;
+// INFO is line based, keys are cut and escaped there
+static const size_t kInfoKeyLen = 64;
+
+static QString InfoKey(const QString& key)
+{
+    QString res(key, 0, std::min(key.size(), kInfoKeyLen));
+    for (auto& c : res)
+    {
+        if (c < 0x20 || c == 0x7f || c == ',')
+            c = '?';
+    }
+
+    return res;
+}
+
+static const char* TypeName(QType type)
+{
+    switch (type)
+    {
+    case QType_string:    return "string";
+    case QType_list:      return "list";
+    case QType_set:       return "set";
+    case QType_sortedSet: return "sortedSet";
+    case QType_hash:      return "hash";
+    default:              return "none";
+    }
+}
+
+
+QHotKeys& QHotKeys::Instance()
+{
+    static QHotKeys hotkeys;
+    return hotkeys;
+}
+
+QHotKeys::QHotKeys() :
+    rate_(0),
+    counter_(0),
+    sampled_(0)
+{
+}
+
+void QHotKeys::InitDecayTimer()
+{
+    auto timer = TimerManager::Instance().CreateTimer();
+    timer->Init(60 * 1000);
+    timer->SetCallback([this]() {
+        _Decay();
+    });
+    TimerManager::Instance().AddTimer(timer);
+}
+
+void QHotKeys::_Add(int dbno, const QString& key)
+{
+    if (sketch_.empty())
+        sketch_.resize(kDepth * kWidth, 0);
+
+    ++ sampled_;
+
+    // double hashing, rows are h1 + i * h2
+    const uint64_t hash = std::hash<QString>()(key) ^ (static_cast<uint64_t>(dbno) * 0x9E3779B97F4A7C15ULL);
+    const uint32_t h1 = static_cast<uint32_t>(hash);
+    const uint32_t h2 = static_cast<uint32_t>(hash >> 32) | 1;
+
+    uint32_t* counters[kDepth];
+    uint32_t min = UINT32_MAX;
+    for (size_t i = 0; i < kDepth; ++ i)
+    {
+        counters[i] = &sketch_[i * kWidth + (h1 + i * h2) % kWidth];
+        min = std::min(min, *counters[i]);
+    }
+
+    // conservative update: only raise counters up to the new estimate
+    const uint32_t estimate = min > UINT32_MAX - rate_ ? UINT32_MAX : min + rate_;
+    for (auto counter : counters)
+    {
+        if (*counter < estimate)
+            *counter = estimate;
+    }
+
+    HotKey* coldest = nullptr;
+    for (auto& hk : top_)
+    {
+        if (hk.dbno == dbno && hk.key == key)
+        {
+            hk.count = estimate;
+            return;
+        }
+
+        if (!coldest || hk.count < coldest->count)
+            coldest = &hk;
+    }
+
+    if (top_.size() < kTopKeys)
+        top_.push_back(HotKey{key, dbno, estimate});
+    else if (coldest->count < estimate)
+        *coldest = HotKey{key, dbno, estimate};
+}
+
+void QHotKeys::_Decay()
+{
+    for (auto& counter : sketch_)
+        counter >>= 1;
+
+    for (auto& hk : top_)
+        hk.count >>= 1;
+
+    top_.erase(std::remove_if(top_.begin(), top_.end(), [](const HotKey& hk) {
+                   return hk.count == 0;
+               }),
+               top_.end());
+}
+
+void QHotKeys::Reset()
+{
+    std::vector<uint32_t>().swap(sketch_);
+    top_.clear();
+    sampled_ = 0;
+}
+
+std::vector<const QHotKeys::HotKey*> QHotKeys::_Sorted() const
+{
+    std::vector<const HotKey*> keys;
+    keys.reserve(top_.size());
+    for (const auto& hk : top_)
+        keys.push_back(&hk);
+
+    std::sort(keys.begin(), keys.end(), [](const HotKey* a, const HotKey* b) {
+        return a->count > b->count;
+    });
+
+    return keys;
+}
+
+void QHotKeys::OnHotKeysCommand(size_t count, UnboundedBuffer* reply)
+{
+    auto keys = _Sorted();
+    if (keys.size() > count)
+        keys.resize(count);
+
+    PreFormatMultiBulk(keys.size(), reply);
+    for (const HotKey* hk : keys)
+    {
+        PreFormatMultiBulk(3, reply);
+        FormatBulk(hk->key, reply);
+        FormatInt(hk->dbno, reply);
+        FormatInt(static_cast<long>(hk->count), reply);
+    }
+}
+
+void QHotKeys::OnInfoCommand(UnboundedBuffer& res)
+{
+    if (rate_ == 0 && sampled_ == 0)
+        return;
+
+    char buf[256];
+    int n = snprintf(buf, sizeof buf - 1,
+                 "# Hotkeys\r\n"
+                 "hotkeys_sample_rate:%u\r\n"
+                 "hotkeys_sampled:%lu\r\n"
+                 , rate_
+                 , sampled_);
+
+    if (!res.IsEmpty())
+        res.PushData("\r\n", 2);
+
+    res.PushData(buf, n);
+
+    auto keys = _Sorted();
+    for (size_t i = 0; i < keys.size() && i < kInfoKeys; ++ i)
+    {
+        n = snprintf(buf, sizeof buf - 1,
+                     "hotkey_%lu:key=%s,db=%d,count=%u\r\n",
+                     i,
+                     InfoKey(keys[i]->key).c_str(),
+                     keys[i]->dbno,
+                     keys[i]->count);
+
+        res.PushData(buf, n);
+    }
+}
+
+
+static bool BiggerBytes(const QBigKeys::BigKey& a, const QBigKeys::BigKey& b)
+{
+    return a.bytes > b.bytes;
+}
+
+static bool MoreElements(const QBigKeys::BigKey& a, const QBigKeys::BigKey& b)
+{
+    return a.elements > b.elements;
+}
+
+// keep the biggest kTopKeys, less is reversed so heap front is the smallest
+template <typename Less>
+static void AddTop(std::vector<QBigKeys::BigKey>& heap, const QBigKeys::BigKey& bk, Less less)
+{
+    if (heap.size() < QBigKeys::kTopKeys)
+    {
+        heap.push_back(bk);
+        std::push_heap(heap.begin(), heap.end(), less);
+    }
+    else if (less(bk, heap.front()))
+    {
+        std::pop_heap(heap.begin(), heap.end(), less);
+        heap.back() = bk;
+        std::push_heap(heap.begin(), heap.end(), less);
+    }
+}
+
+static size_t Elements(const QObject& obj)
+{
+    switch (obj.type)
+    {
+    case QType_list:      return obj.CastList()->size();
+    case QType_set:       return obj.CastSet()->size();
+    case QType_sortedSet: return obj.CastSortedSet()->Size();
+    case QType_hash:      return obj.CastHash()->size();
+    default:              return 1;
+    }
+}
+
+QBigKeys& QBigKeys::Instance()
+{
+    static QBigKeys bigkeys;
+    return bigkeys;
+}
+
+QBigKeys::QBigKeys() :
+    scanning_(false),
+    scanDb_(0),
+    scanBucket_(0),
+    lastScanStart_(0),
+    scannedKeys_(0),
+    lastScanDone_(0),
+    lastScanKeys_(0),
+    lastScanMs_(0)
+{
+}
+
+void QBigKeys::InitScanTimer()
+{
+    auto timer = TimerManager::Instance().CreateTimer();
+    timer->Init(100);
+    timer->SetCallback([this]() {
+        _Cron();
+    });
+    TimerManager::Instance().AddTimer(timer);
+}
+
+void QBigKeys::_Cron()
+{
+    if (!scanning_)
+    {
+        if (g_config.bigkeysscaninterval <= 0)
+            return;
+
+        const uint64_t now = ::Now();
+        if (lastScanStart_ != 0 &&
+            now < lastScanStart_ + static_cast<uint64_t>(g_config.bigkeysscaninterval) * 1000)
+            return;
+
+        scanning_ = true;
+        scanDb_ = 0;
+        scanBucket_ = 0;
+        scannedKeys_ = 0;
+        byBytes_.clear();
+        byElements_.clear();
+        lastScanStart_ = now;
+    }
+
+    _ScanSome(static_cast<size_t>(std::max(g_config.bigkeysscankeys, 1)));
+}
+
+void QBigKeys::_ScanSome(size_t count)
+{
+    const int dbs = static_cast<int>(g_config.databases);
+    const int oldDb = QSTORE.GetDB();
+
+    while (count > 0 && scanDb_ < dbs)
+    {
+        QSTORE.SelectDB(scanDb_);
+
+        size_t visited = 0;
+        scanBucket_ = QSTORE.ScanBuckets(scanBucket_, count, [&](const QString& key, const QObject& obj) {
+            BigKey bk;
+            bk.dbno = scanDb_;
+            bk.type = static_cast<QType>(obj.type);
+            bk.bytes = EstimateBytes(key, obj);
+            bk.elements = Elements(obj);
+
+            const bool big = byBytes_.size() < kTopKeys || BiggerBytes(bk, byBytes_.front());
+            const bool many = byElements_.size() < kTopKeys || MoreElements(bk, byElements_.front());
+            if (big || many)
+            {
+                bk.key = key;
+                if (big)
+                    AddTop(byBytes_, bk, BiggerBytes);
+                if (many)
+                    AddTop(byElements_, bk, MoreElements);
+            }
+
+            ++ visited;
+        });
+
+        scannedKeys_ += visited;
+        count -= std::min(count, visited);
+        if (scanBucket_ == 0)
+            ++ scanDb_;
+    }
+
+    QSTORE.SelectDB(oldDb);
+
+    if (scanDb_ >= dbs)
+        _Finish();
+}
+
+void QBigKeys::_Finish()
+{
+    scanning_ = false;
+
+    std::sort_heap(byBytes_.begin(), byBytes_.end(), BiggerBytes);
+    std::sort_heap(byElements_.begin(), byElements_.end(), MoreElements);
+    bytesResult_.swap(byBytes_);
+    elementsResult_.swap(byElements_);
+    byBytes_.clear();
+    byElements_.clear();
+
+    lastScanDone_ = ::Now();
+    lastScanKeys_ = scannedKeys_;
+    lastScanMs_ = lastScanDone_ - lastScanStart_;
+
+    DBG << "Big keys scan done, " << lastScanKeys_ << " keys in " << lastScanMs_ << " ms";
+}
+
+void QBigKeys::OnBigKeysCommand(bool byElements, size_t count, UnboundedBuffer* reply)
+{
+    const auto& keys = byElements ? elementsResult_ : bytesResult_;
+    const size_t n = std::min(count, keys.size());
+
+    PreFormatMultiBulk(n, reply);
+    for (size_t i = 0; i < n; ++ i)
+    {
+        const BigKey& bk = keys[i];
+
+        PreFormatMultiBulk(5, reply);
+        FormatBulk(bk.key, reply);
+        FormatInt(bk.dbno, reply);
+        FormatBulk(TypeName(bk.type), strlen(TypeName(bk.type)), reply);
+        FormatInt(static_cast<long>(bk.bytes), reply);
+        FormatInt(static_cast<long>(bk.elements), reply);
+    }
+}
+
+void QBigKeys::OnInfoCommand(UnboundedBuffer& res)
+{
+    if (g_config.bigkeysscaninterval <= 0 && lastScanDone_ == 0)
+        return;
+
+    char buf[256];
+    int n = snprintf(buf, sizeof buf - 1,
+                 "# Bigkeys\r\n"
+                 "bigkeys_scan_interval:%d\r\n"
+                 "bigkeys_scanning:%d\r\n"
+                 "bigkeys_last_scan:%lu\r\n"
+                 "bigkeys_last_scan_keys:%lu\r\n"
+                 "bigkeys_last_scan_ms:%lu\r\n"
+                 , g_config.bigkeysscaninterval
+                 , scanning_ ? 1 : 0
+                 , lastScanDone_ / 1000
+                 , lastScanKeys_
+                 , lastScanMs_);
+
+    if (!res.IsEmpty())
+        res.PushData("\r\n", 2);
+
+    res.PushData(buf, n);
+
+    for (size_t i = 0; i < bytesResult_.size() && i < kInfoKeys; ++ i)
+    {
+        const BigKey& bk = bytesResult_[i];
+        n = snprintf(buf, sizeof buf - 1,
+                     "bigkey_%lu:key=%s,db=%d,type=%s,bytes=%lu,elements=%lu\r\n",
+                     i,
+                     InfoKey(bk.key).c_str(),
+                     bk.dbno,
+                     TypeName(bk.type),
+                     bk.bytes,
+                     bk.elements);
+
+        res.PushData(buf, n);
+    }
+}
+
+}
+
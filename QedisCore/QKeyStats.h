@@ -0,0 +1,132 @@
+#ifndef BERT_QKEYSTATS_H
+#define BERT_QKEYSTATS_H
+
+#include <stdint.h>
+#include <vector>
+#include "QString.h"
+#include "QCommon.h"
+
+namespace qedis
+{
+
+class UnboundedBuffer;
+
+// Hot key detection.
+// One of every hotkeys-sample-rate key accesses is counted in a count-min
+// sketch, weighted by the rate so counts approximate real accesses. A key
+// whose estimate beats the coldest of the top list replaces it. All counts
+// are halved every minute, so keys no longer accessed fade out.
+class QHotKeys
+{
+public:
+    static QHotKeys& Instance();
+
+    QHotKeys(const QHotKeys& ) = delete;
+    void operator= (const QHotKeys& ) = delete;
+
+    void InitDecayTimer();
+
+    // 0 to disable
+    void SetSampleRate(int rate) { rate_ = rate > 0 ? static_cast<uint32_t>(rate) : 0; }
+
+    // main thread, key is read or written
+    void Touch(int dbno, const QString& key)
+    {
+        if (rate_ == 0 || ++ counter_ < rate_)
+            return;
+
+        counter_ = 0;
+        _Add(dbno, key);
+    }
+
+    void Reset();
+
+    // HOTKEYS [count]
+    void OnHotKeysCommand(size_t count, UnboundedBuffer* reply);
+    void OnInfoCommand(UnboundedBuffer& res);
+
+    static const size_t kDepth = 4;
+    static const size_t kWidth = 16 * 1024;
+    static const size_t kTopKeys = 64;
+
+private:
+    QHotKeys();
+
+    struct HotKey
+    {
+        QString  key;
+        int      dbno;
+        uint32_t count;
+    };
+
+    void _Add(int dbno, const QString& key);
+    void _Decay();
+    std::vector<const HotKey*> _Sorted() const;
+
+    uint32_t rate_;
+    uint32_t counter_;
+
+    std::vector<uint32_t> sketch_; // kDepth rows of kWidth
+    std::vector<HotKey> top_;
+    uint64_t sampled_;
+};
+
+// Big key detection.
+// Every bigkeys-scan-interval seconds, all dbs are walked a few buckets per
+// timer tick, bigkeys-scan-keys keys at most, and the biggest keys by
+// estimated memory and by element count are kept. Result of the last
+// completed pass is reported, so it is at most one interval old.
+class QBigKeys
+{
+public:
+    static QBigKeys& Instance();
+
+    QBigKeys(const QBigKeys& ) = delete;
+    void operator= (const QBigKeys& ) = delete;
+
+    void InitScanTimer();
+
+    // BIGKEYS [MEMORY|ELEMENTS] [count]
+    void OnBigKeysCommand(bool byElements, size_t count, UnboundedBuffer* reply);
+    void OnInfoCommand(UnboundedBuffer& res);
+
+    static const size_t kTopKeys = 64;
+
+    struct BigKey
+    {
+        QString  key;
+        int      dbno;
+        QType    type;
+        size_t   bytes;
+        size_t   elements;
+    };
+
+private:
+    QBigKeys();
+
+    void _Cron();
+    void _ScanSome(size_t count);
+    void _Finish();
+
+    bool     scanning_;
+    int      scanDb_;
+    size_t   scanBucket_;
+    uint64_t lastScanStart_;
+    uint64_t scannedKeys_;
+
+    // min heaps of current pass
+    std::vector<BigKey> byBytes_;
+    std::vector<BigKey> byElements_;
+
+    // last completed pass, biggest first
+    std::vector<BigKey> bytesResult_;
+    std::vector<BigKey> elementsResult_;
+    uint64_t lastScanDone_;
+    uint64_t lastScanKeys_;
+    uint64_t lastScanMs_;
+};
+
+}
+
+#endif
+
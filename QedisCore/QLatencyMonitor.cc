@@ -0,0 +1,152 @@
+
+#include <cstdio>
+#include "QLatencyMonitor.h"
+#include "QCommon.h"
+#include "UnboundedBuffer.h"
+
+namespace qedis
+{
+
+QLatencyMonitor& QLatencyMonitor::Instance()
+{
+    static QLatencyMonitor monitor;
+    return monitor;
+}
+
+QLatencyMonitor::QLatencyMonitor() :
+    thresholdUs_(0),
+    latestForkUs_(0)
+{
+}
+
+void QLatencyMonitor::OnFork(uint64_t usec)
+{
+    latestForkUs_ = usec;
+    AddSampleIfNeeded("fork", usec);
+}
+
+void QLatencyMonitor::_AddSample(const char* event, uint64_t usec)
+{
+    const time_t now = ::time(nullptr);
+    const uint32_t ms = static_cast<uint32_t>(usec / 1000);
+
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    Event& e = events_[event];
+    if (ms > e.maxMs)
+        e.maxMs = ms;
+
+    if (!e.samples.empty())
+    {
+        Sample& latest = e.samples[(e.next + e.samples.size() - 1) % e.samples.size()];
+        if (latest.time == now)
+        {
+            if (ms > latest.ms)
+                latest.ms = ms;
+
+            return;
+        }
+    }
+
+    if (e.samples.size() < kSamples)
+    {
+        e.samples.push_back(Sample{now, ms});
+        e.next = e.samples.size() % kSamples;
+    }
+    else
+    {
+        e.samples[e.next] = Sample{now, ms};
+        e.next = (e.next + 1) % kSamples;
+    }
+}
+
+void QLatencyMonitor::OnLatestCommand(UnboundedBuffer* reply)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    PreFormatMultiBulk(events_.size(), reply);
+    for (const auto& kv : events_)
+    {
+        const Event& e = kv.second;
+        const Sample& latest = e.samples[(e.next + e.samples.size() - 1) % e.samples.size()];
+
+        PreFormatMultiBulk(4, reply);
+        FormatBulk(kv.first, reply);
+        FormatInt(static_cast<long>(latest.time), reply);
+        FormatInt(static_cast<long>(latest.ms), reply);
+        FormatInt(static_cast<long>(e.maxMs), reply);
+    }
+}
+
+void QLatencyMonitor::OnHistoryCommand(const QString& event, UnboundedBuffer* reply)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    auto it = events_.find(event);
+    if (it == events_.end())
+    {
+        PreFormatMultiBulk(0, reply);
+        return;
+    }
+
+    // oldest first
+    const Event& e = it->second;
+    const size_t size = e.samples.size();
+    const size_t start = size < kSamples ? 0 : e.next;
+
+    PreFormatMultiBulk(size, reply);
+    for (size_t i = 0; i < size; ++ i)
+    {
+        const Sample& s = e.samples[(start + i) % size];
+
+        PreFormatMultiBulk(2, reply);
+        FormatInt(static_cast<long>(s.time), reply);
+        FormatInt(static_cast<long>(s.ms), reply);
+    }
+}
+
+size_t QLatencyMonitor::Reset(const std::vector<QString>& events)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    size_t n = 0;
+    if (events.empty())
+    {
+        n = events_.size();
+        events_.clear();
+    }
+    else
+    {
+        for (const auto& event : events)
+            n += events_.erase(event);
+    }
+
+    return n;
+}
+
+void QLatencyMonitor::OnInfoCommand(UnboundedBuffer& res)
+{
+    size_t events = 0;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        events = events_.size();
+    }
+
+    char buf[256];
+    int n = snprintf(buf, sizeof buf - 1,
+                 "# Latency\r\n"
+                 "latest_fork_usec:%lu\r\n"
+                 "latency_monitor_threshold:%lu\r\n"
+                 "latency_events:%lu\r\n"
+                 , latestForkUs_.load()
+                 , thresholdUs_.load() / 1000
+                 , events);
+
+    if (!res.IsEmpty())
+        res.PushData("\r\n", 2);
+
+    res.PushData(buf, n);
+}
+
+}
+
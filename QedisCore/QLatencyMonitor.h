@@ -0,0 +1,85 @@
+#ifndef BERT_QLATENCYMONITOR_H
+#define BERT_QLATENCYMONITOR_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "QString.h"
+#include "Timer.h"
+
+namespace qedis
+{
+
+class UnboundedBuffer;
+
+// Latency monitor.
+// Internal events which may block the main loop, like fork, expire and
+// eviction cycles, aof fsync and backend dump, are timed; one taking at
+// least latency-monitor-threshold ms is kept in a ring of samples of the
+// event, samples in the same second keep the max.
+class QLatencyMonitor
+{
+public:
+    static QLatencyMonitor& Instance();
+
+    QLatencyMonitor(const QLatencyMonitor& ) = delete;
+    void operator= (const QLatencyMonitor& ) = delete;
+
+    // ms, 0 to disable
+    void SetThreshold(int ms) { thresholdUs_ = ms > 0 ? ms * 1000ULL : 0; }
+
+    // any thread, event took usec, timed by NowUs()
+    void AddSampleIfNeeded(const char* event, uint64_t usec)
+    {
+        const uint64_t threshold = thresholdUs_.load(std::memory_order_relaxed);
+        if (threshold > 0 && usec >= threshold)
+            _AddSample(event, usec);
+    }
+
+    // fork is always timed for INFO
+    void OnFork(uint64_t usec);
+
+    // LATENCY LATEST
+    void OnLatestCommand(UnboundedBuffer* reply);
+    // LATENCY HISTORY <event>
+    void OnHistoryCommand(const QString& event, UnboundedBuffer* reply);
+    // LATENCY RESET [event ...], returns events reset
+    size_t Reset(const std::vector<QString>& events);
+
+    void OnInfoCommand(UnboundedBuffer& res);
+
+    static const size_t kSamples = 160;
+
+private:
+    QLatencyMonitor();
+
+    struct Sample
+    {
+        time_t   time;
+        uint32_t ms;
+    };
+
+    struct Event
+    {
+        std::vector<Sample> samples; // ring
+        size_t   next = 0;
+        uint32_t maxMs = 0;
+    };
+
+    void _AddSample(const char* event, uint64_t usec);
+
+    std::atomic<uint64_t> thresholdUs_;
+    std::atomic<uint64_t> latestForkUs_;
+
+    // aof thread adds samples too
+    std::mutex mutex_;
+    std::map<QString, Event> events_;
+};
+
+}
+
+#endif
+
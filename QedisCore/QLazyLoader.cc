@@ -0,0 +1,370 @@
+
+#include <cstdio>
+#include <limits>
+#include "QLazyLoader.h"
+#include "QCommon.h"
+#include "QStore.h"
+#include "QConfig.h"
+#include "Log/Logger.h"
+#include "UnboundedBuffer.h"
+
+namespace qedis
+{
+
+// keys decoded by one Feed
+static const size_t kKeysPerFeed = 1024;
+
+QLazyLoader& QLazyLoader::Instance()
+{
+    static QLazyLoader loader;
+    return loader;
+}
+
+QLazyLoader::QLazyLoader() :
+    data_(nullptr),
+    size_(0),
+    pending_(0),
+    feedDb_(0),
+    opened_(false),
+    totalKeys_(0),
+    openTime_(0),
+    doneTime_(0),
+    loadedOnAccess_(0),
+    loadedInBackground_(0),
+    loadedForIteration_(0),
+    dropped_(0),
+    expired_(0)
+{
+}
+
+bool QLazyLoader::Open(const QString& file)
+{
+    const uint64_t start = ::Now();
+    if (!file_.Open(file.c_str()))
+        return false;
+
+    size_t size = std::numeric_limits<size_t>::max();
+    const char* data = file_.Read(size);
+
+    long version = 0;
+    std::vector<QDBKeyTable> indexes;
+    if (!data || size < 9 || memcmp(data, "REDIS", 5) != 0 ||
+        !Strtol(data + 5, 4, &version) || version < 6 ||
+        !QDBLoader::LoadKeyIndex(data, size, indexes))
+    {
+        file_.Close();
+        return false;
+    }
+
+    tables_.clear();
+    tables_.resize(g_config.databases);
+    for (const auto& index : indexes)
+    {
+        if (index.dbno < 0 || index.dbno >= g_config.databases)
+        {
+            ERR << "DB NUMBER " << index.dbno << " is differ from RDB file";
+            tables_.clear();
+            file_.Close();
+            return false;
+        }
+
+        auto& table = tables_[index.dbno];
+        table.index = index;
+        table.done.assign(index.slots, false);
+        table.pending = index.keys;
+        table.cursor = 0;
+
+        pending_ += index.keys;
+    }
+
+    data_ = data;
+    size_ = size;
+    opened_ = true;
+    totalKeys_ = pending_;
+    openTime_ = ::Now() - start;
+
+    USR << "Lazy load rdb " << file << ", " << totalKeys_ << " keys mapped in " << openTime_ << "ms";
+
+    if (pending_ == 0)
+        _Finish();
+
+    return true;
+}
+
+QLazyLoader::Table* QLazyLoader::_GetTable(int dbno)
+{
+    if (pending_ == 0 || dbno < 0 || dbno >= static_cast<int>(tables_.size()))
+        return nullptr;
+
+    auto& table = tables_[dbno];
+    return table.pending > 0 ? &table : nullptr;
+}
+
+int64_t QLazyLoader::_Find(const Table& table, const QString& key, int64_t* expireAt) const
+{
+    const uint64_t hash = QDBKeyTable::Hash(key);
+    const uint64_t tag = QDBKeyTable::Tag(hash);
+    const uint64_t mask = table.index.slots - 1;
+
+    for (uint64_t i = hash & mask, n = 0; n < table.index.slots; i = (i + 1) & mask, ++ n)
+    {
+        const uint64_t slot = table.index.Slot(i);
+        if (slot == 0)
+            break;
+
+        if (QDBKeyTable::Tag(slot) != tag)
+            continue;
+
+        const uint64_t offset = QDBKeyTable::Offset(slot);
+        if (offset >= size_)
+            continue;
+
+        QDBLoader loader(data_ + offset, size_ - offset);
+
+        int8_t type;
+        QString name;
+        int64_t when;
+        if (!loader.LoadRecordHeader(type, name, when) || name != key)
+            continue;
+
+        if (table.done[i])
+            return -1;
+
+        if (expireAt)
+            *expireAt = when;
+
+        return static_cast<int64_t>(i);
+    }
+
+    return -1;
+}
+
+void QLazyLoader::_Done(Table& table, uint64_t slot)
+{
+    table.done[slot] = true;
+    -- table.pending;
+    -- pending_;
+}
+
+bool QLazyLoader::_Materialize(Table& table, uint64_t slot)
+{
+    const int dbno = table.index.dbno;
+    const uint64_t offset = QDBKeyTable::Offset(table.index.Slot(slot));
+    QDBLoader loader(data_ + offset, size_ - offset);
+
+    int8_t type;
+    QString key;
+    int64_t expireAt;
+    bool succ = loader.LoadRecordHeader(type, key, expireAt);
+
+    QObject obj;
+    if (succ)
+    {
+        try {
+            obj = loader.LoadObject(type);
+        }
+        catch (const std::runtime_error& e) {
+            ERR << "Lazy load " << key << " with exception: " << e.what();
+            succ = false;
+        }
+    }
+
+    _Done(table, slot);
+
+    if (!succ || obj.type == QType_invalid)
+        return false;
+
+    if (expireAt > 0 && expireAt <= static_cast<int64_t>(::Now()))
+    {
+        ++ expired_;
+        return false;
+    }
+
+    QSTORE.InsertLazy(dbno, key, std::move(obj), expireAt);
+    return true;
+}
+
+bool QLazyLoader::Load(int dbno, const QString& key)
+{
+    Table* table = _GetTable(dbno);
+    if (!table)
+        return false;
+
+    const int64_t slot = _Find(*table, key);
+    if (slot < 0)
+        return false;
+
+    ++ loadedOnAccess_;
+    const bool loaded = _Materialize(*table, static_cast<uint64_t>(slot));
+    if (pending_ == 0)
+        _Finish();
+
+    return loaded;
+}
+
+bool QLazyLoader::Drop(int dbno, const QString& key)
+{
+    Table* table = _GetTable(dbno);
+    if (!table)
+        return false;
+
+    int64_t expireAt = 0;
+    const int64_t slot = _Find(*table, key, &expireAt);
+    if (slot < 0)
+        return false;
+
+    ++ dropped_;
+    _Done(*table, static_cast<uint64_t>(slot));
+    if (pending_ == 0)
+        _Finish();
+
+    return expireAt == 0 || expireAt > static_cast<int64_t>(::Now());
+}
+
+void QLazyLoader::DropDb(int dbno)
+{
+    if (pending_ == 0)
+        return;
+
+    for (int i = 0; i < static_cast<int>(tables_.size()); ++ i)
+    {
+        if (dbno != -1 && i != dbno)
+            continue;
+
+        auto& table = tables_[i];
+        if (table.pending == 0)
+            continue;
+
+        dropped_ += table.pending;
+        pending_ -= table.pending;
+        table.pending = 0;
+        std::vector<bool>().swap(table.done);
+    }
+
+    if (pending_ == 0)
+        _Finish();
+}
+
+size_t QLazyLoader::Pending(int dbno) const
+{
+    if (pending_ == 0 || dbno < 0 || dbno >= static_cast<int>(tables_.size()))
+        return 0;
+
+    return tables_[dbno].pending;
+}
+
+void QLazyLoader::LoadAll(int dbno)
+{
+    if (pending_ == 0)
+        return;
+
+    const uint64_t start = ::Now();
+    const size_t before = pending_;
+    for (int i = 0; i < static_cast<int>(tables_.size()) && pending_ > 0; ++ i)
+    {
+        if (dbno != -1 && i != dbno)
+            continue;
+
+        auto& table = tables_[i];
+        for (uint64_t slot = 0; table.pending > 0 && slot < table.index.slots; ++ slot)
+        {
+            if (!table.done[slot] && table.index.Slot(slot) != 0)
+                _Materialize(table, slot);
+        }
+    }
+
+    if (before == pending_)
+        return;
+
+    loadedForIteration_ += before - pending_;
+    INF << "Lazy load " << (before - pending_) << " keys of db " << dbno
+        << " for iteration, cost " << (::Now() - start) << "ms";
+
+    if (pending_ == 0)
+        _Finish();
+}
+
+bool QLazyLoader::Feed()
+{
+    if (pending_ == 0)
+        return false;
+
+    size_t n = 0;
+    while (pending_ > 0 && n < kKeysPerFeed)
+    {
+        auto& table = tables_[feedDb_];
+        for (; table.pending > 0 && n < kKeysPerFeed && table.cursor < table.index.slots; ++ table.cursor)
+        {
+            if (table.done[table.cursor] || table.index.Slot(table.cursor) == 0)
+                continue;
+
+            _Materialize(table, table.cursor);
+            ++ loadedInBackground_;
+            ++ n;
+        }
+
+        if (table.cursor == table.index.slots && table.pending > 0)
+        {
+            ERR << "Lazy load: key count of db " << feedDb_ << " mismatch index";
+            pending_ -= table.pending;
+            table.pending = 0;
+        }
+
+        if (table.pending == 0)
+            feedDb_ = (feedDb_ + 1) % tables_.size();
+    }
+
+    if (pending_ == 0)
+        _Finish();
+
+    return true;
+}
+
+void QLazyLoader::_Finish()
+{
+    tables_.clear();
+    data_ = nullptr;
+    size_ = 0;
+    file_.Close();
+
+    doneTime_ = ::Now();
+    USR << "Lazy load done, " << loadedOnAccess_ << " keys on access, "
+        << loadedInBackground_ << " in background, "
+        << loadedForIteration_ << " for iteration";
+}
+
+void QLazyLoader::OnInfoCommand(UnboundedBuffer& res)
+{
+    if (!opened_)
+        return;
+
+    char buf[512];
+    int n = snprintf(buf, sizeof buf - 1,
+                 "# LazyLoad\r\n"
+                 "lazy_loading:%d\r\n"
+                 "lazy_map_ms:%lu\r\n"
+                 "lazy_total_keys:%lu\r\n"
+                 "lazy_pending_keys:%lu\r\n"
+                 "lazy_loaded_on_access:%lu\r\n"
+                 "lazy_loaded_in_background:%lu\r\n"
+                 "lazy_loaded_for_iteration:%lu\r\n"
+                 "lazy_dropped_keys:%lu\r\n"
+                 "lazy_expired_keys:%lu\r\n"
+                 , pending_ > 0 ? 1 : 0
+                 , openTime_
+                 , totalKeys_
+                 , pending_
+                 , loadedOnAccess_
+                 , loadedInBackground_
+                 , loadedForIteration_
+                 , dropped_
+                 , expired_);
+
+    if (!res.IsEmpty())
+        res.PushData("\r\n", 2);
+
+    res.PushData(buf, n);
+}
+
+}
+
@@ -0,0 +1,88 @@
+#ifndef BERT_QLAZYLOADER_H
+#define BERT_QLAZYLOADER_H
+
+#include <vector>
+#include "Log/MemoryFile.h"
+#include "QDB.h"
+
+namespace qedis
+{
+
+class UnboundedBuffer;
+
+// Lazy rdb load.
+// With rdb-lazy-load, rdb is saved with a hash index of keys. At start the
+// file is mapped and only the index is checked, a key is decoded to QStore
+// on its first access, the others are decoded by main loop in background.
+// A key written or deleted before decoded is dropped from the index, so
+// the old version never comes back. Cold keys stay as file-backed pages.
+class QLazyLoader
+{
+public:
+    static QLazyLoader& Instance();
+
+    QLazyLoader(const QLazyLoader& ) = delete;
+    void operator= (const QLazyLoader& ) = delete;
+
+    // map rdb at start, false if it has no key index
+    bool Open(const QString& file);
+    bool IsLoading() const { return pending_ > 0; }
+
+    // key of db is not in memory, decode it if in file; true if inserted
+    bool Load(int dbno, const QString& key);
+    // key is written or deleted, true if it was in file and not expired
+    bool Drop(int dbno, const QString& key);
+    // db is cleared, -1 for all
+    void DropDb(int dbno);
+    // keys of db not decoded yet
+    size_t Pending(int dbno) const;
+    // decode all keys of db before iterating it, -1 for all
+    void LoadAll(int dbno);
+
+    // main loop, decode some keys; true if busy
+    bool Feed();
+
+    void OnInfoCommand(UnboundedBuffer& res);
+
+private:
+    QLazyLoader();
+
+    struct Table
+    {
+        QDBKeyTable index{0, 0, 0, nullptr};
+        std::vector<bool> done;  // slot is decoded or dropped
+        size_t   pending = 0;
+        uint64_t cursor = 0;     // background decoding
+    };
+
+    Table* _GetTable(int dbno);
+    // slot of key not done yet, -1 if none
+    int64_t _Find(const Table& table, const QString& key, int64_t* expireAt = nullptr) const;
+    void _Done(Table& table, uint64_t slot);
+    // decode the record of slot to QStore, false if expired or bad
+    bool _Materialize(Table& table, uint64_t slot);
+    void _Finish();
+
+    InputMemoryFile file_;
+    const char* data_;
+    size_t   size_;
+    std::vector<Table> tables_; // by dbno
+    size_t   pending_;
+    size_t   feedDb_;
+
+    // stats
+    bool     opened_;
+    size_t   totalKeys_;
+    uint64_t openTime_;
+    uint64_t doneTime_;
+    uint64_t loadedOnAccess_;
+    uint64_t loadedInBackground_;
+    uint64_t loadedForIteration_;
+    uint64_t dropped_;
+    uint64_t expired_;
+};
+
+}
+
+#endif
+
@@ -1,19 +1,128 @@
 
+#include <cstdio>
+#include <memory>
+#include <unordered_map>
+#include <map>
+#include <mutex>
 #include "QLeveldb.h"
 #include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+#include "leveldb/cache.h"
+#include "leveldb/filter_policy.h"
 #include "Log/Logger.h"
 #include "UnboundedBuffer.h"
+#include "QConfig.h"
+#include "QCodec.h"
 
 namespace qedis
 {
 
-QLeveldb::QLeveldb() : db_(nullptr)
+// low bit of the flag byte is the ttl flag, high 4 bits are the codec of
+// the object contents; old values have codec 0, not compressed
+static const int8_t kTtlFlag = 0x1;
+// the value is meta, object is stored by fields
+static const int8_t kFieldsFlag = 0x2;
+static const int    kCodecShift = 4;
+
+// key of field: | 0x00 | key len 4bytes big endian | key | field |
+// user key begins with 0x00 is stored as | 0x00 | 0xffffffff | key |
+// if all dbs share one leveldb, every key begins with db number 2bytes
+//
+// Versions before fields stored every user key as is, so a key beginning
+// with 0x00 is ambiguous in an old leveldb; Open() escapes all of them once
+// and marks the layout with | 0x00 | 0xfffffffe | "layout" |, no key stored
+// by fields is that long, and its value is never an encoded object. Such an
+// old leveldb can't be read by older versions after it.
+static const char kFieldTag = '\0';
+static const uint32_t kEscapedLen = 0xffffffff;
+static const uint32_t kLayoutLen = 0xfffffffe;
+static const char* const kLayoutMark = "qedis-layout-1";
+
+static void AppendLen(std::string& out, uint32_t len)
+{
+    out.push_back(kFieldTag);
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(static_cast<char>((len >> shift) & 0xff));
+}
+
+static size_t CollectionSize(const QObject& obj)
+{
+    switch (obj.encoding)
+    {
+        case QEncode_hash:
+            return obj.CastHash()->size();
+
+        case QEncode_set:
+            return obj.CastSet()->size();
+
+        case QEncode_sset:
+            return obj.CastSortedSet()->Size();
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+// round trips every double, scores need not be integers
+static std::string EncodeScore(double score)
+{
+    char buf[32];
+    const int len = snprintf(buf, sizeof buf, "%.17g", score);
+    return std::string(buf, len);
+}
+
+// | flag 1byte| ttl 8bytes, if has|, return false if expired
+static bool DecodeHead(const char* data, size_t& offset, int8_t& flag, int64_t& remainTtl)
+{
+    remainTtl = 0;
+
+    flag = *(int8_t*)(data + offset);
+    offset += sizeof flag;
+
+    int64_t absttl = 0;
+    if (flag & kTtlFlag)
+    {
+        absttl = *(int64_t*)(data + offset);
+        offset += sizeof absttl;
+    }
+
+    if (absttl != 0)
+    {
+        int64_t now = static_cast<int64_t>(::Now());
+        if (absttl <= now)
+        {
+            DBG << "Load from leveldb is timeout " << absttl;
+            return false;
+        }
+
+        // Only support seconds, because lru is 24bits, too short.
+        remainTtl = (absttl - now) / 1000;
+        INF << "Load from leveldb remainTtlSeconds: " << remainTtl;
+    }
+
+    return true;
+}
+
+// block cache and filter policy are shared by all backends,
+// so the cache size is the total whatever the layout
+struct QLeveldb::Resources
+{
+    std::unique_ptr<leveldb::Cache> cache;
+    std::unique_ptr<const leveldb::FilterPolicy> filter;
+};
+
+static std::mutex s_mutex;
+static std::weak_ptr<QLeveldb::Resources> s_resources;
+static std::map<std::string, std::weak_ptr<leveldb::DB> > s_dbs;
+
+QLeveldb::QLeveldb()
 {
 }
 
 QLeveldb::~QLeveldb()
 {
-    delete db_;
 }
 
 bool QLeveldb::IsOpen() const 
@@ -21,29 +130,193 @@ bool QLeveldb::IsOpen() const
     return db_ != nullptr;
 }
 
-bool QLeveldb::Open(const char* path)
+bool QLeveldb::Open(const char* path, int dbno)
 {
+    std::lock_guard<std::mutex> guard(s_mutex);
+
+    resources_ = s_resources.lock();
+    if (!resources_)
+    {
+        resources_ = std::make_shared<Resources>();
+        if (g_config.backendcachesize > 0)
+            resources_->cache.reset(leveldb::NewLRUCache(g_config.backendcachesize));
+        if (g_config.backendbloombits > 0)
+            resources_->filter.reset(leveldb::NewBloomFilterPolicy(g_config.backendbloombits));
+
+        s_resources = resources_;
+    }
+
+    prefix_.clear();
+    if (dbno >= 0)
+    {
+        prefix_.push_back(static_cast<char>((dbno >> 8) & 0xff));
+        prefix_.push_back(static_cast<char>(dbno & 0xff));
+    }
+
+    db_ = s_dbs[path].lock();
+    if (db_)
+        return _UpgradeLayout();
+
     leveldb::Options options;
     options.create_if_missing = true; 
     // options.error_if_exists = true; 
+    options.block_cache = resources_->cache.get();
+    options.filter_policy = resources_->filter.get();
+    options.write_buffer_size = g_config.backendwritebuffer;
+    options.compression = g_config.backendcompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
                     
-    auto s = leveldb::DB::Open(options, path, &db_); 
+    leveldb::DB* db = nullptr;
+    auto s = leveldb::DB::Open(options, path, &db); 
     if (!s.ok()) {
         ERR << "Open db_ failed:" << s.ToString(); 
+        return false;
     }
 
-    return s.ok();
+    db_.reset(db);
+    s_dbs[path] = db_;
+    return _UpgradeLayout();
+}
+
+bool QLeveldb::_UpgradeLayout()
+{
+    std::string layoutKey(prefix_);
+    AppendLen(layoutKey, kLayoutLen);
+    layoutKey.append("layout");
+
+    std::string mark;
+    auto s = db_->Get(leveldb::ReadOptions(), layoutKey, &mark);
+    if (s.ok() && mark == kLayoutMark)
+        return true;
+
+    // else it's an old user key as the mark, escaped below
+    if (!s.ok() && !s.IsNotFound())
+    {
+        ERR << "Read leveldb layout failed:" << s.ToString();
+        return false;
+    }
+
+    // no layout mark, keys beginning with 0x00 are user keys as is; escape
+    // them and mark in one batch, a crash leaves it all to do again. Keys
+    // already escaped and fields of a meta are left, they were written by
+    // a version with fields but before the mark.
+    leveldb::WriteBatch batch;
+    size_t escaped = 0;
+
+    std::unordered_map<std::string, bool> byFields;
+    auto isField = [&](const std::string& key) -> bool {
+        auto it = byFields.find(key);
+        if (it != byFields.end())
+            return it->second;
+
+        std::string meta;
+        const bool fields = db_->Get(leveldb::ReadOptions(), _RawKey(key), &meta).ok() &&
+                            !meta.empty() && (meta[0] & kFieldsFlag);
+        byFields[key] = fields;
+        return fields;
+    };
+
+    const std::string begin(prefix_ + kFieldTag);
+    std::unique_ptr<leveldb::Iterator> iter(db_->NewIterator(leveldb::ReadOptions()));
+    for (iter->Seek(begin); iter->Valid() && iter->key().starts_with(begin); iter->Next())
+    {
+        const char* rest = iter->key().data() + prefix_.size();
+        const size_t restSize = iter->key().size() - prefix_.size();
+        if (restSize > 4)
+        {
+            uint32_t len = 0;
+            for (int i = 1; i <= 4; ++ i)
+                len = (len << 8) | static_cast<uint8_t>(rest[i]);
+
+            if (len == kEscapedLen ||
+                (len <= restSize - 5 && isField(std::string(rest + 5, len))))
+                continue;
+        }
+
+        std::string raw(prefix_);
+        AppendLen(raw, kEscapedLen);
+        raw.append(rest, restSize);
+
+        batch.Put(raw, iter->value());
+        batch.Delete(iter->key());
+        ++ escaped;
+    }
+
+    if (!iter->status().ok())
+    {
+        ERR << "Scan leveldb for layout upgrade failed:" << iter->status().ToString();
+        return false;
+    }
+
+    batch.Put(layoutKey, kLayoutMark);
+    s = db_->Write(leveldb::WriteOptions(), &batch);
+    if (!s.ok())
+    {
+        ERR << "Upgrade leveldb layout failed:" << s.ToString();
+        return false;
+    }
+
+    if (escaped > 0)
+        USR << "Upgrade leveldb layout, escaped keys " << escaped;
+
+    return true;
+}
+
+std::string QLeveldb::_RawKey(const QString& key) const
+{
+    std::string raw(prefix_);
+    if (!key.empty() && key[0] == kFieldTag)
+        AppendLen(raw, kEscapedLen);
+
+    raw.append(key);
+    return raw;
 }
 
-QObject QLeveldb::Get(const QString& key)
+std::string QLeveldb::_FieldPrefix(const QString& key) const
 {
+    std::string prefix(prefix_);
+    AppendLen(prefix, static_cast<uint32_t>(key.size()));
+    prefix.append(key);
+    return prefix;
+}
+
+QObject QLeveldb::Get(const QString& key, bool* byFields)
+{
+    // meta and fields must be the same version
+    const leveldb::Snapshot* snap = db_->GetSnapshot();
+    QEDIS_DEFER
+    {
+        db_->ReleaseSnapshot(snap);
+    };
+
+    leveldb::ReadOptions options;
+    options.snapshot = snap;
+
     std::string value;
-    auto status = db_->Get(leveldb::ReadOptions(), leveldb::Slice(key.data(), key.size()), &value);
+    auto status = db_->Get(options, _RawKey(key), &value);
     if (!status.ok())
         return QObject(QType_invalid);
 
     int64_t remainTtlSeconds = 0;
-    QObject obj = _DecodeObject(value.data(), value.size(), remainTtlSeconds);
+    QObject obj;
+
+    int8_t flag = *(int8_t*)value.data();
+    if (flag & kFieldsFlag)
+    {
+        size_t offset = 0;
+        if (!DecodeHead(value.data(), offset, flag, remainTtlSeconds))
+            return QObject(QType_invalid);
+
+        int8_t type = *(int8_t*)(value.data() + offset);
+        obj = _DecodeFields(snap, key, type);
+    }
+    else
+    {
+        obj = _DecodeObject(value.data(), value.size(), remainTtlSeconds);
+    }
+
+    if (byFields)
+        *byFields = (flag & kFieldsFlag) != 0;
+
     // trick: use obj.lru to store the remain seconds to be expired.
     if (remainTtlSeconds > 0)
         obj.lru = static_cast<uint32_t>(remainTtlSeconds);
@@ -53,6 +326,37 @@ QObject QLeveldb::Get(const QString& key)
     return obj;
 }
 
+bool QLeveldb::GetField(const QString& key, const QString& name, int& type, bool& exist, QString& value)
+{
+    const leveldb::Snapshot* snap = db_->GetSnapshot();
+    QEDIS_DEFER
+    {
+        db_->ReleaseSnapshot(snap);
+    };
+
+    leveldb::ReadOptions options;
+    options.snapshot = snap;
+
+    std::string meta;
+    auto status = db_->Get(options, _RawKey(key), &meta);
+    if (!status.ok())
+        return false;
+
+    size_t offset = 0;
+    int8_t flag = 0;
+    int64_t remainTtl = 0;
+    if (!(meta[0] & kFieldsFlag) || !DecodeHead(meta.data(), offset, flag, remainTtl))
+        return false;
+
+    type = *(int8_t*)(meta.data() + offset);
+
+    std::string v;
+    exist = db_->Get(options, _FieldPrefix(key) + name, &v).ok();
+    value.assign(v.data(), v.size());
+
+    return true;
+}
+
 bool QLeveldb::Put(const QString& key)
 {
     QObject* obj;
@@ -72,67 +376,361 @@ bool QLeveldb::Put(const QString& key)
 
 bool QLeveldb::Put(const QString& key, const QObject& obj, int64_t absttl)
 {
+    QBackendOp op;
+    op.key = key;
+    Encode(obj, absttl, op);
+
+    return Write({&op});
+}
+
+bool QLeveldb::Delete(const QString& key)
+{
+    QBackendOp op;
+    op.key = key;
+    op.del = true;
+
+    return Write({&op});
+}
+
+void QLeveldb::Encode(const QObject& obj, int64_t absttl, QBackendOp& op)
+{
+    const size_t size = CollectionSize(obj);
+    if (g_config.backendfieldthreshold > 0 &&
+        size >= static_cast<size_t>(g_config.backendfieldthreshold))
+    {
+        op.byFields = true;
+        _EncodeMeta(obj, absttl, op.value);
+
+        op.fields.reserve(size);
+        switch (obj.encoding)
+        {
+            case QEncode_hash:
+                for (const auto& e : *obj.CastHash())
+                {
+                    op.fields.push_back(QBackendField());
+                    op.fields.back().name = e.first;
+                    op.fields.back().value = e.second;
+                }
+                break;
+
+            case QEncode_set:
+                for (const auto& e : *obj.CastSet())
+                {
+                    op.fields.push_back(QBackendField());
+                    op.fields.back().name = e;
+                }
+                break;
+
+            case QEncode_sset:
+                for (const auto& e : *obj.CastSortedSet())
+                {
+                    op.fields.push_back(QBackendField());
+                    op.fields.back().name = e.first;
+                    op.fields.back().value = EncodeScore(e.second);
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        return;
+    }
+
     UnboundedBuffer v;
     _EncodeObject(obj, absttl, v);
+    op.value.assign(v.ReadAddr(), v.ReadableSize());
+}
 
-    leveldb::Slice lkey(key.data(), key.size());
-    leveldb::Slice lval(v.ReadAddr(), v.ReadableSize());
+void QLeveldb::EncodeFields(const QObject& obj, int64_t absttl, const QFieldSet& fields, QBackendOp& op)
+{
+    op.byFields = true;
+    op.delta = true;
+    _EncodeMeta(obj, absttl, op.value);
+
+    op.fields.resize(fields.size());
+    size_t i = 0;
+    for (const auto& name : fields)
+        _EncodeField(obj, name, op.fields[i ++]);
+}
 
-    auto s = db_->Put(leveldb::WriteOptions(), lkey, lval); 
-    return s.ok();
+bool QLeveldb::_HasOldFields(const QBackendOp& op) const
+{
+    switch (op.oldFields)
+    {
+        case QOldFields_none:
+            return false;
+
+        case QOldFields_some:
+            return true;
+
+        default:
+            break;
+    }
+
+    // a point read stops at the newest level having the key and skips files
+    // by bloom filter, a seek has to position in every level
+    std::string meta;
+    if (!db_->Get(leveldb::ReadOptions(), _RawKey(op.key), &meta).ok() || meta.empty())
+        return false;
+
+    return (meta[0] & kFieldsFlag) != 0;
 }
 
-bool QLeveldb::Delete(const QString& key)
+bool QLeveldb::Write(const std::vector<const QBackendOp*>& ops)
 {
-    leveldb::Slice lkey(key.data(), key.size());
-    auto s = db_->Delete(leveldb::WriteOptions(), lkey); 
+    leveldb::WriteBatch batch;
+
+    // to drop the old fields; it can't see fields put by this batch
+    std::unique_ptr<leveldb::Iterator> iter;
+    std::unordered_map<std::string, std::vector<std::string> > batchFields;
+
+    for (const auto op : ops)
+    {
+        const std::string prefix = _FieldPrefix(op->key);
+        if (!op->delta)
+        {
+            if (_HasOldFields(*op))
+            {
+                if (!iter)
+                    iter.reset(db_->NewIterator(leveldb::ReadOptions()));
+
+                for (iter->Seek(prefix); iter->Valid() && iter->key().starts_with(prefix); iter->Next())
+                    batch.Delete(iter->key());
+            }
+
+            auto it = batchFields.find(prefix);
+            if (it != batchFields.end())
+            {
+                for (const auto& fkey : it->second)
+                    batch.Delete(fkey);
+
+                batchFields.erase(it);
+            }
+        }
+
+        const std::string rawKey = _RawKey(op->key);
+        if (op->del)
+        {
+            batch.Delete(rawKey);
+            continue;
+        }
+
+        batch.Put(rawKey, leveldb::Slice(op->value.data(), op->value.size()));
+        for (const auto& field : op->fields)
+        {
+            std::string fkey = prefix + field.name;
+            if (field.del)
+            {
+                batch.Delete(fkey);
+            }
+            else
+            {
+                batch.Put(fkey, leveldb::Slice(field.value.data(), field.value.size()));
+                batchFields[prefix].push_back(std::move(fkey));
+            }
+        }
+    }
+
+    auto s = db_->Write(leveldb::WriteOptions(), &batch);
+    if (!s.ok())
+        ERR << "Write leveldb batch failed:" << s.ToString();
+
     return s.ok();
 }
 
+void QLeveldb::ForEachKey(const std::function<void (const QString& key)>& visitor)
+{
+    leveldb::ReadOptions options;
+    options.fill_cache = false;
+    std::unique_ptr<leveldb::Iterator> iter(db_->NewIterator(options));
+
+    // escaped keys, then skip all field keys
+    std::string escaped(prefix_);
+    AppendLen(escaped, kEscapedLen);
+    for (iter->Seek(escaped); iter->Valid() && iter->key().starts_with(escaped); iter->Next())
+        visitor(QString(iter->key().data() + escaped.size(), iter->key().size() - escaped.size()));
+
+    for (iter->Seek(prefix_ + static_cast<char>(kFieldTag + 1));
+         iter->Valid() && iter->key().starts_with(prefix_);
+         iter->Next())
+        visitor(QString(iter->key().data() + prefix_.size(), iter->key().size() - prefix_.size()));
+}
 
-void QLeveldb::_EncodeObject(const QObject& obj, int64_t absttl, UnboundedBuffer& v)
+void QLeveldb::_EncodeMeta(const QObject& obj, int64_t absttl, QString& value)
 {
-    // value format: | ttl flag 1byte| ttl 8bytes if has|type 1byte| object contents
+    // | flag 1byte| ttl 8bytes if has|type 1byte| size 4bytes |
+    UnboundedBuffer v;
 
-    // write ttl, if has
-    int8_t ttlflag = (absttl > 0 ? 1 : 0);
-    v.Write(&ttlflag, sizeof ttlflag);
-    if (ttlflag)
+    int8_t flag = kFieldsFlag;
+    if (absttl > 0)
+        flag |= kTtlFlag;
+    v.Write(&flag, sizeof flag);
+    if (absttl > 0)
         v.Write(&absttl, sizeof absttl);
 
-    // write type
     int8_t type = obj.type;
     v.Write(&type, sizeof type);
 
+    auto size = static_cast<uint32_t>(CollectionSize(obj));
+    v.Write(&size, sizeof size);
+
+    value.assign(v.ReadAddr(), v.ReadableSize());
+}
+
+void QLeveldb::_EncodeField(const QObject& obj, const QString& name, QBackendField& field)
+{
+    field.name = name;
+    field.del = true;
+
+    switch (obj.encoding)
+    {
+        case QEncode_hash:
+            {
+                auto it = obj.CastHash()->find(name);
+                if (it != obj.CastHash()->end())
+                {
+                    field.value = it->second;
+                    field.del = false;
+                }
+            }
+            break;
+
+        case QEncode_set:
+            field.del = (obj.CastSet()->count(name) == 0);
+            break;
+
+        case QEncode_sset:
+            {
+                auto it = obj.CastSortedSet()->FindMember(name);
+                if (it != obj.CastSortedSet()->end())
+                {
+                    field.value = EncodeScore(it->second);
+                    field.del = false;
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+QObject QLeveldb::_DecodeFields(const leveldb::Snapshot* snap, const QString& key, int type)
+{
+    leveldb::ReadOptions options;
+    options.snapshot = snap;
+    std::unique_ptr<leveldb::Iterator> iter(db_->NewIterator(options));
+
+    QObject obj;
+    switch (type)
+    {
+        case QType_hash:
+            obj = QObject::CreateHash();
+            break;
+
+        case QType_set:
+            obj = QObject::CreateSet();
+            break;
+
+        case QType_sortedSet:
+            obj = QObject::CreateSSet();
+            break;
+
+        default:
+            ERR << "Load from leveldb bad type by fields " << type;
+            return QObject(QType_invalid);
+    }
+
+    const std::string prefix = _FieldPrefix(key);
+    for (iter->Seek(prefix); iter->Valid() && iter->key().starts_with(prefix); iter->Next())
+    {
+        QString name(iter->key().data() + prefix.size(), iter->key().size() - prefix.size());
+        QString value(iter->value().data(), iter->value().size());
+
+        switch (type)
+        {
+            case QType_hash:
+                obj.CastHash()->insert(QHash::value_type(name, value));
+                break;
+
+            case QType_set:
+                obj.CastSet()->insert(name);
+                break;
+
+            case QType_sortedSet:
+                obj.CastSortedSet()->AddMember(name, std::stod(value));
+                break;
+        }
+    }
+
+    return obj;
+}
+
+void QLeveldb::_EncodeObject(const QObject& obj, int64_t absttl, UnboundedBuffer& v)
+{
+    // value format: | flag 1byte| ttl 8bytes if has|type 1byte| object contents
+    // if compressed, contents: | raw len 4bytes | compressed data |
+
+    UnboundedBuffer contents;
     switch (obj.encoding)
     {
         case QEncode_raw:
         case QEncode_int:
             {
                 auto str = GetDecodedString(&obj);
-                _EncodeString(*str, v);
+                _EncodeString(*str, contents);
             }
             break;
     
         case QEncode_list:
-            _EncodeList(obj.CastList(), v);
+            _EncodeList(obj.CastList(), contents);
             break;
             
         case QEncode_set:
-            _EncodeSet(obj.CastSet(), v);
+            _EncodeSet(obj.CastSet(), contents);
             break;
             
         case QEncode_hash:
-            _EncodeHash(obj.CastHash(), v);
+            _EncodeHash(obj.CastHash(), contents);
             break;
             
         case QEncode_sset:
-            _EncodeSSet(obj.CastSortedSet(), v);
+            _EncodeSSet(obj.CastSortedSet(), contents);
             break;
             
         default:
             break;
     }
+
+    QCodec codec = g_config.backendcodec;
+
+    QString compressed;
+    if (!Compress(codec, contents.ReadAddr(), contents.ReadableSize(), compressed))
+        codec = QCodec_none;
+
+    // write flag and ttl, if has
+    int8_t flag = static_cast<int8_t>(codec << kCodecShift);
+    if (absttl > 0)
+        flag |= kTtlFlag;
+    v.Write(&flag, sizeof flag);
+    if (absttl > 0)
+        v.Write(&absttl, sizeof absttl);
+
+    // write type
+    int8_t type = obj.type;
+    v.Write(&type, sizeof type);
+
+    if (codec == QCodec_none)
+    {
+        v.Write(contents.ReadAddr(), contents.ReadableSize());
+    }
+    else
+    {
+        auto rawLen = static_cast<uint32_t>(contents.ReadableSize());
+        v.Write(&rawLen, sizeof rawLen);
+        v.Write(compressed.data(), compressed.size());
+    }
 }
 
 
@@ -190,47 +788,40 @@ void QLeveldb::_EncodeSSet(const PSSET& ss, UnboundedBuffer& v)
     {
         _EncodeString(e.first, v);
     
-        auto s(std::to_string(e.second));
-        _EncodeString(s, v);
+        _EncodeString(EncodeScore(e.second), v);
     }
 }
 
 QObject QLeveldb::_DecodeObject(const char* data, size_t len, int64_t& remainTtl)
 {
-    // | type 1byte | ttl flag 1byte| ttl 8bytes, if has|
-
-    remainTtl = 0;
+    // | flag 1byte| ttl 8bytes, if has| type 1byte |
 
     size_t offset = 0;
+    int8_t flag = 0;
+    if (!DecodeHead(data, offset, flag, remainTtl))
+        return QObject(QType_invalid);
 
-    int8_t hasttl = *(int8_t*)(data + offset);
-    offset += sizeof hasttl;
+    int8_t type = *(int8_t*)(data + offset);
+    offset += sizeof type;
 
-    int64_t absttl = 0;
-    if (hasttl)
+    QString raw;
+    const auto codec = static_cast<QCodec>((flag >> kCodecShift) & 0xF);
+    if (codec != QCodec_none)
     {
-        absttl = *(int64_t*)(data + offset);
-        offset += sizeof absttl;
-    }
+        uint32_t rawLen = *(uint32_t*)(data + offset);
+        offset += sizeof rawLen;
 
-    if (absttl != 0)
-    {
-        int64_t now = static_cast<int64_t>(::Now());
-        if (absttl <= now)
+        raw.resize(rawLen);
+        if (!Decompress(codec, data + offset, len - offset, &raw[0], rawLen))
         {
-            DBG << "Load from leveldb is timeout " << absttl;
+            ERR << "Load from leveldb decompress failed, codec " << CodecName(codec);
             return QObject(QType_invalid);
         }
-        else
-        {
-            // Only support seconds, because lru is 24bits, too short.
-            remainTtl = (absttl - now) / 1000;
-            INF << "Load from leveldb remainTtlSeconds: " << remainTtl;
-        }
-    }
 
-    int8_t type = *(int8_t*)(data + offset);
-    offset += sizeof type;
+        data = raw.data();
+        len = raw.size();
+        offset = 0;
+    }
 
     switch (type)
     {
@@ -358,7 +949,7 @@ QObject QLeveldb::_DecodeSSet(const char* data, size_t len)
         offset += scoreStr.size() + 4;
 
         double score = std::stod(scoreStr);
-        sset->AddMember(member, static_cast<long>(score));
+        sset->AddMember(member, score);
 
         DBG << "Load leveldb sset member : " << member << " score : " << score;
     }
@@ -1,12 +1,14 @@
 #ifndef BERT_QLEVELDB_H
 #define BERT_QLEVELDB_H
 
+#include <memory>
 #include "QDumpInterface.h"
 #include "QStore.h"
 
 namespace leveldb
 {
 class DB;
+class Snapshot;
 }
 
 namespace qedis
@@ -20,21 +22,41 @@ public:
     QLeveldb();
     ~QLeveldb();
 
-    bool Open(const char* path);
+    // dbno >= 0: all dbs share the leveldb at path, keys are prefixed by dbno
+    bool Open(const char* path, int dbno = -1);
     bool IsOpen() const ;
 
-    QObject Get(const QString& key) override;
+    QObject Get(const QString& key, bool* byFields = nullptr) override;
+    bool GetField(const QString& key, const QString& field, int& type, bool& exist, QString& value) override;
     bool Put(const QString& key) override;
 
     bool Put(const QString& key, const QObject& obj, int64_t ttl = 0) override;
     bool Delete(const QString& key) override;
 
+    void Encode(const QObject& obj, int64_t absttl, QBackendOp& op) override;
+    void EncodeFields(const QObject& obj, int64_t absttl, const QFieldSet& fields, QBackendOp& op) override;
+    bool Write(const std::vector<const QBackendOp*>& ops) override;
+    void ForEachKey(const std::function<void (const QString& key)>& visitor) override;
+
+    struct Resources;
+
 private:
-     leveldb::DB* db_;
+     // declared first, the db must be closed before them
+     std::shared_ptr<Resources> resources_;
+     std::shared_ptr<leveldb::DB> db_;
+     std::string prefix_;
+
+     // escape user keys beginning with 0x00 written by old versions
+     bool _UpgradeLayout();
+
+     std::string _RawKey(const QString& key) const;
+     std::string _FieldPrefix(const QString& key) const;
+     // only then Write() seeks the field prefix to drop old fields
+     bool _HasOldFields(const QBackendOp& op) const;
 
      // encoding stuff
 
-     // value format: type + ttl(if has) + qobject
+     // value format: flag(ttl, codec) + ttl(if has) + type + qobject
      void _EncodeObject(const QObject& obj, int64_t absttl, UnboundedBuffer& v);
 
      void _EncodeString(const QString& str, UnboundedBuffer& v);
@@ -43,6 +65,13 @@ private:
      void _EncodeSet(const PSET& , UnboundedBuffer& v);
      void _EncodeSSet(const PSSET& , UnboundedBuffer& v);
 
+     // big hash, set and sorted set are stored by fields:
+     // meta value format: flag(fields, ttl) + ttl(if has) + type + size
+     // every field is a key: see FieldPrefix(), value is empty for set
+     void _EncodeMeta(const QObject& obj, int64_t absttl, QString& value);
+     void _EncodeField(const QObject& obj, const QString& name, QBackendField& field);
+     QObject _DecodeFields(const leveldb::Snapshot* snap, const QString& key, int type);
+
      // decoding stuff
      QObject _DecodeObject(const char* data, size_t len, int64_t& remainTtlSeconds);
 
@@ -0,0 +1,104 @@
+
+#include <unistd.h>
+#include <climits>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include "QManifest.h"
+#include "Log/Logger.h"
+
+namespace qedis
+{
+
+bool QManifest::Load(const QString& name)
+{
+    seq_ = 0;
+    base_.clear();
+    parts_.clear();
+    damaged_ = false;
+
+    std::ifstream ifs(name.c_str());
+    if (!ifs)
+    {
+        // exists but can't be read is not a fresh start
+        damaged_ = (::access(name.c_str(), F_OK) == 0);
+        return false;
+    }
+
+    QString line;
+    while (std::getline(ifs, line))
+    {
+        std::istringstream fields(line);
+        QString type, value;
+        if (!(fields >> type))
+            continue; // blank line
+
+        if (!(fields >> value))
+        {
+            ERR << "manifest " << name << " bad line: " << line;
+            damaged_ = true;
+            return false;
+        }
+
+        if (type == "seq")
+        {
+            errno = 0;
+            char* end = nullptr;
+            const long seq = ::strtol(value.c_str(), &end, 10);
+            if (errno != 0 || *end != '\0' || seq < 0 || seq > INT_MAX)
+            {
+                ERR << "manifest " << name << " bad seq: " << value;
+                damaged_ = true;
+                return false;
+            }
+
+            seq_ = static_cast<int>(seq);
+        }
+        else if (type == "base")
+        {
+            base_ = value;
+        }
+        else if (type == partTag_)
+        {
+            parts_.push_back(value);
+        }
+        else
+        {
+            WRN << "unknown manifest " << name << " line " << line;
+        }
+    }
+
+    if (ifs.bad())
+    {
+        damaged_ = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool QManifest::Save(const QString& name) const
+{
+    QString tmp = name + ".tmp";
+    {
+        std::ofstream ofs(tmp.c_str(), std::ios::trunc);
+        if (!ofs)
+            return false;
+
+        ofs << "seq " << seq_ << "\n";
+        if (!base_.empty())
+            ofs << "base " << base_ << "\n";
+        for (const auto& part : parts_)
+            ofs << partTag_ << " " << part << "\n";
+
+        ofs.flush();
+        if (!ofs)
+            return false;
+    }
+
+    return ::rename(tmp.c_str(), name.c_str()) == 0;
+}
+
+}
+
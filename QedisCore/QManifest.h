@@ -0,0 +1,48 @@
+#ifndef BERT_QMANIFEST_H
+#define BERT_QMANIFEST_H
+
+#include <vector>
+#include "QString.h"
+
+namespace qedis
+{
+
+// A chain of files loaded in order: the base, then parts applied on top of
+// it. Multi part aof and incremental rdb both keep one.
+// Format, one per line:
+//   seq <n>       last number given to a file name
+//   base <file>
+//   <tag> <file>  a part, tag is "incr" for aof and "delta" for rdb
+class QManifest
+{
+public:
+    explicit
+    QManifest(const char* partTag) : partTag_(partTag), seq_(0), damaged_(false) {}
+
+    // false if missing or damaged, IsDamaged() tells which
+    bool  Load(const QString& name);
+    // written to a tmp file then renamed, a crash leaves old or new one
+    bool  Save(const QString& name) const;
+    bool  IsDamaged() const { return damaged_; }
+
+    // for a new file name
+    int   NextSeq() { return ++ seq_; }
+
+    const QString&  Base() const { return base_; }
+    void  SetBase(const QString& base) { base_ = base; }
+
+    std::vector<QString>&  Parts() { return parts_; }
+    const std::vector<QString>&  Parts() const { return parts_; }
+
+private:
+    const char* partTag_;
+    int      seq_;
+    QString  base_;
+    std::vector<QString> parts_;
+    bool     damaged_;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,340 @@
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include "QMetrics.h"
+#include "QStore.h"
+#include "QConfig.h"
+#include "QReplication.h"
+#include "QAOF.h"
+#include "QBackendWriter.h"
+#include "QHelper.h"
+#include "Server.h"
+#include "Log/Logger.h"
+#include "Threads/ThreadPool.h"
+#include "UnboundedBuffer.h"
+#include "Timer.h"
+
+namespace qedis
+{
+
+QMetrics& QMetrics::Instance()
+{
+    static QMetrics metrics;
+    return metrics;
+}
+
+QMetrics::QMetrics() :
+    lastSampleTime_(0),
+    lastSampleCalls_(0),
+    opsIndex_(0)
+{
+    for (auto& ops : opsSamples_)
+        ops = 0;
+}
+
+void QMetrics::InitSampleTimer()
+{
+    auto timer = TimerManager::Instance().CreateTimer();
+    timer->Init(100);
+    timer->SetCallback([this]() {
+        _Sample();
+    });
+    TimerManager::Instance().AddTimer(timer);
+}
+
+void QMetrics::_Sample()
+{
+    const uint64_t now = ::Now();
+    const uint64_t calls = QCommandStats::Instance().TotalCalls();
+
+    if (lastSampleTime_ != 0 && now > lastSampleTime_)
+    {
+        // reset by CONFIG RESETSTAT
+        const uint64_t delta = calls >= lastSampleCalls_ ? calls - lastSampleCalls_ : calls;
+        opsSamples_[opsIndex_] = delta * 1000.0 / (now - lastSampleTime_);
+        opsIndex_ = (opsIndex_ + 1) % kOpsSamples;
+    }
+
+    lastSampleTime_ = now;
+    lastSampleCalls_ = calls;
+}
+
+double QMetrics::InstantaneousOps() const
+{
+    double sum = 0;
+    for (auto ops : opsSamples_)
+        sum += ops;
+
+    return sum / kOpsSamples;
+}
+
+QMetrics::Snapshot QMetrics::Collect() const
+{
+    Snapshot snap;
+
+    snap.commands = QCommandStats::Instance().TotalCalls();
+    snap.opsPerSec = InstantaneousOps();
+    snap.commandStats = QCommandStats::Instance().Snapshot();
+
+    snap.netInput = StreamSocket::TotalRecvBytes();
+    snap.netOutput = StreamSocket::TotalSentBytes();
+    snap.clients = Server::Instance()->TCPSize();
+    snap.blockedClients = QSTORE.BlockedSize();
+
+    const int oldDb = QSTORE.GetDB();
+    for (int dbno = 0; dbno < g_config.databases; ++ dbno)
+    {
+        QSTORE.SelectDB(dbno);
+
+        const size_t keys = QSTORE.DBSize();
+        if (keys > 0)
+            snap.keyspace.push_back(Snapshot::Keyspace{dbno, keys, QSTORE.ExpiresSize()});
+    }
+    QSTORE.SelectDB(oldDb);
+
+    snap.master = QREPL.GetMasterAddr().Empty();
+    snap.slaves = QREPL.OnlineSlaves();
+    snap.masterLinkUp = QREPL.IsMasterLinkUp();
+
+    snap.aof = g_config.appendonly;
+    if (snap.aof)
+    {
+        snap.aofPendingBytes = QAOFThreadController::Instance().PendingBytes();
+        snap.aofLagMs = QAOFThreadController::Instance().LagMs();
+    }
+
+    snap.backend = QBackendWriter::Instance().IsEnabled();
+    if (snap.backend)
+    {
+        const auto stats = QBackendWriter::Instance().GetStats();
+        snap.backendPendingOps = stats.pendingOps;
+        snap.backendPendingBytes = stats.pendingBytes;
+        snap.backendLagMs = stats.lagMs;
+        snap.backendWrittenOps = stats.writtenOps;
+        snap.backendErrors = stats.errors;
+    }
+
+    return snap;
+}
+
+static void Header(UnboundedBuffer& out, const char* name, const char* type, const char* help)
+{
+    char buf[512];
+    int n = snprintf(buf, sizeof buf,
+                     "# HELP %s %s\n"
+                     "# TYPE %s %s\n",
+                     name, help, name, type);
+
+    out.PushData(buf, std::min<int>(n, sizeof buf - 1));
+}
+
+static void Value(UnboundedBuffer& out, const char* name, const char* labels, double value)
+{
+    char buf[512];
+    int n = snprintf(buf, sizeof buf, "%s%s %.15g\n", name, labels, value);
+
+    out.PushData(buf, std::min<int>(n, sizeof buf - 1));
+}
+
+static void Metric(UnboundedBuffer& out, const char* name, const char* type, const char* help, double value)
+{
+    Header(out, name, type, help);
+    Value(out, name, "", value);
+}
+
+// command latency buckets are powers of two from 1024ns, like LATENCY HISTOGRAM
+static const int kMinBucketExp = 10;
+static const int kMaxBucketExp = 34;
+
+void QMetrics::Format(const Snapshot& snap, UnboundedBuffer& out)
+{
+    Metric(out, "qedis_commands_processed_total", "counter",
+           "Commands executed.", snap.commands);
+    Metric(out, "qedis_instantaneous_ops_per_sec", "gauge",
+           "Commands per second, averaged over the last 1.6 seconds.", snap.opsPerSec);
+
+    char labels[256];
+
+    Header(out, "qedis_command_duration_seconds", "histogram", "Command execution time.");
+    for (const auto& stat : snap.commandStats)
+    {
+        for (int exp = kMinBucketExp; exp <= kMaxBucketExp; ++ exp)
+        {
+            snprintf(labels, sizeof labels, "{cmd=\"%s\",le=\"%g\"}",
+                     stat.name.c_str(), static_cast<double>(1ULL << exp) / 1e9);
+            Value(out, "qedis_command_duration_seconds_bucket", labels, stat.latency.CountBelow(exp));
+        }
+
+        snprintf(labels, sizeof labels, "{cmd=\"%s\",le=\"+Inf\"}", stat.name.c_str());
+        Value(out, "qedis_command_duration_seconds_bucket", labels, stat.calls);
+
+        snprintf(labels, sizeof labels, "{cmd=\"%s\"}", stat.name.c_str());
+        Value(out, "qedis_command_duration_seconds_sum", labels, stat.ns / 1e9);
+        Value(out, "qedis_command_duration_seconds_count", labels, stat.calls);
+    }
+
+    Header(out, "qedis_command_failed_calls_total", "counter", "Commands replied an error.");
+    for (const auto& stat : snap.commandStats)
+    {
+        snprintf(labels, sizeof labels, "{cmd=\"%s\"}", stat.name.c_str());
+        Value(out, "qedis_command_failed_calls_total", labels, stat.failed);
+    }
+
+    Header(out, "qedis_command_rejected_calls_total", "counter", "Commands refused before executed.");
+    for (const auto& stat : snap.commandStats)
+    {
+        snprintf(labels, sizeof labels, "{cmd=\"%s\"}", stat.name.c_str());
+        Value(out, "qedis_command_rejected_calls_total", labels, stat.rejected);
+    }
+
+    Header(out, "qedis_db_keys", "gauge", "Keys in db.");
+    for (const auto& db : snap.keyspace)
+    {
+        snprintf(labels, sizeof labels, "{db=\"%d\"}", db.dbno);
+        Value(out, "qedis_db_keys", labels, db.keys);
+    }
+
+    Header(out, "qedis_db_expiring_keys", "gauge", "Keys with an expire in db.");
+    for (const auto& db : snap.keyspace)
+    {
+        snprintf(labels, sizeof labels, "{db=\"%d\"}", db.dbno);
+        Value(out, "qedis_db_expiring_keys", labels, db.expires);
+    }
+
+    // reads /proc, so here but not in main thread
+    const auto minfo = getMemoryInfo();
+    Metric(out, "qedis_memory_used_bytes", "gauge", "Virtual memory size.", minfo[VmSize]);
+    Metric(out, "qedis_memory_used_peak_bytes", "gauge", "Peak virtual memory size.", minfo[VmPeak]);
+    Metric(out, "qedis_memory_rss_bytes", "gauge", "Resident set size.", minfo[VmRSS]);
+    Metric(out, "qedis_memory_rss_peak_bytes", "gauge", "Peak resident set size.", minfo[VmHWM]);
+    Metric(out, "qedis_memory_swap_bytes", "gauge", "Swapped out memory.", minfo[VmSwap]);
+
+    Metric(out, "qedis_connected_clients", "gauge", "Client connections.", snap.clients);
+    Metric(out, "qedis_blocked_clients", "gauge", "Clients blocked by list commands.", snap.blockedClients);
+    Metric(out, "qedis_net_input_bytes_total", "counter", "Bytes read from connections.", snap.netInput);
+    Metric(out, "qedis_net_output_bytes_total", "counter", "Bytes written to connections.", snap.netOutput);
+
+    Metric(out, "qedis_replication_master", "gauge", "1 if master, 0 if slave.", snap.master ? 1 : 0);
+    Metric(out, "qedis_connected_slaves", "gauge", "Slaves receiving the command stream.", snap.slaves);
+    if (!snap.master)
+        Metric(out, "qedis_master_link_up", "gauge", "1 if connected to master.", snap.masterLinkUp ? 1 : 0);
+
+    if (snap.aof)
+    {
+        Metric(out, "qedis_aof_pending_bytes", "gauge", "Bytes not written to aof file yet.", snap.aofPendingBytes);
+        Metric(out, "qedis_aof_lag_seconds", "gauge", "Time since aof thread last caught up.", snap.aofLagMs / 1e3);
+    }
+
+    if (snap.backend)
+    {
+        Metric(out, "qedis_backend_pending_ops", "gauge", "Backend writes not committed.", snap.backendPendingOps);
+        Metric(out, "qedis_backend_pending_bytes", "gauge", "Bytes of backend writes not committed.", snap.backendPendingBytes);
+        Metric(out, "qedis_backend_lag_seconds", "gauge", "Age of the oldest backend write not committed.", snap.backendLagMs / 1e3);
+        Metric(out, "qedis_backend_written_ops_total", "counter", "Backend writes committed.", snap.backendWrittenOps);
+        Metric(out, "qedis_backend_write_errors_total", "counter", "Backend batches failed.", snap.backendErrors);
+    }
+}
+
+void QMetrics::OnInfoCommand(UnboundedBuffer& res)
+{
+    char buf[512];
+    int n = snprintf(buf, sizeof buf - 1,
+                 "# Stats\r\n"
+                 "total_commands_processed:%lu\r\n"
+                 "instantaneous_ops_per_sec:%.0f\r\n"
+                 "total_net_input_bytes:%lu\r\n"
+                 "total_net_output_bytes:%lu\r\n"
+                 , QCommandStats::Instance().TotalCalls()
+                 , InstantaneousOps()
+                 , StreamSocket::TotalRecvBytes()
+                 , StreamSocket::TotalSentBytes());
+
+    if (!res.IsEmpty())
+        res.PushData("\r\n", 2);
+
+    res.PushData(buf, n);
+}
+
+
+QMetricsClient::QMetricsClient() : replying_(false)
+{
+}
+
+PacketLength QMetricsClient::_HandlePacket(const char* msg, std::size_t len)
+{
+    // previous request is being answered
+    if (replying_)
+        return 0;
+
+    const char* const end = msg + len;
+    const char* head = std::search(msg, end, "\r\n\r\n", "\r\n\r\n" + 4);
+    if (head == end)
+    {
+        if (len > kMaxRequestBytes)
+        {
+            WRN << "Too long http request from " << peerAddr_.ToString();
+            OnError();
+        }
+
+        return 0;
+    }
+
+    head += 4;
+
+    // request line: GET /metrics HTTP/1.1, query string is ignored
+    const char* method = msg;
+    const char* methodEnd = std::find(method, head, ' ');
+    const char* path = methodEnd + 1;
+    const char* pathEnd = path < head ? std::find_if(path, head, [](char c) {
+        return c == ' ' || c == '?' || c == '\r';
+    }) : head;
+
+    if (methodEnd == head ||
+        static_cast<size_t>(methodEnd - method) != 3 || strncmp(method, "GET", 3) != 0)
+    {
+        const char body[] = "method not allowed\n";
+        _Reply("405 Method Not Allowed", body, sizeof body - 1);
+    }
+    else if (static_cast<size_t>(pathEnd - path) != 8 || strncmp(path, "/metrics", 8) != 0)
+    {
+        const char body[] = "not found\n";
+        _Reply("404 Not Found", body, sizeof body - 1);
+    }
+    else
+    {
+        auto snap = std::make_shared<QMetrics::Snapshot>(QMetrics::Instance().Collect());
+        auto self = std::static_pointer_cast<QMetricsClient>(shared_from_this());
+
+        replying_ = true;
+        ThreadPool::Instance().ExecuteTask([self, snap]() {
+            UnboundedBuffer body;
+            QMetrics::Format(*snap, body);
+            self->_Reply("200 OK", body.ReadAddr(), body.ReadableSize());
+            self->replying_ = false;
+        });
+    }
+
+    return static_cast<PacketLength>(head - msg);
+}
+
+void QMetricsClient::_Reply(const char* status, const char* body, size_t len)
+{
+    char buf[256];
+    int n = snprintf(buf, sizeof buf - 1,
+                     "HTTP/1.1 %s\r\n"
+                     "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                     "Content-Length: %lu\r\n"
+                     "\r\n"
+                     , status
+                     , len);
+
+    UnboundedBuffer reply;
+    reply.PushData(buf, n);
+    reply.PushData(body, len);
+    SendPacket(reply);
+}
+
+}
+
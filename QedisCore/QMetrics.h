@@ -0,0 +1,112 @@
+#ifndef BERT_QMETRICS_H
+#define BERT_QMETRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "StreamSocket.h"
+#include "QCommandStats.h"
+
+namespace ConnectionTag
+{
+const int kMetricsClient = 5;
+}
+
+namespace qedis
+{
+
+class UnboundedBuffer;
+
+// Server stats for INFO stats and the prometheus endpoint.
+// Scraping must not stall the main thread: it only copies counters into a
+// snapshot, the text is formatted by a pool thread.
+class QMetrics
+{
+public:
+    static QMetrics& Instance();
+
+    QMetrics(const QMetrics& ) = delete;
+    void operator= (const QMetrics& ) = delete;
+
+    // samples ops per second every 100ms, like redis
+    void InitSampleTimer();
+    double InstantaneousOps() const;
+
+    struct Snapshot
+    {
+        uint64_t commands = 0;
+        double   opsPerSec = 0;
+        std::vector<QCommandStats::Stat> commandStats;
+
+        uint64_t netInput = 0;
+        uint64_t netOutput = 0;
+        size_t   clients = 0;
+        size_t   blockedClients = 0;
+
+        // db, keys, expires; empty dbs are skipped
+        struct Keyspace
+        {
+            int    dbno;
+            size_t keys;
+            size_t expires;
+        };
+        std::vector<Keyspace> keyspace;
+
+        bool     master = true;
+        size_t   slaves = 0;
+        bool     masterLinkUp = false;
+
+        bool     aof = false;
+        uint64_t aofPendingBytes = 0;
+        uint64_t aofLagMs = 0;
+
+        bool     backend = false;
+        uint64_t backendPendingOps = 0;
+        uint64_t backendPendingBytes = 0;
+        uint64_t backendLagMs = 0;
+        uint64_t backendWrittenOps = 0;
+        uint64_t backendErrors = 0;
+    };
+
+    // main thread, cheap copies only
+    Snapshot Collect() const;
+    // any thread, prometheus text format
+    static void Format(const Snapshot& snap, UnboundedBuffer& out);
+
+    void OnInfoCommand(UnboundedBuffer& res);
+
+    static const size_t kOpsSamples = 16;
+
+private:
+    QMetrics();
+
+    void _Sample();
+
+    uint64_t lastSampleTime_;
+    uint64_t lastSampleCalls_;
+    double   opsSamples_[kOpsSamples];
+    size_t   opsIndex_;
+};
+
+// HTTP/1.1 connection of metrics-port, serves GET /metrics.
+// Requests on a connection are answered in order, the next one waits until
+// the pool thread queued the reply.
+class QMetricsClient : public StreamSocket
+{
+public:
+    QMetricsClient();
+
+    // http request head is limited
+    static const size_t kMaxRequestBytes = 8 * 1024;
+
+private:
+    PacketLength _HandlePacket(const char* msg, std::size_t len) override;
+    void _Reply(const char* status, const char* body, size_t len);
+
+    std::atomic<bool> replying_;
+};
+
+}
+
+#endif
+
@@ -7,6 +7,7 @@
 #include "QDB.h"
 
 #include "QConfig.h"
+#include "crc16.h"
 
 namespace qedis
 {
@@ -388,7 +389,7 @@ void MigrateClusterData(const std::unordered_map<SocketAddr, std::set<int>>& mig
     for (const auto& kv : QSTORE)
     {
         const size_t kMaxShards = 8; // TODO
-        size_t hashv = Hash()(kv.first) % kMaxShards;
+        size_t hashv = keyHashSlot(kv.first.data(), kv.first.size()) % kMaxShards;
         INF << kv.first << "'s hash value = " << hashv;
 
         for (const auto& addrShards : migration)
@@ -32,6 +32,19 @@ bool QReplication::IsBgsaving() const
     return  bgsaving_;
 }
 
+std::size_t QReplication::OnlineSlaves() const
+{
+    std::size_t n = 0;
+    for (const auto& wptr : slaves_)
+    {
+        auto cli = wptr.lock();
+        if (cli && cli->GetSlaveInfo()->state == QSlaveState_online)
+            ++ n;
+    }
+
+    return n;
+}
+
 void QReplication::AddSlave(qedis::QClient* cli)
 {
     slaves_.push_back(std::static_pointer_cast<QClient>(cli->shared_from_this()));
@@ -51,10 +64,23 @@ bool QReplication::HasAnyWaitingBgsave() const
     return false;
 }
 
-void QReplication::OnRdbSaveDone()
+void QReplication::OnRdbSaveDone(bool succ)
 {
     bgsaving_ = false;
     
+    if (!succ)
+    {
+        for (auto& wptr : slaves_)
+        {
+            auto cli = wptr.lock();
+            if (cli && cli->GetSlaveInfo()->state == QSlaveState_wait_bgsave_end)
+                cli->OnError(); // release slave, it will retry sync
+        }
+
+        buffer_.Clear();
+        return;
+    }
+
     InputMemoryFile  rdb;
     
     // send rdb to slaves that wait rdb end, set state
@@ -101,17 +127,7 @@ void QReplication::TryBgsave()
     if (!HasAnyWaitingBgsave())
         return;
     
-    int ret = fork();
-    if (ret == 0)
-    {
-        {
-            QDBSaver  qdb;
-            qdb.Save(g_config.rdbfullname.c_str());
-            std::cerr << "QReplication save rdb done, exiting child\n";
-        }
-        _exit(0);
-    }
-    else if (ret == -1)
+    if (!QDBSaver::BackgroundSave(g_config.rdbfullname.c_str()))
     {
         ERR << "QReplication save rdb FATAL ERROR";
         _OnStartBgsave(false);
@@ -119,7 +135,6 @@ void QReplication::TryBgsave()
     else
     {
         INF << "QReplication save rdb START";
-        g_qdbPid = ret;
         _OnStartBgsave(true);
     }
 }
@@ -389,9 +404,16 @@ SocketAddr QReplication::GetMasterAddr() const
 void QReplication::SetMasterAddr(const char* ip, unsigned short port)
 {
     if (ip)
+    {
         masterInfo_.addr.Init(ip, port);
+        // link is down until connected, INFO may come first
+        if (!masterInfo_.downSince)
+            masterInfo_.downSince = ::time(nullptr);
+    }
     else
+    {
         masterInfo_.addr.Clear();
+    }
 }
     
 void QReplication::SetRdbSize(std::size_t s)
@@ -512,6 +534,8 @@ void QReplication::OnInfoCommand(UnboundedBuffer& res)
 
         auto master = master_.lock();
         masterInfo << (master ? "up\r\n" : "down\r\n");
+        masterInfo << "master_sync_in_progress:"
+                   << (masterInfo_.state != QReplState_online) << "\r\n";
         if (!master)
         {
             if (!masterInfo_.downSince)
@@ -83,7 +83,8 @@ public:
     void TryBgsave();
     bool StartBgsave();
     void OnStartBgsave();
-    void OnRdbSaveDone();
+    // failed save releases slaves waiting for it
+    void OnRdbSaveDone(bool succ);
     void SendToSlaves(const std::vector<QString>& params);
     
     // slave side
@@ -95,6 +96,11 @@ public:
     QReplState GetMasterState() const;
     SocketAddr GetMasterAddr() const;
     std::size_t GetRdbSize() const;
+
+    // master side, slaves receiving the command stream
+    std::size_t OnlineSlaves() const;
+    // slave side
+    bool IsMasterLinkUp() const { return !master_.expired(); }
     
     // info command
     void OnInfoCommand(UnboundedBuffer& res);
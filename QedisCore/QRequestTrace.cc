@@ -0,0 +1,169 @@
+
+#include <cstdio>
+#include <fstream>
+#include "QRequestTrace.h"
+#include "QCommon.h"
+#include "UnboundedBuffer.h"
+
+namespace qedis
+{
+
+static const char* const kStageNames[] =
+{
+    "recv",
+    "parse",
+    "exec",
+    "reply",
+    "send",
+    "total",
+};
+
+QRequestTrace& QRequestTrace::Instance()
+{
+    static QRequestTrace trace;
+    return trace;
+}
+
+QRequestTrace::QRequestTrace() :
+    rate_(0),
+    counter_(0),
+    traced_(0),
+    next_(0)
+{
+    for (auto& sum : sums_)
+        sum = 0;
+}
+
+static uint64_t Delay(uint64_t from, uint64_t to)
+{
+    return to > from ? to - from : 0;
+}
+
+void QRequestTrace::OnDone(const Trace& trace)
+{
+    const uint64_t delays[Stage_max] =
+    {
+        Delay(trace.recv, trace.parse),
+        Delay(trace.parse, trace.exec),
+        Delay(trace.exec, trace.execEnd),
+        Delay(trace.execEnd, trace.queued),
+        Delay(trace.queued, trace.sent),
+        Delay(trace.recv, trace.sent),
+    };
+
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    for (int i = 0; i < Stage_max; ++ i)
+    {
+        stages_[i].Record(delays[i]);
+        sums_[i] += delays[i];
+    }
+
+    ++ traced_;
+
+    if (raw_.size() < kRawTraces)
+    {
+        raw_.push_back(trace);
+        next_ = raw_.size() % kRawTraces;
+    }
+    else
+    {
+        raw_[next_] = trace;
+        next_ = (next_ + 1) % kRawTraces;
+    }
+}
+
+void QRequestTrace::Reset()
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    for (int i = 0; i < Stage_max; ++ i)
+    {
+        stages_[i].Reset();
+        sums_[i] = 0;
+    }
+
+    traced_ = 0;
+    raw_.clear();
+    next_ = 0;
+}
+
+long QRequestTrace::Dump(const QString& file)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    std::ofstream ofs(file.c_str(), std::ios::trunc);
+    if (!ofs)
+        return -1;
+
+    ofs << "# client cmd recv parse exec exec_end queued sent, monotonic usec\n";
+
+    const size_t size = raw_.size();
+    const size_t start = size < kRawTraces ? 0 : next_;
+    for (size_t i = 0; i < size; ++ i)
+    {
+        const Trace& t = raw_[(start + i) % size];
+        ofs << t.client << ' ' << t.cmd << ' '
+            << t.recv << ' ' << t.parse << ' '
+            << t.exec << ' ' << t.execEnd << ' '
+            << t.queued << ' ' << t.sent << '\n';
+    }
+
+    ofs.flush();
+    return ofs ? static_cast<long>(size) : -1;
+}
+
+void QRequestTrace::_FormatStats(UnboundedBuffer& res)
+{
+    char buf[256];
+    int n = snprintf(buf, sizeof buf - 1,
+                     "# Tracing\r\n"
+                     "trace_sample_rate:%u\r\n"
+                     "traced_requests:%lu\r\n"
+                     , rate_
+                     , traced_);
+
+    res.PushData(buf, n);
+
+    for (int i = 0; i < Stage_max; ++ i)
+    {
+        const QHistogram& h = stages_[i];
+        n = snprintf(buf, sizeof buf - 1,
+                     "trace_%s_usec:avg=%.2f,p50=%lu,p99=%lu,p99.9=%lu,max=%lu\r\n",
+                     kStageNames[i],
+                     traced_ ? static_cast<double>(sums_[i]) / traced_ : 0.0,
+                     h.Percentile(50),
+                     h.Percentile(99),
+                     h.Percentile(99.9),
+                     h.Percentile(100));
+
+        res.PushData(buf, n);
+    }
+}
+
+void QRequestTrace::OnInfoCommand(UnboundedBuffer& res)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    if (rate_ == 0 && traced_ == 0)
+        return;
+
+    if (!res.IsEmpty())
+        res.PushData("\r\n", 2);
+
+    _FormatStats(res);
+}
+
+void QRequestTrace::OnStatsCommand(UnboundedBuffer* reply)
+{
+    UnboundedBuffer res;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        _FormatStats(res);
+    }
+
+    FormatBulk(res.ReadAddr(), res.ReadableSize(), reply);
+}
+
+}
+
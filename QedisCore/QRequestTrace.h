@@ -0,0 +1,99 @@
+#ifndef BERT_QREQUESTTRACE_H
+#define BERT_QREQUESTTRACE_H
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include "QString.h"
+#include "QCommandStats.h"
+
+namespace qedis
+{
+
+class UnboundedBuffer;
+
+// Sampled request lifecycle tracing.
+// One of every trace-sample-rate requests is timestamped: when recv thread
+// last read data before it was parsed, parse start, execute start and end,
+// reply queued to send buffer, and reply written by send thread. Delays
+// between the stages go to histograms, the latest raw traces are kept in
+// memory for DEBUG TRACE DUMP.
+class QRequestTrace
+{
+public:
+    static QRequestTrace& Instance();
+
+    QRequestTrace(const QRequestTrace& ) = delete;
+    void operator= (const QRequestTrace& ) = delete;
+
+    // all times are NowUs()
+    struct Trace
+    {
+        uint64_t client = 0;
+        QString  cmd;
+        uint64_t recv = 0;
+        uint64_t parse = 0;
+        uint64_t exec = 0;
+        uint64_t execEnd = 0;
+        uint64_t queued = 0;
+        uint64_t sent = 0;
+    };
+
+    // 0 to disable
+    void SetSampleRate(int rate) { rate_ = rate > 0 ? static_cast<uint32_t>(rate) : 0; }
+
+    // main thread, true if the request should be traced
+    bool Sample()
+    {
+        if (rate_ == 0 || ++ counter_ < rate_)
+            return false;
+
+        counter_ = 0;
+        return true;
+    }
+
+    // send thread, reply of trace is written
+    void OnDone(const Trace& trace);
+
+    void Reset();
+    // write raw traces to file, oldest first; -1 if failed
+    long Dump(const QString& file);
+
+    void OnInfoCommand(UnboundedBuffer& res);
+    // DEBUG TRACE STATS, same as the info section
+    void OnStatsCommand(UnboundedBuffer* reply);
+
+    static const size_t kRawTraces = 4096;
+
+private:
+    QRequestTrace();
+
+    void _FormatStats(UnboundedBuffer& res);
+
+    enum Stage
+    {
+        Stage_recv,   // recv -> parse, waiting in recv buffer
+        Stage_parse,  // parse -> exec
+        Stage_exec,   // exec -> execEnd
+        Stage_reply,  // execEnd -> queued
+        Stage_send,   // queued -> sent, waiting for send thread and writev
+        Stage_total,  // recv -> sent
+        Stage_max,
+    };
+
+    uint32_t rate_;
+    uint32_t counter_;
+
+    // send thread adds traces
+    std::mutex mutex_;
+    QHistogram stages_[Stage_max];
+    uint64_t   sums_[Stage_max];
+    uint64_t   traced_;
+    std::vector<Trace> raw_; // ring
+    size_t     next_;
+};
+
+}
+
+#endif
+
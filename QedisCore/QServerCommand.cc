@@ -1,4 +1,5 @@
 #include <sys/utsname.h>
+#include <algorithm>
 #include <cassert>
 #include <unistd.h>
 
@@ -8,8 +9,14 @@
 #include "Server.h"
 #include "QDB.h"
 #include "QAOF.h"
+#include "QCheckpoint.h"
 #include "QConfig.h"
 #include "QSlowLog.h"
+#include "QCommandStats.h"
+#include "QLatencyMonitor.h"
+#include "QRequestTrace.h"
+#include "QTraceCapture.h"
+#include "QKeyStats.h"
 #include "QGlobRegex.h"
 #include "Delegate.h"
 
@@ -88,24 +95,10 @@ QError bgsave(const std::vector<QString>& params, UnboundedBuffer* reply)
         return QError_ok;
     }
    
-    int ret = fork();
-    if (ret == 0)
-    {
-        {
-        QDBSaver  qdb;
-        qdb.Save(g_config.rdbfullname.c_str());
-        }
-        _exit(0);
-    }
-    else if (ret == -1)
-    {
+    if (!QDBSaver::BackgroundSave(g_config.rdbfullname.c_str()))
         FormatSingle("Background saving FAILED", 24, reply);
-    }
     else
-    {
-        g_qdbPid = ret;
         FormatSingle("Background saving started", 25, reply);
-    }
 
     return QError_ok;
 }
@@ -122,7 +115,14 @@ QError save(const std::vector<QString>& params, UnboundedBuffer* reply)
     }
     
     QDBSaver qdb;
-    qdb.Save(g_config.rdbfullname.c_str());
+    if (!qdb.Save(g_config.rdbfullname.c_str()))
+    {
+        reply->PushData("-ERR save rdb failed\r\n",
+                 sizeof "-ERR save rdb failed\r\n" - 1);
+        return QError_ok;
+    }
+
+    QCheckpoint::Instance().OnFullSaved();
     g_lastQDBSave = time(NULL);
 
     FormatOK(reply);
@@ -215,6 +215,47 @@ QError debug(const std::vector<QString>& params, UnboundedBuffer* reply)
             FormatBulk(buf, len, reply);
         }
     }
+    else if (strcasecmp(params[1].c_str(), "trace") == 0 && params.size() >= 3)
+    {
+        if (strcasecmp(params[2].c_str(), "stats") == 0 && params.size() == 3)
+        {
+            QRequestTrace::Instance().OnStatsCommand(reply);
+        }
+        else if (strcasecmp(params[2].c_str(), "dump") == 0 && params.size() == 4)
+        {
+            const long n = QRequestTrace::Instance().Dump(params[3]);
+            if (n < 0)
+                ReplyError(err = QError_param, reply);
+            else
+                FormatInt(n, reply);
+        }
+        else if (strcasecmp(params[2].c_str(), "reset") == 0 && params.size() == 3)
+        {
+            QRequestTrace::Instance().Reset();
+            FormatOK(reply);
+        }
+        else if (strcasecmp(params[2].c_str(), "start") == 0 && (params.size() == 4 || params.size() == 5))
+        {
+            // DEBUG TRACE START <file> [rate], capture requests of one in rate clients
+            const int rate = params.size() == 5 ? atoi(params[4].c_str()) : 1;
+            if (QTraceCapture::Instance().Start(params[3], rate))
+                FormatOK(reply);
+            else
+                ReplyError(err = QError_param, reply);
+        }
+        else if (strcasecmp(params[2].c_str(), "stop") == 0 && params.size() == 3)
+        {
+            const long n = QTraceCapture::Instance().Stop();
+            if (n < 0)
+                ReplyError(err = QError_param, reply);
+            else
+                FormatInt(n, reply);
+        }
+        else
+        {
+            ReplyError(err = QError_syntax, reply);
+        }
+    }
     else
     {
         ReplyError(err = QError_param, reply);
@@ -229,7 +270,8 @@ QError shutdown(const std::vector<QString>& params, UnboundedBuffer* reply)
     if (params.size() == 2 && strncasecmp(params[1].c_str(), "save", 4) == 0)
     {
         QDBSaver  qdb;
-        qdb.Save(g_config.rdbfullname.c_str());
+        if (qdb.Save(g_config.rdbfullname.c_str()))
+            QCheckpoint::Instance().OnFullSaved();
     }
 
     Server::Instance()->Terminate();
@@ -281,6 +323,26 @@ void OnMemoryInfoCollect(UnboundedBuffer& res)
     res.PushData(buf, n);
 }
 
+void OnPersistenceInfoCollect(UnboundedBuffer& res)
+{
+    char buf[256];
+    int n = snprintf(buf, sizeof buf - 1,
+                 "# Persistence\r\n"
+                 "rdb_bgsave_in_progress:%d\r\n"
+                 "rdb_last_save_time:%ld\r\n"
+                 "aof_enabled:%d\r\n"
+                 "aof_rewrite_in_progress:%d\r\n"
+                 , g_qdbPid != -1
+                 , static_cast<long>(g_lastQDBSave)
+                 , g_config.appendonly
+                 , g_rewritePid != -1);
+
+    if (!res.IsEmpty())
+        res.PushData("\r\n", 2);
+
+    res.PushData(buf, n);
+}
+
 void OnServerInfoCollect(UnboundedBuffer& res)
 {
     char buf[1024];
@@ -325,12 +387,68 @@ void OnClientInfoCollect(UnboundedBuffer& res)
     res.PushData(buf, n);
 }
 
+// sections of info whose "# Name" header matches, case insensitive
+static void FilterInfoSection(const char* info, std::size_t len, const QString& section, UnboundedBuffer& res)
+{
+    const char* const end = info + len;
+    bool keep = false;
+    for (const char* line = info; line < end; )
+    {
+        const char* eol = std::search(line, end, "\r\n", "\r\n" + 2);
+        const std::size_t lineLen = eol - line;
+        if (eol != end)
+            eol += 2;
+
+        if (lineLen > 2 && line[0] == '#' && line[1] == ' ')
+        {
+            keep = lineLen - 2 == section.size() &&
+                   strncasecmp(line + 2, section.c_str(), section.size()) == 0;
+
+            if (keep && !res.IsEmpty())
+                res.PushData("\r\n", 2);
+        }
+
+        if (keep && lineLen > 0)
+            res.PushData(line, eol - line);
+
+        line = eol;
+    }
+}
+
 QError info(const std::vector<QString>& params, UnboundedBuffer* reply)
 {
     UnboundedBuffer res;
 
     extern Delegate<void (UnboundedBuffer& )> g_infoCollector;
-    g_infoCollector(res);
+
+    // commandstats and latencystats are long, only shown when asked
+    const QString section = params.size() > 1 ? params[1] : QString();
+    if (section.empty() ||
+        strcasecmp(section.c_str(), "default") == 0 ||
+        strcasecmp(section.c_str(), "all") == 0 ||
+        strcasecmp(section.c_str(), "everything") == 0)
+    {
+        g_infoCollector(res);
+        if (!section.empty() && strcasecmp(section.c_str(), "default") != 0)
+        {
+            QCommandStats::Instance().OnCommandStatsInfo(res);
+            QCommandStats::Instance().OnLatencyStatsInfo(res);
+        }
+    }
+    else if (strcasecmp(section.c_str(), "commandstats") == 0)
+    {
+        QCommandStats::Instance().OnCommandStatsInfo(res);
+    }
+    else if (strcasecmp(section.c_str(), "latencystats") == 0)
+    {
+        QCommandStats::Instance().OnLatencyStatsInfo(res);
+    }
+    else
+    {
+        UnboundedBuffer all;
+        g_infoCollector(all);
+        FilterInfoSection(all.ReadAddr(), all.ReadableSize(), section, res);
+    }
     
     FormatBulk(res.ReadAddr(), res.ReadableSize(), reply);
     return QError_ok;
@@ -412,6 +530,83 @@ QError slowlog(const std::vector<QString>& params, UnboundedBuffer* reply)
     return QError_ok;
 }
 
+QError latency(const std::vector<QString>& params, UnboundedBuffer* reply)
+{
+    if (strcasecmp(params[1].c_str(), "histogram") == 0)
+    {
+        QCommandStats::Instance().OnHistogramCommand(params, reply);
+    }
+    else if (strcasecmp(params[1].c_str(), "latest") == 0 && params.size() == 2)
+    {
+        QLatencyMonitor::Instance().OnLatestCommand(reply);
+    }
+    else if (strcasecmp(params[1].c_str(), "history") == 0 && params.size() == 3)
+    {
+        QLatencyMonitor::Instance().OnHistoryCommand(params[2], reply);
+    }
+    else if (strcasecmp(params[1].c_str(), "reset") == 0)
+    {
+        std::vector<QString> events(params.begin() + 2, params.end());
+        FormatInt(static_cast<long>(QLatencyMonitor::Instance().Reset(events)), reply);
+    }
+    else
+    {
+        ReplyError(QError_syntax, reply);
+        return QError_syntax;
+    }
+
+    return QError_ok;
+}
+
+// HOTKEYS [count]
+QError hotkeys(const std::vector<QString>& params, UnboundedBuffer* reply)
+{
+    long count = 10;
+    if (params.size() > 2 ||
+        (params.size() == 2 && (!Strtol(params[1].c_str(), params[1].size(), &count) || count < 0)))
+    {
+        ReplyError(QError_syntax, reply);
+        return QError_syntax;
+    }
+
+    QHotKeys::Instance().OnHotKeysCommand(static_cast<size_t>(count), reply);
+    return QError_ok;
+}
+
+// BIGKEYS [MEMORY|ELEMENTS] [count]
+QError bigkeys(const std::vector<QString>& params, UnboundedBuffer* reply)
+{
+    bool byElements = false;
+    long count = 10;
+
+    size_t i = 1;
+    if (i < params.size() && strcasecmp(params[i].c_str(), "memory") == 0)
+    {
+        ++ i;
+    }
+    else if (i < params.size() && strcasecmp(params[i].c_str(), "elements") == 0)
+    {
+        byElements = true;
+        ++ i;
+    }
+
+    if (i < params.size())
+    {
+        if (!Strtol(params[i].c_str(), params[i].size(), &count) || count < 0)
+            i = 0; // invalid count
+        else
+            ++ i;
+    }
+
+    if (i != params.size())
+    {
+        ReplyError(QError_syntax, reply);
+        return QError_syntax;
+    }
+
+    QBigKeys::Instance().OnBigKeysCommand(byElements, static_cast<size_t>(count), reply);
+    return QError_ok;
+}
 
 // Config options get/set
 //
@@ -420,6 +615,7 @@ enum ConfigType {
     Config_bool,
     Config_int,
     Config_int64,
+    Config_codec,
 };
 
 struct ConfigInfo
@@ -446,14 +642,30 @@ std::map<QString, ConfigInfo> configOptions = {
     {"requirepass", {Config_string, true, &g_config.password}},
     {"rdbchecksum", {Config_bool, false, &g_config.rdbchecksum}},
     {"rdbcompression", {Config_bool, false, &g_config.rdbcompression}},
+    {"rdb-forkless", {Config_bool, true, &g_config.rdbforkless}},
+    {"rdb-incremental-max-deltas", {Config_int, true, &g_config.rdbmaxdeltas}},
+    {"rdb-codec", {Config_codec, true, &g_config.rdbcodec}},
+    {"save-threads", {Config_int, true, &g_config.savethreads}},
+    {"dump-codec", {Config_codec, true, &g_config.dumpcodec}},
     {"slowlog-log-slower-than", {Config_int, true, &g_config.slowlogtime}},
     {"slowlog-max-len", {Config_int, true, &g_config.slowlogmaxlen}},
+    {"latency-monitor-threshold", {Config_int, true, &g_config.latencythreshold}},
+    {"trace-sample-rate", {Config_int, true, &g_config.tracesamplerate}},
+    {"hotkeys-sample-rate", {Config_int, true, &g_config.hotkeyssamplerate}},
+    {"bigkeys-scan-interval", {Config_int, true, &g_config.bigkeysscaninterval}},
+    {"bigkeys-scan-keys", {Config_int, true, &g_config.bigkeysscankeys}},
+    {"metrics-port", {Config_int, false, &g_config.metricsport}},
     {"slaveof", {Config_string, false, &g_config.masterIp}},
     {"maxmemory", {Config_int64, true, &g_config.maxmemory}},
     {"maxmemorySamples", {Config_int, true, &g_config.maxmemorySamples}},
     {"maxmemory-noevict", {Config_bool, true, &g_config.noeviction}},
+    {"maxmemory-tiered", {Config_bool, true, &g_config.tieredstorage}},
     {"backend", {Config_int, false, &g_config.backend}},
     {"backendhz", {Config_int, false, &g_config.backendHz}},
+    {"backend-codec", {Config_codec, true, &g_config.backendcodec}},
+    {"backend-field-threshold", {Config_int, true, &g_config.backendfieldthreshold}},
+    {"backend-warmup-memory", {Config_int64, true, &g_config.backendwarmupmemory}},
+    {"backend-warmup-interval", {Config_int, true, &g_config.backendwarmupinterval}},
 };
 
 static std::vector<QString> GetConfig(const QString& option)
@@ -497,6 +709,10 @@ static std::vector<QString> GetConfig(const QString& option)
                 res.push_back(*(const QString*)it->second.value);
                 break;
 
+            case Config_codec:
+                res.push_back(CodecName(*(const QCodec*)it->second.value));
+                break;
+
             case Config_int:
             case Config_int64:
                 {
@@ -541,6 +757,11 @@ static QError SetConfig(const QString& option, const QString& value)
             *(QString*)it->second.value = value;
             break;
 
+        case Config_codec:
+            if (!ParseCodec(value, *(QCodec*)it->second.value))
+                return QError_syntax;
+            break;
+
         case Config_int:
         case Config_int64:
             {
@@ -558,6 +779,18 @@ static QError SetConfig(const QString& option, const QString& value)
                         QSlowLog::Instance().SetThreshold(g_config.slowlogtime);
                         QSlowLog::Instance().SetLogLimit(static_cast<std::size_t>(g_config.slowlogmaxlen));
                     }
+                    else if (option == "latency-monitor-threshold")
+                    {
+                        QLatencyMonitor::Instance().SetThreshold(g_config.latencythreshold);
+                    }
+                    else if (option == "trace-sample-rate")
+                    {
+                        QRequestTrace::Instance().SetSampleRate(g_config.tracesamplerate);
+                    }
+                    else if (option == "hotkeys-sample-rate")
+                    {
+                        QHotKeys::Instance().SetSampleRate(g_config.hotkeyssamplerate);
+                    }
                 }
                 else
                 {
@@ -576,7 +809,21 @@ static QError SetConfig(const QString& option, const QString& value)
 
 QError config(const std::vector<QString>& params, UnboundedBuffer* reply)
 {
+    if (params.size() == 2 && strcasecmp(params[1].c_str(), "resetstat") == 0)
+    {
+        QCommandStats::Instance().Reset();
+        QHotKeys::Instance().Reset();
+        FormatOK(reply);
+        return QError_ok;
+    }
+
     // at least 3 params
+    if (params.size() < 3)
+    {
+        ReplyError(QError_param, reply);
+        return QError_param;
+    }
+
     if (strncasecmp(params[1].c_str(), "get", 3) == 0)
     {
         auto res = GetConfig(params[2]);
@@ -1,4 +1,3 @@
-#include <sys/time.h>
 #include <fstream>
 #include <sstream>
 
@@ -33,26 +32,10 @@ void QSlowLog::SetLogLimit(std::size_t maxCount)
     logMaxCount_ = maxCount;
 }
 
-void QSlowLog::Begin()
+void QSlowLog::EndAndStat(const std::vector<QString>& cmds, long long used)
 {
     if (!threshold_)
         return;
-
-    timeval  begin;
-    gettimeofday(&begin, 0);
-    beginUs_ = begin.tv_sec * 1000000 + begin.tv_usec;
-}
-
-
-
-void QSlowLog::EndAndStat(const std::vector<QString>& cmds)
-{
-    if (!threshold_ || beginUs_ == 0)
-        return;
-    
-    timeval  end;
-    gettimeofday(&end, 0);
-    auto used = end.tv_sec * 1000000 + end.tv_usec - beginUs_;
     
     if (used >= threshold_)
     {
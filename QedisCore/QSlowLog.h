@@ -33,8 +33,8 @@ public:
     QSlowLog(const QSlowLog& ) = delete;
     void operator= (const QSlowLog& ) = delete;
 
-    void Begin();
-    void EndAndStat(const std::vector<QString>& cmds);
+    // used: microseconds the command took
+    void EndAndStat(const std::vector<QString>& cmds, long long used);
     
     void SetThreshold(unsigned int );
     void SetLogLimit(std::size_t maxCount);
@@ -48,7 +48,6 @@ private:
     ~QSlowLog();
     
     unsigned int threshold_;
-    long long    beginUs_;
     Logger*      logger_;
     
     std::size_t  logMaxCount_;
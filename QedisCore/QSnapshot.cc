@@ -0,0 +1,374 @@
+
+#include "QSnapshot.h"
+#include "QLazyLoader.h"
+#include "QDB.h"
+#include "Log/Logger.h"
+#include "Threads/ThreadPool.h"
+#include <cassert>
+#include <algorithm>
+
+namespace qedis
+{
+
+// unordered_map won't rehash until size > buckets * factor
+static const float  kNoRehashLoadFactor = 1000000.0f;
+static const size_t kMinBuckets = 1024;
+// buckets are sized for the keys at start plus as many new ones
+static const size_t kBucketsPerKey = 2;
+// new keys only chain longer while frozen, give up before lookups get slow
+static const size_t kMaxLoadFactor = 4;
+// max keys saved per lock, main thread may wait for them
+static const size_t kKeysPerLock = 256;
+
+static QObject CloneObject(const QObject& obj)
+{
+    QObject copy(QType(obj.type));
+    copy.encoding = obj.encoding;
+    copy.lru = obj.lru;
+
+    switch (obj.encoding)
+    {
+        case QEncode_raw:
+            copy.value = new QString(*obj.CastString());
+            break;
+
+        case QEncode_int:
+            copy.value = obj.value;
+            break;
+
+        case QEncode_list:
+            copy.value = new QList(*obj.CastList());
+            break;
+
+        case QEncode_set:
+            copy.value = new QSet(*obj.CastSet());
+            break;
+
+        case QEncode_sset:
+            copy.value = new QSortedSet(*obj.CastSortedSet());
+            break;
+
+        case QEncode_hash:
+            copy.value = new QHash(*obj.CastHash());
+            break;
+
+        default:
+            break;
+    }
+
+    return copy;
+}
+
+QSnapshot& QSnapshot::Instance()
+{
+    static QSnapshot snapshot;
+    return snapshot;
+}
+
+bool QSnapshot::Start(const QString& qdbFile, const std::vector<QCheckpointDelta>* delta)
+{
+    assert (!running_);
+
+    // the snapshot walks buckets, keys left in lazily loaded rdb first
+    if (!delta)
+        QLazyLoader::Instance().LoadAll(-1);
+
+    auto& store = QSTORE.store_;
+
+    dbs_.clear();
+    dbs_.resize(store.size());
+    for (size_t i = 0; i < store.size(); ++ i)
+    {
+        QDB& db = store[i];
+        const size_t buckets = std::max(kMinBuckets, db.size() * kBucketsPerKey);
+        if (db.bucket_count() < buckets)
+            db.rehash(buckets);
+
+        // freeze bucket count, the cursor depends on it
+        db.max_load_factor(kNoRehashLoadFactor);
+        dbs_[i].buckets = db.bucket_count();
+        dbs_[i].keys = db.size();
+
+        const auto& expires = QSTORE.expiresDb_[i].Keys();
+        if (!delta)
+        {
+            dbs_[i].expires = expires;
+            continue;
+        }
+
+        for (const auto& key : (*delta)[i].keys)
+        {
+            auto it = expires.find(key);
+            if (it != expires.end())
+                dbs_[i].expires.insert(*it);
+        }
+    }
+
+    now_ = ::Now();
+    file_ = qdbFile;
+    delta_ = delta;
+    aborted_ = false;
+    running_ = true;
+
+    // created here, it reads config
+    std::shared_ptr<QDBSaver> qdb = std::make_shared<QDBSaver>();
+    qdb->SetDelta(delta);
+    result_ = ThreadPool::Instance().ExecuteTask([qdb, qdbFile]() {
+        return qdb->Save(qdbFile.c_str(), &QSnapshot::Instance());
+    });
+
+    if (!result_.valid())
+    {
+        ERR << "start snapshot thread failed";
+        _Finish();
+        return false;
+    }
+
+    INF << "start snapshot " << qdbFile;
+    return true;
+}
+
+bool QSnapshot::CheckDone(bool& succ)
+{
+    if (!running_)
+        return false;
+
+    if (result_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+
+    succ = result_.get();
+
+    const bool aborted = aborted_;
+    const QString file = file_;
+    const auto delta = delta_;
+    _Finish();
+
+    if (aborted)
+    {
+        if (QDBSaver::RetryByFork(file.c_str(), delta))
+            return false;
+
+        ERR << "fork to save " << file << " failed";
+        succ = false;
+    }
+
+    return true;
+}
+
+void QSnapshot::_Finish()
+{
+    for (auto& db : QSTORE.store_)
+        db.max_load_factor(1.0f);
+
+    dbs_.clear();
+    file_.clear();
+    delta_ = nullptr;
+    aborted_ = false;
+    running_ = false;
+}
+
+void QSnapshot::_Abort()
+{
+    aborted_ = true;
+
+    // let dbs rehash now, old versions are not needed any more
+    for (auto& db : QSTORE.store_)
+        db.max_load_factor(1.0f);
+
+    for (auto& state : dbs_)
+        QDB().swap(state.preserved);
+}
+
+bool QSnapshot::_IsVisited(const DbState& state, const QDB& db, const QString& key) const
+{
+    return state.drained || db.bucket(key) < state.cursor;
+}
+
+std::unique_lock<std::mutex> QSnapshot::BeforeWrite(int dbno, const QString& key)
+{
+    if (!running_ || aborted_)
+        return std::unique_lock<std::mutex>();
+
+    std::unique_lock<std::mutex> guard(mutex_);
+
+    DbState& state = dbs_[dbno];
+    const QDB& db = QSTORE.store_[dbno];
+    if (db.size() >= state.buckets * kMaxLoadFactor)
+    {
+        WRN << "snapshot of db " << dbno << " gives up, keys " << db.size()
+            << " in frozen buckets " << state.buckets << ", load factor passes " << kMaxLoadFactor
+            << ", fork to save " << file_;
+        _Abort();
+        return std::unique_lock<std::mutex>();
+    }
+
+    if (_IsVisited(state, db, key) || state.preserved.count(key))
+        return guard;
+
+    if (delta_ && !(*delta_)[dbno].keys.count(key))
+        return guard;
+
+    auto it = db.find(key);
+    if (it != db.end())
+        state.preserved.insert(QDB::value_type(key, CloneObject(it->second)));
+    else
+        state.preserved.insert(QDB::value_type(key, QObject()));
+
+    return guard;
+}
+
+std::unique_lock<std::mutex> QSnapshot::BeforeClear(int dbno)
+{
+    if (!running_ || aborted_)
+        return std::unique_lock<std::mutex>();
+
+    std::unique_lock<std::mutex> guard(mutex_);
+
+    for (int i = 0; i < DbNum(); ++ i)
+    {
+        if (dbno == -1 || dbno == i)
+            _Drain(i, dbs_[i], QSTORE.store_[i]);
+    }
+
+    return guard;
+}
+
+void QSnapshot::_Drain(int dbno, DbState& state, QDB& db)
+{
+    if (state.drained)
+        return;
+
+    // data is going to be destroyed, move instead of copy
+    if (delta_)
+    {
+        for (const auto& key : (*delta_)[dbno].keys)
+        {
+            auto it = db.find(key);
+            if (it != db.end() && !state.preserved.count(key))
+                state.preserved.insert(QDB::value_type(key, std::move(it->second)));
+        }
+
+        state.drained = true;
+        return;
+    }
+
+    for (size_t b = state.cursor; b < state.buckets; ++ b)
+    {
+        for (auto it = db.begin(b); it != db.end(b); ++ it)
+        {
+            if (!state.preserved.count(it->first))
+                state.preserved.insert(QDB::value_type(it->first, std::move(it->second)));
+        }
+    }
+
+    state.drained = true;
+}
+
+void QSnapshot::ForEach(int dbno, const Visitor& visitor)
+{
+    DbState& state = dbs_[dbno];
+
+    auto visit = [&](const QString& key, const QObject& obj) {
+        int64_t expireAt = 0;
+
+        auto it = state.expires.find(key);
+        if (it != state.expires.end())
+        {
+            if (it->second <= now_)
+                return;
+
+            expireAt = static_cast<int64_t>(it->second);
+        }
+
+        visitor(key, obj, expireAt);
+    };
+
+    while (true)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (aborted_)
+            return;
+
+        if (state.drained || state.cursor >= state.buckets)
+            break;
+
+        const QDB& db = QSTORE.store_[dbno];
+        size_t n = 0;
+        for (; state.cursor < state.buckets && n < kKeysPerLock; ++ state.cursor)
+        {
+            for (auto it = db.begin(state.cursor); it != db.end(state.cursor); ++ it, ++ n)
+            {
+                if (!state.preserved.count(it->first))
+                    visit(it->first, it->second);
+            }
+        }
+    }
+
+    // all keys are visited now, nobody will add to preserved
+    QDB preserved;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (aborted_)
+            return;
+
+        preserved.swap(state.preserved);
+    }
+
+    for (const auto& kv : preserved)
+    {
+        if (kv.second.type != QType_invalid)
+            visit(kv.first, kv.second);
+    }
+}
+
+void QSnapshot::ForEachChanged(int dbno, const std::unordered_set<QString, Hash>& keys,
+                               const Visitor& visitor,
+                               const std::function<void (const QString& key)>& deleted)
+{
+    DbState& state = dbs_[dbno];
+    const QDB& db = QSTORE.store_[dbno];
+
+    auto key = keys.begin();
+    while (key != keys.end())
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (aborted_)
+            return;
+
+        for (size_t n = 0; key != keys.end() && n < kKeysPerLock; ++ key, ++ n)
+        {
+            // the old version if modified since start, else it's untouched
+            const QObject* obj = nullptr;
+            auto it = state.preserved.find(*key);
+            if (it != state.preserved.end())
+            {
+                if (it->second.type != QType_invalid)
+                    obj = &it->second;
+            }
+            else if (!state.drained)
+            {
+                auto live = db.find(*key);
+                if (live != db.end())
+                    obj = &live->second;
+            }
+
+            int64_t expireAt = 0;
+            auto expire = state.expires.find(*key);
+            if (expire != state.expires.end())
+            {
+                if (expire->second <= now_)
+                    obj = nullptr;
+                else
+                    expireAt = static_cast<int64_t>(expire->second);
+            }
+
+            if (obj)
+                visitor(*key, *obj, expireAt);
+            else
+                deleted(*key);
+        }
+    }
+}
+
+}
+
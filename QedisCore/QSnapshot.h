@@ -0,0 +1,94 @@
+#ifndef BERT_QSNAPSHOT_H
+#define BERT_QSNAPSHOT_H
+
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <functional>
+#include "QStore.h"
+
+namespace qedis
+{
+
+// In process snapshot, no fork.
+// A background thread walks every db bucket by bucket, the bucket count is
+// frozen while running, so "visited" is just bucket(key) < cursor. Buckets
+// are sized at start for twice the keys, past that new keys chain longer;
+// if they chain too long the snapshot gives up and a fork child saves.
+// Before main thread modifies an unvisited key, the old version is preserved,
+// so the saver always see the keyspace at the moment Start() was called.
+// For a delta of incremental rdb only the changed keys are looked up, so
+// only they are preserved, and nothing is visited until the end.
+class QSnapshot
+{
+public:
+    static QSnapshot& Instance();
+
+    QSnapshot(const QSnapshot& ) = delete;
+    void operator= (const QSnapshot& ) = delete;
+
+    // main thread
+    bool Start(const QString& qdbFile, const std::vector<QCheckpointDelta>* delta = nullptr);
+    bool IsRunning() const { return running_; }
+    // true if the save is done, succ is its result; not done if it gave up
+    // and the fork child is saving
+    bool CheckDone(bool& succ);
+    // too many keys added, the saver thread stops, its file is dropped
+    bool IsAborted() const { return aborted_; }
+
+    // main thread, call before modify key; the returned lock must be held
+    // while the db structure is changed(insert or erase)
+    std::unique_lock<std::mutex> BeforeWrite(int dbno, const QString& key);
+    // main thread, call before clear the db or all dbs(dbno = -1)
+    std::unique_lock<std::mutex> BeforeClear(int dbno);
+
+    // saver thread
+    using Visitor = std::function<void (const QString& key, const QObject& obj, int64_t expireAt)>;
+    int  DbNum() const { return static_cast<int>(dbs_.size()); }
+    // sizes at start, hint for loader
+    size_t DbSize(int dbno) const { return dbs_[dbno].keys; }
+    size_t ExpiresSize(int dbno) const { return dbs_[dbno].expires.size(); }
+    void ForEach(int dbno, const Visitor& visitor);
+    // delta: visit changed keys of the db, deleted gets the ones not exist
+    void ForEachChanged(int dbno, const std::unordered_set<QString, Hash>& keys,
+                        const Visitor& visitor,
+                        const std::function<void (const QString& key)>& deleted);
+
+private:
+    QSnapshot() : running_(false), aborted_(false), now_(0), delta_(nullptr)
+    {
+    }
+
+    struct DbState
+    {
+        size_t cursor = 0;      // buckets [0, cursor) are saved
+        size_t buckets = 0;     // bucket count frozen at start
+        size_t keys = 0;        // db size at start
+        bool   drained = false; // db was cleared, only preserved keys left
+
+        // old versions; QType_invalid means key not exist at start
+        QDB    preserved;
+        std::unordered_map<QString, uint64_t, Hash> expires;
+    };
+
+    bool _IsVisited(const DbState& state, const QDB& db, const QString& key) const;
+    void _Drain(int dbno, DbState& state, QDB& db);
+    void _Abort();
+    void _Finish();
+
+    std::atomic<bool>     running_;
+    // set with mutex_ held, saver thread never touches dbs after it
+    std::atomic<bool>     aborted_;
+    uint64_t              now_;
+    std::mutex            mutex_;
+    std::vector<DbState>  dbs_;
+    QString               file_;
+    // saving a delta, keys of it
+    const std::vector<QCheckpointDelta>* delta_;
+    std::future<bool>     result_;
+};
+
+}
+
+#endif
+
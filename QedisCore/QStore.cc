@@ -5,7 +5,17 @@
 #include "QMulti.h"
 #include "Log/Logger.h"
 #include "QLeveldb.h"
+#include "QSnapshot.h"
+#include "QBackendWriter.h"
+#include "QBackendLoader.h"
+#include "QLazyLoader.h"
+#include "QLatencyMonitor.h"
+#include "QKeyStats.h"
+#include "Threads/ThreadPool.h"
 #include <limits>
+#include <algorithm>
+#include <thread>
+#include <chrono>
 #include <cassert>
 
 
@@ -125,6 +135,7 @@ void QObject::_FreeValue()
 }
 
 int QStore::dirty_ = 0;
+bool QStore::writing_ = false;
 
 void QStore::ExpiresDB::SetExpire(const QString& key, uint64_t when)
 {
@@ -463,43 +474,150 @@ const QObject* QStore::GetObject(const QString& key) const
     if (it != db->end())
         return &it->second;
 
-    if (!backends_.empty())
+    // not decoded yet from lazily loaded rdb
+    if (QLazyLoader::Instance().Load(dbno_, key))
     {
-        // if it's in dirty list, it must be deleted, wait sync to backend
-        if (waitSyncKeys_[dbno_].count(key))
-            return nullptr;
+        it = db->find(key);
+        if (it != db->end())
+            return &it->second;
+    }
+
+    // cold keys of client command are loaded by QBackendLoader,
+    // others are read synchronously here
+    uint64_t waitSeq = 0;
+    if (IsColdKey(dbno_, key, waitSeq))
+    {
+        if (waitSeq != 0)
+            QBackendWriter::Instance().WaitCommitted(waitSeq);
 
         // load from leveldb, if has, insert to qedis cache
-        QObject obj = backends_[dbno_]->Get(key);
+        bool byFields = false;
+        QObject obj = backends_[dbno_]->Get(key, &byFields);
+        OnBackendRead(obj.type != QType_invalid);
         if (obj.type != QType_invalid)
         {
             DBG << "GetKey from leveldb:" << key;
+            return InsertFromBackend(key, std::move(obj), byFields);
+        }
+    }
 
-            QObject& realobj = ((*db)[key] = std::move(obj));
-            realobj.lru = QObject::lruclock;
+    return nullptr;
+}
 
-            // trick: use lru field to store the remain seconds to be expired.
-            unsigned int remainTtlSeconds = obj.lru;
-            if (remainTtlSeconds > 0)
-                SetExpire(key, ::Now() + remainTtlSeconds * 1000);
+bool QStore::IsColdKey(int dbno, const QString& key, uint64_t& waitSeq) const
+{
+    if (backends_.empty())
+        return false;
 
-            return &realobj;
-        }
+    if (store_[dbno].count(key))
+        return false;
+
+    // if it's in dirty list, it must be deleted, wait sync to backend
+    if (waitSyncKeys_[dbno].count(key))
+        return false;
+
+    // checked by loader just now
+    if (QBackendLoader::Instance().IsAbsent(dbno, key))
+        return false;
+
+    // never written to backend
+    if (!backendFilters_.empty() && !backendFilters_[dbno].MayContain(key))
+    {
+        ++ filterNegatives_;
+        return false;
     }
 
-    return nullptr;
+    // handed to writer but not written yet
+    bool del = false;
+    waitSeq = QBackendWriter::Instance().PendingSeq(dbno, key, del);
+    return !del;
+}
+
+const QObject* QStore::InsertFromBackend(const QString& key, QObject&& obj, bool byFields) const
+{
+    if (byFields)
+        fieldKeys_[dbno_].insert(key);
+
+    ++ tiered_.promotions;
+    if (tiered_.coldKeys > 0)
+        -- tiered_.coldKeys;
+
+    // trick: use lru field to store the remain seconds to be expired.
+    const unsigned int remainTtlSeconds = obj.lru;
+
+    auto guard = QSnapshot::Instance().BeforeWrite(dbno_, key);
+    QObject& realobj = (store_[dbno_][key] = std::move(obj));
+    realobj.lru = QObject::lruclock;
+
+    if (remainTtlSeconds > 0)
+        SetExpire(key, ::Now() + static_cast<uint64_t>(remainTtlSeconds) * 1000);
+
+    return &realobj;
+}
+
+void QStore::OnBackendRead(bool hit) const
+{
+    ++ tiered_.backendReads;
+    if (hit)
+        ++ tiered_.backendHits;
+    else if (!backendFilters_.empty())
+        ++ filterFalsePositives_;
+}
+
+bool QStore::DemoteKey(const QString& key)
+{
+    assert (!backends_.empty());
+
+    auto& db = store_[dbno_];
+    auto it = db.find(key);
+    if (it == db.end())
+        return false;
+
+    auto& dirtyKeys = waitSyncKeys_[dbno_];
+    auto dirty = dirtyKeys.find(key);
+    if (dirty != dirtyKeys.end())
+    {
+        // backend is stale, write it first
+        if (QBackendWriter::Instance().IsFull())
+            return false;
+
+        size_t bytes;
+        if (!_DumpKey(dbno_, key, dirty->second, ::Now(), bytes))
+            return false;
+
+        dirtyKeys.erase(dirty);
+    }
+
+    // keep it hot until the write is committed, a failed batch may never be
+    bool del = false;
+    if (QBackendWriter::Instance().PendingSeq(dbno_, key, del) != 0)
+        return false;
+
+    // ttl is in backend too
+    expiresDb_[dbno_].ClearExpire(key);
+
+    auto guard = QSnapshot::Instance().BeforeWrite(dbno_, key);
+    db.erase(it);
+
+    ++ tiered_.demotions;
+    ++ tiered_.coldKeys;
+    return true;
 }
 
 bool QStore::DeleteKey(const QString& key)
 {
     auto db = &store_[dbno_];
+    _AddCheckpointKey(key);
+    const bool lazy = QLazyLoader::Instance().Drop(dbno_, key);
+
     // add to dirty queue
     if (!waitSyncKeys_.empty())
     {
-        waitSyncKeys_[dbno_][key] = nullptr; // null implies delete data
+        _SetDirty(key, nullptr); // null implies delete data
     }
 
-    return db->erase(key) != 0;
+    auto guard = QSnapshot::Instance().BeforeWrite(dbno_, key);
+    return db->erase(key) != 0 || lazy;
 }
 
 bool QStore::ExistsKey(const QString& key) const
@@ -531,8 +649,15 @@ static bool RandomMember(const QDB& hash, QString& res, QObject** val)
     return false;
 }
 
+size_t QStore::DBSize() const
+{
+    return store_[dbno_].size() + QLazyLoader::Instance().Pending(dbno_);
+}
+
 QString QStore::RandomKey(QObject** val) const
 {
+    _LoadLazy();
+
     QString res;
     if (!store_.empty() && !store_[dbno_].empty())
         RandomMember(store_[dbno_], res, val);
@@ -542,6 +667,8 @@ QString QStore::RandomKey(QObject** val) const
 
 size_t QStore::ScanKey(size_t cursor, size_t count, std::vector<QString>& res) const
 {
+    _LoadLazy();
+
     if (store_.empty() || store_[dbno_].empty())
         return 0;
 
@@ -555,6 +682,65 @@ size_t QStore::ScanKey(size_t cursor, size_t count, std::vector<QString>& res) c
     return newCursor;
 }
 
+size_t QStore::ScanBuckets(size_t bucket, size_t count,
+                           const std::function<void (const QString& key, const QObject& obj)>& visitor) const
+{
+    _LoadLazy();
+
+    const QDB& db = store_[dbno_];
+
+    size_t n = 0;
+    for (; bucket < db.bucket_count() && n < count; ++ bucket)
+    {
+        for (auto it = db.begin(bucket); it != db.end(bucket); ++ it, ++ n)
+            visitor(it->first, it->second);
+    }
+
+    return bucket < db.bucket_count() ? bucket : 0;
+}
+
+std::vector<QStore::BucketRange> QStore::SplitBuckets(size_t parts, size_t minKeys) const
+{
+    size_t total = 0;
+    for (const auto& db : store_)
+        total += db.size();
+
+    const size_t keysPerRange = std::max(minKeys, total / std::max<size_t>(parts, 1));
+
+    std::vector<BucketRange> ranges;
+    for (int dbno = 0; dbno < static_cast<int>(store_.size()); ++ dbno)
+    {
+        const QDB& db = store_[dbno];
+        if (db.empty())
+            continue;
+
+        size_t begin = 0;
+        size_t keys = 0;
+        for (size_t bucket = 0; bucket < db.bucket_count(); ++ bucket)
+        {
+            keys += db.bucket_size(bucket);
+            if (keys >= keysPerRange)
+            {
+                ranges.push_back(BucketRange{dbno, begin, bucket + 1});
+                begin = bucket + 1;
+                keys = 0;
+            }
+        }
+
+        if (keys > 0)
+            ranges.push_back(BucketRange{dbno, begin, db.bucket_count()});
+    }
+
+    return ranges;
+}
+
+uint64_t QStore::ExpireAt(int dbno, const QString& key) const
+{
+    const auto& keys = expiresDb_[dbno].Keys();
+    auto it = keys.find(key);
+    return it == keys.end() ? 0 : it->second;
+}
+
 QError  QStore::GetValue(const QString& key, QObject*& value, bool touch)
 {
     if (touch)
@@ -588,8 +774,18 @@ QError  QStore::_GetValueByType(const QString& key, QObject*& value, QType type,
         else
         {
             value = const_cast<QObject*>(cobj);
+            QHotKeys::Instance().Touch(dbno_, key);
+
+            if (writing_)
+            {
+                // snapshot is running, save the old version before modify
+                QSnapshot::Instance().BeforeWrite(dbno_, key);
+                // may be changed in place and not be params[1], like
+                // the destination of SMOVE
+                _AddCheckpointKey(key);
+            }
 
-            // Do not update if child process exists
+            // Do not update if child process or snapshot exists
             extern pid_t g_qdbPid;
             if (touch && g_rewritePid == -1 && g_qdbPid == -1)
                 value->lru = QObject::lruclock;
@@ -609,12 +805,17 @@ QError  QStore::_GetValueByType(const QString& key, QObject*& value, QType type,
 QObject* QStore::SetValue(const QString& key, QObject&& value)
 {
     auto db = &store_[dbno_];
+    QLazyLoader::Instance().Drop(dbno_, key);
+
+    auto guard = QSnapshot::Instance().BeforeWrite(dbno_, key);
     QObject& obj = ((*db)[key] = std::move(value));
     obj.lru = QObject::lruclock;
+    _AddCheckpointKey(key);
+    QHotKeys::Instance().Touch(dbno_, key);
 
     // put this key to sync list
     if (!waitSyncKeys_.empty())
-        waitSyncKeys_[dbno_][key] = &obj;
+        _SetDirty(key, &obj);
 
     return &obj;
 }
@@ -622,6 +823,7 @@ QObject* QStore::SetValue(const QString& key, QObject&& value)
 void QStore::SetExpire(const QString& key, uint64_t when) const
 {
     expiresDb_[dbno_].SetExpire(key, when);
+    _AddCheckpointKey(key);
 }
 
 void QStore::SetExpireAfter(const QString& key, uint64_t ttl) const
@@ -637,7 +839,11 @@ int64_t QStore::TTL(const QString& key, uint64_t now)
 
 bool QStore::ClearExpire(const QString& key)
 {
-    return expiresDb_[dbno_].ClearExpire(key);
+    if (!expiresDb_[dbno_].ClearExpire(key))
+        return false;
+
+    _AddCheckpointKey(key);
+    return true;
 }
 
 QStore::ExpireResult QStore::_ExpireIfNeed(const QString& key, uint64_t now)
@@ -652,21 +858,50 @@ void QStore::InitExpireTimer()
         auto timer = TimerManager::Instance().CreateTimer();
         timer->Init(1);
         timer->SetCallback([&, i] () {
+                const uint64_t start = ::NowUs();
                 int oldDb = QSTORE.SelectDB(i);
                 QSTORE.LoopCheckExpire(::Now());
                 QSTORE.SelectDB(oldDb);
+                QLatencyMonitor::Instance().AddSampleIfNeeded("expire-cycle", ::NowUs() - start);
         });
 
         TimerManager::Instance().AddTimer(timer);
     }
 }
 
+void QStore::ResizeDB(size_t dbsize, size_t expiresize)
+{
+    store_[dbno_].reserve(dbsize);
+    expiresDb_[dbno_].Reserve(expiresize);
+}
+
+void QStore::ClearCurrentDB()
+{
+    auto guard = QSnapshot::Instance().BeforeClear(dbno_);
+    store_[dbno_].clear();
+    QLazyLoader::Instance().DropDb(dbno_);
+
+    if (!checkpointDeltas_.empty())
+    {
+        checkpointDeltas_[dbno_].flushed = true;
+        checkpointDeltas_[dbno_].keys.clear();
+    }
+}
+
 void QStore::ResetDb()
 {
+    auto guard = QSnapshot::Instance().BeforeClear(-1);
     std::vector<QDB>(store_.size()).swap(store_);
     std::vector<ExpiresDB>(expiresDb_.size()).swap(expiresDb_);
     std::vector<BlockedClients>(blockedClients_.size()).swap(blockedClients_);
     dbno_ = 0;
+    QLazyLoader::Instance().DropDb(-1);
+
+    for (auto& delta : checkpointDeltas_)
+    {
+        delta.flushed = true;
+        delta.keys.clear();
+    }
 }
 
 size_t QStore::BlockedSize() const
@@ -708,6 +943,9 @@ void    QStore::InitBlockedTimer()
 }
 
 
+// keys demoted per db per round, demotion frees little memory each
+static const int kDemoteBatch = 64;
+
 static void EvictItems()
 {
     QObject::lruclock = static_cast<uint32_t>(::time(nullptr));
@@ -729,40 +967,113 @@ static void EvictItems()
             return;
         }
 
+        const bool tiered = g_config.tieredstorage && g_config.backend != BackEndNone;
         for (int dbno = 0; true; ++ dbno)
         {
             if (QSTORE.SelectDB(dbno) == -1)
                 break;
 
-            if (QSTORE.DBSize() == 0)
-                continue;
-        
-            QString evictKey;
-            uint32_t choosedIdle = 0;
-            for (int i = 0; i < g_config.maxmemorySamples; ++ i)
+            for (int n = 0; n < (tiered ? kDemoteBatch : 1); ++ n)
             {
-                QObject* val = nullptr;
+                if (QSTORE.DBSize() == 0)
+                    break;
+        
+                QString evictKey;
+                uint32_t choosedIdle = 0;
+                for (int i = 0; i < g_config.maxmemorySamples; ++ i)
+                {
+                    QObject* val = nullptr;
 
-                auto key = QSTORE.RandomKey(&val);
-                if (!val) continue;
+                    auto key = QSTORE.RandomKey(&val);
+                    if (!val) continue;
                 
-                auto idle = EstimateIdleTime(val->lru);
-                if (evictKey.empty() || choosedIdle < idle)
-                {
-                    evictKey = std::move(key);
-                    choosedIdle = idle;
+                    auto idle = EstimateIdleTime(val->lru);
+                    if (evictKey.empty() || choosedIdle < idle)
+                    {
+                        evictKey = std::move(key);
+                        choosedIdle = idle;
+                    }
                 }
-            }
 
-            if (!evictKey.empty())
-            {
-                QSTORE.DeleteKey(evictKey);
-                WRN << "Evict '" << evictKey << "' in db " << dbno << ", idle time: " << choosedIdle << ", used mem: " << usedMem;
+                if (evictKey.empty())
+                    break;
+
+                if (tiered)
+                {
+                    if (!QSTORE.DemoteKey(evictKey))
+                    {
+                        if (QBackendWriter::Instance().IsFull())
+                            return; // writer is busy
+
+                        continue; // demote it after written
+                    }
+
+                    DBG << "Demote '" << evictKey << "' in db " << dbno << ", idle time: " << choosedIdle;
+                }
+                else
+                {
+                    QSTORE.DeleteKey(evictKey);
+                    WRN << "Evict '" << evictKey << "' in db " << dbno << ", idle time: " << choosedIdle << ", used mem: " << usedMem;
+                }
             }
         }
     }
 }
 
+// rough memory of a collection by its first elements
+template <typename C, typename F>
+static size_t SampleBytes(const C& c, size_t size, F elemBytes)
+{
+    const size_t kSamples = 16;
+
+    size_t n = 0;
+    size_t bytes = 0;
+    for (auto it = c.begin(); it != c.end() && n < kSamples; ++ it, ++ n)
+        bytes += elemBytes(*it);
+
+    return n == 0 ? 0 : bytes * size / n;
+}
+
+size_t EstimateBytes(const QString& key, const QObject& obj)
+{
+    const size_t kNodeOverhead = 32; // hash node, string header
+
+    size_t bytes = kNodeOverhead + sizeof obj + key.size();
+    switch (obj.type)
+    {
+    case QType_string:
+        if (obj.encoding == QEncode_raw)
+            bytes += obj.CastString()->size();
+        break;
+
+    case QType_list:
+        bytes += SampleBytes(*obj.CastList(), obj.CastList()->size(),
+                             [](const QString& v) { return kNodeOverhead + v.size(); });
+        break;
+
+    case QType_set:
+        bytes += SampleBytes(*obj.CastSet(), obj.CastSet()->size(),
+                             [](const QString& v) { return kNodeOverhead + v.size(); });
+        break;
+
+    case QType_hash:
+        bytes += SampleBytes(*obj.CastHash(), obj.CastHash()->size(),
+                             [](const QHash::value_type& kv) { return 2 * kNodeOverhead + kv.first.size() + kv.second.size(); });
+        break;
+
+    case QType_sortedSet:
+        // member is in both score map and member map
+        bytes += SampleBytes(*obj.CastSortedSet(), obj.CastSortedSet()->Size(),
+                             [](const QSortedSet::Member2Score::value_type& kv) { return 3 * kNodeOverhead + 2 * kv.first.size(); });
+        break;
+
+    default:
+        break;
+    }
+
+    return bytes;
+}
+
 uint32_t EstimateIdleTime(uint32_t lru)
 {
     if (lru <= QObject::lruclock)
@@ -777,7 +1088,10 @@ void QStore::InitEvictionTimer()
     auto timer = TimerManager::Instance().CreateTimer();
     timer->Init(1000); // emit eviction every second.
     timer->SetCallback([] () {
+        const uint64_t start = ::NowUs();
         EvictItems();
+        QLatencyMonitor::Instance().AddSampleIfNeeded("eviction-cycle", ::NowUs() - start);
+        QSTORE.UpdateTieredStats();
     });
 
     TimerManager::Instance().AddTimer(timer);
@@ -793,14 +1107,26 @@ void QStore::InitDumpBackends()
     if (g_config.backend == BackEndLeveldb)
     {
         waitSyncKeys_.resize(store_.size());
+        fieldKeys_.resize(store_.size());
+        dirtyFields_.resize(store_.size());
         for (size_t i = 0; i < store_.size(); ++ i)
         {
             std::unique_ptr<QLeveldb> db(new QLeveldb);
-            QString dbpath = g_config.backendPath + std::to_string(i);
-            if (!db->Open(dbpath.data()))
-                assert(false);
+            if (g_config.backendshared)
+            {
+                if (!db->Open(g_config.backendPath.data(), static_cast<int>(i)))
+                    assert(false);
+                else if (i == 0)
+                    USR << "Open leveldb " << g_config.backendPath << " shared by " << store_.size() << " dbs";
+            }
             else
-                USR << "Open leveldb " << dbpath;
+            {
+                QString dbpath = g_config.backendPath + std::to_string(i);
+                if (!db->Open(dbpath.data()))
+                    assert(false);
+                else
+                    USR << "Open leveldb " << dbpath;
+            }
 
             backends_.push_back(std::move(db));
         }
@@ -810,15 +1136,44 @@ void QStore::InitDumpBackends()
         // ERROR: unsupport backend
         return;
     }
+
+    std::vector<QDumpInterface*> backends;
+    for (const auto& db : backends_)
+        backends.push_back(db.get());
+
+    QBackendWriter::Instance().Start(backends);
+    QBackendLoader::Instance().Start(backends, g_config.backendloadthreads);
+
+    // all keys in backend are cold at start
+    scanMissedKeys_.resize(backends.size());
+    const bool filter = g_config.backendfilter;
+    backendScan_ = ThreadPool::Instance().ExecuteTask([backends, filter]() {
+        BackendScan scan;
+        for (auto backend : backends)
+        {
+            if (filter)
+                scan.filters.push_back(QBloomFilter());
+
+            backend->ForEachKey([&scan, filter](const QString& key) {
+                ++ scan.keys;
+                if (filter)
+                    scan.filters.back().Add(key);
+            });
+        }
+
+        return scan;
+    });
         
     for (int i = 0; i < static_cast<int>(backends_.size()); ++ i)
     {
         auto timer = TimerManager::Instance().CreateTimer();
         timer->Init(1000 / g_config.backendHz);
         timer->SetCallback([&, i] () {
+                const uint64_t start = ::NowUs();
                 int oldDb = QSTORE.SelectDB(i);
                 QSTORE.DumpToBackends(i);
                 QSTORE.SelectDB(oldDb);
+                QLatencyMonitor::Instance().AddSampleIfNeeded("backend-dump", ::NowUs() - start);
         });
 
         TimerManager::Instance().AddTimer(timer);
@@ -830,56 +1185,405 @@ void  QStore::DumpToBackends(int dbno)
     if (static_cast<int>(waitSyncKeys_.size()) <= dbno)
         return;
 
-    const int kMaxSync = 100;
-    int processed = 0;
+    // encode here, leveldb write is done by writer thread in batches
+    const size_t kMaxBytesPerTick = 8 * 1024 * 1024;
+    size_t bytes = 0;
     auto& dirtyKeys = waitSyncKeys_[dbno];
             
     uint64_t now = ::Now();
-    for (auto it = dirtyKeys.begin(); processed++ < kMaxSync && it != dirtyKeys.end(); )
+    for (auto it = dirtyKeys.begin(); bytes < kMaxBytesPerTick && it != dirtyKeys.end(); )
     {
-        // check ttl
-        int64_t when = QSTORE.TTL(it->first, now);
-
-        if (it->second && when != QStore::ExpireResult::expired)
+        if (QBackendWriter::Instance().IsFull())
         {
-            assert (when != QStore::ExpireResult::notExpire);
+            DBG << "backend writer is full, dirty keys " << dirtyKeys.size();
+            break;
+        }
 
-            if (when > 0)
-                when += now;
+        size_t keyBytes;
+        const bool written = _DumpKey(dbno, it->first, it->second, now, keyBytes);
+        bytes += keyBytes;
 
-            backends_[dbno]->Put(it->first, *it->second, when);
-            DBG << "UPDATE leveldb key " << it->first << ", when = " << when;
-        }
+        if (written)
+            it = dirtyKeys.erase(it);
         else
+            ++ it;
+    }
+}
+
+bool QStore::_DumpKey(int dbno, const QString& key, const QObject* value, uint64_t now, size_t& bytes)
+{
+    const size_t kMaxDirtyFields = 64 * 1024;
+    auto& dirtyFields = dirtyFields_[dbno];
+    auto& fieldKeys = fieldKeys_[dbno];
+
+    QBackendOp op;
+    op.dbno = dbno;
+    op.key = key;
+
+    // check ttl
+    int64_t when = expiresDb_[dbno].TTL(key, now);
+
+    if (value && when != QStore::ExpireResult::expired)
+    {
+        assert (when != QStore::ExpireResult::notExpire);
+
+        if (when > 0)
+            when += now;
+
+        // only write the changed fields, unless they're too many
+        auto fields = dirtyFields.find(key);
+        if (fields != dirtyFields.end() && fields->second.size() < kMaxDirtyFields)
+            backends_[dbno]->EncodeFields(*value, when, fields->second, op);
+        else
+            backends_[dbno]->Encode(*value, when, op);
+
+        DBG << "UPDATE leveldb key " << key << ", when = " << when;
+    }
+    else
+    {
+        op.del = true;
+        DBG << "DELETE leveldb key " << key;
+    }
+
+    // what the backend holds before this op, saves the writer a lookup
+    if (fieldKeys.count(key))
+        op.oldFields = QOldFields_some;
+    else if (!backendFilters_.empty() && !backendFilters_[dbno].MayContain(key))
+        op.oldFields = QOldFields_none;
+
+    if (!op.del)
+    {
+        if (!backendFilters_.empty())
+            backendFilters_[dbno].Add(key);
+        else if (!scanMissedKeys_.empty())
+            scanMissedKeys_[dbno].push_back(key);
+    }
+
+    if (op.byFields)
+        fieldKeys.insert(key);
+    else
+        fieldKeys.erase(key);
+
+    dirtyFields.erase(key);
+
+    bytes = op.Bytes();
+    return QBackendWriter::Instance().Push(std::move(op));
+}
+   
+void QStore::FlushBackends()
+{
+    // the scan thread is reading backends
+    if (backendScan_.valid())
+        backendScan_.wait();
+
+    int oldDb = SelectDB(0);
+    for (size_t i = 0; i < waitSyncKeys_.size(); ++ i)
+    {
+        SelectDB(static_cast<int>(i));
+        while (!waitSyncKeys_[i].empty())
         {
-            backends_[dbno]->Delete(it->first);
-            DBG << "DELETE leveldb key " << it->first;
+            if (QBackendWriter::Instance().IsFull())
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+
+            const size_t left = waitSyncKeys_[i].size();
+            DumpToBackends(static_cast<int>(i));
+            if (waitSyncKeys_[i].size() == left)
+            {
+                ERR << "flush backend " << i << " failed, lost dirty keys " << left;
+                break;
+            }
         }
-            
-        it = dirtyKeys.erase(it);
     }
+
+    SelectDB(oldDb);
 }
-   
+
+void QStore::UpdateTieredStats()
+{
+    if (backendScan_.valid() &&
+        backendScan_.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        BackendScan scan = backendScan_.get();
+        tiered_.coldKeys += scan.keys;
+        USR << "backend keys at start: " << scan.keys;
+
+        if (!scan.filters.empty())
+        {
+            for (size_t i = 0; i < scanMissedKeys_.size(); ++ i)
+            {
+                for (const auto& key : scanMissedKeys_[i])
+                    scan.filters[i].Add(key);
+            }
+
+            backendFilters_.swap(scan.filters);
+        }
+
+        std::vector<std::vector<QString> >().swap(scanMissedKeys_);
+    }
+
+    const uint64_t now = ::Now();
+    if (tiered_.lastTime != 0 && now > tiered_.lastTime)
+    {
+        const uint64_t elapsed = now - tiered_.lastTime;
+        tiered_.promotionsPerSec = (tiered_.promotions - tiered_.lastPromotions) * 1000 / elapsed;
+        tiered_.demotionsPerSec = (tiered_.demotions - tiered_.lastDemotions) * 1000 / elapsed;
+    }
+
+    tiered_.lastTime = now;
+    tiered_.lastPromotions = tiered_.promotions;
+    tiered_.lastDemotions = tiered_.demotions;
+}
+
+void QStore::OnTieredInfoCommand(UnboundedBuffer& res)
+{
+    if (backends_.empty())
+        return;
+
+    size_t hotKeys = 0;
+    for (const auto& db : store_)
+        hotKeys += db.size();
+
+    const double hitRatio = tiered_.backendReads == 0 ? 0 :
+                            static_cast<double>(tiered_.backendHits) / tiered_.backendReads;
+
+    size_t filterKeys = 0;
+    size_t filterBytes = 0;
+    double filterFpRate = 0;
+    for (const auto& f : backendFilters_)
+    {
+        filterKeys += f.Keys();
+        filterBytes += f.Bytes();
+        filterFpRate = std::max(filterFpRate, f.FalsePositiveRate());
+    }
+
+    char buf[1024];
+    int n = snprintf(buf, sizeof buf - 1,
+                 "# Tiered\r\n"
+                 "tiered_storage:%s\r\n"
+                 "tiered_hot_keys:%lu\r\n"
+                 "tiered_cold_keys:%ld\r\n"
+                 "tiered_promotions:%lu\r\n"
+                 "tiered_demotions:%lu\r\n"
+                 "tiered_promotions_per_sec:%lu\r\n"
+                 "tiered_demotions_per_sec:%lu\r\n"
+                 "tiered_backend_reads:%lu\r\n"
+                 "tiered_backend_hits:%lu\r\n"
+                 "tiered_backend_hit_ratio:%.4f\r\n"
+                 "backend_filter_ready:%d\r\n"
+                 "backend_filter_keys:%lu\r\n"
+                 "backend_filter_bytes:%lu\r\n"
+                 "backend_filter_fp_rate:%.6f\r\n"
+                 "backend_filter_negatives:%lu\r\n"
+                 "backend_filter_false_positives:%lu\r\n"
+                 , g_config.tieredstorage ? "yes" : "no"
+                 , hotKeys
+                 , tiered_.coldKeys
+                 , tiered_.promotions
+                 , tiered_.demotions
+                 , tiered_.promotionsPerSec
+                 , tiered_.demotionsPerSec
+                 , tiered_.backendReads
+                 , tiered_.backendHits
+                 , hitRatio
+                 , backendFilters_.empty() ? 0 : 1
+                 , filterKeys
+                 , filterBytes
+                 , filterFpRate
+                 , filterNegatives_
+                 , filterFalsePositives_);
+
+    if (!res.IsEmpty())
+        res.PushData("\r\n", 2);
+
+    res.PushData(buf, n);
+}
+
+void QStore::InitCheckpointTracking()
+{
+    checkpointDeltas_.clear();
+    checkpointDeltas_.resize(store_.size());
+}
+
+void QStore::_AddCheckpointKey(const QString& key) const
+{
+    if (!checkpointDeltas_.empty())
+        checkpointDeltas_[dbno_].keys.insert(key);
+}
+
+std::vector<QCheckpointDelta> QStore::TakeCheckpointDeltas()
+{
+    std::vector<QCheckpointDelta> deltas(checkpointDeltas_.size());
+    deltas.swap(checkpointDeltas_);
+    return deltas;
+}
+
+void QStore::RestoreCheckpointDeltas(std::vector<QCheckpointDelta>&& deltas)
+{
+    if (checkpointDeltas_.size() != deltas.size())
+        return;
+
+    for (size_t i = 0; i < deltas.size(); ++ i)
+    {
+        auto& delta = checkpointDeltas_[i];
+        if (delta.flushed)
+            continue; // older changes are gone
+
+        delta.flushed = deltas[i].flushed;
+        delta.keys.insert(deltas[i].keys.begin(), deltas[i].keys.end());
+    }
+}
+
+size_t QStore::CheckpointChangedKeys() const
+{
+    size_t n = 0;
+    for (const auto& delta : checkpointDeltas_)
+        n += delta.keys.size();
+
+    return n;
+}
+
+void QStore::InsertLazy(int dbno, const QString& key, QObject&& obj, int64_t expireAt) const
+{
+    auto guard = QSnapshot::Instance().BeforeWrite(dbno, key);
+    auto res = store_[dbno].emplace(key, std::move(obj));
+    if (!res.second)
+        return;
+
+    res.first->second.lru = QObject::lruclock;
+    if (expireAt > 0)
+        expiresDb_[dbno].SetExpire(key, expireAt);
+}
+
+void QStore::_LoadLazy() const
+{
+    QLazyLoader::Instance().LoadAll(dbno_);
+}
+
+size_t QStore::BackendDirtyKeys() const
+{
+    size_t n = 0;
+    for (const auto& keys : waitSyncKeys_)
+        n += keys.size();
+
+    return n;
+}
+
 void QStore::AddDirtyKey(const QString& key)
 {
+    _AddCheckpointKey(key);
+
     // put this key to sync list
     if (!waitSyncKeys_.empty())
     {
         QObject* obj = nullptr;
         GetValue(key, obj);
-        waitSyncKeys_[dbno_][key] = obj;
+        _SetDirty(key, obj);
     }
 }
     
 void QStore::AddDirtyKey(const QString& key, const QObject* value)
 {
+    _AddCheckpointKey(key);
+
     // put this key to sync list
     if (!waitSyncKeys_.empty())
-        waitSyncKeys_[dbno_][key] = value;
+        _SetDirty(key, value);
+}
+
+void QStore::AddDirtyFields(const QString& key, const std::vector<const QString*>& fields)
+{
+    _AddCheckpointKey(key);
+
+    if (waitSyncKeys_.empty())
+        return;
+
+    auto& dirtyKeys = waitSyncKeys_[dbno_];
+    auto& dirtyFields = dirtyFields_[dbno_];
+
+    // the backend must have it by fields, and nothing else changed
+    auto it = dirtyFields.find(key);
+    if (!fieldKeys_[dbno_].count(key) || (it == dirtyFields.end() && dirtyKeys.count(key)))
+    {
+        AddDirtyKey(key);
+        return;
+    }
+
+    QObject* obj = nullptr;
+    GetValue(key, obj);
+    if (!obj)
+    {
+        _SetDirty(key, nullptr);
+        return;
+    }
+
+    if (it == dirtyFields.end())
+        it = dirtyFields.insert(std::make_pair(key, QFieldSet())).first;
+
+    for (const auto field : fields)
+        it->second.insert(*field);
+
+    dirtyKeys[key] = obj;
+}
+
+void QStore::_SetDirty(const QString& key, const QObject* value)
+{
+    waitSyncKeys_[dbno_][key] = value;
+    dirtyFields_[dbno_].erase(key);
 }
 
 std::vector<QString>  g_dirtyKeys;
 
+// fields of hash, set and sorted set changed by command,
+// false if it may change others, then the whole key is dirty
+static bool ChangedFields(const std::vector<QString>& params, std::vector<const QString*>& fields)
+{
+    struct FieldPos
+    {
+        const char* cmd;
+        size_t first; // index of first field in params
+        size_t step;  // 0 if only one field
+    };
+
+    static const FieldPos kFieldCmds[] =
+    {
+        {"hset",        2, 0},
+        {"hsetnx",      2, 0},
+        {"hincrby",     2, 0},
+        {"hincrbyfloat",2, 0},
+        {"hmset",       2, 2},
+        {"hdel",        2, 1},
+        {"sadd",        2, 1},
+        {"srem",        2, 1},
+        {"zadd",        3, 2},
+        {"zrem",        2, 1},
+        {"zincrby",     3, 0},
+    };
+
+    for (const auto& pos : kFieldCmds)
+    {
+        if (strcasecmp(params[0].c_str(), pos.cmd) != 0)
+            continue;
+
+        if (pos.step == 0)
+        {
+            if (params.size() > pos.first)
+                fields.push_back(&params[pos.first]);
+        }
+        else
+        {
+            for (size_t i = pos.first; i < params.size(); i += pos.step)
+                fields.push_back(&params[i]);
+        }
+
+        return !fields.empty();
+    }
+
+    return false;
+}
+
 void Propogate(const std::vector<QString>& params)
 {
     assert (!params.empty());
@@ -899,7 +1603,12 @@ void Propogate(const std::vector<QString>& params)
     {
         ++ QStore::dirty_;
         QMulti::Instance().NotifyDirty(QSTORE.GetDB(), params[1]);
-        QSTORE.AddDirtyKey(params[1]); // TODO optimize
+
+        std::vector<const QString*> fields;
+        if (g_config.backend != BackEndNone && ChangedFields(params, fields))
+            QSTORE.AddDirtyFields(params[1], fields);
+        else
+            QSTORE.AddDirtyKey(params[1]); // TODO optimize
     }
 
     if (g_config.appendonly)
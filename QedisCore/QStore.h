@@ -8,10 +8,13 @@
 #include "QList.h"
 #include "Timer.h"
 #include "QDumpInterface.h"
+#include "QBloomFilter.h"
 
 #include <vector>
 #include <map>
 #include <memory>
+#include <future>
+#include <functional>
 
 namespace qedis
 {
@@ -70,13 +73,24 @@ private:
     void _FreeValue();
 };
 
+// rough memory of a key, sampling first elements of collections; not exact
+size_t EstimateBytes(const QString& key, const QObject& obj);
+
 class QClient;
+class UnboundedBuffer;
 
 using QDB = std::unordered_map<QString, QObject, qedis::Hash>;
 
 
 const int kMaxDbNum = 65536;
 
+// changes of a db since the last rdb save, for incremental rdb
+struct QCheckpointDelta
+{
+    bool flushed = false; // db was cleared, then keys changed
+    std::unordered_set<QString, Hash> keys;
+};
+
 class QStore
 {
 public:
@@ -95,13 +109,33 @@ public:
     bool ExistsKey(const QString& key) const;
     QType  KeyType(const QString& key) const;
     QString RandomKey(QObject** val = nullptr) const;
-    size_t DBSize() const { return store_[dbno_].size(); }
+    size_t DBSize() const;
+    size_t ExpiresSize() const { return expiresDb_[dbno_].Keys().size(); }
+    // pre-size current db before loading
+    void   ResizeDB(size_t dbsize, size_t expiresize);
     size_t ScanKey(size_t cursor, size_t count, std::vector<QString>& res) const;
+    // visit buckets from bucket until about count keys visited,
+    // return the next bucket, 0 if done; keys may be missed if rehashed
+    size_t ScanBuckets(size_t bucket, size_t count,
+                       const std::function<void (const QString& key, const QObject& obj)>& visitor) const;
+
+    // for threads saving a frozen keyspace(fork child or SAVE), read only:
+    // bucket ranges of all dbs in order, about total keys / parts each
+    struct BucketRange
+    {
+        int    dbno;
+        size_t begin;
+        size_t end;
+    };
+    std::vector<BucketRange> SplitBuckets(size_t parts, size_t minKeys) const;
+    const QDB& GetDb(int dbno) const { return store_[dbno]; }
+    // absolute expire time, 0 if persist
+    uint64_t ExpireAt(int dbno, const QString& key) const;
 
     // iterator
-    QDB::const_iterator begin() const   { return store_[dbno_].begin(); }
+    QDB::const_iterator begin() const   { _LoadLazy(); return store_[dbno_].begin(); }
     QDB::const_iterator end()   const   { return store_[dbno_].end(); }
-    QDB::iterator       begin()         { return store_[dbno_].begin(); }
+    QDB::iterator       begin()         { _LoadLazy(); return store_[dbno_].begin(); }
     QDB::iterator       end()           { return store_[dbno_].end(); }
     
     const QObject* GetObject(const QString& key) const;
@@ -128,7 +162,7 @@ public:
     void    InitExpireTimer();
     
     // danger cmd
-    void    ClearCurrentDB() { store_[dbno_].clear(); }
+    void    ClearCurrentDB();
     void    ResetDb();
     
     // for blocked list
@@ -146,6 +180,8 @@ public:
     size_t  BlockedSize() const;
     
     static  int dirty_;
+    // executing write command, objects got may be modified in place
+    static  bool writing_;
 
     // eviction timer for lru
     void    InitEvictionTimer();
@@ -154,8 +190,41 @@ public:
     void    DumpToBackends(int dbno);
     void    AddDirtyKey(const QString& key);
     void    AddDirtyKey(const QString& key, const QObject* value);
+    // only these fields of key are changed
+    void    AddDirtyFields(const QString& key, const std::vector<const QString*>& fields);
+    // on exit, hand all dirty keys to backend writer
+    void    FlushBackends();
+    // modified keys not yet handed to backend writer
+    size_t  BackendDirtyKeys() const;
+    // key not in memory but may be in backend; waitSeq is its pending write
+    bool    IsColdKey(int dbno, const QString& key, uint64_t& waitSeq) const;
+    // insert object got from backend to current db
+    const QObject* InsertFromBackend(const QString& key, QObject&& obj, bool byFields) const;
+    // a read of backend, by loader or GetObject
+    void    OnBackendRead(bool hit) const;
+
+    // tiered storage: drop key from memory, only if its latest version is
+    // committed to backend; false if it's being written, try later
+    bool    DemoteKey(const QString& key);
+    // every second, for the rates in info
+    void    UpdateTieredStats();
+    void    OnTieredInfoCommand(UnboundedBuffer& res);
+
+    // incremental rdb: track changed keys from now on
+    void    InitCheckpointTracking();
+    bool    IsCheckpointTracking() const { return !checkpointDeltas_.empty(); }
+    // changes since last call, when a rdb save starts
+    std::vector<QCheckpointDelta> TakeCheckpointDeltas();
+    // the save failed, its changes are not saved yet
+    void    RestoreCheckpointDeltas(std::vector<QCheckpointDelta>&& deltas);
+    size_t  CheckpointChangedKeys() const;
+
+    // insert key decoded by lazy loader, it's not a change
+    void    InsertLazy(int dbno, const QString& key, QObject&& obj, int64_t expireAt) const;
     
 private:
+    friend class QSnapshot;
+
     QStore() : dbno_(0)
     {
     }
@@ -167,15 +236,18 @@ private:
     class ExpiresDB
     {
     public:
+        using Q_EXPIRE_DB = std::unordered_map<QString, uint64_t, Hash>;
+
         void SetExpire(const QString& key, uint64_t when);
         int64_t TTL(const QString& key, uint64_t now);
         bool ClearExpire(const QString& key);
         ExpireResult ExpireIfNeed(const QString& key, uint64_t now);
 
         int LoopCheck(uint64_t now);
+        const Q_EXPIRE_DB& Keys() const { return expireKeys_; }
+        void Reserve(size_t n) { expireKeys_.reserve(n); }
         
     private:
-        using Q_EXPIRE_DB = std::unordered_map<QString, uint64_t, Hash>;
         Q_EXPIRE_DB expireKeys_;  // all the keys to be expired, unorder.
     };
     
@@ -200,6 +272,13 @@ private:
     };
 
     QError _SetValue(const QString& key, QObject& value, bool exclusive = false);
+    void   _SetDirty(const QString& key, const QObject* value);
+    // hand the dirty key to backend writer, bytes is encoded size;
+    // false if written synchronously and failed, the key is still dirty
+    bool   _DumpKey(int dbno, const QString& key, const QObject* value, uint64_t now, size_t& bytes);
+    void   _AddCheckpointKey(const QString& key) const;
+    // decode keys of current db left in lazily loaded rdb
+    void   _LoadLazy() const;
 
     // Because GetObject() must be const, so mutable them
     mutable std::vector<QDB> store_;
@@ -209,6 +288,45 @@ private:
         
     using ToSyncDb = std::unordered_map<QString, const QObject*, Hash>;
     std::vector<ToSyncDb> waitSyncKeys_;
+    // keys stored by fields in backend, and the changed fields of them;
+    // a dirty key without changed fields must be written whole
+    mutable std::vector<QFieldSet> fieldKeys_;
+    std::vector<std::unordered_map<QString, QFieldSet, Hash> > dirtyFields_;
+
+    // tiered storage stats
+    struct TieredStats
+    {
+        int64_t  coldKeys = 0;      // estimated, keys in backend only
+        uint64_t promotions = 0;
+        uint64_t demotions = 0;
+        uint64_t backendReads = 0;
+        uint64_t backendHits = 0;
+
+        uint64_t lastTime = 0;
+        uint64_t lastPromotions = 0;
+        uint64_t lastDemotions = 0;
+        uint64_t promotionsPerSec = 0;
+        uint64_t demotionsPerSec = 0;
+    };
+    mutable TieredStats tiered_;
+
+    // backend is scanned at start: count keys, build the filters
+    struct BackendScan
+    {
+        int64_t keys = 0;
+        std::vector<QBloomFilter> filters;
+    };
+    std::future<BackendScan> backendScan_;
+    // keys may be in backend; empty until scan done
+    std::vector<QBloomFilter> backendFilters_;
+    // keys dumped while scanning, the scan may miss them
+    std::vector<std::vector<QString> > scanMissedKeys_;
+    mutable uint64_t filterNegatives_ = 0;
+    mutable uint64_t filterFalsePositives_ = 0;
+
+    // keys changed since last rdb save, per db
+    mutable std::vector<QCheckpointDelta> checkpointDeltas_;
+
     int dbno_;
 };
 
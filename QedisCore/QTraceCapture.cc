@@ -0,0 +1,175 @@
+
+#include <cstring>
+#include "QTraceCapture.h"
+#include "Log/Logger.h"
+#include "Timer.h"
+
+namespace qedis
+{
+
+const char QTraceCapture::kMagic[4] = {'Q', 'T', 'R', 'C'};
+const uint8_t QTraceCapture::kVersion;
+
+// replaying them would break the target or leak credentials
+static bool NotCaptured(const QString& cmd)
+{
+    return cmd == "debug" ||
+           cmd == "shutdown" ||
+           cmd == "auth" ||
+           cmd == "monitor" ||
+           cmd == "sync" ||
+           cmd == "psync" ||
+           cmd == "replconf" ||
+           cmd == "slaveof";
+}
+
+static void AppendVarint(QString& out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+
+    out.push_back(static_cast<char>(v));
+}
+
+QTraceCapture& QTraceCapture::Instance()
+{
+    static QTraceCapture capture;
+    return capture;
+}
+
+QTraceCapture::QTraceCapture() :
+    active_(false),
+    rate_(1),
+    last_(0),
+    requests_(0)
+{
+}
+
+bool QTraceCapture::Start(const QString& file, int rate)
+{
+    if (active_ || rate <= 0)
+        return false;
+
+    if (!file_.Open(file.c_str(), false))
+    {
+        ERR << "trace capture can not open " << file;
+        return false;
+    }
+
+    file_.Write(kMagic, sizeof kMagic);
+    file_.Write(kVersion);
+
+    active_ = true;
+    rate_ = static_cast<uint64_t>(rate);
+    last_ = ::NowUs();
+    requests_ = 0;
+
+    USR << "trace capture start " << file << ", sample rate " << rate;
+    return true;
+}
+
+long QTraceCapture::Stop()
+{
+    if (!active_)
+        return -1;
+
+    active_ = false;
+    file_.Close();
+
+    USR << "trace capture stop, requests " << requests_;
+    return requests_;
+}
+
+void QTraceCapture::_Append(uint64_t client, int db, const QString& cmd, const std::vector<QString>& params)
+{
+    if (NotCaptured(cmd))
+        return;
+
+    const uint64_t now = ::NowUs();
+    const uint64_t delta = now > last_ ? now - last_ : 0;
+    last_ = now;
+
+    record_.clear();
+    AppendVarint(record_, delta);
+    AppendVarint(record_, client);
+    AppendVarint(record_, static_cast<uint64_t>(db));
+    AppendVarint(record_, params.size());
+    for (const auto& arg : params)
+    {
+        AppendVarint(record_, arg.size());
+        record_.append(arg);
+    }
+
+    file_.Write(record_.data(), record_.size());
+    ++ requests_;
+}
+
+
+bool QTraceReader::Open(const char* file)
+{
+    if (!file_.Open(file))
+        return false;
+
+    size_ = static_cast<size_t>(-1);
+    data_ = file_.Read(size_);
+    if (!data_ ||
+        size_ < sizeof QTraceCapture::kMagic + 1 ||
+        memcmp(data_, QTraceCapture::kMagic, sizeof QTraceCapture::kMagic) != 0 ||
+        static_cast<uint8_t>(data_[sizeof QTraceCapture::kMagic]) != QTraceCapture::kVersion)
+    {
+        file_.Close();
+        return false;
+    }
+
+    pos_ = sizeof QTraceCapture::kMagic + 1;
+    time_ = 0;
+    return true;
+}
+
+bool QTraceReader::_ReadVarint(uint64_t& v)
+{
+    v = 0;
+    for (int shift = 0; shift < 64 && pos_ < size_; shift += 7)
+    {
+        const uint8_t byte = static_cast<uint8_t>(data_[pos_ ++]);
+        v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+bool QTraceReader::Next(Record& rec)
+{
+    uint64_t delta, client, db, argc;
+    if (!_ReadVarint(delta) ||
+        !_ReadVarint(client) ||
+        !_ReadVarint(db) ||
+        !_ReadVarint(argc) ||
+        argc == 0)
+        return false;
+
+    rec.params.resize(argc);
+    for (auto& arg : rec.params)
+    {
+        uint64_t len;
+        if (!_ReadVarint(len) || len > size_ - pos_)
+            return false;
+
+        arg.assign(data_ + pos_, len);
+        pos_ += len;
+    }
+
+    time_ += delta;
+    rec.time = time_;
+    rec.client = client;
+    rec.db = static_cast<int>(db);
+    return true;
+}
+
+}
+
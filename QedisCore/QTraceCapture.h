@@ -0,0 +1,84 @@
+#ifndef BERT_QTRACECAPTURE_H
+#define BERT_QTRACECAPTURE_H
+
+#include <stdint.h>
+#include <vector>
+#include "QString.h"
+#include "Log/MemoryFile.h"
+
+namespace qedis
+{
+
+// Request stream capture for replay, DEBUG TRACE START/STOP.
+// File is "QTRC", a version byte, then one record per request, all varints:
+//   usec since previous record, client id, db, argc, (arg len, arg bytes)...
+// With sample rate N only clients whose id % N == 0 are captured, so the
+// order of every captured client is complete.
+class QTraceCapture
+{
+public:
+    static QTraceCapture& Instance();
+
+    QTraceCapture(const QTraceCapture& ) = delete;
+    void operator= (const QTraceCapture& ) = delete;
+
+    static const char kMagic[4];
+    static const uint8_t kVersion = 1;
+
+    // a new file, replacing any previous one; false if capturing or failed
+    bool Start(const QString& file, int rate);
+    // requests written, -1 if not capturing
+    long Stop();
+
+    bool IsActive() const { return active_; }
+
+    // main thread, cmd is lower case
+    void Capture(uint64_t client, int db, const QString& cmd, const std::vector<QString>& params)
+    {
+        if (active_ && client % rate_ == 0)
+            _Append(client, db, cmd, params);
+    }
+
+private:
+    QTraceCapture();
+
+    void _Append(uint64_t client, int db, const QString& cmd, const std::vector<QString>& params);
+
+    bool     active_;
+    uint64_t rate_;
+    uint64_t last_;
+    long     requests_;
+    QString  record_;
+    OutputMemoryFile file_;
+};
+
+
+class QTraceReader
+{
+public:
+    struct Record
+    {
+        uint64_t time = 0;  // usec since capture start
+        uint64_t client = 0;
+        int      db = 0;
+        std::vector<QString> params;
+    };
+
+    bool Open(const char* file);
+    // false at end or on a truncated record
+    bool Next(Record& rec);
+
+private:
+    bool _ReadVarint(uint64_t& v);
+
+    InputMemoryFile file_;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t pos_ = 0;
+    uint64_t time_ = 0;
+};
+
+}
+
+#endif
+
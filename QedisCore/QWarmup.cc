@@ -0,0 +1,440 @@
+
+#include <cstdio>
+#include <unistd.h>
+#include <algorithm>
+#include <limits>
+#include <set>
+#include "QWarmup.h"
+#include "QStore.h"
+#include "QConfig.h"
+#include "QBackendLoader.h"
+#include "Log/Logger.h"
+#include "Log/MemoryFile.h"
+#include "Threads/ThreadPool.h"
+#include "UnboundedBuffer.h"
+#include "Timer.h"
+
+namespace qedis
+{
+
+static const char kMagic[] = "QHOT";
+static const uint32_t kVersion = 1;
+
+// keys visited per cron of the hot key scan
+static const size_t kScanKeysPerTick = 8 * 1024;
+// prefetches in loader per load thread, client loads go first anyway
+static const size_t kInflightPerThread = 4;
+
+QWarmup& QWarmup::Instance()
+{
+    static QWarmup warmup;
+    return warmup;
+}
+
+QWarmup::QWarmup() :
+    state_(Idle),
+    pos_(0),
+    startTime_(0),
+    doneTime_(0),
+    totalKeys_(0),
+    prefetched_(0),
+    skipped_(0),
+    bytes_(0),
+    scanning_(false),
+    scanDb_(0),
+    scanBucket_(0),
+    candidateBytes_(0),
+    lastScanStart_(0),
+    lastSaveTime_(0),
+    lastSaveKeys_(0),
+    savingKeys_(0)
+{
+}
+
+void QWarmup::Start()
+{
+    if (g_config.backend == BackEndNone || g_config.backendwarmupmemory == 0)
+        return;
+
+    startTime_ = ::Now();
+    lastScanStart_ = startTime_;
+
+    // manifest may be big, don't block serving
+    const QString file = g_config.backendwarmupfile;
+    const uint64_t budget = g_config.backendwarmupmemory;
+    reading_ = ThreadPool::Instance().ExecuteTask([file, budget]() {
+        return _Read(file, budget);
+    });
+
+    state_ = reading_.valid() ? Reading : Done;
+
+    auto timer = TimerManager::Instance().CreateTimer();
+    timer->Init(100);
+    timer->SetCallback([this]() {
+        _Cron();
+    });
+    TimerManager::Instance().AddTimer(timer);
+}
+
+bool QWarmup::Feed()
+{
+    if (state_ == Reading)
+    {
+        if (reading_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return false;
+
+        keys_ = reading_.get();
+        totalKeys_ = keys_.size();
+        state_ = Loading;
+        USR << "Warm up " << totalKeys_ << " hot keys from " << g_config.backendwarmupfile;
+    }
+
+    if (state_ != Loading)
+        return false;
+
+    auto& loader = QBackendLoader::Instance();
+    const size_t maxInflight = kInflightPerThread * g_config.backendloadthreads;
+
+    bool busy = false;
+    while (pos_ < keys_.size() && loader.PrefetchInflight() < maxInflight)
+    {
+        const HotKey& hk = keys_[pos_ ++];
+        if (loader.Prefetch(hk.dbno, hk.key))
+        {
+            ++ prefetched_;
+            bytes_ += hk.bytes;
+            busy = true;
+        }
+        else
+        {
+            // loaded by client already, or deleted
+            ++ skipped_;
+        }
+    }
+
+    if (pos_ == keys_.size() && loader.PrefetchInflight() == 0)
+    {
+        state_ = Done;
+        doneTime_ = ::Now();
+        std::vector<HotKey>().swap(keys_);
+
+        USR << "Warm up done, loaded " << loader.PrefetchLoaded()
+            << " keys, skipped " << skipped_
+            << ", cost " << (doneTime_ - startTime_) << "ms";
+    }
+
+    return busy;
+}
+
+void QWarmup::Save()
+{
+    if (g_config.backend == BackEndNone || g_config.backendwarmupmemory == 0)
+        return;
+
+    if (writing_.valid())
+        writing_.wait();
+
+    // don't lose the manifest if still reading it
+    if (state_ == Reading)
+    {
+        keys_ = reading_.get();
+        state_ = Loading;
+    }
+
+    _BeginScan();
+    _ScanSome(std::numeric_limits<size_t>::max());
+
+    auto keys = _FinishScan();
+    if (_Write(g_config.backendwarmupfile, keys))
+    {
+        lastSaveTime_ = ::time(nullptr);
+        lastSaveKeys_ = keys.size();
+        USR << "Save " << keys.size() << " hot keys to " << g_config.backendwarmupfile;
+    }
+}
+
+void QWarmup::_Cron()
+{
+    if (writing_.valid() &&
+        writing_.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        if (writing_.get())
+        {
+            lastSaveTime_ = ::time(nullptr);
+            lastSaveKeys_ = savingKeys_;
+        }
+    }
+
+    if (!scanning_)
+    {
+        const uint64_t interval = static_cast<uint64_t>(g_config.backendwarmupinterval) * 1000;
+        if (interval == 0 || ::Now() < lastScanStart_ + interval || writing_.valid())
+            return;
+
+        _BeginScan();
+    }
+
+    _ScanSome(kScanKeysPerTick);
+    if (scanning_)
+        return;
+
+    auto keys = _FinishScan();
+    savingKeys_ = keys.size();
+
+    const QString file = g_config.backendwarmupfile;
+    writing_ = ThreadPool::Instance().ExecuteTask([file](const std::vector<HotKey>& keys) {
+        return _Write(file, keys);
+    }, std::move(keys));
+}
+
+void QWarmup::_BeginScan()
+{
+    scanning_ = true;
+    scanDb_ = 0;
+    scanBucket_ = 0;
+    candidates_.clear();
+    candidateBytes_ = 0;
+    lastScanStart_ = ::Now();
+}
+
+void QWarmup::_ScanSome(size_t count)
+{
+    const int dbs = static_cast<int>(g_config.databases);
+    const int oldDb = QSTORE.GetDB();
+
+    while (count > 0 && scanDb_ < dbs)
+    {
+        QSTORE.SelectDB(scanDb_);
+
+        size_t visited = 0;
+        scanBucket_ = QSTORE.ScanBuckets(scanBucket_, count, [&](const QString& key, const QObject& obj) {
+            HotKey hk;
+            hk.idle = EstimateIdleTime(obj.lru);
+            hk.dbno = scanDb_;
+            hk.bytes = static_cast<uint32_t>(std::min<size_t>(EstimateBytes(key, obj),
+                                                              std::numeric_limits<uint32_t>::max()));
+            hk.key = key;
+            _AddCandidate(std::move(hk));
+            ++ visited;
+        });
+
+        count -= std::min(count, visited);
+        if (scanBucket_ == 0)
+            ++ scanDb_;
+    }
+
+    QSTORE.SelectDB(oldDb);
+
+    if (scanDb_ >= dbs)
+        scanning_ = false;
+}
+
+void QWarmup::_AddCandidate(HotKey&& hk)
+{
+    const uint64_t budget = g_config.backendwarmupmemory;
+    if (hk.bytes > budget)
+        return;
+
+    // drop the most idle ones until fit
+    if (candidateBytes_ + hk.bytes > budget &&
+        !candidates_.empty() &&
+        candidates_.front().idle <= hk.idle)
+        return;
+
+    candidateBytes_ += hk.bytes;
+    candidates_.push_back(std::move(hk));
+    std::push_heap(candidates_.begin(), candidates_.end());
+
+    while (candidateBytes_ > budget)
+    {
+        std::pop_heap(candidates_.begin(), candidates_.end());
+        candidateBytes_ -= candidates_.back().bytes;
+        candidates_.pop_back();
+    }
+}
+
+std::vector<QWarmup::HotKey> QWarmup::_FinishScan()
+{
+    scanning_ = false;
+
+    std::vector<HotKey> keys;
+    keys.swap(candidates_);
+    std::sort(keys.begin(), keys.end());
+
+    // warm up not finished, the keys not yet loaded are still hot
+    uint64_t bytes = candidateBytes_;
+    candidateBytes_ = 0;
+    if (pos_ < keys_.size())
+    {
+        std::set<std::pair<int, QString> > seen;
+        for (const auto& hk : keys)
+            seen.insert(std::make_pair(hk.dbno, hk.key));
+
+        for (size_t i = pos_; i < keys_.size(); ++ i)
+        {
+            const HotKey& hk = keys_[i];
+            if (bytes + hk.bytes > g_config.backendwarmupmemory)
+                break;
+
+            if (seen.insert(std::make_pair(hk.dbno, hk.key)).second)
+            {
+                bytes += hk.bytes;
+                keys.push_back(hk);
+            }
+        }
+    }
+
+    return keys;
+}
+
+// file: "QHOT" version, then dbno(u16) bytes(u32) keylen(u32) key,
+// hottest first
+bool QWarmup::_Write(const QString& file, const std::vector<HotKey>& keys)
+{
+    const QString tmp = file + ".tmp";
+    ::unlink(tmp.c_str());
+
+    {
+        OutputMemoryFile out;
+        if (!out.Open(tmp, false))
+        {
+            ERR << "open " << tmp << " failed, errno " << errno;
+            return false;
+        }
+
+        out.Write(kMagic, 4);
+        out.Write(kVersion);
+        for (const auto& hk : keys)
+        {
+            out.Write(static_cast<uint16_t>(hk.dbno));
+            out.Write(hk.bytes);
+            out.Write(static_cast<uint32_t>(hk.key.size()));
+            out.Write(hk.key.data(), hk.key.size());
+        }
+
+        out.Sync();
+    }
+
+    if (::rename(tmp.c_str(), file.c_str()) != 0)
+    {
+        ERR << "rename " << tmp << " to " << file << " failed, errno " << errno;
+        return false;
+    }
+
+    return true;
+}
+
+std::vector<QWarmup::HotKey> QWarmup::_Read(const QString& file, uint64_t budget)
+{
+    std::vector<HotKey> keys;
+
+    InputMemoryFile in;
+    if (!in.Open(file.c_str()))
+        return keys;
+
+    try
+    {
+        size_t len = 4;
+        const char* magic = in.Read(len);
+        if (len != 4 || memcmp(magic, kMagic, 4) != 0)
+        {
+            WRN << "bad warm up file " << file;
+            return keys;
+        }
+        in.Skip(4);
+
+        if (in.Read<uint32_t>() != kVersion)
+        {
+            WRN << "unknown warm up file version " << file;
+            return keys;
+        }
+
+        uint64_t bytes = 0;
+        while (true)
+        {
+            len = 1;
+            if (!in.Read(len))
+                break;
+
+            HotKey hk;
+            hk.dbno = in.Read<uint16_t>();
+            hk.bytes = in.Read<uint32_t>();
+
+            len = in.Read<uint32_t>();
+            const size_t keylen = len;
+            const char* key = in.Read(len);
+            if (len != keylen)
+                break; // truncated
+            in.Skip(len);
+
+            if (hk.dbno >= g_config.databases)
+                continue;
+
+            // the budget may be less than when saved
+            if (bytes + hk.bytes > budget)
+                break;
+
+            bytes += hk.bytes;
+            hk.key.assign(key, len);
+            keys.push_back(std::move(hk));
+        }
+    }
+    catch (const std::runtime_error& e)
+    {
+        WRN << "read warm up file " << file << " failed: " << e.what();
+    }
+
+    return keys;
+}
+
+void QWarmup::OnInfoCommand(UnboundedBuffer& res)
+{
+    if (g_config.backend == BackEndNone || g_config.backendwarmupmemory == 0)
+        return;
+
+    static const char* const kStates[] = { "idle", "reading", "loading", "done" };
+
+    double progress = 0;
+    if (state_ == Done)
+        progress = 100;
+    else if (totalKeys_ > 0)
+        progress = 100.0 * pos_ / totalKeys_;
+
+    const uint64_t end = state_ == Done ? doneTime_ : ::Now();
+
+    char buf[1024];
+    int n = snprintf(buf, sizeof buf - 1,
+                 "# Warmup\r\n"
+                 "warmup_status:%s\r\n"
+                 "warmup_keys:%lu\r\n"
+                 "warmup_prefetched:%lu\r\n"
+                 "warmup_loaded:%lu\r\n"
+                 "warmup_skipped:%lu\r\n"
+                 "warmup_bytes:%lu\r\n"
+                 "warmup_memory_budget:%lu\r\n"
+                 "warmup_progress:%.2f\r\n"
+                 "warmup_elapsed_ms:%lu\r\n"
+                 "warmup_hotkeys_saved:%lu\r\n"
+                 "warmup_last_save:%lu\r\n"
+                 "warmup_scanning:%d\r\n"
+                 , kStates[state_]
+                 , totalKeys_
+                 , prefetched_
+                 , QBackendLoader::Instance().PrefetchLoaded()
+                 , skipped_
+                 , bytes_
+                 , g_config.backendwarmupmemory
+                 , progress
+                 , startTime_ == 0 ? 0 : end - startTime_
+                 , lastSaveKeys_
+                 , lastSaveTime_
+                 , scanning_ ? 1 : 0);
+
+    if (!res.IsEmpty())
+        res.PushData("\r\n", 2);
+
+    res.PushData(buf, n);
+}
+
+}
+
@@ -0,0 +1,95 @@
+#ifndef BERT_QWARMUP_H
+#define BERT_QWARMUP_H
+
+#include <future>
+#include <vector>
+#include "QString.h"
+
+namespace qedis
+{
+
+class UnboundedBuffer;
+
+// Warm up memory from backend after restart.
+// The hottest keys(least idle) fitting in backend-warmup-memory are saved
+// to a manifest, by an incremental scan every backend-warmup-interval and
+// at shutdown. At start a thread reads the manifest, then the keys are
+// prefetched by backend loader while clients are already served.
+class QWarmup
+{
+public:
+    static QWarmup& Instance();
+
+    QWarmup(const QWarmup& ) = delete;
+    void operator= (const QWarmup& ) = delete;
+
+    // main thread, after backend loader started
+    void Start();
+    // main loop, hand keys to loader; true if busy
+    bool Feed();
+    // shutdown, scan all and save manifest now
+    void Save();
+
+    void OnInfoCommand(UnboundedBuffer& res);
+
+private:
+    QWarmup();
+
+    struct HotKey
+    {
+        uint32_t idle = 0;
+        int      dbno = 0;
+        uint32_t bytes = 0;
+        QString  key;
+
+        bool operator< (const HotKey& other) const { return idle < other.idle; }
+    };
+
+    enum State
+    {
+        Idle,
+        Reading,
+        Loading,
+        Done,
+    };
+
+    // the hot key scan
+    void _Cron();
+    void _BeginScan();
+    void _ScanSome(size_t count);
+    void _AddCandidate(HotKey&& hk);
+    std::vector<HotKey> _FinishScan();
+
+    static std::vector<HotKey> _Read(const QString& file, uint64_t budget);
+    static bool _Write(const QString& file, const std::vector<HotKey>& keys);
+
+    // warm up
+    State    state_;
+    std::future<std::vector<HotKey> > reading_;
+    std::vector<HotKey> keys_;
+    size_t   pos_;
+    uint64_t startTime_;
+    uint64_t doneTime_;
+    size_t   totalKeys_;
+    size_t   prefetched_;
+    size_t   skipped_;
+    uint64_t bytes_;
+
+    // heap of candidates, the most idle on top
+    bool     scanning_;
+    int      scanDb_;
+    size_t   scanBucket_;
+    std::vector<HotKey> candidates_;
+    uint64_t candidateBytes_;
+    uint64_t lastScanStart_;
+
+    std::future<bool> writing_;
+    uint64_t lastSaveTime_;
+    size_t   lastSaveKeys_;
+    size_t   savingKeys_;
+};
+
+}
+
+#endif
+
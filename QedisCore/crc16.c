@@ -0,0 +1,93 @@
+/* CRC16 implementation according to CCITT standards, same as redis cluster.
+ *
+ * Name                       : "XMODEM", also known as "ZMODEM", "CRC-16/ACORN"
+ * Width                      : 16 bit
+ * Poly                       : 1021 (That is actually x^16 + x^12 + x^5 + 1)
+ * Initialization             : 0000
+ * Reflect Input byte         : False
+ * Reflect Output CRC         : False
+ * Xor constant to output CRC : 0000
+ * Output for "123456789"     : 31C3
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include "crc16.h"
+
+/* crc16_tab[k][n] is the crc of byte n followed by k zero bytes, so crc16()
+ * consumes 8 bytes with independent lookups. Built once on first use. */
+static uint16_t crc16_tab[8][256];
+static pthread_once_t crc16_once = PTHREAD_ONCE_INIT;
+
+static void crc16_init_once(void) {
+    int k, n, bit;
+
+    for (n = 0; n < 256; n++) {
+        uint16_t c = (uint16_t)(n << 8);
+        for (bit = 0; bit < 8; bit++)
+            c = (c & 0x8000) ? (uint16_t)((c << 1) ^ 0x1021) : (uint16_t)(c << 1);
+        crc16_tab[0][n] = c;
+    }
+
+    for (k = 1; k < 8; k++) {
+        for (n = 0; n < 256; n++) {
+            uint16_t c = crc16_tab[k - 1][n];
+            crc16_tab[k][n] = (uint16_t)((c << 8) ^ crc16_tab[0][c >> 8]);
+        }
+    }
+}
+
+uint16_t crc16_bytewise(uint16_t crc, const char *buf, size_t len) {
+    const unsigned char *s = (const unsigned char *)buf;
+    size_t i;
+
+    pthread_once(&crc16_once, crc16_init_once);
+    for (i = 0; i < len; i++)
+        crc = (uint16_t)((crc << 8) ^ crc16_tab[0][((crc >> 8) ^ s[i]) & 0xff]);
+    return crc;
+}
+
+uint16_t crc16(uint16_t crc, const char *buf, size_t len) {
+    const uint16_t (*t)[256] = crc16_tab;
+    const unsigned char *s = (const unsigned char *)buf;
+
+    pthread_once(&crc16_once, crc16_init_once);
+    while (len >= 8) {
+        crc = t[7][s[0] ^ (crc >> 8)] ^ t[6][s[1] ^ (crc & 0xff)] ^
+              t[5][s[2]] ^ t[4][s[3]] ^ t[3][s[4]] ^ t[2][s[5]] ^
+              t[1][s[6]] ^ t[0][s[7]];
+        s += 8;
+        len -= 8;
+    }
+    return crc16_bytewise(crc, (const char *)s, len);
+}
+
+/* Only hash what is between { and } if the key contains a non empty tag, so
+ * keys like {user1000}.following and {user1000}.followers share a slot. */
+unsigned int keyHashSlot(const char *key, size_t keylen) {
+    size_t s, e;
+
+    for (s = 0; s < keylen; s++)
+        if (key[s] == '{') break;
+
+    if (s == keylen)
+        return crc16(0, key, keylen) & 0x3FFF;
+
+    for (e = s + 1; e < keylen; e++)
+        if (key[e] == '}') break;
+
+    if (e == keylen || e == s + 1)
+        return crc16(0, key, keylen) & 0x3FFF;
+
+    return crc16(0, key + s + 1, e - s - 1) & 0x3FFF;
+}
+
+/* Test main */
+#ifdef TEST_MAIN
+#include <stdio.h>
+int main(void) {
+    printf("31c3 == %04x\n", crc16(0, "123456789", 9));
+    printf("%u == %u\n", keyHashSlot("{user1000}.following", 20), keyHashSlot("user1000", 8));
+    return 0;
+}
+#endif
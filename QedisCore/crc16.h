@@ -0,0 +1,25 @@
+#ifndef BERT_CRC16_H
+#define BERT_CRC16_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* crc-16-xmodem, the same as redis cluster */
+uint16_t crc16(uint16_t crc, const char *buf, size_t len);
+
+/* bytewise reference version, for tests and benchmarks */
+uint16_t crc16_bytewise(uint16_t crc, const char *buf, size_t len);
+
+/* crc16 of key, or of the {tag} in key if any, in [0, 16384) */
+unsigned int keyHashSlot(const char *key, size_t keylen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -38,6 +38,9 @@
  * POSSIBILITY OF SUCH DAMAGE. */
 
 #include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "crc64.h"
 
 static const uint64_t crc64_tab[256] = {
     UINT64_C(0x0000000000000000), UINT64_C(0x7ad870c830358979),
@@ -170,7 +173,7 @@ static const uint64_t crc64_tab[256] = {
     UINT64_C(0x536fa08fdfd90e51), UINT64_C(0x29b7d047efec8728),
 };
 
-uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
+uint64_t crc64_bytewise(uint64_t crc, const unsigned char *s, uint64_t l) {
     uint64_t j;
 
     for (j = 0; j < l; j++) {
@@ -180,12 +183,187 @@ uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
     return crc;
 }
 
+/* Slice-by-N: crc64_slice_tab[k][n] is the crc of byte n followed by k zero
+ * bytes, so N input bytes are folded with N independent lookups per step
+ * instead of N dependent ones. The tables are built once on first use. */
+static uint64_t crc64_slice_tab[16][256];
+static pthread_once_t crc64_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t load64le(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+uint64_t crc64_slice8(uint64_t crc, const unsigned char *s, uint64_t l) {
+    const uint64_t (*t)[256] = crc64_slice_tab;
+
+    crc64_init();
+    while (l >= 8) {
+        crc ^= load64le(s);
+        crc = t[7][crc & 0xff] ^ t[6][(crc >> 8) & 0xff] ^
+              t[5][(crc >> 16) & 0xff] ^ t[4][(crc >> 24) & 0xff] ^
+              t[3][(crc >> 32) & 0xff] ^ t[2][(crc >> 40) & 0xff] ^
+              t[1][(crc >> 48) & 0xff] ^ t[0][crc >> 56];
+        s += 8;
+        l -= 8;
+    }
+    return crc64_bytewise(crc, s, l);
+}
+
+uint64_t crc64_slice16(uint64_t crc, const unsigned char *s, uint64_t l) {
+    const uint64_t (*t)[256] = crc64_slice_tab;
+
+    crc64_init();
+    while (l >= 16) {
+        uint64_t hi = load64le(s + 8);
+        crc ^= load64le(s);
+        crc = t[15][crc & 0xff] ^ t[14][(crc >> 8) & 0xff] ^
+              t[13][(crc >> 16) & 0xff] ^ t[12][(crc >> 24) & 0xff] ^
+              t[11][(crc >> 32) & 0xff] ^ t[10][(crc >> 40) & 0xff] ^
+              t[9][(crc >> 48) & 0xff] ^ t[8][crc >> 56] ^
+              t[7][hi & 0xff] ^ t[6][(hi >> 8) & 0xff] ^
+              t[5][(hi >> 16) & 0xff] ^ t[4][(hi >> 24) & 0xff] ^
+              t[3][(hi >> 32) & 0xff] ^ t[2][(hi >> 40) & 0xff] ^
+              t[1][(hi >> 48) & 0xff] ^ t[0][hi >> 56];
+        s += 16;
+        l -= 16;
+    }
+    return crc64_slice8(crc, s, l);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <wmmintrin.h>
+
+#define CRC64_HAVE_CLMUL 1
+
+/* Carry-less multiply folding, see Intel's "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction". The 128 bit state is folded over
+ * the following data with bit reflected constants x^(n+63) and x^(n-1) mod P,
+ * n being the fold distance in bits. Instead of a Barrett reduction, the last
+ * 16 bytes of state are simply fed to the table code. */
+#define CRC64_K_512_LO UINT64_C(0xaf86efb16d9ab4fb) /* x^575 mod P */
+#define CRC64_K_512_HI UINT64_C(0xf49784a634f014e4) /* x^511 mod P */
+#define CRC64_K_128_LO UINT64_C(0xd9d7be7d505da32c) /* x^191 mod P */
+#define CRC64_K_128_HI UINT64_C(0x381d0015c96f4444) /* x^127 mod P */
+
+__attribute__((target("pclmul,sse2")))
+static inline __m128i crc64_fold(__m128i acc, __m128i k, __m128i data) {
+    __m128i lo = _mm_clmulepi64_si128(acc, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(acc, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(lo, hi), data);
+}
+
+__attribute__((target("pclmul,sse2")))
+static uint64_t crc64_clmul_x86(uint64_t crc, const unsigned char *s, uint64_t l) {
+    const __m128i k512 = _mm_set_epi64x((long long)CRC64_K_512_HI, (long long)CRC64_K_512_LO);
+    const __m128i k128 = _mm_set_epi64x((long long)CRC64_K_128_HI, (long long)CRC64_K_128_LO);
+    __m128i x0, x1, x2, x3;
+    unsigned char rest[16];
+
+    if (l < 128)
+        return crc64_slice16(crc, s, l);
+
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)s),
+                       _mm_cvtsi64_si128((long long)crc));
+    x1 = _mm_loadu_si128((const __m128i *)(s + 16));
+    x2 = _mm_loadu_si128((const __m128i *)(s + 32));
+    x3 = _mm_loadu_si128((const __m128i *)(s + 48));
+    s += 64;
+    l -= 64;
+
+    while (l >= 64) {
+        x0 = crc64_fold(x0, k512, _mm_loadu_si128((const __m128i *)s));
+        x1 = crc64_fold(x1, k512, _mm_loadu_si128((const __m128i *)(s + 16)));
+        x2 = crc64_fold(x2, k512, _mm_loadu_si128((const __m128i *)(s + 32)));
+        x3 = crc64_fold(x3, k512, _mm_loadu_si128((const __m128i *)(s + 48)));
+        s += 64;
+        l -= 64;
+    }
+
+    x0 = crc64_fold(x0, k128, x1);
+    x0 = crc64_fold(x0, k128, x2);
+    x0 = crc64_fold(x0, k128, x3);
+
+    while (l >= 16) {
+        x0 = crc64_fold(x0, k128, _mm_loadu_si128((const __m128i *)s));
+        s += 16;
+        l -= 16;
+    }
+
+    _mm_storeu_si128((__m128i *)rest, x0);
+    crc = crc64_slice16(0, rest, sizeof rest);
+    return crc64_slice16(crc, s, l);
+}
+#endif
+
+uint64_t crc64_clmul(uint64_t crc, const unsigned char *s, uint64_t l) {
+#ifdef CRC64_HAVE_CLMUL
+    if (crc64_clmul_supported())
+        return crc64_clmul_x86(crc, s, l);
+#endif
+    return crc64_slice16(crc, s, l);
+}
+
+int crc64_clmul_supported(void) {
+#ifdef CRC64_HAVE_CLMUL
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse2");
+#else
+    return 0;
+#endif
+}
+
+typedef uint64_t (*crc64_func)(uint64_t, const unsigned char *, uint64_t);
+static crc64_func crc64_impl_func = crc64_bytewise;
+static const char *crc64_impl_name = "bytewise";
+
+static void crc64_init_once(void) {
+    int k, n;
+
+    for (n = 0; n < 256; n++)
+        crc64_slice_tab[0][n] = crc64_tab[n];
+    for (k = 1; k < 16; k++) {
+        for (n = 0; n < 256; n++) {
+            uint64_t c = crc64_slice_tab[k - 1][n];
+            crc64_slice_tab[k][n] = crc64_tab[c & 0xff] ^ (c >> 8);
+        }
+    }
+
+#ifdef CRC64_HAVE_CLMUL
+    if (crc64_clmul_supported()) {
+        crc64_impl_func = crc64_clmul_x86;
+        crc64_impl_name = "pclmul";
+        return;
+    }
+#endif
+    crc64_impl_func = crc64_slice16;
+    crc64_impl_name = "slice16";
+}
+
+void crc64_init(void) {
+    pthread_once(&crc64_once, crc64_init_once);
+}
+
+const char *crc64_impl(void) {
+    crc64_init();
+    return crc64_impl_name;
+}
+
+uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
+    crc64_init();
+    return crc64_impl_func(crc, s, l);
+}
+
 /* Test main */
 #ifdef TEST_MAIN
 #include <stdio.h>
 int main(void) {
-    printf("e9c6d914c4b8d9ca == %016llx\n",
-        (unsigned long long) crc64(0,(unsigned char*)"123456789",9));
+    printf("e9c6d914c4b8d9ca == %016llx (%s)\n",
+        (unsigned long long) crc64(0,(unsigned char*)"123456789",9), crc64_impl());
     return 0;
 }
 #endif
@@ -0,0 +1,28 @@
+#ifndef BERT_CRC64_H
+#define BERT_CRC64_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* crc-64-jones as used by the rdb file, picks the fastest kernel at runtime */
+uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
+
+/* the kernels, for tests and benchmarks */
+void crc64_init(void);
+const char *crc64_impl(void);
+int crc64_clmul_supported(void);
+
+uint64_t crc64_bytewise(uint64_t crc, const unsigned char *s, uint64_t l);
+uint64_t crc64_slice8(uint64_t crc, const unsigned char *s, uint64_t l);
+uint64_t crc64_slice16(uint64_t crc, const unsigned char *s, uint64_t l);
+uint64_t crc64_clmul(uint64_t crc, const unsigned char *s, uint64_t l);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
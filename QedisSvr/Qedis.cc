@@ -5,6 +5,7 @@
 //
 
 #include <iostream>
+#include <algorithm>
 #include <unistd.h>
 #include <sys/wait.h>
 
@@ -19,9 +20,19 @@
 #include "QPubsub.h"
 #include "QMigration.h"
 #include "QDB.h"
+#include "QSnapshot.h"
+#include "QCheckpoint.h"
 #include "QAOF.h"
+#include "QBackendWriter.h"
+#include "QBackendLoader.h"
+#include "QWarmup.h"
+#include "QLazyLoader.h"
 #include "QConfig.h"
 #include "QSlowLog.h"
+#include "QLatencyMonitor.h"
+#include "QRequestTrace.h"
+#include "QKeyStats.h"
+#include "QMetrics.h"
 #include "QModule.h"
 
 #include "QedisLogo.h"
@@ -161,6 +172,15 @@ std::shared_ptr<StreamSocket> Qedis::_OnNewConnection(int connfd, int tag)
         }
         break;
 #endif
+    case ConnectionTag::kMetricsClient:
+        {
+            auto cli(std::make_shared<QMetricsClient>());
+            if (!cli->Init(connfd, peer))
+                cli.reset();
+
+            return cli;
+        }
+        break;
     case ConnectionTag::kMigrateClient:
         {
             INF << "Connect to migrate " << peer.ToString();
@@ -185,55 +205,101 @@ static void QdbCron()
 {
     using namespace qedis;
     
+    QCheckpoint::Instance().Cron();
+
     if (g_qdbPid != -1)
         return;
     
     if (g_now.MilliSeconds() > (g_lastQDBSave + unsigned(g_config.saveseconds)) * 1000UL &&
         QStore::dirty_ >= g_config.savechanges)
     {
-        int ret = fork();
-        if (ret == 0)
-        {
-            {
-                QDBSaver  qdb;
-                qdb.Save(g_config.rdbfullname.c_str());
-                std::cerr << "ServerCron child save rdb done, exiting child\n";
-            }  //  make qdb to be destructed before exit
-            _exit(0);
-        }
-        else if (ret == -1)
-        {
-            ERR << "fork qdb save process failed";
-        }
-        else
-        {
-            g_qdbPid = ret;
-        }
+        const bool started = g_config.rdbincremental ?
+                             QCheckpoint::Instance().BackgroundSave() :
+                             QDBSaver::BackgroundSave(g_config.rdbfullname.c_str());
+        if (!started)
+            ERR << "start qdb save failed";
             
         INF << "ServerCron save rdb file " << g_config.rdbfullname;
     }
 }
 
-static void LoadDbFromDisk()
+// commands replayed, -1 if the file is missing or broken; if truncatedOk,
+// the commands before a broken tail are replayed, like a crash left it
+static long ReplayAOF(const qedis::QString& file, bool truncatedOk = false)
+{
+    using namespace qedis;
+
+    QAOFLoader aofLoader;
+    if (!aofLoader.Load(file.c_str()))
+    {
+        if (!truncatedOk)
+            return -1;
+
+        if (aofLoader.IsTruncated())
+            WRN << "aof " << file << " is truncated, load " << aofLoader.GetCmds().size() << " commands before the broken tail";
+        else
+            WRN << "aof " << file << " is missing, treat it as empty";
+    }
+
+    const auto& cmds = aofLoader.GetCmds();
+    for (const auto& cmd : cmds)
+    {
+        // aof keeps the command name as clients sent it
+        QString name(cmd[0]);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+        const QCommandInfo* info = QCommandTable::GetCommandInfo(name);
+        QCommandTable::ExecuteCmd(cmd, info);
+    }
+
+    return static_cast<long>(cmds.size());
+}
+
+// false if data on disk is broken
+static bool LoadDbFromDisk()
 {
     using namespace qedis;
     
     //  USE AOF RECOVERY FIRST, IF FAIL, THEN RDB
-    QAOFLoader aofLoader;
-    if (aofLoader.Load(g_config.appendfilename.c_str()))
+    bool loaded = false;
+    QAOFManifest manifest;
+    const bool multiPart = g_config.appendmultipart && manifest.Load(QAOFManifest::Name());
+    if (manifest.IsDamaged())
+    {
+        std::cerr << "aof manifest " << QAOFManifest::Name() << " is damaged, refuse to start\n";
+        return false;
+    }
+
+    if (multiPart)
     {
-        const auto& cmds = aofLoader.GetCmds();
-        for (const auto& cmd : cmds)
+        // base first, then incr segments in order; a segment is applied on
+        // top of all before it, so only the last one may be cut by a crash
+        const auto files = manifest.Files();
+        for (size_t i = 0; i < files.size(); ++ i)
         {
-            const QCommandInfo* info = QCommandTable::GetCommandInfo(cmd[0]);
-            QCommandTable::ExecuteCmd(cmd, info);
+            const long cmds = ReplayAOF(files[i], i + 1 == files.size());
+            if (cmds < 0)
+            {
+                // log thread is not started yet
+                std::cerr << "aof segment " << files[i] << " is missing or broken, "
+                          << "later segments can not be applied, refuse to start\n";
+                return false;
+            }
+
+            if (cmds > 0)
+                loaded = true;
         }
     }
     else
     {
-        QDBLoader  loader;
-        loader.Load(g_config.rdbfullname.c_str());
+        loaded = ReplayAOF(g_config.appendfilename) > 0;
     }
+
+    // rdb base and its incremental deltas
+    if (!loaded)
+        return QCheckpoint::Instance().Load();
+
+    return true;
 }
 
 #if QEDIS_CLUSTER
@@ -293,6 +359,16 @@ bool Qedis::_Init()
         return false;
     }
 
+    if (g_config.metricsport > 0)
+    {
+        SocketAddr metricsAddr(g_config.ip.c_str(), static_cast<unsigned short>(g_config.metricsport));
+        if (!Server::TCPBind(metricsAddr, ConnectionTag::kMetricsClient))
+        {
+            ERR << "can not bind metrics socket on port " << metricsAddr.GetPort();
+            return false;
+        }
+    }
+
     QCommandTable::Init();
     QCommandTable::AliasCommand(g_config.aliases);
     QSTORE.Init(g_config.databases);
@@ -300,17 +376,25 @@ bool Qedis::_Init()
     QSTORE.InitBlockedTimer();
     QSTORE.InitEvictionTimer();
     QSTORE.InitDumpBackends();
+    QWarmup::Instance().Start();
     QPubsub::Instance().InitPubsubTimer();
     QMigrationManager::Instance().InitMigrationTimer();
     
     // Only if there is no backend, load aof or rdb
-    if (g_config.backend == qedis::BackEndNone)
-        LoadDbFromDisk();
+    if (g_config.backend == qedis::BackEndNone && !LoadDbFromDisk())
+        return false;
 
+    QCheckpoint::Instance().Init();
     QAOFThreadController::Instance().Start();
 
     QSlowLog::Instance().SetThreshold(g_config.slowlogtime);
     QSlowLog::Instance().SetLogLimit(static_cast<std::size_t>(g_config.slowlogmaxlen));
+    QLatencyMonitor::Instance().SetThreshold(g_config.latencythreshold);
+    QRequestTrace::Instance().SetSampleRate(g_config.tracesamplerate);
+    QHotKeys::Instance().SetSampleRate(g_config.hotkeyssamplerate);
+    QHotKeys::Instance().InitDecayTimer();
+    QBigKeys::Instance().InitScanTimer();
+    QMetrics::Instance().InitSampleTimer();
     
     {
         auto cronTimer = TimerManager::Instance().CreateTimer();
@@ -387,10 +471,26 @@ bool Qedis::_Init()
     return  true;
 }
 
+static void OnQdbSaveDone(int exit, int signal)
+{
+    using namespace qedis;
+
+    QDBSaver::SaveDoneHandler(exit, signal);
+    if (QREPL.IsBgsaving())
+        QREPL.OnRdbSaveDone(exit == 0 && signal == 0);
+    else
+        QREPL.TryBgsave();
+}
+
 static void CheckChild()
 {
     using namespace qedis;
 
+    // no child for snapshot thread
+    bool succ = false;
+    if (g_qdbPid == kQDBSnapshotPid && QSnapshot::Instance().CheckDone(succ))
+        OnQdbSaveDone(succ ? 0 : 1, 0);
+
     if (g_qdbPid == -1 && g_rewritePid == -1)
         return;
 
@@ -406,11 +506,7 @@ static void CheckChild()
         
         if (pid == g_qdbPid)
         {
-            QDBSaver::SaveDoneHandler(exit, signal);
-            if (QREPL.IsBgsaving())
-                QREPL.OnRdbSaveDone();
-            else
-                QREPL.TryBgsave();
+            OnQdbSaveDone(exit, signal);
         }
         else if (pid == g_rewritePid)
         {
@@ -428,11 +524,18 @@ static void CheckChild()
 bool Qedis::_RunLogic()
 {
     g_now.Now();
+
+    const uint64_t start = ::NowUs();
     TimerManager::Instance().UpdateTimers(g_now);
+    qedis::QLatencyMonitor::Instance().AddSampleIfNeeded("timer-cycle", ::NowUs() - start);
     
     CheckChild();
+
+    bool busy = qedis::QBackendLoader::Instance().Poll();
+    busy = qedis::QWarmup::Instance().Feed() || busy;
+    busy = qedis::QLazyLoader::Instance().Feed() || busy;
     
-    return Server::_RunLogic();
+    return Server::_RunLogic() || busy;
 }
 
 
@@ -440,6 +543,10 @@ void Qedis::_Recycle()
 {
     std::cerr << "Qedis::_Recycle: server is exiting.. BYE BYE\n";
     qedis::QAOFThreadController::Instance().Stop();
+    qedis::QBackendLoader::Instance().Stop();
+    qedis::QWarmup::Instance().Save();
+    qedis::QStore::Instance().FlushBackends();
+    qedis::QBackendWriter::Instance().Stop();
 }
 
 
@@ -0,0 +1,80 @@
+
+#include <string>
+#include "UnitTest.h"
+#include "QBloomFilter.h"
+
+using namespace qedis;
+
+// share of never added keys the filter lets through
+static double MeasuredRate(const QBloomFilter& filter, int probes)
+{
+    int passed = 0;
+    for (int i = 0; i < probes; ++ i)
+    {
+        if (filter.MayContain("absent:" + std::to_string(i)))
+            ++ passed;
+    }
+
+    return static_cast<double>(passed) / probes;
+}
+
+TEST_CASE(bloom_no_false_negative)
+{
+    QBloomFilter filter(1000, 0.01);
+
+    EXPECT_FALSE(filter.MayContain("key"));
+    EXPECT_TRUE(filter.Add("key"));
+    EXPECT_FALSE(filter.Add("key"));
+    EXPECT_TRUE(filter.MayContain("key"));
+
+    for (int i = 0; i < 20000; ++ i)
+        filter.Add("key:" + std::to_string(i));
+
+    bool all = true;
+    for (int i = 0; i < 20000; ++ i)
+        all = all && filter.MayContain("key:" + std::to_string(i));
+
+    EXPECT_TRUE(all);
+}
+
+TEST_CASE(bloom_false_positive_rate)
+{
+    const double error = 0.01;
+    QBloomFilter filter(10000, error);
+
+    for (int i = 0; i < 10000; ++ i)
+        filter.Add("key:" + std::to_string(i));
+
+    // at capacity, one filter
+    const double rate = MeasuredRate(filter, 100000);
+    EXPECT_TRUE(rate < error * 1.5);
+    EXPECT_TRUE(filter.FalsePositiveRate() < error);
+}
+
+TEST_CASE(bloom_growth)
+{
+    const double error = 0.01;
+    QBloomFilter filter(1000, error);
+
+    filter.Add("key:0");
+    const size_t initBytes = filter.Bytes();
+
+    // 1000 + 2000 + 4000 + 8000 + 16000 + ..., six filters for 50000 keys
+    size_t added = 1;
+    for (int i = 1; i < 50000; ++ i)
+    {
+        if (filter.Add("key:" + std::to_string(i)))
+            ++ added;
+    }
+
+    // a false positive in Add skips the key, about error of them
+    EXPECT_TRUE(filter.Keys() == added);
+    EXPECT_TRUE(added > 50000 * (1 - error * 2));
+    EXPECT_TRUE(filter.Bytes() > initBytes * 32);
+
+    // the error stays bounded however many filters are chained
+    const double rate = MeasuredRate(filter, 100000);
+    EXPECT_TRUE(rate < error * 1.5);
+    EXPECT_TRUE(filter.FalsePositiveRate() < error);
+}
+
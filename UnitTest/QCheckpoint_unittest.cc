@@ -0,0 +1,72 @@
+#include <cstdio>
+#include "UnitTest.h"
+#include "QCommand.h"
+#include "QStore.h"
+#include "QDB.h"
+#include "UnboundedBuffer.h"
+
+using namespace qedis;
+
+// execute and propagate like QClient does
+static void Exec(const std::vector<QString>& params)
+{
+    UnboundedBuffer reply;
+    if (QCommandTable::ExecuteCmd(params, &reply) == QError_ok)
+        Propogate(params);
+}
+
+// keys written in place which are not params[1] must be in the delta
+TEST_CASE(checkpoint_second_key)
+{
+    const char* const base = "checkpoint_unittest.rdb";
+    const char* const delta = "checkpoint_unittest.delta";
+
+    QCommandTable::Init();
+    QSTORE.Init(1);
+
+    Exec({"sadd", "src", "a", "b"});
+    Exec({"sadd", "dst", "x"});
+    Exec({"rpush", "from", "1", "2"});
+    Exec({"rpush", "to", "9"});
+
+    QDBSaver().Save(base);
+    QSTORE.InitCheckpointTracking();
+
+    Exec({"smove", "src", "dst", "a"});
+    Exec({"rpoplpush", "from", "to"});
+
+    const auto deltas = QSTORE.TakeCheckpointDeltas();
+    EXPECT_TRUE(deltas[0].keys.count("dst") == 1);
+    EXPECT_TRUE(deltas[0].keys.count("to") == 1);
+    {
+        QDBSaver saver;
+        saver.SetDelta(&deltas);
+        saver.Save(delta);
+    }
+
+    QSTORE.ResetDb();
+    EXPECT_TRUE(QDBLoader().Load(base) == 0);
+    EXPECT_TRUE(QDBLoader().LoadDelta(delta) == 0);
+    QSTORE.SelectDB(0);
+
+    QObject* obj = nullptr;
+    EXPECT_TRUE(QSTORE.GetValueByType("src", obj, QType_set) == QError_ok);
+    EXPECT_TRUE(obj && obj->CastSet()->size() == 1);
+
+    obj = nullptr;
+    EXPECT_TRUE(QSTORE.GetValueByType("dst", obj, QType_set) == QError_ok);
+    EXPECT_TRUE(obj && obj->CastSet()->size() == 2 && obj->CastSet()->count("a") == 1);
+
+    obj = nullptr;
+    EXPECT_TRUE(QSTORE.GetValueByType("from", obj, QType_list) == QError_ok);
+    EXPECT_TRUE(obj && obj->CastList()->size() == 1);
+
+    obj = nullptr;
+    EXPECT_TRUE(QSTORE.GetValueByType("to", obj, QType_list) == QError_ok);
+    EXPECT_TRUE(obj && obj->CastList()->size() == 2 && obj->CastList()->front() == "2");
+
+    QSTORE.ResetDb();
+    ::remove(base);
+    ::remove(delta);
+}
+
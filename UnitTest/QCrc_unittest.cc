@@ -0,0 +1,98 @@
+
+#include <string>
+#include "UnitTest.h"
+#include "crc64.h"
+#include "crc16.h"
+
+// every length around the 8 and 16 bytes blocks, from unaligned starts
+static std::string CrcData()
+{
+    std::string data(1024 + 16, '\0');
+    uint32_t x = 12345;
+    for (auto& c : data)
+    {
+        x = x * 1103515245 + 12345;
+        c = static_cast<char>(x >> 16);
+    }
+
+    return data;
+}
+
+static bool SameAsBytewise(uint64_t (*kernel)(uint64_t, const unsigned char*, uint64_t))
+{
+    const std::string data = CrcData();
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data());
+
+    for (size_t offset = 0; offset < 16; ++ offset)
+    {
+        for (size_t len = 0; len <= 300; ++ len)
+        {
+            if (kernel(0, p + offset, len) != crc64_bytewise(0, p + offset, len))
+                return false;
+        }
+    }
+
+    // a long one, and the crc carried between calls
+    const uint64_t whole = crc64_bytewise(0, p, 1024);
+    if (kernel(0, p, 1024) != whole)
+        return false;
+
+    return kernel(kernel(0, p, 333), p + 333, 1024 - 333) == whole;
+}
+
+TEST_CASE(crc64_check_value)
+{
+    crc64_init();
+
+    const unsigned char check[] = "123456789";
+    EXPECT_TRUE(crc64_bytewise(0, check, 9) == 0xe9c6d914c4b8d9caULL);
+    EXPECT_TRUE(crc64(0, check, 9) == 0xe9c6d914c4b8d9caULL);
+}
+
+TEST_CASE(crc64_kernels)
+{
+    crc64_init();
+
+    EXPECT_TRUE(SameAsBytewise(crc64_slice8));
+    EXPECT_TRUE(SameAsBytewise(crc64_slice16));
+    EXPECT_TRUE(SameAsBytewise(crc64));
+
+    if (crc64_clmul_supported())
+        EXPECT_TRUE(SameAsBytewise(crc64_clmul));
+}
+
+TEST_CASE(crc16_check_value)
+{
+    EXPECT_TRUE(crc16(0, "123456789", 9) == 0x31c3);
+    EXPECT_TRUE(crc16_bytewise(0, "123456789", 9) == 0x31c3);
+
+    const std::string data = CrcData();
+    bool same = true;
+    for (size_t len = 0; len <= 300; ++ len)
+        same = same && crc16(0, data.data() + 3, len) == crc16_bytewise(0, data.data() + 3, len);
+
+    EXPECT_TRUE(same);
+}
+
+static unsigned int Slot(const std::string& key)
+{
+    return keyHashSlot(key.data(), key.size());
+}
+
+TEST_CASE(crc16_hash_tag)
+{
+    // redis cluster spec examples
+    EXPECT_TRUE(Slot("{user1000}.following") == Slot("{user1000}.followers"));
+    EXPECT_TRUE(Slot("{user1000}.following") == Slot("user1000"));
+    EXPECT_TRUE(Slot("foo{bar}{zap}") == Slot("bar"));
+    EXPECT_TRUE(Slot("foo{{bar}}zap") == Slot("{bar"));
+
+    // empty or unclosed tag, the whole key is hashed
+    EXPECT_TRUE(Slot("foo{}{bar}") == (crc16(0, "foo{}{bar}", 10) & 16383));
+    EXPECT_TRUE(Slot("foo{bar") == (crc16(0, "foo{bar", 7) & 16383));
+    EXPECT_TRUE(Slot("") == 0);
+
+    EXPECT_TRUE(Slot("123456789") == (0x31c3 & 16383));
+    EXPECT_TRUE(Slot("a somewhat longer key") < 16384);
+}
+
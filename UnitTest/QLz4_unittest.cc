@@ -0,0 +1,122 @@
+
+#include <string>
+#include <vector>
+#include "UnitTest.h"
+#include "QCodec.h"
+#include "lz4/lz4.h"
+
+using namespace qedis;
+
+static std::vector<std::string> Lz4Samples()
+{
+    std::vector<std::string> samples;
+
+    samples.push_back(std::string(1, 'a'));
+    samples.push_back("hello world");
+    samples.push_back(std::string(100000, 'x'));            // long overlapped match
+    samples.push_back(std::string(70000, '\0') + "end");   // match longer than the window
+
+    std::string text;
+    for (int i = 0; i < 5000; ++ i)
+        text += "key:" + std::to_string(i % 97) + ",value:" + std::to_string(i) + ";";
+    samples.push_back(text);
+
+    std::string noise(4096, '\0');
+    uint32_t x = 7;
+    for (auto& c : noise)
+    {
+        x = x * 1103515245 + 12345;
+        c = static_cast<char>(x >> 16);
+    }
+    samples.push_back(noise);                               // incompressible
+
+    return samples;
+}
+
+static bool RoundTrip(const std::string& data)
+{
+    std::string out(data.size() + data.size() / 255 + 16, '\0');
+    const unsigned int n = lz4_compress(data.data(), static_cast<unsigned>(data.size()),
+                                        &out[0], static_cast<unsigned>(out.size()));
+    if (n == 0)
+        return false;
+
+    std::string raw(data.size(), '\0');
+    if (lz4_decompress(out.data(), n, &raw[0], static_cast<unsigned>(raw.size())) != data.size())
+        return false;
+
+    return raw == data;
+}
+
+TEST_CASE(lz4_round_trip)
+{
+    for (const auto& data : Lz4Samples())
+        EXPECT_TRUE(RoundTrip(data));
+}
+
+TEST_CASE(lz4_codec)
+{
+    QCodec codec;
+    EXPECT_TRUE(ParseCodec("lz4", codec) && codec == QCodec_lz4);
+
+    const std::string text = Lz4Samples()[4];
+    QString packed;
+    ASSERT_TRUE(Compress(QCodec_lz4, text.data(), text.size(), packed));
+    EXPECT_TRUE(packed.size() < text.size());
+
+    std::string raw(text.size(), '\0');
+    EXPECT_TRUE(Decompress(QCodec_lz4, packed.data(), packed.size(), &raw[0], raw.size()));
+    EXPECT_TRUE(raw == text);
+
+    // too short or incompressible, stored as is
+    EXPECT_FALSE(Compress(QCodec_lz4, "short", 5, packed));
+    const std::string noise = Lz4Samples()[5];
+    EXPECT_FALSE(Compress(QCodec_lz4, noise.data(), noise.size(), packed));
+}
+
+TEST_CASE(lz4_corrupt)
+{
+    const std::string text = Lz4Samples()[4];
+    std::string packed(text.size(), '\0');
+    const unsigned int n = lz4_compress(text.data(), static_cast<unsigned>(text.size()),
+                                        &packed[0], static_cast<unsigned>(packed.size()));
+    ASSERT_TRUE(n > 0);
+    packed.resize(n);
+
+    std::string raw(text.size(), '\0');
+    const unsigned int rawLen = static_cast<unsigned>(raw.size());
+
+    // out buffer too small
+    EXPECT_TRUE(lz4_decompress(packed.data(), n, &raw[0], rawLen - 1) == 0);
+
+    // truncated, every cut must be rejected or decode a shorter prefix
+    bool safe = true;
+    for (unsigned int cut = 1; cut < n; ++ cut)
+        safe = safe && lz4_decompress(packed.data(), cut, &raw[0], rawLen) < rawLen;
+    EXPECT_TRUE(safe);
+
+    // match offset before the start of output
+    const char badOffset[] = {'\x10', 'a', '\x05', '\x00'};
+    EXPECT_TRUE(lz4_decompress(badOffset, sizeof badOffset, &raw[0], rawLen) == 0);
+
+    // zero offset
+    const char zeroOffset[] = {'\x10', 'a', '\x00', '\x00'};
+    EXPECT_TRUE(lz4_decompress(zeroOffset, sizeof zeroOffset, &raw[0], rawLen) == 0);
+
+    // literal length runs past the input
+    const char longLiteral[] = {'\xf0', '\xff', '\xff', '\x10', 'a'};
+    EXPECT_TRUE(lz4_decompress(longLiteral, sizeof longLiteral, &raw[0], rawLen) == 0);
+
+    // random bytes never write past out
+    std::string garbage = packed;
+    uint32_t x = 99;
+    for (int round = 0; round < 200; ++ round)
+    {
+        x = x * 1103515245 + 12345;
+        garbage[(x >> 8) % garbage.size()] ^= static_cast<char>(x >> 24);
+        lz4_decompress(garbage.data(), static_cast<unsigned>(garbage.size()), &raw[0], rawLen);
+    }
+
+    EXPECT_FALSE(Decompress(QCodec_lz4, packed.data(), packed.size() - 1, &raw[0], raw.size()));
+}
+
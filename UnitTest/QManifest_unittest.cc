@@ -0,0 +1,70 @@
+
+#include <cstdio>
+#include <fstream>
+#include "UnitTest.h"
+#include "QManifest.h"
+
+using namespace qedis;
+
+static void WriteFile(const char* name, const char* content)
+{
+    std::ofstream ofs(name, std::ios::trunc);
+    ofs << content;
+}
+
+TEST_CASE(manifest_round_trip)
+{
+    const char* const name = "manifest_unittest.manifest";
+
+    QManifest manifest("delta");
+    EXPECT_FALSE(manifest.Load(name));
+    EXPECT_FALSE(manifest.IsDamaged()); // missing is a fresh start
+
+    manifest.SetBase("dump.rdb");
+    manifest.Parts().push_back("dump.rdb.delta." + std::to_string(manifest.NextSeq()));
+    manifest.Parts().push_back("dump.rdb.delta." + std::to_string(manifest.NextSeq()));
+    ASSERT_TRUE(manifest.Save(name));
+
+    QManifest loaded("delta");
+    ASSERT_TRUE(loaded.Load(name));
+    EXPECT_TRUE(loaded.Base() == "dump.rdb");
+    EXPECT_TRUE(loaded.Parts().size() == 2 && loaded.Parts()[1] == "dump.rdb.delta.2");
+    EXPECT_TRUE(loaded.NextSeq() == 3);
+
+    // parts of another tag are not ours
+    QManifest aof("incr");
+    ASSERT_TRUE(aof.Load(name));
+    EXPECT_TRUE(aof.Parts().empty());
+
+    ::remove(name);
+}
+
+TEST_CASE(manifest_damaged)
+{
+    const char* const name = "manifest_unittest.manifest";
+    const char* const bad[] = {
+        "seq abc\nbase dump.rdb\n",
+        "seq 12x\n",
+        "seq -1\n",
+        "seq 99999999999999999999\n",
+        "seq 3\nbase\n",
+    };
+
+    for (const char* content : bad)
+    {
+        WriteFile(name, content);
+
+        QManifest manifest("delta");
+        EXPECT_FALSE(manifest.Load(name));
+        EXPECT_TRUE(manifest.IsDamaged());
+    }
+
+    WriteFile(name, "\nseq 7\n\nbase dump.rdb\ndelta dump.rdb.delta.7\n");
+    QManifest manifest("delta");
+    EXPECT_TRUE(manifest.Load(name));
+    EXPECT_FALSE(manifest.IsDamaged());
+    EXPECT_TRUE(manifest.Parts().size() == 1);
+
+    ::remove(name);
+}
+
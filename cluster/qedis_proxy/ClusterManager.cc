@@ -5,6 +5,8 @@
 #include "net/Connection.h"
 #include "net/Socket.h"
 
+#include "crc16.h"
+
 #if USE_ZOOKEEPER
     #include "ZookeeperConn.h"
 #else
@@ -128,8 +130,9 @@ void ClusterManager::AddServerInfo(int setid, const std::string& host)
 
 const std::string& ClusterManager::GetServer(const std::string& key) const
 {
-    // TODO calc key's hash value
-    const int hash = 1;
+    // same sharding as qedis server's MigrateClusterData
+    const int kMaxShards = 8;
+    const int hash = keyHashSlot(key.data(), key.size()) % kMaxShards;
 
     auto it = shardingInfo_.find(hash);
     if (it != shardingInfo_.end())